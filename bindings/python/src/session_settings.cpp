@@ -282,6 +282,9 @@ void bind_session_settings()
         .def_readwrite("max_fail_count", &dht_settings::max_fail_count)
         .def_readwrite("max_torrents", &dht_settings::max_torrents)
         .def_readwrite("max_dht_items", &dht_settings::max_dht_items)
+        .def_readwrite("max_peer_store_size", &dht_settings::max_peer_store_size)
+        .def_readwrite("request_threads", &dht_settings::request_threads)
+        .def_readwrite("put_verify_batch", &dht_settings::put_verify_batch)
         .def_readwrite("restrict_routing_ips", &dht_settings::restrict_routing_ips)
         .def_readwrite("restrict_search_ips", &dht_settings::restrict_search_ips)
     ;
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include "ge.h"
 #include "precomp_data.h"
 
@@ -130,6 +131,100 @@ void ge_double_scalarmult_vartime(ge_p2 *r, const unsigned char *a, const ge_p3
 }
 
 
+/*
+r = a[0] * A[0] + ... + a[n-1] * A[n-1] + b * B
+where a holds the n scalars, 32 bytes each, one after another.
+B is the Ed25519 base point (x,4/5) with x positive.
+The doublings are shared by all the terms, which is what makes this cheaper
+than n separate scalar multiplications.
+Returns -1 if the temporary tables could not be allocated, 0 otherwise.
+*/
+
+int ge_multi_scalarmult_vartime(ge_p2 *r, const unsigned char *a, const ge_p3 *A, size_t n, const unsigned char *b) {
+    signed char *aslide;
+    signed char bslide[256];
+    ge_cached *Ai; /* A[k],3A[k],5A[k],...,15A[k] for each k */
+    ge_p1p1 t;
+    ge_p3 u;
+    ge_p3 A2;
+    size_t k;
+    int i;
+    int j;
+
+    aslide = (signed char*)malloc(n * 256);
+    Ai = (ge_cached*)malloc(n * 8 * sizeof(ge_cached));
+
+    if (aslide == NULL || Ai == NULL) {
+        free(aslide);
+        free(Ai);
+        return -1;
+    }
+
+    slide(bslide, b);
+
+    for (k = 0; k < n; ++k) {
+        slide(aslide + k * 256, a + k * 32);
+        ge_p3_to_cached(&Ai[k * 8], &A[k]);
+        ge_p3_dbl(&t, &A[k]);
+        ge_p1p1_to_p3(&A2, &t);
+
+        for (j = 1; j < 8; ++j) {
+            ge_add(&t, &A2, &Ai[k * 8 + j - 1]);
+            ge_p1p1_to_p3(&u, &t);
+            ge_p3_to_cached(&Ai[k * 8 + j], &u);
+        }
+    }
+
+    ge_p2_0(r);
+
+    for (i = 255; i >= 0; --i) {
+        if (bslide[i]) {
+            break;
+        }
+
+        for (k = 0; k < n; ++k) {
+            if (aslide[k * 256 + i]) {
+                break;
+            }
+        }
+
+        if (k < n) {
+            break;
+        }
+    }
+
+    for (; i >= 0; --i) {
+        ge_p2_dbl(&t, r);
+
+        for (k = 0; k < n; ++k) {
+            signed char s = aslide[k * 256 + i];
+
+            if (s > 0) {
+                ge_p1p1_to_p3(&u, &t);
+                ge_add(&t, &u, &Ai[k * 8 + s / 2]);
+            } else if (s < 0) {
+                ge_p1p1_to_p3(&u, &t);
+                ge_sub(&t, &u, &Ai[k * 8 + (-s) / 2]);
+            }
+        }
+
+        if (bslide[i] > 0) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_madd(&t, &u, &Bi[bslide[i] / 2]);
+        } else if (bslide[i] < 0) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_msub(&t, &u, &Bi[(-bslide[i]) / 2]);
+        }
+
+        ge_p1p1_to_p2(r, &t);
+    }
+
+    free(aslide);
+    free(Ai);
+    return 0;
+}
+
+
 static const fe d = {
     -10913610, 13857413, -15372611, 6949391, 114729, -8787816, -6275908, -3247719, -18696448, -12055116
 };
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include "libtorrent/ed25519.hpp"
 #include "sha512.h"
 #include "ge.h"
@@ -75,3 +77,230 @@ int ed25519_verify(const unsigned char *signature, const unsigned char *message,
 
     return 1;
 }
+
+/*
+same as ge_frombytes_negate_vartime(), but fails on the encodings that
+ge_tobytes() never produces, i.e. y >= 2^255 - 19, or x = 0 with the sign
+bit set. ed25519_verify() compares R bytewise against such an encoding, so it
+rejects these.
+*/
+static int frombytes_canonical_negate_vartime(ge_p3 *h, const unsigned char *s) {
+    int i;
+
+    if ((s[31] & 0x7f) == 0x7f && s[0] >= 0xed) {
+        for (i = 1; i < 31; ++i) {
+            if (s[i] != 0xff) {
+                break;
+            }
+        }
+
+        if (i == 31) {
+            return -1;
+        }
+    }
+
+    if (ge_frombytes_negate_vartime(h, s) != 0) {
+        return -1;
+    }
+
+    if ((s[31] & 0x80) && !fe_isnonzero(h->X)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int is_neutral(const ge_p2 *p) {
+    fe t;
+
+    if (fe_isnonzero(p->X)) {
+        return 0;
+    }
+
+    fe_sub(t, p->Y, p->Z);
+    return !fe_isnonzero(t);
+}
+
+/*
+returns 1 if 8 * (a[0] * A[0] + ... + a[n-1] * A[n-1] + b * B) is the neutral
+element, 0 otherwise (or if it couldn't be computed)
+*/
+static int is_small_order_sum(const unsigned char *a, const ge_p3 *A, size_t n, const unsigned char *b) {
+    ge_p2 R;
+    ge_p1p1 t;
+    int i;
+
+    if (ge_multi_scalarmult_vartime(&R, a, A, n, b) != 0) {
+        return 0;
+    }
+
+    for (i = 0; i < 3; ++i) {
+        ge_p2_dbl(&t, &R);
+        ge_p1p1_to_p2(&R, &t);
+    }
+
+    return is_neutral(&R);
+}
+
+/*
+checks 8 * (s B - R - h A) = 0. This differs from ed25519_verify(), which
+checks s B - h A = R exactly, only for signatures where R or A has a small
+order component. Those can only be made with the private key. Unlike
+ed25519_verify(), this agrees with ed25519_verify_batch() on every signature.
+*/
+int ed25519_verify_cofactored(const unsigned char *signature, const unsigned char *message, size_t message_len, const unsigned char *public_key) {
+    unsigned char h[64];
+    unsigned char scalars[64];
+    sha512_context hash;
+    ge_p3 points[2];
+
+    if (signature[63] & 224) {
+        return 0;
+    }
+
+    /* the points are -R and -A */
+    if (frombytes_canonical_negate_vartime(&points[0], signature) != 0
+        || ge_frombytes_negate_vartime(&points[1], public_key) != 0) {
+        return 0;
+    }
+
+    sha512_init(&hash);
+    sha512_update(&hash, signature, 32);
+    sha512_update(&hash, public_key, 32);
+    sha512_update(&hash, message, message_len);
+    sha512_final(&hash, h);
+    sc_reduce(h);
+
+    memset(scalars, 0, 32);
+    scalars[0] = 1;
+    memcpy(scalars + 32, h, 32);
+
+    return is_small_order_sum(scalars, points, 2, signature + 32);
+}
+
+/*
+The batch is checked with a single equation, a random linear combination of
+the individual ones:
+
+  8 * sum(z_i * (s_i B - R_i - h_i A_i)) = 0
+
+where the 128 bit z_i are derived from a hash of the whole batch. This holds
+for every batch of signatures that pass ed25519_verify_cofactored(), and
+(other than with negligible probability) for no other. When it doesn't hold,
+each signature is verified on its own with ed25519_verify_cofactored(), to
+find the bad ones. Either way, the result is the same as that of verifying
+each of them with ed25519_verify_cofactored().
+*/
+int ed25519_verify_batch(const unsigned char * const *signatures, const unsigned char * const *messages, const size_t *message_lens, const unsigned char * const *public_keys, size_t num, int *valid) {
+    unsigned char seed[64];
+    unsigned char z[64];
+    unsigned char zero[32];
+    unsigned char b[32];
+    unsigned char counter[4];
+    sha512_context hash;
+    sha512_context batch_hash;
+    ge_p3 *points = NULL;
+    unsigned char *scalars = NULL;
+    unsigned char *h = NULL;
+    size_t *index = NULL;
+    size_t m = 0;
+    size_t i;
+    int ret = 1;
+
+    if (num < 2) {
+        goto verify_each;
+    }
+
+    points = (ge_p3*)malloc(2 * num * sizeof(ge_p3));
+    scalars = (unsigned char*)malloc(2 * num * 32);
+    h = (unsigned char*)malloc(num * 64);
+    index = (size_t*)malloc(num * sizeof(size_t));
+
+    if (points == NULL || scalars == NULL || h == NULL || index == NULL) {
+        goto verify_each;
+    }
+
+    sha512_init(&batch_hash);
+
+    for (i = 0; i < num; ++i) {
+        const unsigned char *signature = signatures[i];
+        unsigned char *hi = h + m * 64;
+
+        valid[i] = 0;
+
+        /* these fail ed25519_verify_cofactored() too, leave them out of the
+           batch */
+        if (signature[63] & 224) {
+            ret = 0;
+            continue;
+        }
+
+        if (frombytes_canonical_negate_vartime(&points[2 * m], signature) != 0
+            || ge_frombytes_negate_vartime(&points[2 * m + 1], public_keys[i]) != 0) {
+            ret = 0;
+            continue;
+        }
+
+        sha512_init(&hash);
+        sha512_update(&hash, signature, 32);
+        sha512_update(&hash, public_keys[i], 32);
+        sha512_update(&hash, messages[i], message_lens[i]);
+        sha512_final(&hash, hi);
+        sc_reduce(hi);
+
+        sha512_update(&batch_hash, hi, 32);
+        sha512_update(&batch_hash, signature, 64);
+        index[m++] = i;
+    }
+
+    if (m == 0) {
+        goto done;
+    }
+
+    sha512_final(&batch_hash, seed);
+    memset(zero, 0, sizeof(zero));
+    memset(b, 0, sizeof(b));
+
+    for (i = 0; i < m; ++i) {
+        counter[0] = (unsigned char)i;
+        counter[1] = (unsigned char)(i >> 8);
+        counter[2] = (unsigned char)(i >> 16);
+        counter[3] = (unsigned char)(i >> 24);
+        sha512_init(&hash);
+        sha512_update(&hash, seed, 64);
+        sha512_update(&hash, counter, 4);
+        sha512_final(&hash, z);
+        memset(z + 16, 0, 48);
+
+        /* the points are -R_i and -A_i */
+        memcpy(scalars + 2 * i * 32, z, 32);
+        sc_muladd(scalars + (2 * i + 1) * 32, z, h + i * 64, zero);
+        sc_muladd(b, z, signatures[index[i]] + 32, b);
+    }
+
+    if (is_small_order_sum(scalars, points, 2 * m, b)) {
+        for (i = 0; i < m; ++i) {
+            valid[index[i]] = 1;
+        }
+
+        goto done;
+    }
+
+    ret = 1;
+
+verify_each:
+    for (i = 0; i < num; ++i) {
+        valid[i] = ed25519_verify_cofactored(signatures[i], messages[i], message_lens[i], public_keys[i]);
+
+        if (!valid[i]) {
+            ret = 0;
+        }
+    }
+
+done:
+    free(points);
+    free(scalars);
+    free(h);
+    free(index);
+    return ret;
+}
@@ -8,6 +8,7 @@
 
 #include "src/ge.h"
 #include "src/sc.h"
+#include "src/sha512.h"
 
 const char message[] = "Hello, world!";
 
@@ -58,6 +59,73 @@ int main(int argc, char *argv[]) {
         printf("correctly detected signature change\n");
     }
 
+    /* sign with an R that has an order 2 component. ed25519_verify rejects
+       this, ed25519_verify_cofactored and ed25519_verify_batch accept it */
+    {
+        /* the encoding of (0, -1), the point of order 2 */
+        unsigned char torsion[32];
+        unsigned char r[64], h[64];
+        const unsigned char *signatures[2], *messages[2], *public_keys[2];
+        size_t message_lens[2];
+        unsigned char other_signature[64];
+        int valid[2];
+        sha512_context hash;
+        ge_p3 R, T;
+        ge_cached T_cached;
+        ge_p1p1 sum;
+
+        memset(torsion, 0xff, 32);
+        torsion[0] = 0xec;
+        torsion[31] = 0x7f;
+
+        ed25519_create_seed(seed);
+        ed25519_create_keypair(public_key, private_key, seed);
+
+        ed25519_create_seed(r);
+        ed25519_create_seed(r + 32);
+        sc_reduce(r);
+        ge_scalarmult_base(&R, r);
+        ge_frombytes_negate_vartime(&T, torsion);
+        ge_p3_to_cached(&T_cached, &T);
+        ge_add(&sum, &R, &T_cached);
+        ge_p1p1_to_p3(&R, &sum);
+        ge_p3_tobytes(signature, &R);
+
+        sha512_init(&hash);
+        sha512_update(&hash, signature, 32);
+        sha512_update(&hash, public_key, 32);
+        sha512_update(&hash, (const unsigned char *) message, strlen(message));
+        sha512_final(&hash, h);
+        sc_reduce(h);
+        sc_muladd(signature + 32, h, private_key, r);
+
+        ed25519_sign(other_signature, message, strlen(message), public_key, private_key);
+
+        signatures[0] = signature;
+        signatures[1] = other_signature;
+        messages[0] = messages[1] = (const unsigned char *) message;
+        message_lens[0] = message_lens[1] = strlen(message);
+        public_keys[0] = public_keys[1] = public_key;
+
+        if (ed25519_verify(signature, message, strlen(message), public_key)) {
+            printf("cofactorless verify accepted small order R\n");
+        } else if (!ed25519_verify_cofactored(signature, message, strlen(message), public_key)) {
+            printf("cofactored verify rejected small order R\n");
+        } else if (!ed25519_verify_batch(signatures, messages, message_lens, public_keys, 2, valid)
+            || !valid[0] || !valid[1]) {
+            printf("batch verify rejected small order R\n");
+        } else {
+            /* a bad signature in the batch makes it verify each one */
+            other_signature[44] ^= 0x10;
+            if (ed25519_verify_batch(signatures, messages, message_lens, public_keys, 2, valid)
+                || !valid[0] || valid[1]) {
+                printf("batch verify disagreed with cofactored verify\n");
+            } else {
+                printf("small order R verified consistently\n");
+            }
+        }
+    }
+
     /* generate two keypairs for testing key exchange */
     ed25519_create_seed(seed);
     ed25519_create_keypair(public_key, private_key, seed);
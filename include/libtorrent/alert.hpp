@@ -255,6 +255,15 @@ namespace libtorrent {
 		// returns a pointer to a copy of the alert.
 		virtual std::auto_ptr<alert> clone() const = 0;
 
+		// internal
+		// the number of bytes needed to hold a copy of this alert, and a
+		// function to copy construct it into such a buffer. This lets the
+		// alert queue store alerts without allocating each one on the
+		// heap. Alerts defined by TORRENT_DEFINE_ALERT implement these, other
+		// alerts are heap allocated with clone().
+		virtual int storage_size() const { return 0; }
+		virtual alert* clone_into(char* /* storage */) const { return 0; }
+
 	private:
 		time_point m_timestamp;
 	};
@@ -0,0 +1,115 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_ALERT_ARENA_HPP_INCLUDED
+#define TORRENT_ALERT_ARENA_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+
+#include <vector>
+#include <memory> // for auto_ptr
+
+namespace libtorrent
+{
+	class alert;
+
+	// a list of alerts of any type. Alerts are copy constructed into large
+	// blocks of memory owned by the arena, instead of being heap allocated
+	// one at a time. clear() destructs the alerts but keeps the blocks, to be
+	// reused by the next batch of alerts. Alert types that can't be copied
+	// into the arena (see alert::clone_into()) are heap allocated.
+	//
+	// The arena is not thread safe, alert_manager holds two of them and
+	// protects them with its mutex.
+	struct TORRENT_EXTRA_EXPORT alert_arena
+	{
+		alert_arena();
+		~alert_arena();
+
+		// copies ``a`` into the arena and returns a pointer to the copy. The
+		// pointer is valid until clear() is called
+		alert* push_back(alert const& a);
+
+		// takes ownership of a heap allocated alert
+		alert* push_back(std::auto_ptr<alert> a);
+
+		// hands over the alert at index ``i`` to the caller. A heap allocated
+		// alert is returned as is, an alert in the arena is copied. The entry
+		// is left empty and may not be accessed anymore. It's removed by
+		// clear()
+		std::auto_ptr<alert> release(int i);
+
+		// destructs all alerts. The memory is kept for reuse
+		void clear();
+
+		// the alerts, in the order they were pushed
+		std::vector<alert*> const& alerts() const { return m_alerts; }
+		alert* operator[](int i) const { return m_alerts[i]; }
+		int size() const { return int(m_alerts.size()); }
+		bool empty() const { return m_alerts.empty(); }
+
+		// the number of bytes allocated for blocks
+		int capacity() const { return int(m_blocks.size()) * block_size; }
+
+		enum
+		{
+			// the size of each block of memory alerts are constructed in.
+			// Alerts larger than this are heap allocated
+			block_size = 32 * 1024,
+
+			// every alert is placed at an offset that's a multiple of this
+			alignment = 16
+		};
+
+	private:
+
+		// not copyable
+		alert_arena(alert_arena const&);
+		alert_arena& operator=(alert_arena const&);
+
+		std::vector<alert*> m_alerts;
+
+		// one entry per alert in m_alerts, true if that alert was heap
+		// allocated and needs to be deleted rather than just destructed
+		std::vector<bool> m_heap_allocated;
+
+		std::vector<char*> m_blocks;
+
+		// the block new alerts are constructed in, and the number of bytes
+		// already used in it
+		int m_block;
+		int m_used;
+	};
+}
+
+#endif
+
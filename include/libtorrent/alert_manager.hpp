@@ -36,10 +36,13 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/config.hpp"
 #include "libtorrent/alert.hpp"
 #include "libtorrent/thread.hpp"
+#include "libtorrent/alert_arena.hpp"
 
 #include <boost/function/function1.hpp>
 #include <boost/shared_ptr.hpp>
 #include <list>
+#include <deque>
+#include <vector>
 
 namespace libtorrent {
 
@@ -58,13 +61,22 @@ namespace libtorrent {
 		void post_alert_ptr(alert* alert_);
 		bool pending() const;
 		std::auto_ptr<alert> get(int& num_resume);
+
+		// returns all queued alerts, heap allocated and owned by the caller.
+		// Alerts posted with post_alert_ptr() are handed over as they are,
+		// the others are copied out of the arena
 		void get_all(std::deque<alert*>* alerts, int& num_resume);
 
+		// returns pointers to all queued alerts, without copying them. The
+		// alerts are owned by the alert_manager and stay valid until the
+		// next call to this function
+		void get_all(std::vector<alert*>& alerts, int& num_resume);
+
 		template <class T>
 		bool should_post() const
 		{
 			mutex::scoped_lock lock(m_mutex);
-			if (m_alerts.size() >= m_queue_size_limit) return false;
+			if (size_t(num_queued()) >= m_queue_size_limit) return false;
 			return (m_alert_mask & T::static_category) != 0;
 		}
 
@@ -95,9 +107,25 @@ namespace libtorrent {
 #endif
 
 	private:
-		void post_impl(std::auto_ptr<alert>& alert_, mutex::scoped_lock& l);
+		void post_impl(alert const& alert_, std::auto_ptr<alert> owned
+			, mutex::scoped_lock& l);
+
+		// the number of alerts in the queue that haven't been popped yet
+		int num_queued() const
+		{ return m_alerts[m_generation].size() - m_read_pos; }
+
+		// the queue is double buffered. Alerts are posted to
+		// m_alerts[m_generation]. get_all() with a vector hands out the
+		// alerts in that buffer and makes the other one current, after
+		// clearing it. This keeps the alerts handed out by the previous
+		// call alive until the next one, without copying them.
+		alert_arena m_alerts[2];
+		int m_generation;
+
+		// the number of alerts at the front of the current buffer that have
+		// already been popped by get() or get_all() with a deque
+		int m_read_pos;
 
-		std::deque<alert*> m_alerts;
 		mutable mutex m_mutex;
 		condition_variable m_condition;
 		boost::uint32_t m_alert_mask;
@@ -46,6 +46,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/close_reason.hpp"
 #include "libtorrent/aux_/escape_string.hpp" // for convert_from_native
 
+#include <new> // for placement new
+
 namespace libtorrent
 {
 
@@ -123,6 +125,9 @@ namespace libtorrent
 	virtual int type() const { return alert_type; } \
 	virtual std::auto_ptr<alert> clone() const \
 	{ return std::auto_ptr<alert>(new name(*this)); } \
+	virtual int storage_size() const { return sizeof(name); } \
+	virtual alert* clone_into(char* storage) const \
+	{ return new (storage) name(*this); } \
 	virtual int category() const { return static_category; } \
 	virtual char const* what() const { return #name; }
 
@@ -304,6 +304,7 @@ namespace libtorrent
 			void add_dht_router(std::pair<std::string, int> const& node);
 			void set_dht_settings(dht_settings const& s);
 			dht_settings const& get_dht_settings() const { return m_dht_settings; }
+			void set_dht_storage(dht::dht_storage_constructor_type sc);
 			void start_dht();
 			void stop_dht();
 			void start_dht(entry const& startup_state);
@@ -426,6 +427,7 @@ namespace libtorrent
 			size_t set_alert_queue_size_limit(size_t queue_size_limit_);
 			std::auto_ptr<alert> pop_alert();
 			void pop_alerts(std::deque<alert*>* alerts);
+			void pop_alerts(std::vector<alert*>* alerts);
 			void set_alert_dispatch(boost::function<void(std::auto_ptr<alert>)> const&);
 
 			alert const* wait_for_alert(time_duration max_wait);
@@ -593,6 +595,8 @@ namespace libtorrent
 			void do_delayed_uncork();
 
 			void post_socket_job(socket_job& j);
+			io_service& peer_socket_io_service(sha1_hash const& ih);
+			io_service& incoming_socket_io_service();
 
 			// implements session_interface
 			virtual tcp::endpoint bind_outgoing_socket(socket_type& s, address
@@ -631,6 +635,7 @@ namespace libtorrent
 			void update_dht_upload_rate_limit();
 			void update_disk_threads();
 			void update_network_threads();
+			void update_network_shards();
 			void update_cache_buffer_chunk_size();
 			void update_report_web_seed_downloads();
 			void trigger_auto_manage();
@@ -653,6 +658,7 @@ namespace libtorrent
 			void update_dht_announce_interval();
 			void update_anonymous_mode();
 			void update_force_proxy();
+			void update_udp_offload();
 			void update_download_rate();
 			void update_upload_rate();
 			void update_connections_limit();
@@ -686,6 +692,13 @@ namespace libtorrent
 			boost::pool<> m_send_buffers;
 #endif
 
+			// network threads with their own io_service, each owning the
+			// sockets of a subset of the peer connections. See
+			// settings_pack::network_shards. Handlers queued on
+			// m_io_service may hold sockets belonging to the shards, so
+			// they must outlive it
+			std::vector<boost::shared_ptr<network_shard> > m_net_shards;
+
 			// this is where all active sockets are stored.
 			// the selector can sleep while there's no activity on
 			// them
@@ -714,6 +727,12 @@ namespace libtorrent
 			// to distribute its cost to multiple threads
 			std::vector<boost::shared_ptr<network_thread_pool> > m_net_thread_pool;
 
+			// the number of shards in m_net_shards new connections are
+			// assigned to, and the last one an incoming connection was
+			// assigned to
+			int m_num_net_shards;
+			int m_next_incoming_shard;
+
 			// the bandwidth manager is responsible for
 			// handing out bandwidth to connections that
 			// asks for it, it can also throttle the
@@ -978,6 +997,10 @@ namespace libtorrent
 #ifndef TORRENT_DISABLE_DHT
 			boost::shared_ptr<dht::dht_tracker> m_dht;
 			dht_settings m_dht_settings;
+
+			// creates the storage of the DHT node. If it's empty, the
+			// default storage is used
+			dht::dht_storage_constructor_type m_dht_storage_constructor;
 			
 			// these are used when starting the DHT
 			// (and bootstrapping it), and then erased
@@ -212,6 +212,11 @@ namespace libtorrent { namespace aux
 		// used to (potentially) issue socket write calls onto multiple threads
 		virtual void post_socket_job(socket_job& j) = 0;
 
+		// the io_service to create plain TCP peer sockets on, for the
+		// torrent with info-hash ``ih``. This is the network thread's
+		// io_service unless network shards are enabled
+		virtual io_service& peer_socket_io_service(sha1_hash const& ih) = 0;
+
 		// load the specified torrent. also evict one torrent, except
 		// for the one specified, if we are at the limit of loaded torrents
 		virtual bool load_torrent(torrent* t) = 0;
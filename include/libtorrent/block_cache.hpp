@@ -48,6 +48,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/time.hpp"
 #include "libtorrent/tailqueue.hpp"
 #include "libtorrent/linked_list.hpp"
+#include "libtorrent/frequency_sketch.hpp"
 #include "libtorrent/disk_buffer_pool.hpp"
 #include "libtorrent/file.hpp" // for iovec_t
 
@@ -116,6 +117,7 @@ namespace libtorrent
 			, refcount(0)
 			, dirty(false)
 			, pending(false)
+			, read_ahead(false)
 		{
 #if TORRENT_USE_ASSERTS
 			hashing_count = 0;
@@ -126,7 +128,7 @@ namespace libtorrent
 
 		char* buf;
 
-		enum { max_refcount = (1 << 30) - 1 };
+		enum { max_refcount = (1 << 29) - 1 };
 
 		// the number of references to this buffer. These references
 		// might be in outstanding asyncronous requests or in peer
@@ -134,7 +136,7 @@ namespace libtorrent
 		// all references are gone and refcount reaches 0. The buf
 		// pointer in this struct doesn't count as a reference and
 		// is always the last to be cleared
-		boost::uint32_t refcount:30;
+		boost::uint32_t refcount:29;
 
 		// if this is true, this block needs to be written to
 		// disk before it's freed. Typically all blocks in a piece
@@ -150,6 +152,12 @@ namespace libtorrent
 		// write job to write this block.
 		boost::uint32_t pending:1;
 
+		// set on blocks that were read from disk speculatively, as part of
+		// the read-ahead of a request for another block. It's cleared the
+		// first time the block is requested. Blocks evicted with this still
+		// set were read in vain
+		boost::uint32_t read_ahead:1;
+
 #if TORRENT_USE_ASSERTS
 		// this many of the references are held by hashing operations
 		int hashing_count;
@@ -342,21 +350,50 @@ namespace libtorrent
 		typedef cache_t::iterator iterator;
 		typedef cache_t::const_iterator const_iterator;
 
+		// the cache is partitioned into this many shards. Each shard has its
+		// own piece table and ARC lists and may be operated on independently
+		// of the others. The disk_io_thread protects each shard by a separate
+		// mutex. The cache size limit is still global, since all shards
+		// allocate their blocks from the same disk_buffer_pool.
+		enum { num_shards = 8 };
+
+		// runs of this many adjacent pieces belonging to the same storage
+		// map to the same shard. This allows cache lines spanning multiple
+		// pieces to be flushed while only holding a single shard's mutex.
+		enum { shard_stripe = 16 };
+
+		// returns the shard the specified piece belongs to
+		static int shard_index(piece_manager const* st, int piece)
+		{
+			// the low bits of the pointer are always zero, because of alignment.
+			// Mix the storage pointer to spread torrents evenly across the
+			// shards, and step to the next shard for every stripe of pieces
+			boost::uint32_t const h = boost::uint32_t(std::size_t(st) >> 4)
+				* 2654435761u;
+			return int(((h >> 16) + boost::uint32_t(piece) / shard_stripe)
+				% num_shards);
+		}
+		static int shard_index(disk_io_job const* j);
+		static int shard_index(cached_piece_entry const* pe)
+		{ return shard_index(pe->storage.get(), pe->piece); }
+		static int shard_index(block_cache_reference const& ref);
+
 		// returns the number of blocks this job would cause to be read in
 		int pad_job(disk_io_job const* j, int blocks_in_piece
 			, int read_ahead) const;
 
 		void reclaim_block(block_cache_reference const& ref);
 
-		// returns a range of all pieces. This migh be a very
-		// long list, use carefully
-		std::pair<iterator, iterator> all_pieces() const;
-		int num_pieces() const { return m_pieces.size(); }
+		// returns a range of all pieces in the specified shard. This migh be a
+		// very long list, use carefully
+		std::pair<iterator, iterator> all_pieces(int shard) const;
+		int num_pieces(int shard) const { return m_shards[shard].pieces.size(); }
 
-		list_iterator write_lru_pieces() const
-		{ return m_lru[cached_piece_entry::write_lru].iterate(); }
+		list_iterator write_lru_pieces(int shard) const
+		{ return m_shards[shard].lru[cached_piece_entry::write_lru].iterate(); }
 
-		int num_write_lru_pieces() const { return m_lru[cached_piece_entry::write_lru].size(); }
+		int num_write_lru_pieces(int shard) const
+		{ return m_shards[shard].lru[cached_piece_entry::write_lru].size(); }
 
 		// mark this piece for deletion. If there are no outstanding
 		// requests to this piece, it's removed immediately, and the
@@ -426,34 +463,43 @@ namespace libtorrent
 		// flushed, the callback is posted
 		cached_piece_entry* add_dirty_block(disk_io_job* j);
 	
-		enum { blocks_inc_refcount = 1 };
+		// blocks_read_ahead marks the inserted blocks that aren't covered by
+		// the job as read-ahead, to keep track of how many of them are used
+		enum { blocks_inc_refcount = 1, blocks_read_ahead = 2 };
 		void insert_blocks(cached_piece_entry* pe, int block, file::iovec_t *iov
 			, int iov_len, disk_io_job* j, int flags = 0);
 
 #if TORRENT_USE_INVARIANT_CHECKS
-		void check_invariant() const;
+		// checks the invariant of a single shard
+		void check_invariant(int shard) const;
 #endif
 		
-		// try to remove num number of read cache blocks from the cache
-		// pick the least recently used ones first
+		// try to remove num number of read cache blocks from the specified
+		// shard. pick the least recently used ones first
 		// return the number of blocks that was requested to be evicted
 		// that couldn't be
-		int try_evict_blocks(int num, cached_piece_entry* ignore = 0);
+		int try_evict_blocks(int shard, int num, cached_piece_entry* ignore = 0);
 
 		// if there are any dirty blocks 
 		void clear(tailqueue& jobs);
 
+		// these functions look at every shard. The caller is expected to hold
+		// all shard mutexes
 		void update_stats_counters(counters& c) const;
 #ifndef TORRENT_NO_DEPRECATE
 		void get_stats(cache_status* ret) const;
 #endif
 		void set_settings(aux::session_settings const& sett);
 
+		// the settings_pack::cache_eviction_policy_t in effect
+		int eviction_policy() const { return m_policy; }
+
 		enum reason_t { ref_hashing = 0, ref_reading = 1, ref_flushing = 2 };
 		bool inc_block_refcount(cached_piece_entry* pe, int block, int reason);
 		void dec_block_refcount(cached_piece_entry* pe, int block, int reason);
 
-		int pinned_blocks() const { return m_pinned_blocks; }
+		// the total number of pinned blocks, across all shards
+		int pinned_blocks() const;
 
 #if TORRENT_USE_ASSERTS
 		void mark_deleted(file_storage const& fs);
@@ -469,20 +515,12 @@ namespace libtorrent
 		void free_piece(cached_piece_entry* p);
 		int drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf);
 
-		// block container
-		cache_t m_pieces;
-
-		// linked list of all elements in m_pieces, in usage order
-		// the most recently used are in the tail. iterating from head
-		// to tail gives the least recently used entries first
-		// the read-list is for read blocks and the write-list is for
-		// dirty blocks that needs flushing before being evicted
-		// [0] = write-LRU
-		// [1] = read-LRU1
-		// [2] = read-LRU1-ghost
-		// [3] = read-LRU2
-		// [4] = read-LRU2-ghost
-		linked_list m_lru[cached_piece_entry::num_lrus];
+		// the key identifying a piece in the frequency sketch
+		static boost::uint32_t piece_key(cached_piece_entry const* pe);
+
+		// with the TinyLFU policy, L1 is the window, holding this share of the
+		// read pieces (in percent) and L2 is the main cache
+		enum { tinylfu_window_percent = 10 };
 
 		// this is used to determine whether to evict blocks from
 		// L1 or L2.
@@ -492,30 +530,83 @@ namespace libtorrent
 			ghost_hit_lru1,
 			ghost_hit_lru2
 		};
-		int m_last_cache_op;
 
-		// the number of pieces to keep in the ARC ghost lists
-		// this is determined by being a fraction of the cache size
-		int m_ghost_size;
+		struct cache_shard
+		{
+			cache_shard();
+
+			// block container
+			cache_t pieces;
+
+			// linked list of all elements in pieces, in usage order
+			// the most recently used are in the tail. iterating from head
+			// to tail gives the least recently used entries first
+			// the read-list is for read blocks and the write-list is for
+			// dirty blocks that needs flushing before being evicted
+			// [0] = write-LRU
+			// [1] = read-LRU1
+			// [2] = read-LRU1-ghost
+			// [3] = read-LRU2
+			// [4] = read-LRU2-ghost
+			linked_list lru[cached_piece_entry::num_lrus];
+
+			// one of cache_op_t
+			int last_cache_op;
+
+			// the number of blocks in this shard
+			// that are in the read cache
+			boost::uint32_t read_cache_size;
+			// the number of blocks in this shard
+			// that are in the write cache
+			boost::uint32_t write_cache_size;
+
+			// the number of blocks that are currently sitting
+			// in peer's send buffers. If two peers are sending
+			// the same block, it counts as 2, even though there're
+			// no buffer duplication
+			boost::uint32_t send_buffer_blocks;
+
+			// the number of blocks with a refcount > 0, i.e.
+			// they may not be evicted
+			int pinned_blocks;
+
+			// how often pieces in this shard have been requested recently.
+			// Only maintained with the TinyLFU eviction policy
+			frequency_sketch sketch;
+
+			// the number of read-ahead blocks in this shard that were
+			// requested after being read, and that were evicted without
+			// ever being requested, respectively
+			boost::int64_t read_ahead_hits;
+			boost::int64_t read_ahead_waste;
+		};
+
+		cache_shard& shard(cached_piece_entry const* pe)
+		{ return m_shards[shard_index(pe)]; }
 
-		// the number of blocks in the cache
-		// that are in the read cache
-		boost::uint32_t m_read_cache_size;
-		// the number of blocks in the cache
-		// that are in the write cache
-		boost::uint32_t m_write_cache_size;
+		// moves the pieces that don't fit in the TinyLFU window into L2, as
+		// long as they're requested more often than the L2 pieces they push
+		// out. Returns true if the window still holds more pieces than its
+		// share, i.e. pieces that lost and should be evicted first
+		bool tinylfu_admit(cache_shard& s);
 
-		// the number of blocks that are currently sitting
-		// in peer's send buffers. If two peers are sending
-		// the same block, it counts as 2, even though there're
-		// no buffer duplication
-		boost::uint32_t m_send_buffer_blocks;
+		// called when a block is requested and when a read cache block is
+		// freed, respectively, to account for the read-ahead blocks
+		void read_ahead_hit(cache_shard& s, cached_block_entry& b);
+		void read_block_freed(cache_shard& s, cached_block_entry& b);
+
+		cache_shard m_shards[num_shards];
+
+		// the number of pieces to keep in each shard's ARC ghost lists
+		// this is determined by being a fraction of the cache size
+		int m_ghost_size;
 
-		// the number of blocks with a refcount > 0, i.e.
-		// they may not be evicted
-		int m_pinned_blocks;
+		// one of settings_pack::cache_eviction_policy_t
+		int m_policy;
 
 #if TORRENT_USE_ASSERTS
+		// protects m_deleted_storages, which is accessed from all shards
+		mutable mutex m_deleted_storages_mutex;
 		std::vector<std::pair<std::string, void const*> > m_deleted_storages;
 #endif
 	};
@@ -229,7 +229,11 @@ namespace libtorrent
 		void write_bitfield();
 		void write_have(int index);
 		void write_dont_have(int index);
+		// writes the message header of a piece message for ``r``
+		void write_piece_header(peer_request const& r);
 		void write_piece(peer_request const& r, disk_buffer_holder& buffer);
+		void write_piece_file(peer_request const& r, file_io_slice const& slice);
+		bool can_send_file() const;
 		void write_handshake(bool plain_handshake = false);
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		void write_extensions();
@@ -46,6 +46,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <string.h> // for memcpy
 
 #include "libtorrent/disk_io_job.hpp" // for block_cache_reference
+#include "libtorrent/file.hpp" // for file_handle
+#include "libtorrent/peer_request.hpp"
 #include "libtorrent/debug.hpp"
 
 namespace libtorrent
@@ -76,6 +78,13 @@ namespace libtorrent
 			int size; // the total size of the buffer
 			int used_size; // this is the number of bytes to send/receive
 			block_cache_reference ref;
+
+			// if this is set, this entry isn't a buffer in memory but a range
+			// of an open file, starting at file_offset. buf and start are NULL
+			file_handle file;
+			boost::int64_t file_offset;
+			// the block the file range holds
+			peer_request request;
 		};
 
 		bool empty() const { return m_bytes == 0; }
@@ -92,6 +101,28 @@ namespace libtorrent
 			, free_buffer_fun destructor, void* userdata
 			, block_cache_reference ref = block_cache_reference());
 
+		// appends the block ``r`` as a range of an open file, starting at
+		// ``offset``. The bytes aren't read into memory, but are sent straight
+		// from the file to the socket. File ranges are never included in the
+		// vectors built by build_iovec(), which stops at the first one
+		void append_file(file_handle const& f, boost::int64_t offset
+			, peer_request const& r);
+
+		// if the first entry in the chain is a file range, returns the file
+		// and sets ``offset`` and ``s`` to the part of it that's left to send.
+		// Otherwise returns NULL
+		file* front_file(boost::int64_t& offset, int& s);
+
+		// the block the file range at the front of the chain was appended
+		// for. Only valid if front_file() returns a file
+		peer_request const& front_file_request() const;
+
+		// replaces the file range at the front of the chain with ``buffer``,
+		// holding all of its block. The part of it that has already been
+		// sent is skipped
+		void replace_front_file(char* buffer, free_buffer_fun destructor
+			, void* userdata, block_cache_reference ref = block_cache_reference());
+
 		// returns the number of bytes available at the
 		// end of the last chained buffer.
 		int space_in_last_buffer();
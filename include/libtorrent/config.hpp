@@ -202,6 +202,23 @@ POSSIBILITY OF SUCH DAMAGE.
 # define TORRENT_USE_PREAD 1
 #endif
 
+// io_uring was introduced in linux 5.1, registering an eventfd with it (which
+// the disk threads block on) in 5.2. Whether it's actually available is still
+// checked at run-time, falling back to preadv/pwritev
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0) && !defined TORRENT_USE_IO_URING
+# define TORRENT_USE_IO_URING 1
+#endif
+
+// sendfile() can send from a regular file to a socket since linux 2.6.33
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,33) && !defined TORRENT_USE_SENDFILE
+# define TORRENT_USE_SENDFILE 1
+#endif
+
+// recvmmsg() was introduced in linux 2.6.33 and sendmmsg() in 3.0
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,0,0) && !defined TORRENT_USE_MMSG
+# define TORRENT_USE_MMSG 1
+#endif
+
 #define TORRENT_HAVE_MMAP 1
 #define TORRENT_USE_NETLINK 1
 #define TORRENT_USE_IFCONF 1
@@ -516,6 +533,18 @@ int snprintf(char* buf, int len, char const* fmt, ...)
 #define TORRENT_USE_PREAD 1
 #endif
 
+#ifndef TORRENT_USE_IO_URING
+#define TORRENT_USE_IO_URING 0
+#endif
+
+#ifndef TORRENT_USE_SENDFILE
+#define TORRENT_USE_SENDFILE 0
+#endif
+
+#ifndef TORRENT_USE_MMSG
+#define TORRENT_USE_MMSG 0
+#endif
+
 #ifndef TORRENT_NO_FPU
 #define TORRENT_NO_FPU 0
 #endif
@@ -39,6 +39,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/thread.hpp"
 #include "libtorrent/io_service_fwd.hpp"
 #include "libtorrent/file.hpp" // for iovec_t
+#include "libtorrent/error_code.hpp"
 #include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
@@ -58,6 +59,7 @@ namespace libtorrent
 	class alert;
 	struct alert_dispatcher;
 	struct disk_observer;
+	struct counters;
 
 	struct TORRENT_EXTRA_EXPORT disk_buffer_pool : boost::noncopyable
 	{
@@ -100,6 +102,13 @@ namespace libtorrent
 
 		void set_settings(aux::session_settings const& sett);
 
+		// sets the gauges describing the huge page arena (see
+		// settings_pack::use_hugepage_cache)
+		void update_stats_counters(counters& c) const;
+
+		// the size of the pages the arena is made up of
+		enum { arena_page_size = 2 * 1024 * 1024 };
+
 		struct handler_t
 		{
 			char* buffer; // argument to the callback
@@ -152,6 +161,17 @@ namespace libtorrent
 
 		void check_buffer_level(mutex::scoped_lock& l);
 
+#if TORRENT_HAVE_MMAP
+		// sets up m_cache_pool as an anonymous mapping of m_max_use blocks,
+		// backed by huge pages if possible. Returns false on failure
+		bool map_arena(error_code& ec);
+		void unmap_arena();
+
+		// the cache pool is the huge page arena, rather than a mapping of the
+		// mmap_cache file
+		bool using_arena() const { return m_cache_pool != 0 && m_cache_fd < 0; }
+#endif
+
 		mutable mutex m_pool_mutex;
 
 		int m_cache_buffer_chunk_size;
@@ -165,8 +185,18 @@ namespace libtorrent
 		char* m_cache_pool;
 		// list of block indices that are not in use. block_index
 		// times 0x4000 + m_cache_pool is the address where the
-		// corresponding memory lives
+		// corresponding memory lives. It's a stack, except for the huge
+		// page arena, where it's a min-heap
 		std::vector<int> m_free_list;
+
+		// the number of bytes mapped for the arena. It's rounded up to whole
+		// huge pages
+		boost::uint64_t m_arena_size;
+
+		// the number of blocks handed out from each huge page of the arena,
+		// and the number of huge pages with at least one block handed out
+		std::vector<boost::uint16_t> m_arena_page_use;
+		int m_arena_pages_in_use;
 #endif
 
 		alert_dispatcher* m_post_alert;
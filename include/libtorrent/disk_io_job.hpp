@@ -47,12 +47,18 @@ namespace libtorrent
 	class entry;
 	class piece_manager;
 	struct cached_piece_entry;
+	struct file_mapping;
 
 	struct block_cache_reference
 	{
 		void* storage;
 		int piece;
 		int block;
+
+		// if this is set, the buffer isn't a block in the cache but points
+		// into a memory mapped file. The reference holds one reference
+		// count on the mapping, which is released by reclaim_block()
+		file_mapping* mapping;
 	};
 
 	// disk_io_jobs are allocated in a pool allocator in disk_io_thread
@@ -129,6 +135,21 @@ namespace libtorrent
 
 			// turns into file::coalesce_buffers in the file operation
 			coalesce_buffers = 0x40,
+
+			// set on hash jobs for pieces that are in the cache, which are
+			// queued for the dedicated hashing threads. Such a job may only
+			// hash blocks that are already in the cache. If any block is
+			// missing, the job is handed over to a generic disk thread instead
+			cached_only = 0x80,
+
+			// set on read jobs by a requester that can send a range of a file
+			// directly (see settings_pack::use_sendfile). A read miss may then
+			// be answered with a file reference rather than a buffer
+			allow_file_reference = 0x100,
+
+			// set on completed read jobs whose ``buffer`` points to a
+			// file_io_slice rather than the data. The slice is owned by the job
+			file_reference = 0x200
 		};
 
 		// for write jobs, returns true if its block
@@ -147,6 +168,8 @@ namespace libtorrent
 		// for aiocb_complete this points to the aiocb that completed
 		// for get_cache_info this points to a cache_status object which
 		// is filled in
+		// for read jobs with the file_reference flag set, this points to a
+		// file_io_slice describing where the block lives on disk
 		char* buffer;
 
 		// the disk storage this job applies to (if applicable)
@@ -209,7 +232,7 @@ namespace libtorrent
 		boost::int32_t ret;
 
 		// flags controlling this job
-		boost::uint8_t flags;
+		boost::uint16_t flags;
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		bool in_use:1;
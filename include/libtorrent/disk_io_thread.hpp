@@ -50,6 +50,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/optional.hpp>
 #include <boost/shared_ptr.hpp>
 #include <deque>
+#include <set>
 #include "libtorrent/config.hpp"
 #ifndef TORRENT_DISABLE_POOL_ALLOCATOR
 #include <boost/pool/pool.hpp>
@@ -64,6 +65,8 @@ namespace libtorrent
 	struct alert_dispatcher;
 	struct add_torrent_params;
 	struct counters;
+	struct io_uring_queue;
+	struct uring_job;
 
 	struct cached_piece_info
 	{
@@ -290,6 +293,11 @@ namespace libtorrent
 		void set_settings(settings_pack* sett);
 		void set_num_threads(int i, bool wait = true);
 
+		// sets the number of threads dedicated to hashing pieces that are
+		// in the cache. These threads never perform any file operations.
+		// If it's 0, hash jobs are performed by the regular disk threads
+		void set_num_hashing_threads(int i, bool wait = true);
+
 		void async_read(piece_manager* storage, peer_request const& r
 			, boost::function<void(disk_io_job const*)> const& handler, void* requester
 			, int flags = 0);
@@ -395,12 +403,36 @@ namespace libtorrent
 		int do_read(disk_io_job* j, tailqueue& completed_jobs);
 		int do_uncached_read(disk_io_job* j);
 
+		// serves a read job out of a memory mapping of the file (see
+		// use_mmap_reads). Returns -2 if the storage can't map the block
+		int do_mapped_read(disk_io_job* j);
+
+		// answers a read job with a reference to the file range the block is
+		// stored in (see use_sendfile), once the range is in the page cache.
+		// Returns -2 if the block doesn't map to a single file range
+		int do_file_reference_read(disk_io_job* j);
+
+		// returns true if misses of this read job are served without
+		// allocating a piece in the block cache
+		bool bypass_read_cache(disk_io_job const* j) const;
+
+		// tells the operating system the requester of this job is expected
+		// to read ``size`` bytes at ``offset`` into ``piece`` next (see
+		// adaptive_read_ahead)
+		void hint_read_ahead(disk_io_job* j, int piece, int offset, int size);
+
 		int do_write(disk_io_job* j, tailqueue& completed_jobs);
 		int do_uncached_write(disk_io_job* j);
 
 		int do_hash(disk_io_job* j, tailqueue& completed_jobs);
 		int do_uncached_hash(disk_io_job* j);
 
+		// hash jobs whose pieces aren't in the cache are read from disk and
+		// hashed in parallel. The others are performed one at a time
+		bool can_batch_hash(disk_io_job* j);
+		void perform_hash_batch(disk_io_job** jobs, int num_jobs
+			, tailqueue& completed_jobs);
+
 		int do_move_storage(disk_io_job* j, tailqueue& completed_jobs);
 		int do_release_files(disk_io_job* j, tailqueue& completed_jobs);
 		int do_delete_files(disk_io_job* j, tailqueue& completed_jobs);
@@ -446,20 +478,66 @@ namespace libtorrent
 		void fail_jobs(storage_error const& e, tailqueue& jobs_);
 		void fail_jobs_impl(storage_error const& e, tailqueue& src, tailqueue& dst);
 
-		void check_cache_level(mutex::scoped_lock& l, tailqueue& completed_jobs);
+		// evicts and flushes blocks until the cache is below its size limit.
+		// The shards are locked one at a time, the caller may not hold any
+		// cache mutex
+		void check_cache_level(tailqueue& completed_jobs);
 
 		void perform_job(disk_io_job* j, tailqueue& completed_jobs);
 
+		// if the job is an uncached read or write and the storage supports
+		// it, queue up the file operations in the thread's io_uring instead
+		// of performing them synchronously. Returns false if the job should
+		// be performed by perform_job() instead.
+		bool try_issue_uring_job(disk_io_job* j, io_uring_queue& ring);
+
+		// hands the queued operations to the kernel. If the kernel keeps
+		// refusing them, they're performed synchronously instead
+		void submit_uring_jobs(io_uring_queue& ring);
+
+		// submits the queued operations and blocks until at least one
+		// operation completes
+		void wait_uring_jobs(io_uring_queue& ring);
+
+		// posts the jobs whose file operations have all completed
+		void reap_uring_jobs(io_uring_queue& ring);
+		void uring_op_done(void* userdata, int result, tailqueue& completed_jobs);
+		void uring_job_done(uring_job* u, tailqueue& completed_jobs);
+
+		// wakes up the disk threads blocked in wait() on their io_uring,
+		// for them to pick up new jobs. assumes m_job_mutex is held
+		void wake_uring_waiters();
+
+		// returns true if there's a write to the piece of this job queued
+		// up or being performed by any disk thread
+		bool write_in_flight(disk_io_job const* j) const;
+
+		// if j is a write, records it in m_writes_in_flight. Called for
+		// every job put in m_queued_jobs. assumes m_job_mutex is held
+		void add_write_in_flight(disk_io_job const* j);
+
+		// assumes m_job_mutex is held
+		void clear_write_in_flight(piece_manager const* storage, int piece);
+
 		// this queues up another job to be submitted
 		void add_job(disk_io_job* j);
 		void add_fence_job(piece_manager* storage, disk_io_job* j);
 
-		// assumes l is locked (cache mutex).
+		// assumes l is locked (the mutex of p's cache shard).
 		// writes out the blocks [start, end) (releases the lock
 		// during the file operation)
 		int flush_range(cached_piece_entry* p, int start, int end
 			, int flags, tailqueue& completed_jobs, mutex::scoped_lock& l);
 
+		// assumes l is locked (the mutex of the cache shard all the pieces
+		// belong to). Writes out all dirty blocks of the pieces. Blocks that
+		// are contiguous across adjacent pieces are written by the same
+		// operation, and the operations are issued in order of their offset,
+		// continuing where the previous call left off in this shard (like an
+		// elevator). Returns the number of blocks written
+		int flush_pieces_sorted(cached_piece_entry** pieces, int num_pieces
+			, tailqueue& completed_jobs, mutex::scoped_lock& l);
+
 		// low level flush operations, used by flush_range
 		int build_iovec(cached_piece_entry* pe, int start, int end
 			, file::iovec_t* iov, int* flushing, int block_base_index = 0);
@@ -470,7 +548,7 @@ namespace libtorrent
 			, storage_error const& error
 			, tailqueue& completed_jobs);
 
-		// assumes l is locked (the cache mutex).
+		// assumes l is locked (the mutex of pe's cache shard).
 		// assumes pe->hash to be set.
 		// If there are new blocks in piece 'pe' that have not been
 		// hashed by the partial_hash object attached to this piece,
@@ -491,13 +569,27 @@ namespace libtorrent
 			// used for asserts and only applies for fence jobs
 			flush_expect_clear = 8
 		};
-		void flush_cache(piece_manager* storage, boost::uint32_t flags, tailqueue& completed_jobs, mutex::scoped_lock& l);
-		void flush_expired_write_blocks(tailqueue& completed_jobs, mutex::scoped_lock& l);
+		// these lock the cache shards themselves, one at a time. The caller
+		// may not hold any cache mutex
+		void flush_cache(piece_manager* storage, boost::uint32_t flags, tailqueue& completed_jobs);
+		void flush_expired_write_blocks(tailqueue& completed_jobs);
+
+		// assumes l is locked (the mutex of pe's cache shard)
 		void flush_piece(cached_piece_entry* pe, int flags, tailqueue& completed_jobs, mutex::scoped_lock& l);
 
 		int try_flush_hashed(cached_piece_entry* p, int cont_blocks, tailqueue& completed_jobs, mutex::scoped_lock& l);
 
-		void try_flush_write_blocks(int num, tailqueue& completed_jobs, mutex::scoped_lock& l);
+		// assumes l is locked (the mutex of the specified cache shard)
+		void try_flush_write_blocks(int shard, int num, tailqueue& completed_jobs, mutex::scoped_lock& l);
+
+		// returns the mutex protecting the cache shard the specified
+		// piece belongs to
+		mutex& cache_mutex(piece_manager const* storage, int piece) const
+		{ return m_cache_mutex[block_cache::shard_index(storage, piece)]; }
+		mutex& cache_mutex(disk_io_job const* j) const
+		{ return m_cache_mutex[block_cache::shard_index(j)]; }
+		mutex& cache_mutex(cached_piece_entry const* pe) const
+		{ return m_cache_mutex[block_cache::shard_index(pe)]; }
 
 		// used to batch reclaiming of blocks to once per cycle
 		void commit_reclaimed_blocks();
@@ -515,6 +607,19 @@ namespace libtorrent
 		// the actual threads running disk jobs
 		std::vector<boost::shared_ptr<thread> > m_threads;
 
+		// the number of hashing threads we want. This is only modified
+		// while holding m_job_mutex, to not race with add_job()
+		boost::atomic<int> m_num_hashing_threads;
+
+		// the number of hashing threads still running. The last generic
+		// disk thread won't exit until this drops to zero, since the
+		// hashing threads may hand jobs over to it
+		// protected by m_job_mutex
+		int m_num_running_hashing_threads;
+
+		// the threads dedicated to hashing cached pieces
+		std::vector<boost::shared_ptr<thread> > m_hash_threads;
+
 		aux::session_settings m_settings;
 
 		// userdata pointer for the complete_job function, which
@@ -529,10 +634,22 @@ namespace libtorrent
 		// LRU cache of open files
 		file_pool m_file_pool;
 
-		// disk cache
-		mutable mutex m_cache_mutex;
+		// disk cache. Every shard of the cache is protected by its own
+		// mutex. A thread never holds more than one of them at a time,
+		// except when locking all of them, which is always done in order
+		mutable mutex m_cache_mutex[block_cache::num_shards];
 		block_cache m_disk_cache;
 
+		// the shard to start evicting from the next time the cache is
+		// above its size limit. This rotates to spread evictions evenly
+		boost::atomic<int> m_next_evict_shard;
+
+		// for each cache shard, the storage and piece the last call to
+		// flush_pieces_sorted() ended at. The next one picks up from there.
+		// The storage is only used for ordering, it's never dereferenced.
+		// Protected by the shard's mutex
+		std::pair<piece_manager const*, int> m_flush_cursor[block_cache::num_shards];
+
 		// total number of blocks in use by both the read
 		// and the write cache. This is not supposed to
 		// exceed m_cache_size
@@ -578,7 +695,20 @@ namespace libtorrent
 		// jobs queued for servicing
 		tailqueue m_queued_jobs;
 
-		// when using more than 2 threads, this is
+		// the pieces with write jobs that are queued in m_queued_jobs or
+		// have been picked off the queue but not written to disk yet. Writes
+		// issued to an io_uring stay in here until the operation completes. When not using a write cache, a
+		// piece may not be hashed until all its writes have completed.
+		// protected by m_job_mutex
+		std::multiset<std::pair<piece_manager const*, int> > m_writes_in_flight;
+
+		// the io_urings of the generic disk threads that are waiting for
+		// jobs while they have file operations in flight. Those threads are
+		// blocked on their ring, rather than on m_job_cond. protected by
+		// m_job_mutex
+		std::vector<io_uring_queue*> m_uring_waiters;
+
+		// when there are hashing threads, this is
 		// used for just hashing jobs, just for threads
 		// dedicated to do hashing
 		condition_variable m_hash_job_cond;
@@ -598,7 +728,6 @@ namespace libtorrent
 		// handler functions
 		mutex m_completed_jobs_mutex;
 		tailqueue m_completed_jobs;
-
 		// these are blocks that have been returned by the main thread
 		// but they haven't been freed yet. This is used to batch
 		// reclaiming of blocks, to only need one mutex lock per cycle
@@ -42,6 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/noncopyable.hpp>
 #include <boost/smart_ptr.hpp>
+#include <boost/atomic.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -328,6 +329,16 @@ namespace libtorrent
 
 		boost::int64_t get_size(error_code& ec) const;
 
+		// returns true if all of the given range of the file is in the
+		// operating system's page cache, i.e. reading it won't block on the
+		// disk. Returns false if that can't be determined
+		bool is_resident(boost::int64_t file_offset, int size) const;
+
+		// tells the operating system the given range of the file is about to
+		// be read, without waiting for it to be read. This is a no-op on
+		// systems without posix_fadvise()
+		void hint_read(boost::int64_t file_offset, int size);
+
 		// return the offset of the first byte that
 		// belongs to a data-region
 		boost::int64_t sparse_end(boost::int64_t start) const;
@@ -370,6 +381,35 @@ namespace libtorrent
 #endif
 	};
 
+	// a read-only memory mapping of the first ``size`` bytes of an open
+	// file. The mapping is reference counted (via boost::intrusive_ptr) and
+	// unmapped when the last reference goes away. It stays valid after the
+	// file it was created from has been closed.
+	struct TORRENT_EXTRA_EXPORT file_mapping : boost::noncopyable
+	{
+		file_mapping(handle_type fd, boost::int64_t size, error_code& ec);
+		~file_mapping();
+
+		char const* data() const { return m_base; }
+		boost::int64_t size() const { return m_size; }
+
+		// returns true if files can be memory mapped on this system. Mapping
+		// whole files requires mmap() and a 64 bit address space.
+		static bool supported();
+
+		friend void intrusive_ptr_add_ref(file_mapping const* m)
+		{ ++m->m_refs; }
+
+		friend void intrusive_ptr_release(file_mapping const* m)
+		{ if (--m->m_refs == 0) delete m; }
+
+	private:
+
+		char* m_base;
+		boost::int64_t m_size;
+		mutable boost::atomic<int> m_refs;
+	};
+
 }
 
 #endif // TORRENT_FILE_HPP_INCLUDED
@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_FILE_POOL_HPP
 
 #include <map>
+#include <boost/intrusive_ptr.hpp>
 #include "libtorrent/file.hpp"
 #include "libtorrent/time.hpp"
 #include "libtorrent/thread.hpp"
@@ -92,6 +93,17 @@ namespace libtorrent
 		// file open mode (see file::open_mode_t).
 		file_handle open_file(void* st, std::string const& p
 			, int file_index, file_storage const& fs, int m, error_code& ec);
+
+		// return a read-only memory mapping of the file at ``file_index`` in
+		// storage ``st``, covering at least its first ``size`` bytes. ``f``
+		// is the open handle to the file, as returned by open_file(). The
+		// mapping is kept by the pool for as long as the file is, and it's
+		// re-created when a larger range is requested. Returns an empty
+		// pointer if the file is smaller than ``size``, or if it can't be
+		// mapped (in which case ``ec`` is set).
+		boost::intrusive_ptr<file_mapping> map_file(void* st, int file_index
+			, file_handle const& f, boost::int64_t size, error_code& ec);
+
 		// release all files belonging to the specified storage_interface (``st``)
 		// the overload that takes ``file_index`` releases only the file with
 		// that index in storage ``st``.
@@ -129,6 +141,9 @@ namespace libtorrent
 		{
 			lru_file_entry(): key(0), last_use(aux::time_now()), mode(0) {}
 			mutable file_handle file_ptr;
+			// a memory mapping of the file, if it's been mapped. Blocks that
+			// have been handed out from it hold their own references
+			boost::intrusive_ptr<file_mapping> mapping;
 			void* key;
 			time_point last_use;
 			int mode;
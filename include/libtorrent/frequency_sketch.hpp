@@ -0,0 +1,91 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_FREQUENCY_SKETCH_HPP_INCLUDED
+#define TORRENT_FREQUENCY_SKETCH_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+
+#include <boost/cstdint.hpp>
+#include <vector>
+
+namespace libtorrent
+{
+	// a count-min sketch estimating how many times keys have been seen
+	// recently, in a fixed amount of memory. Each key maps to one counter in
+	// each of 4 rows, and its estimate is the smallest of them. Counters
+	// saturate at 15. Once the number of increments reaches 10 times the
+	// width of the sketch, all counters are halved, so that the estimates
+	// follow changes in popularity over time.
+	//
+	// This is the frequency filter of the TinyLFU cache admission policy
+	// (see settings_pack::cache_eviction_policy).
+	struct TORRENT_EXTRA_EXPORT frequency_sketch
+	{
+		frequency_sketch();
+
+		// sizes the sketch to track roughly ``num_keys`` distinct keys. If
+		// this changes the size of the sketch, all counters are reset
+		void resize(int num_keys);
+
+		// records one occurrence of ``key``
+		void increment(boost::uint32_t key);
+
+		// returns the estimated number of recent occurrences of ``key``,
+		// in the range [0, 15]
+		int estimate(boost::uint32_t key) const;
+
+		// the number of counters in each row
+		int width() const { return int(m_mask) + 1; }
+
+		enum { depth = 4, max_count = 15 };
+
+	private:
+
+		int index(boost::uint32_t key, int row) const;
+
+		// halves all counters
+		void age();
+
+		// depth rows of width counters each
+		std::vector<boost::uint8_t> m_table;
+
+		// width - 1. The width is always a power of 2
+		boost::uint32_t m_mask;
+
+		// the number of increments since the counters were last halved
+		int m_additions;
+	};
+}
+
+#endif // TORRENT_FREQUENCY_SKETCH_HPP_INCLUDED
+
@@ -0,0 +1,157 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_IO_URING_QUEUE_HPP_INCLUDED
+#define TORRENT_IO_URING_QUEUE_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/error_code.hpp"
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <vector>
+
+namespace libtorrent
+{
+	// a thin wrapper around a linux io_uring submission and completion
+	// queue. It talks to the kernel directly via the system calls, there's
+	// no dependency on liburing. An instance is not thread safe, the intention
+	// is for each disk thread to own one.
+	//
+	// If io_uring is not supported (either at compile time or by the running
+	// kernel, which needs to support registering an eventfd with the ring)
+	// the queue is left closed and is_open() returns false. It's then
+	// up to the caller to fall back to regular preadv()/pwritev().
+	struct TORRENT_EXTRA_EXPORT io_uring_queue : boost::noncopyable
+	{
+		// the result of one read or write operation. ``result`` is the number
+		// of bytes transferred, or a negative errno.
+		struct completion
+		{
+			void* userdata;
+			int result;
+		};
+
+		// ``entries`` is the number of operations that can be queued or in
+		// flight at any given time. The kernel may round this up.
+		explicit io_uring_queue(int entries);
+		~io_uring_queue();
+
+		bool is_open() const { return m_ring_fd >= 0; }
+
+		// queue up a vectored read or write against ``fd``. The operation is
+		// not handed to the kernel until the next call to submit(). The
+		// iovec array (and the buffers) must stay valid until the operation
+		// completes. Returns false if the queue is full.
+		bool async_readv(handle_type fd, file::iovec_t const* bufs, int num_bufs
+			, boost::int64_t file_offset, void* userdata);
+		bool async_writev(handle_type fd, file::iovec_t const* bufs, int num_bufs
+			, boost::int64_t file_offset, void* userdata);
+
+		// hand all queued operations to the kernel in a single system call.
+		// If ``wait`` is true, this blocks until at least one operation has
+		// completed. Returns the number of submitted operations, or -1 on
+		// error.
+		int submit(bool wait, error_code& ec);
+
+		// pops up to ``num`` completed operations into ``out``. Returns the
+		// number of completions that were returned. This never blocks.
+		int reap(completion* out, int num);
+
+		// blocks until an operation completes, or until wake() is called.
+		// Completions posted since the last call are counted, so this
+		// returns immediately if one completed after the last reap(). It may
+		// also return spuriously.
+		void wait();
+
+		// makes a thread blocked in wait() return. Unlike the other
+		// functions, this may be called from any thread
+		void wake();
+
+		// removes the operations that haven't been handed to the kernel yet
+		// from the queue, and appends their userdata to ``out``. This is
+		// for when submit() keeps failing, the caller is expected to
+		// perform them some other way
+		void take_unsubmitted(std::vector<void*>& out);
+
+		// the number of operations that have been queued (submitted or not)
+		// but not yet reaped
+		int num_pending() const { return m_pending; }
+
+		// the number of operations queued, but not yet submitted to the kernel
+		int num_unsubmitted() const { return m_unsubmitted; }
+
+		// the max number of pending operations
+		int capacity() const { return m_capacity; }
+
+	private:
+
+		bool queue_op(int op, handle_type fd, file::iovec_t const* bufs
+			, int num_bufs, boost::int64_t file_offset, void* userdata);
+
+		void close();
+
+		int m_ring_fd;
+
+		// an eventfd registered with the ring. The kernel signals it for every
+		// completion, wake() signals it too
+		int m_event_fd;
+
+		// the memory mapped rings, and their sizes
+		void* m_sq_ring;
+		void* m_cq_ring;
+		void* m_sqes;
+		int m_sq_ring_size;
+		int m_cq_ring_size;
+		int m_sqes_size;
+
+		// pointers into the mapped submission queue ring
+		unsigned* m_sq_head;
+		unsigned* m_sq_tail;
+		unsigned* m_sq_mask;
+		unsigned* m_sq_array;
+
+		// pointers into the mapped completion queue ring
+		unsigned* m_cq_head;
+		unsigned* m_cq_tail;
+		unsigned* m_cq_mask;
+		void* m_cqes;
+
+		int m_capacity;
+		int m_pending;
+		int m_unsubmitted;
+	};
+}
+
+#endif // TORRENT_IO_URING_QUEUE_HPP_INCLUDED
+
@@ -0,0 +1,154 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_DHT_STORAGE_HPP
+#define TORRENT_DHT_STORAGE_HPP
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/peer_id.hpp" // for sha1_hash
+#include "libtorrent/socket.hpp"
+#include "libtorrent/address.hpp"
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/function/function3.hpp>
+
+namespace libtorrent
+{
+	struct dht_settings;
+	struct counters;
+	class entry;
+}
+
+namespace libtorrent { namespace dht
+{
+	// The storage of a DHT node. It holds the peers announced to the node
+	// (``announce_peer``) and the BEP44 items put to it (``put``). The node
+	// validates the requests (tokens, signatures, sequence numbers) before
+	// calling into the storage, so an implementation only has to store and
+	// look things up. It also has to expire and evict entries to stay within
+	// dht_settings::max_dht_items, dht_settings::max_torrents etc.
+	//
+	// All functions are called from the network thread.
+	struct TORRENT_EXTRA_EXPORT dht_storage_interface
+	{
+		// adds the peers of ``info_hash`` to ``peers``, as the reply of a
+		// ``get_peers`` request. Returns false if there are no peers for the
+		// info-hash
+		virtual bool get_peers(sha1_hash const& info_hash, bool noseed
+			, bool scrape, entry& peers) const = 0;
+
+		// adds (or refreshes) a peer of ``info_hash``. ``name`` is the name of
+		// the torrent and may be NULL
+		virtual void announce_peer(sha1_hash const& info_hash
+			, tcp::endpoint const& endp, char const* name, int name_len
+			, bool seed) = 0;
+
+		// sets "v" of ``item`` to the immutable item. Returns false if we
+		// don't have it
+		virtual bool get_immutable_item(sha1_hash const& target
+			, entry& item) const = 0;
+
+		// stores the bencoded immutable item ``buf``, or refreshes it if we
+		// already have it. ``addr`` is the address of the node that put it
+		virtual void put_immutable_item(sha1_hash const& target
+			, char const* buf, int size, address const& addr) = 0;
+
+		// sets ``seq`` to the sequence number of the mutable item. Returns
+		// false if we don't have it
+		virtual bool get_mutable_item_seq(sha1_hash const& target
+			, boost::int64_t& seq) const = 0;
+
+		// sets "seq" of ``item`` to the sequence number of the mutable item,
+		// and "v", "sig" and "k" if ``force_fill`` is set or if ``seq`` is
+		// less than the sequence number we have. Returns false if we don't
+		// have the item
+		virtual bool get_mutable_item(sha1_hash const& target
+			, boost::int64_t seq, bool force_fill, entry& item) const = 0;
+
+		// stores the mutable item, replacing the one we have if ``seq`` is
+		// greater than its sequence number. The signature has already been
+		// verified
+		virtual void put_mutable_item(sha1_hash const& target
+			, char const* buf, int size
+			, char const* sig
+			, boost::int64_t seq
+			, char const* pk
+			, char const* salt, int salt_size
+			, address const& addr) = 0;
+
+		// called periodically, to expire old entries
+		virtual void tick() = 0;
+
+		virtual int num_torrents() const = 0;
+		virtual int num_peers() const = 0;
+
+		virtual ~dht_storage_interface() {}
+	};
+
+	// a function creating the storage for the DHT node with the given node ID
+	typedef boost::function<dht_storage_interface*(sha1_hash const& id
+		, dht_settings const& settings, counters& cnt)>
+		dht_storage_constructor_type;
+
+	// the default storage. Everything is kept in RAM and lost when the
+	// node shuts down
+	TORRENT_EXPORT dht_storage_interface* dht_default_storage_constructor(
+		sha1_hash const& id, dht_settings const& settings, counters& cnt);
+
+	// a storage that survives restarts. Peers and items are appended to a log
+	// file in ``path``, which is memory mapped. Only an index of the items is
+	// kept in RAM, the values are read from the mapping. When the node starts,
+	// the log is replayed and the peers and items that haven't expired yet are
+	// restored. The log is compacted as it grows. Compaction rewrites the live
+	// peers and items synchronously, on the network thread, and DHT requests
+	// are not answered while it runs.
+	//
+	// This requires memory mapped files. Where they're not available, this
+	// returns the default storage.
+	TORRENT_EXPORT dht_storage_interface* dht_disk_storage_constructor(
+		std::string const& path, sha1_hash const& id
+		, dht_settings const& settings, counters& cnt);
+
+	// internal
+	// returns how important it is to keep the item ``target``, the lowest
+	// scoring item is evicted first. This takes the popularity (number of
+	// announcers) and the fit, in terms of distance from ideal storing node,
+	// into account. Each additional 5 announcers is worth one extra bit in the
+	// distance. That is, an item with 10 announcers is allowed to be twice as
+	// far from another item with 5 announcers, from our node ID.
+	TORRENT_EXTRA_EXPORT int item_importance(sha1_hash const& target
+		, sha1_hash const& our_id, int num_announcers);
+
+} } // namespace libtorrent::dht
+
+#endif
@@ -52,6 +52,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket.hpp"
 #include "libtorrent/thread.hpp"
 #include "libtorrent/deadline_timer.hpp"
+#include "libtorrent/thread_pool.hpp"
 
 namespace libtorrent
 {
@@ -71,13 +72,29 @@ namespace libtorrent { namespace dht
 
 	struct dht_tracker;
 
+	// a query handed off to a request thread
+	struct dht_request_job
+	{
+		boost::shared_ptr<dht_tracker> tracker;
+		udp::endpoint ep;
+		std::vector<char> buf;
+	};
+
+	// the threads answering DHT queries (see dht_settings::request_threads)
+	struct dht_request_pool : thread_pool<dht_request_job>
+	{
+		void process_job(dht_request_job const& j, bool post);
+	};
+
 	struct dht_tracker
 		: udp_socket_interface
 		, udp_socket_observer
 		, boost::enable_shared_from_this<dht_tracker>
 	{
 		dht_tracker(libtorrent::aux::session_impl& ses, rate_limited_udp_socket& sock
-			, dht_settings const& settings, counters& cnt, entry const* state = 0);
+			, dht_settings const& settings, counters& cnt, entry const* state = 0
+			, dht_storage_constructor_type const& storage_constructor
+				= dht_storage_constructor_type());
 		virtual ~dht_tracker();
 
 		void start(entry const& bootstrap
@@ -119,12 +136,30 @@ namespace libtorrent { namespace dht
 		// used by the library
 		virtual bool incoming_packet(error_code const& ec
 			, udp::endpoint const&, char const* buf, int size);
+		virtual void socket_drained();
 
 	private:
+		friend struct dht_request_pool;
 	
 		boost::shared_ptr<dht_tracker> self()
 		{ return shared_from_this(); }
 
+		// parses the message and passes it on to the node
+		bool incoming_message(udp::endpoint const& ep, char const* buf
+			, int size);
+
+		// called on a request thread
+		void process_request(dht_request_job const& j);
+
+		// these are posted back to the network thread by the request threads
+		void requeue_message(udp::endpoint const& ep
+			, std::vector<char> const& buf);
+		void send_reply(boost::shared_ptr<entry> const& e
+			, boost::shared_ptr<request_effects> const& effects
+			, udp::endpoint const& ep);
+
+		void update_request_threads();
+
 		void on_name_lookup(error_code const& e
 			, udp::resolver::iterator host);
 		void on_router_name_lookup(error_code const& e
@@ -161,6 +196,21 @@ namespace libtorrent { namespace dht
 
 		// used to resolve hostnames for nodes
 		udp::resolver m_host_resolver;
+
+		// the number of request threads running. When 0, queries are
+		// answered by the network thread
+		int m_request_threads;
+
+		// the number of queries posted to the request threads that they
+		// haven't started on. When this gets too large, queries are dropped
+		boost::atomic<int> m_queued_requests;
+		enum { max_queued_requests = 1000 };
+
+		// the last time the routing table snapshot was updated, for the
+		// request threads
+		time_point m_last_snapshot;
+
+		dht_request_pool m_request_pool;
 	};
 }}
 
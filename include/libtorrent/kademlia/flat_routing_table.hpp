@@ -0,0 +1,104 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_FLAT_ROUTING_TABLE_HPP
+#define TORRENT_FLAT_ROUTING_TABLE_HPP
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/kademlia/routing_table.hpp"
+#include "libtorrent/kademlia/node_id.hpp"
+#include "libtorrent/kademlia/node_entry.hpp"
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace libtorrent { namespace dht
+{
+
+// an immutable copy of the live nodes of a routing_table, laid out to make
+// closest node searches cheap. It's what routing_table::snapshot() returns.
+//
+// The nodes are stored in one contiguous array, bucket by bucket, with the
+// index of the first node of every bucket. Since the buckets are ordered by
+// the length of the prefix they share with our own ID, the candidates for the
+// nodes closest to a target always form a suffix of that array. The node IDs
+// are also stored as five arrays of 32 bit words (structure of arrays), so
+// the XOR distances to a target can be computed four nodes at a time with
+// SSE2. The closest nodes are then picked with a partial sort on the
+// distances.
+struct TORRENT_EXTRA_EXPORT flat_routing_table : boost::noncopyable
+{
+	// copies the live nodes of ``buckets``, the buckets of a routing table
+	// with our node ID ``our_id`` and ``bucket_size`` nodes per bucket
+	flat_routing_table(routing_table::table_t const& buckets
+		, node_id const& our_id, int bucket_size);
+
+	// fills ``l`` with the ``count`` nodes closest to ``target``, closest
+	// first. ``options`` and ``count`` mean the same thing as for
+	// routing_table::find_node()
+	void find_node(node_id const& target, std::vector<node_entry>& l
+		, int options, int count = 0) const;
+
+	int size() const { return int(m_nodes.size()); }
+	int num_buckets() const { return int(m_bucket_start.size()) - 1; }
+
+	// computes the first 64 bits of the XOR distance between ``target``
+	// and the nodes [first, last), into ``out``. Compared as numbers, they
+	// order the nodes by distance, except for ties in those 64 bits
+	void distances(node_id const& target, int first, int last
+		, boost::uint64_t* out) const;
+
+private:
+
+	node_id m_id;
+	int m_bucket_size;
+
+	std::vector<node_entry> m_nodes;
+
+	// the index in m_nodes of the first node of every bucket, followed by
+	// the number of nodes
+	std::vector<int> m_bucket_start;
+
+	// the number of confirmed nodes in the buckets before every bucket,
+	// followed by the total number of confirmed nodes
+	std::vector<int> m_confirmed_before;
+
+	// word i of the node IDs, as big endian numbers, in m_lanes[i]
+	enum { num_lanes = node_id::size / 4 };
+	std::vector<boost::uint32_t> m_lanes[num_lanes];
+};
+
+} } // namespace libtorrent::dht
+
+#endif // TORRENT_FLAT_ROUTING_TABLE_HPP
+
@@ -58,6 +58,25 @@ bool TORRENT_EXTRA_EXPORT verify_mutable_item(
 	, char const* pk
 	, char const* sig);
 
+// the parts of a mutable item its signature covers, and the signature.
+// See verify_mutable_items()
+struct signed_item_ref
+{
+	std::pair<char const*, int> v;
+	std::pair<char const*, int> salt;
+	boost::uint64_t seq;
+	char const* pk;
+	char const* sig;
+};
+
+// verifies the signatures of ``num`` mutable items as a batch, which is
+// cheaper than calling verify_mutable_item() for each of them, and gives the
+// same answers. ``valid``
+// must have room for ``num`` entries, it's set to whether each of the
+// signatures is valid. Returns true if all of them are.
+bool TORRENT_EXTRA_EXPORT verify_mutable_items(signed_item_ref const* items
+	, int num, bool* valid);
+
 // TODO: since this is a public function, it should probably be moved
 // out of this header and into one with other public functions.
 
@@ -44,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/kademlia/msg.hpp>
 #include <libtorrent/kademlia/find_data.hpp>
 #include <libtorrent/kademlia/item.hpp>
+#include <libtorrent/kademlia/dht_storage.hpp>
 
 #include <libtorrent/io.hpp>
 #include <libtorrent/session_settings.hpp>
@@ -53,6 +54,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/cstdint.hpp>
 #include <boost/ref.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "libtorrent/socket.hpp"
 
@@ -102,65 +104,6 @@ struct key_desc_t
 bool TORRENT_EXTRA_EXPORT verify_message(bdecode_node const& msg, key_desc_t const desc[]
 	, bdecode_node ret[], int size , char* error, int error_size);
 
-// this is the entry for every peer
-// the timestamp is there to make it possible
-// to remove stale peers
-struct peer_entry
-{
-	time_point added;
-	tcp::endpoint addr;
-	bool seed;
-};
-
-// this is a group. It contains a set of group members
-struct torrent_entry
-{
-	std::string name;
-	std::set<peer_entry> peers;
-};
-
-struct dht_immutable_item
-{
-	dht_immutable_item() : value(0), num_announcers(0), size(0) {}
-	// malloced space for the actual value
-	char* value;
-	// this counts the number of IPs we have seen
-	// announcing this item, this is used to determine
-	// popularity if we reach the limit of items to store
-	bloom_filter<128> ips;
-	// the last time we heard about this
-	time_point last_seen;
-	// number of IPs in the bloom filter
-	int num_announcers;
-	// size of malloced space pointed to by value
-	int size;
-};
-
-struct ed25519_public_key { char bytes[item_pk_len]; };
-
-struct dht_mutable_item : dht_immutable_item
-{
-	char sig[item_sig_len];
-	boost::uint64_t seq;
-	ed25519_public_key key;
-	char* salt;
-	int salt_size;
-};
-
-// internal
-inline bool operator<(ed25519_public_key const& lhs, ed25519_public_key const& rhs)
-{
-	return memcmp(lhs.bytes, rhs.bytes, sizeof(lhs.bytes)) < 0;
-}
-
-// internal
-inline bool operator<(peer_entry const& lhs, peer_entry const& rhs)
-{
-	return lhs.addr.address() == rhs.addr.address()
-		? lhs.addr.port() < rhs.addr.port()
-		: lhs.addr.address() < rhs.addr.address();
-}
-
 struct null_type {};
 
 class announce_observer : public observer
@@ -174,15 +117,23 @@ public:
 	void reply(msg const&) { flags |= flag_done; }
 };
 
-struct count_peers
+// the changes to make to the node when a query has been answered by a
+// request thread (see dht_settings::request_threads). They're applied on the
+// network thread, by node_impl::apply()
+struct TORRENT_EXTRA_EXPORT request_effects : boost::noncopyable
 {
-	int& count;
-	count_peers(int& c): count(c) {}
-	void operator()(std::pair<libtorrent::dht::node_id
-		, libtorrent::dht::torrent_entry> const& t)
-	{
-		count += t.second.peers.size();
-	}
+	request_effects() : heard_about(false), node_seen(false) {}
+	~request_effects();
+
+	// the node that sent the query, and whether it should be passed to
+	// routing_table::heard_about() and routing_table::node_seen()
+	node_id id;
+	udp::endpoint ep;
+	bool heard_about;
+	bool node_seen;
+
+	// alerts to post. These are owned by this object
+	std::vector<alert*> alerts;
 };
 
 struct udp_socket_interface
@@ -193,14 +144,14 @@ struct udp_socket_interface
 
 class TORRENT_EXTRA_EXPORT node_impl : boost::noncopyable
 {
-typedef std::map<node_id, torrent_entry> table_t;
-typedef std::map<node_id, dht_immutable_item> dht_immutable_table_t;
-typedef std::map<node_id, dht_mutable_item> dht_mutable_table_t;
-
 public:
+	// ``storage_constructor`` creates the storage for the peers and items
+	// announced to this node. If it's empty, the default storage is used
 	node_impl(alert_dispatcher* alert_disp, udp_socket_interface* sock
 		, libtorrent::dht_settings const& settings, node_id nid, address const& external_address
-		, dht_observer* observer, counters& cnt);
+		, dht_observer* observer, counters& cnt
+		, dht_storage_constructor_type const& storage_constructor
+			= dht_storage_constructor_type());
 
 	virtual ~node_impl() {}
 
@@ -212,12 +163,30 @@ public:
 	void unreachable(udp::endpoint const& ep);
 	void incoming(msg const& m);
 
-	int num_torrents() const { return m_map.size(); }
+	// answers the query ``m``, on a request thread. The routing table is only
+	// read through its snapshot, and the changes to make on the network
+	// thread are recorded in ``effects``. The quota of the socket must have
+	// been checked by the caller
+	void incoming_query(msg const& m, entry& e, request_effects& effects);
+	void apply(request_effects& effects);
+
+	// verifies the signatures of the mutable puts that have been held back
+	// to be verified as a batch, stores the valid ones and sends the
+	// replies (see dht_settings::put_verify_batch)
+	void verify_pending_puts();
+
+	// publishes the current routing table to the request threads
+	void update_snapshot() { m_table.update_snapshot(); }
+
+	int num_torrents() const
+	{
+		mutex_t::scoped_lock l(m_storage_mutex);
+		return m_storage->num_torrents();
+	}
 	int num_peers() const
 	{
-		int ret = 0;
-		std::for_each(m_map.begin(), m_map.end(), count_peers(ret));
-		return ret;
+		mutex_t::scoped_lock l(m_storage_mutex);
+		return m_storage->num_peers();
 	}
 
 	int bucket_size(int bucket);
@@ -228,7 +197,7 @@ public:
 	boost::int64_t num_global_nodes() const
 	{ return m_table.num_global_nodes(); }
 
-	int data_size() const { return int(m_map.size()); }
+	int data_size() const { return num_torrents(); }
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	void print_state(std::ostream& os) const
@@ -293,7 +262,7 @@ protected:
 	void send_single_refresh(udp::endpoint const& ep, int bucket
 		, node_id const& id = node_id());
 	void lookup_peers(sha1_hash const& info_hash, entry& reply
-		, bool noseed, bool scrape) const;
+		, bool noseed, bool scrape, request_effects* effects = 0) const;
 	bool lookup_torrents(sha1_hash const& target, entry& reply
 		, char* tags) const;
 
@@ -303,11 +272,51 @@ private:
 	typedef libtorrent::mutex mutex_t;
 	mutex_t m_mutex;
 
+	// serializes access to m_storage, which is also used by the request
+	// threads
+	mutable mutex_t m_storage_mutex;
+
+	// protects m_secret
+	mutable mutex_t m_secret_mutex;
+
 	// this list must be destructed after the rpc manager
 	// since it might have references to it
 	std::set<traversal_algorithm*> m_running_requests;
 
-	void incoming_request(msg const& h, entry& e);
+	// ``effects`` is set when called on a request thread. Returns false if
+	// the reply is held back, to be sent by verify_pending_puts()
+	bool incoming_request(msg const& h, entry& e
+		, request_effects* effects = 0);
+
+	// a mutable put whose signature hasn't been verified yet
+	struct pending_put
+	{
+		// the reply, to send once the signature has been checked
+		entry reply;
+		udp::endpoint ep;
+		node_id id;
+		sha1_hash target;
+		std::string value;
+		std::string salt;
+		char pk[item_pk_len];
+		char sig[item_sig_len];
+		boost::int64_t seq;
+		// the "cas" field, if the put had one
+		bool has_cas;
+		boost::int64_t cas;
+	};
+
+	// stores the mutable item of ``p``, once its signature has been verified,
+	// unless the sequence number or "cas" rule it out. In that case ``e`` is
+	// turned into an error reply
+	bool put_mutable_item(pending_put const& p, entry& e);
+
+	// fills ``n`` with the nodes closest to ``target``, from the routing
+	// table or, on request threads, its snapshot
+	void closest_nodes(node_id const& target, nodes_t& n
+		, request_effects* effects);
+
+	void post_alert(alert* a, request_effects* effects) const;
 
 	node_id m_id;
 
@@ -318,9 +327,7 @@ public:
 private:
 	dht_observer* m_observer;
 
-	table_t m_map;
-	dht_immutable_table_t m_immutable_table;
-	dht_mutable_table_t m_mutable_table;
+	boost::scoped_ptr<dht_storage_interface> m_storage;
 	
 	time_point m_last_tracker_tick;
 
@@ -331,6 +338,9 @@ private:
 	// secret random numbers used to create write tokens
 	int m_secret[2];
 
+	// mutable puts waiting for their signatures to be verified as a batch
+	std::vector<pending_put> m_pending_puts;
+
 	alert_dispatcher* m_post_alert;
 	udp_socket_interface* m_sock;
 	counters& m_counters;
@@ -0,0 +1,179 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_PEER_STORE_HPP
+#define TORRENT_PEER_STORE_HPP
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/peer_id.hpp" // for sha1_hash
+#include "libtorrent/socket.hpp"
+#include "libtorrent/time.hpp"
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/function/function6.hpp>
+
+namespace libtorrent
+{
+	struct dht_settings;
+	struct counters;
+	class entry;
+}
+
+namespace libtorrent { namespace dht
+{
+
+// the peers announced to this DHT node, keyed by info-hash. This is laid out
+// to take as little memory as possible per torrent and per peer, since a
+// node may be asked to track millions of peers.
+//
+// Torrents are kept in an open-addressed hash table (linear probing). Each
+// torrent has two packed arrays of peers, one for IPv4 and one for IPv6.
+// Every peer is stored as its compact endpoint (6 or 18 bytes, the same
+// format it's sent in) followed by a 16 bit time stamp, whose top bit is the
+// seed flag. The arrays are sorted by endpoint.
+//
+// The store is bounded both by the number of torrents
+// (dht_settings::max_torrents) and by the number of bytes it uses
+// (dht_settings::max_peer_store_size). When either is exceeded, the torrents
+// that were announced to least recently are evicted.
+class TORRENT_EXTRA_EXPORT peer_store : boost::noncopyable
+{
+public:
+	peer_store(dht_settings const& settings, counters& cnt);
+	~peer_store();
+
+	// adds the peer to the torrent, or refreshes it if it's already in
+	// there. ``name`` may be NULL. It's stored if the torrent doesn't already
+	// have a name
+	void announce(sha1_hash const& info_hash, tcp::endpoint const& ep
+		, bool seed, char const* name, int name_len, time_point now);
+
+	// adds the peers of the torrent to the reply of a ``get_peers`` request.
+	// Either a random sample of at most dht_settings::max_peers_reply peers
+	// as "values", or bloom filters of seeds and downloaders if ``scrape`` is
+	// set. Returns false if we don't have the torrent
+	bool get_peers(sha1_hash const& info_hash, bool noseed, bool scrape
+		, entry& reply) const;
+
+	// removes peers that haven't announced in a while, and torrents that
+	// are left without peers
+	void tick(time_point now);
+
+	// calls ``f`` for every peer, with the info-hash, the endpoint, whether
+	// it's a seed and the number of seconds since it announced. The name of
+	// the torrent (or NULL) is passed along with its first peer only
+	typedef boost::function<void(sha1_hash const&, tcp::endpoint const&
+		, bool, int, char const*, int)> peer_fun;
+	void for_each_peer(peer_fun const& f, time_point now) const;
+
+	int num_torrents() const { return m_num_torrents; }
+	int num_peers() const { return m_num_peers; }
+
+	// the number of bytes allocated by the store, including the hash table
+	boost::int64_t memory_used() const { return m_memory_used; }
+
+	// the number of slots the torrent is stored past its home slot in the
+	// hash table, or -1 if we don't have it. This is meant for tests
+	int probe_length(sha1_hash const& info_hash) const;
+
+	// peers are removed this long after their last announce
+	enum { peer_timeout = 45 * 60 };
+
+	// the size of a stored IPv4 and IPv6 peer
+	enum { v4_entry_size = 6 + 2, v6_entry_size = 18 + 2 };
+
+private:
+
+	struct torrent_slot
+	{
+		sha1_hash info_hash;
+
+		// the time of the last announce, in seconds since m_epoch plus one.
+		// zero means the slot is empty
+		boost::uint32_t last_announce;
+
+		// the number of peers in, and the capacity (in peers) of, the IPv4
+		// and IPv6 arrays
+		boost::uint16_t num_peers[2];
+		boost::uint16_t capacity[2];
+		char* peers[2];
+
+		// malloced, the first byte is the length. NULL if we don't know the
+		// name
+		char* name;
+	};
+
+	boost::uint32_t clock(time_point now) const;
+
+	// returns the slot the info-hash is in, or the empty slot it would be
+	// inserted in
+	int find_slot(sha1_hash const& info_hash) const;
+
+	// returns the index of the torrent's slot, creating it if necessary.
+	// This may evict other torrents and grow the table
+	int insert_torrent(sha1_hash const& info_hash, boost::uint32_t now);
+	void erase_slot(int idx);
+	void free_slot(torrent_slot& t);
+	void resize_table(int capacity);
+
+	// evicts the least recently announced torrents until there's room for
+	// ``extra_bytes`` and ``extra_torrents`` more. ``keep`` is never evicted
+	void evict(boost::int64_t extra_bytes, int extra_torrents
+		, sha1_hash const& keep);
+
+	// evicts the least recently announced torrent other than ``keep``.
+	// Returns false if there's none
+	bool evict_oldest(sha1_hash const& keep);
+
+	void update_memory(boost::int64_t delta);
+	void update_peers(int delta);
+
+	dht_settings const& m_settings;
+	counters& m_counters;
+
+	// the time stamps are relative to this. It's set one peer timeout in the
+	// past, to allow announces to be replayed with their original time
+	time_point m_epoch;
+
+	// the size is always a power of two (or zero)
+	std::vector<torrent_slot> m_table;
+	int m_num_torrents;
+	int m_num_peers;
+	boost::int64_t m_memory_used;
+};
+
+} } // namespace libtorrent::dht
+
+#endif
+
@@ -40,6 +40,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/tuple/tuple.hpp>
 #include <boost/array.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <set>
 
 #include <libtorrent/kademlia/logging.hpp>
@@ -49,6 +50,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/session_settings.hpp>
 #include <libtorrent/assert.hpp>
 #include <libtorrent/time.hpp>
+#include <libtorrent/thread.hpp>
 #include <boost/unordered_set.hpp>
 
 namespace libtorrent
@@ -69,6 +71,8 @@ TORRENT_DECLARE_LOG(table);
 	
 typedef std::vector<node_entry> bucket_t;
 
+struct flat_routing_table;
+
 struct routing_table_node
 {
 	bucket_t replacements;
@@ -142,6 +146,15 @@ public:
 	// are nearest to the given id.
 	void find_node(node_id const& id, std::vector<node_entry>& l
 		, int options, int count = 0);
+
+	// a copy of the live nodes in the buckets, as of the last call to
+	// update_snapshot(). A snapshot is never modified, it's replaced by
+	// the next one, so it can be searched by other threads while the
+	// network thread keeps updating the routing table. snapshot() is
+	// thread safe
+	typedef boost::shared_ptr<flat_routing_table const> snapshot_t;
+	snapshot_t snapshot() const;
+	void update_snapshot();
 	void remove_node(node_entry* n
 		, table_t::iterator bucket) ;
 	
@@ -234,6 +247,11 @@ private:
 
 	// constant called k in paper
 	int m_bucket_size;
+
+	// the last published snapshot of m_buckets. The mutex only protects
+	// the pointer, not the table it points to, which is immutable
+	mutable mutex m_snapshot_mutex;
+	snapshot_t m_snapshot;
 	
 };
 
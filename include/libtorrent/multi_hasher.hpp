@@ -0,0 +1,96 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_MULTI_HASHER_HPP_INCLUDED
+#define TORRENT_MULTI_HASHER_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/sha1_hash.hpp"
+
+#include <boost/cstdint.hpp>
+
+namespace libtorrent
+{
+	// computes the SHA-1 digest of up to ``max_lanes`` independent
+	// messages at the same time. Each message is fed to its own lane. When
+	// all lanes are fed equal, 64 byte aligned, amounts of data with
+	// update_lanes(), the lanes are hashed in parallel, using SIMD
+	// instructions where available (4 lanes with SSE2). Data that doesn't
+	// line up (such as the tail of the last piece) can be fed to a single
+	// lane with update(), at the cost of hashing it serially.
+	//
+	// This is primarily meant for verifying many pieces at once, when
+	// checking files or when hashing pieces that aren't in the cache.
+	class TORRENT_EXTRA_EXPORT multi_hasher
+	{
+	public:
+
+		enum { max_lanes = 4 };
+
+		multi_hasher();
+
+		// feeds ``len`` bytes to each lane. ``data`` is an array of
+		// ``max_lanes`` pointers, lanes whose pointer is NULL are left
+		// untouched. ``len`` must be a multiple of 64, and every lane that's
+		// fed must have been fed a multiple of 64 bytes so far.
+		void update_lanes(char const* const* data, int len);
+
+		// feeds ``len`` bytes to just ``lane``
+		void update(int lane, char const* data, int len);
+
+		// returns the digest of everything fed to ``lane`` and resets it
+		sha1_hash final(int lane);
+
+		// resets all lanes
+		void reset();
+
+		// returns true if the lanes are hashed in parallel on this system,
+		// and false if update_lanes() falls back to hashing one lane at a time
+		static bool is_parallel();
+
+	private:
+
+		struct lane_t
+		{
+			boost::uint32_t state[5];
+			boost::uint64_t count;
+			boost::uint8_t buffer[64];
+		};
+
+		void reset(int lane);
+
+		lane_t m_lanes[max_lanes];
+	};
+}
+
+#endif // TORRENT_MULTI_HASHER_HPP_INCLUDED
+
@@ -34,7 +34,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_NETWORK_THREAD_POOL_HPP_INCLUDED
 
 #include "libtorrent/thread_pool.hpp"
+#include "libtorrent/io_service.hpp"
+#include "libtorrent/thread.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/optional.hpp>
 #include <vector>
 
 namespace libtorrent
@@ -71,6 +75,48 @@ namespace libtorrent
 	struct network_thread_pool : thread_pool<socket_job>
 	{
 		void process_job(socket_job const& j, bool post);
+
+		// issues the async operation described by ``j`` on the peer's
+		// socket, from the calling thread
+		static void issue_job(socket_job const& j);
+	};
+
+	// a network thread running its own io_service. Peer sockets created on
+	// it are waited on, read from and written to by this thread instead of
+	// the main network thread. The completion handlers are posted back to
+	// the main network thread (see settings_pack::network_shards).
+	// defined in session_impl.cpp
+
+	// TODO: 3 a shard should own a subset of the torrents, with their peer
+	// connections, piece pickers and peer lists, and run all of their
+	// handlers. Only the session-wide rate limits and stats counters would
+	// then be shared, through messages to the main network thread. That
+	// takes every call from torrent and peer_connection into session_impl
+	// (alerts, settings, disk job completions, connection and unchoke
+	// limits, the DHT and trackers) being made safe from a shard, and
+	// incoming connections being handed over to their torrent's shard
+	// after the handshake
+	struct network_shard
+	{
+		// ``main_ios`` is kept from running out of work until this shard's
+		// thread has exited, since the thread posts handlers to it
+		explicit network_shard(io_service& main_ios);
+		~network_shard();
+
+		io_service& get_io_service() { return m_ios; }
+
+		// lets the thread exit once all operations on its sockets have
+		// completed. This does not wait for it
+		void stop();
+
+	private:
+
+		void thread_fun();
+
+		io_service m_ios;
+		boost::optional<io_service::work> m_work;
+		boost::optional<io_service::work> m_main_work;
+		boost::scoped_ptr<thread> m_thread;
 	};
 }
 
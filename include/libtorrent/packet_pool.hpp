@@ -0,0 +1,89 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_PACKET_POOL_HPP_INCLUDED
+#define TORRENT_PACKET_POOL_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace libtorrent
+{
+	struct counters;
+
+	// a cache of packet buffers for uTP sockets. Freed buffers are kept in
+	// free lists, one per size class, and handed out again by allocate()
+	// instead of going back to the heap. The size classes cover small
+	// packets and the common MTUs (up to ethernet and jumbo frames). Larger
+	// buffers are always allocated from the heap. No more than
+	// max_cached_bytes are held in the free lists at any time.
+	//
+	// The pool is not thread safe, it's owned by the utp_socket_manager and
+	// only used from the network thread.
+	struct TORRENT_EXTRA_EXPORT packet_pool : boost::noncopyable
+	{
+		packet_pool(counters& cnt);
+		~packet_pool();
+
+		// returns a buffer of at least ``size`` bytes. The buffer must be
+		// returned with release(), passing in the same size
+		void* allocate(int size);
+		void release(void* p, int size);
+
+		// the number of bytes held in the free lists
+		int cached_bytes() const { return m_cached_bytes; }
+
+		enum
+		{
+			num_size_classes = 3,
+			max_cached_bytes = 4 * 1024 * 1024
+		};
+
+		// returns the size class ``size`` belongs to, or -1 if it's too
+		// large to be pooled
+		static int size_class(int size);
+
+		// the number of bytes each buffer in the specified size class has
+		static int class_size(int c);
+
+	private:
+
+		std::vector<void*> m_free_list[num_size_classes];
+		int m_cached_bytes;
+		counters& m_counters;
+	};
+}
+
+#endif
+
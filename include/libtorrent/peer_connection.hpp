@@ -54,6 +54,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/cstdint.hpp>
 #include <boost/pool/pool.hpp>
 #include <boost/aligned_storage.hpp>
+#include <boost/bind.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -92,6 +93,7 @@ namespace libtorrent
 	struct peer_info;
 	struct disk_io_job;
 	struct disk_interface;
+	struct file_io_slice;
 	struct torrent_peer;
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -153,6 +155,38 @@ namespace libtorrent
 		{ return pb.block == block; }
 	};
 
+	// the time it takes to receive ``bytes`` from a peer sending ``rate``
+	// bytes per second
+	TORRENT_EXTRA_EXPORT time_duration transfer_time(boost::int64_t bytes, int rate);
+
+	// estimates the time it takes to receive block ``b`` from a peer. If
+	// it's in ``download_queue`` (the request has been sent) only the bytes
+	// ahead of it are counted. Otherwise it's behind all outstanding bytes
+	// and the requests ahead of it in ``request_queue``, plus one request
+	// round-trip of ``request_time`` milliseconds
+	TORRENT_EXTRA_EXPORT time_duration block_arrival_time(piece_block const& b
+		, std::vector<pending_block> const& download_queue
+		, std::vector<pending_block> const& request_queue
+		, int outstanding_bytes, int block_size, int rate, int request_time);
+
+	// the request queue size (in blocks) for a peer, with
+	// adaptive_request_queue enabled. ``queue_size`` is the size derived
+	// from request_queue_time. It's raised to twice the bandwidth-delay
+	// product given the round-trip ``base_rtt`` (in milliseconds, 0 if not
+	// measured yet), and to ``slow_start_queue`` (0 if not in slow start)
+	TORRENT_EXTRA_EXPORT int adaptive_queue_size(int queue_size, int download_rate
+		, int block_size, int base_rtt, int slow_start_queue);
+
+	// returns true if a connection in slow start should leave it. That's
+	// when the queue can't grow anymore, or when the download rate (in
+	// bytes per second) grew by no more than 1/8 since the last second
+	TORRENT_EXTRA_EXPORT bool slow_start_done(int queue_size, int max_queue_size
+		, int rate, int prev_rate);
+
+	// returns the base round-trip time after adding a new sample, both in
+	// milliseconds. 0 means there's no previous estimate
+	TORRENT_EXTRA_EXPORT int update_base_rtt(int base_rtt, int sample);
+
 	// argument pack passed to peer_connection constructor
 	struct peer_connection_args
 	{
@@ -438,6 +472,17 @@ namespace libtorrent
 		// bytes as if they've been requested
 		time_duration download_queue_time(int extra_bytes = 0) const;
 
+		// estimate of how long it will take until a new request for
+		// extra_bytes sent to this peer is received. This is the
+		// download queue time plus one request round-trip
+		time_duration expected_arrival_time(int extra_bytes) const;
+
+		// estimate of how long it will take until the given block, which has
+		// been requested from this peer, is received. Only the bytes queued
+		// up ahead of it are taken into account. Blocks that haven't been
+		// sent to the peer yet also need a request round-trip
+		time_duration expected_arrival_time(piece_block const& b) const;
+
 		bool is_interesting() const { return m_interesting; }
 		bool is_choked() const { return m_choked; }
 
@@ -472,6 +517,10 @@ namespace libtorrent
 		void timeout_requests();
 
 		boost::shared_ptr<socket_type> get_socket() const { return m_socket; }
+
+		// true if the socket belongs to one of the network shards. Once
+		// connected, such a socket may only be used from the shard's thread
+		bool socket_on_shard() const;
 		tcp::endpoint const& remote() const { return m_remote; }
 		tcp::endpoint local_endpoint() const { return m_local; }
 
@@ -674,6 +723,12 @@ namespace libtorrent
 			, void* userdata = NULL, block_cache_reference ref
 			= block_cache_reference());
 
+		// queues the block ``r``, stored in the file ``f`` starting at
+		// ``offset``, to be sent with sendfile(). Only valid if
+		// can_send_file() is true
+		void append_send_file(file_handle const& f, boost::int64_t offset
+			, peer_request const& r);
+
 #ifndef TORRENT_DISABLE_RESOLVE_COUNTRIES	
 		void set_country(char const* c)
 		{
@@ -754,6 +809,16 @@ namespace libtorrent
 		virtual void write_dont_have(int index) = 0;
 		virtual void write_keepalive() = 0;
 		virtual void write_piece(peer_request const& r, disk_buffer_holder& buffer) = 0;
+
+		// sends a block the disk thread answered with a file range rather
+		// than a buffer. This is only called if can_send_file() is true
+		virtual void write_piece_file(peer_request const&, file_io_slice const&)
+		{ TORRENT_ASSERT(false); }
+
+		// returns true if blocks can be sent straight from the file to the
+		// socket, with sendfile(). i.e. this is a plain TCP connection that
+		// doesn't transform the payload
+		virtual bool can_send_file() const { return false; }
 		virtual void write_suggest(int piece) = 0;
 		virtual void write_bitfield() = 0;
 		
@@ -797,6 +862,16 @@ namespace libtorrent
 		void receive_data_impl(error_code const& error
 			, std::size_t bytes_transferred, int read_loops);
 
+#if TORRENT_USE_SENDFILE
+		// called when the socket is writable and the front of the send buffer
+		// is a file range. Sends up to ``amount`` bytes of it
+		void on_send_file_ready(error_code const& error, int amount);
+
+		// called when the block at the front of the send buffer has been
+		// read into a buffer, because its file range wasn't in the page cache
+		void on_send_file_read(disk_io_job const* j, peer_request r);
+#endif
+
 		void set_send_barrier(int bytes)
 		{
 			TORRENT_ASSERT(bytes == INT_MAX || bytes <= send_buffer_size());
@@ -897,6 +972,10 @@ namespace libtorrent
 #endif
 	private:
 
+		// the download rate (in bytes per second) used to estimate how long
+		// it will take to receive the blocks requested from this peer
+		int estimated_download_rate() const;
+
 		// the average rate of receiving complete piece messages
 		sliding_average<20> m_piece_rate;
 		sliding_average<20> m_send_rate;
@@ -1126,6 +1205,28 @@ namespace libtorrent
 		// at the remote end.
 		boost::uint16_t m_desired_queue_size;
 
+		// while in slow start, this is the request queue size we're
+		// ramping up. It grows by one for every block we receive, i.e.
+		// it doubles every request round-trip
+		boost::uint16_t m_slow_start_queue;
+
+		// the time it takes from sending a request to a peer with no other
+		// requests outstanding, until the block has been received, in
+		// milliseconds. It's a running minimum that slowly follows
+		// increases. 0 means it hasn't been measured yet
+		int m_base_rtt;
+
+		// the download rate at the last second tick in slow start. If the
+		// rate stops growing, we leave slow start
+		int m_slow_start_rate;
+
+		// the block requested from this peer while no other requests were
+		// outstanding, and when it was requested. When it's received, it's
+		// a sample of m_base_rtt. piece_block::invalid if there's no probe
+		// in flight
+		piece_block m_rtt_probe;
+		time_point m_rtt_probe_sent;
+
 #ifndef TORRENT_DISABLE_RESOLVE_COUNTRIES	
 		// in case the session settings is set
 		// to resolve countries, this is set to
@@ -1240,32 +1341,49 @@ namespace libtorrent
 		// other peers to compare it to.
 		bool m_exceeded_limit:1;
 
+		// true while we're growing the request queue of a new (or recently
+		// snubbed) connection by m_slow_start_queue, rather than sizing it
+		// by the download rate
+		bool m_slow_start:1;
+
+		// if the socket belongs to a network shard, this returns the
+		// io_service the completion handlers of its operations have to be
+		// posted to, to run on the network thread. Otherwise NULL
+		io_service* handler_io_service() const;
+
+		// if ``post_to`` is set, the handler is invoked by posting it to
+		// that io_service, rather than being called directly
 		template <class Handler, std::size_t Size>
 		struct allocating_handler
 		{
 			allocating_handler(
 				Handler const& h, handler_storage<Size>& s
+				, io_service* ios = NULL
 			)
 			  : handler(h)
 			  , storage(s)
+			  , post_to(ios)
 			{}
 
 			template <class A0>
 			void operator()(A0 const& a0) const
 			{
-				handler(a0);
+				if (post_to) post_to->post(boost::bind<void>(handler, a0));
+				else handler(a0);
 			}
 
 			template <class A0, class A1>
 			void operator()(A0 const& a0, A1 const& a1) const
 			{
-				handler(a0, a1);
+				if (post_to) post_to->post(boost::bind<void>(handler, a0, a1));
+				else handler(a0, a1);
 			}
 
 			template <class A0, class A1, class A2>
 			void operator()(A0 const& a0, A1 const& a1, A2 const& a2) const
 			{
-				handler(a0, a1, a2);
+				if (post_to) post_to->post(boost::bind<void>(handler, a0, a1, a2));
+				else handler(a0, a1, a2);
 			}
 
 			friend void* asio_handler_allocate(
@@ -1289,6 +1407,7 @@ namespace libtorrent
 
 			Handler handler;
 			handler_storage<Size>& storage;
+			io_service* post_to;
 		};
 
 		template <class Handler>
@@ -1296,7 +1415,7 @@ namespace libtorrent
 			make_read_handler(Handler const& handler)
 		{
 			return allocating_handler<Handler, TORRENT_READ_HANDLER_MAX_SIZE>(
-				handler, m_read_handler_storage
+				handler, m_read_handler_storage, handler_io_service()
 			);
 		}
 
@@ -1305,7 +1424,7 @@ namespace libtorrent
 			make_write_handler(Handler const& handler)
 		{
 			return allocating_handler<Handler, TORRENT_WRITE_HANDLER_MAX_SIZE>(
-				handler, m_write_handler_storage
+				handler, m_write_handler_storage, handler_io_service()
 			);
 		}
 
@@ -342,6 +342,13 @@ namespace libtorrent
 		// incoming connections.
 		int rtt;
 
+		// the time it took for a request sent to this peer, while no other
+		// requests were outstanding, to be answered, in milliseconds. This is
+		// the round-trip used to size the request queue
+		// (``target_dl_queue_length``) to cover the bandwidth-delay product
+		// of the connection. It's 0 until it has been measured.
+		int base_rtt;
+
 		// the number of pieces this peer has.
 		int num_pieces;
 
@@ -86,6 +86,14 @@ namespace libtorrent
 			interesting_piece_picks,
 			hash_fail_piece_picks,
 
+			// time critical pieces that passed the hash check before and
+			// after their deadline, and the number of times the outstanding
+			// requests of a time critical piece were not expected to arrive in
+			// time, and were allowed to be requested from another peer
+			piece_deadlines_met,
+			piece_deadlines_missed,
+			piece_deadlines_at_risk,
+
 			// these counters indicate which parts
 			// of the piece picker CPU is spent in
 			piece_picker_partial_loops,
@@ -182,6 +190,12 @@ namespace libtorrent
 			num_blocks_read,
 			num_blocks_hashed,
 			num_blocks_cache_hits,
+			arc_cache_hits,
+			arc_cache_misses,
+			tinylfu_cache_hits,
+			tinylfu_cache_misses,
+			read_ahead_useful_blocks,
+			read_ahead_wasted_blocks,
 			num_write_ops,
 			num_read_ops,
 			num_read_back,
@@ -211,6 +225,7 @@ namespace libtorrent
 			recv_redundant_bytes,
 
 			dht_messages_in,
+			dht_messages_in_dropped,
 			dht_messages_out,
 			dht_messages_out_dropped,
 			dht_bytes_in,
@@ -234,6 +249,8 @@ namespace libtorrent
 			dht_invalid_put,
 			dht_invalid_get,
 
+			dht_torrents_evicted,
+
 			// uTP counters.
 			utp_packet_loss,
 			utp_timeout,
@@ -248,6 +265,18 @@ namespace libtorrent
 			utp_invalid_pkts_in,
 			utp_redundant_pkts_in,
 
+			// batched UDP socket calls
+			udp_recv_batches,
+			udp_recv_batched_packets,
+			udp_send_batches,
+			udp_send_batched_packets,
+			udp_gso_packets,
+			udp_gro_packets,
+
+			// uTP packet buffer allocations
+			utp_packet_pool_hits,
+			utp_packet_pool_misses,
+
 			// the buffer sizes accepted by
 			// socket send calls. The larger
 			// the more efficient. The size is
@@ -367,6 +396,9 @@ namespace libtorrent
 			num_writing_threads,
 			num_running_threads,
 			blocked_disk_jobs,
+			queued_hash_jobs,
+			num_running_hash_jobs,
+			num_hashing_threads,
 			queued_write_bytes,
 			num_unchoke_slots,
 
@@ -397,12 +429,20 @@ namespace libtorrent
 			arc_write_size,
 			arc_volatile_size,
 
+			// the huge page arena of the disk buffer pool. The number of blocks
+			// it holds, the number of huge pages with at least one block in use
+			// and the number of free blocks on those pages
+			disk_arena_blocks,
+			disk_arena_pages_in_use,
+			disk_arena_fragmented_blocks,
+
 			dht_nodes,
 			dht_node_cache,
 			dht_torrents,
 			dht_peers,
 			dht_immutable_data,
 			dht_mutable_data,
+			dht_peer_store_bytes,
 			dht_allocated_observers,
 
 			has_incoming_connections,
@@ -422,6 +462,9 @@ namespace libtorrent
 			num_utp_close_wait,
 			num_utp_deleted,
 
+			// bytes held in the free lists of the uTP packet pool
+			utp_packet_pool_bytes,
+
 			num_counters,
 			num_gauge_counters = num_counters - num_stats_counters
 		};
@@ -228,6 +228,12 @@ namespace libtorrent
 		// decreases the peer count for the given piece
 		// (used when a peer disconnects)
 		void dec_refcount(bitfield const& bitmask, const void* peer);
+
+		// increases the peer count for the pieces of all the given bitfields.
+		// ``peers`` is parallel to ``bitmasks``. This is cheaper than adding
+		// them one at a time when many peers are added at once
+		void inc_refcount(std::vector<bitfield const*> const& bitmasks
+			, std::vector<const void*> const& peers);
 		
 		// these will increase and decrease the peer count
 		// of all pieces. They are used when seeds join
@@ -495,16 +501,16 @@ namespace libtorrent
 		std::pair<int, int> expand_piece(int piece, int whole_pieces
 			, bitfield const& have, int options) const;
 
+		// the number of peers that have each piece (the availability) is not
+		// part of piece_pos, it's kept in m_peer_count. See piece_picker::init()
 		struct piece_pos
 		{
 			piece_pos() {}
-			piece_pos(int peer_count_, int index_)
-				: peer_count(peer_count_)
-				, download_state(piece_pos::piece_open)
+			explicit piece_pos(int index_)
+				: download_state(piece_pos::piece_open)
 				, piece_priority(4)
 				, index(index_)
 			{
-				TORRENT_ASSERT(peer_count_ >= 0);
 				TORRENT_ASSERT(index_ >= 0);
 			}
 
@@ -580,14 +586,6 @@ namespace libtorrent
 				}
 			}
 
-			// the number of peers that has this piece
-			// (availability)
-#if TORRENT_OPTIMIZE_MEMORY_USAGE
-			boost::uint32_t peer_count : 9;
-#else
-			boost::uint32_t peer_count : 16;
-#endif
-
 			// one of the enums from state_t. This indicates whether this piece
 			// is currently being downloaded or not, and what state it's in if
 			// it is. Specifically, as an optimization, pieces that have all blocks
@@ -614,11 +612,7 @@ namespace libtorrent
 			boost::uint32_t piece_priority : 3;
 
 			// index in to the piece_info vector
-#if TORRENT_OPTIMIZE_MEMORY_USAGE
-			boost::uint32_t index : 17;
-#else
-			boost::uint32_t index;
-#endif
+			boost::uint32_t index : 26;
 
 #ifdef TORRENT_DEBUG_REFCOUNTS
 			// all the peers that have this piece
@@ -630,19 +624,11 @@ namespace libtorrent
 				// index is set to this to indicate that we have the
 				// piece. There is no entry for the piece in the
 				// buckets if this is the case.
-#if TORRENT_OPTIMIZE_MEMORY_USAGE
-				we_have_index = 0x3ffff,
-#else
-				we_have_index = 0xffffffff,
-#endif
+				we_have_index = 0x3ffffff,
 				// the priority value that means the piece is filtered
 				filter_priority = 0,
 				// the max number the peer count can hold
-#if TORRENT_OPTIMIZE_MEMORY_USAGE
-				max_peer_count = 0x1ff
-#else
 				max_peer_count = 0xffff
-#endif
 			};
 			
 			bool have() const { return index == we_have_index; }
@@ -674,6 +660,14 @@ namespace libtorrent
 
 			int priority(piece_picker const* picker) const
 			{
+				// piece_pos objects only live in picker->m_piece_map, which
+				// lets us find this piece's slot in the parallel m_peer_count
+				// array
+				TORRENT_ASSERT(this >= &picker->m_piece_map[0]
+					&& this < &picker->m_piece_map[0] + picker->m_piece_map.size());
+				int const peer_count = picker->m_peer_count[
+					this - &picker->m_piece_map[0]];
+
 				// filtered pieces (prio = 0), pieces we have or pieces with
 				// availability = 0 should not be present in the piece list
 				// returning -1 indicates that they shouldn't.
@@ -694,7 +688,7 @@ namespace libtorrent
 				// the + 1 here is because peer_count count be 0, it m_seeds
 				// is > 0. We don't actually care about seeds (except for the
 				// first one) since the order of the pieces is unaffected.
-				int availability = int(peer_count) + 1;
+				int availability = peer_count + 1;
 				TORRENT_ASSERT(availability > 0);
 				TORRENT_ASSERT(int(priority_levels - piece_priority) > 0);
 
@@ -703,18 +697,14 @@ namespace libtorrent
 			}
 
 			bool operator!=(piece_pos p) const
-			{ return index != p.index || peer_count != p.peer_count; }
+			{ return index != p.index; }
 
 			bool operator==(piece_pos p) const
-			{ return index == p.index && peer_count == p.peer_count; }
+			{ return index == p.index; }
 		};
 
 #ifndef TORRENT_DEBUG_REFCOUNTS
-#if TORRENT_OPTIMIZE_MEMORY_USAGE
 		BOOST_STATIC_ASSERT(sizeof(piece_pos) == sizeof(char) * 4);
-#else
-		BOOST_STATIC_ASSERT(sizeof(piece_pos) == sizeof(char) * 8);
-#endif
 #endif
 
 		bool partial_compare_rarest_first(downloading_piece const* lhs
@@ -724,6 +714,17 @@ namespace libtorrent
 
 		void update_pieces() const;
 
+		// the max number of pieces whose availability may change at once
+		// while still moving them to their new buckets one by one. Beyond
+		// this, the piece list is marked dirty and the next pick_pieces()
+		// rebuilds it, in time linear in the number of pieces. That's still
+		// the case for a bitfield with more than this many pieces (bursts of
+		// them are summed up and cause a single rebuild), the first seed
+		// joining or the last one leaving while more than this many pieces
+		// have no other peers, any other peer with every piece leaving and
+		// a seed losing a piece
+		int max_incremental_updates() const;
+
 		// fills in the range [start, end) of pieces in
 		// m_pieces that have priority 'prio'
 		void priority_range(int prio, int* start, int* end);
@@ -765,6 +766,14 @@ namespace libtorrent
 		// TODO: should this be allocated lazily?
 		mutable std::vector<piece_pos> m_piece_map;
 
+		// the number of peers that have each piece (not counting seeds, see
+		// m_seeds), indexed by piece. This is kept apart from m_piece_map
+		// because it's the only field touched for every piece when a peer
+		// joins or leaves. Scanning a dense array of counters lets those
+		// updates be vectorized and keeps them from pulling the rest of the
+		// piece state through the cache
+		std::vector<boost::uint16_t> m_peer_count;
+
 		// the number of seeds. These are not added to
 		// the availability counters of the pieces
 		int m_seeds;
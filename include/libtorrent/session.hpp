@@ -62,6 +62,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/storage.hpp"
 #include "libtorrent/session_settings.hpp"
+#include "libtorrent/kademlia/dht_storage.hpp"
 
 #ifdef _MSC_VER
 #	include <eh.h>
@@ -562,6 +563,16 @@ namespace libtorrent
 		void set_dht_settings(dht_settings const& settings);
 		bool is_dht_running() const;
 
+		// ``set_dht_storage`` sets the function that creates the storage of
+		// the peers and items announced to the dht node. It takes effect the
+		// next time the DHT is started. The default keeps everything in RAM.
+		// To have the node restart with the state it had when it was shut
+		// down, use the on-disk storage::
+		//
+		// 	ses.set_dht_storage(boost::bind(&dht::dht_disk_storage_constructor
+		// 		, "dht_state", _1, _2, _3));
+		void set_dht_storage(dht::dht_storage_constructor_type sc);
+
 		// ``add_dht_node`` takes a host name and port pair. That endpoint will be
 		// pinged, and if a valid DHT reply is received, the node will be added to
 		// the routing table.
@@ -1121,6 +1132,15 @@ namespace libtorrent
 		// Alternatively, you can pass in the same container the next time you
 		// call ``pop_alerts``.
 		// 
+		// The overload taking a ``std::vector<alert*>`` is the cheapest way to
+		// receive alerts. It does not copy them. The alerts remain owned by
+		// the session and the pointers stay valid until the next call to
+		// ``pop_alerts()`` with a vector, at which point they are freed. The
+		// alerts must not be deleted by the caller. Any previous contents of
+		// the vector are replaced. Internally, alerts are constructed into
+		// two alternating blocks of memory, so posting an alert does not
+		// require a heap allocation of its own.
+		// 
 		// ``wait_for_alert`` blocks until an alert is available, or for no more
 		// than ``max_wait`` time. If ``wait_for_alert`` returns because of the
 		// time-out, and no alerts are available, it returns 0. If at least one
@@ -1147,6 +1167,7 @@ namespace libtorrent
 		// posted, regardelss of the alert mask.
 		std::auto_ptr<alert> pop_alert();
 		void pop_alerts(std::deque<alert*>* alerts);
+		void pop_alerts(std::vector<alert*>* alerts);
 		alert const* wait_for_alert(time_duration max_wait);
 
 #ifndef TORRENT_NO_DEPRECATE
@@ -1487,6 +1487,7 @@ namespace libtorrent
 			, max_fail_count(20)
 			, max_torrents(2000)
 			, max_dht_items(700)
+			, max_peer_store_size(8 * 1024 * 1024)
 			, max_torrent_search_reply(20)
 			, restrict_routing_ips(true)
 			, restrict_search_ips(true)
@@ -1497,6 +1498,8 @@ namespace libtorrent
 			, ignore_dark_internet(true)
 			, block_timeout(5 * 60)
 			, block_ratelimit(5)
+			, request_threads(0)
+			, put_verify_batch(32)
 		{}
 		
 		// the maximum number of peers to send in a reply to ``get_peers``
@@ -1528,6 +1531,13 @@ namespace libtorrent
 		// max number of items the DHT will store
 		int max_dht_items;
 
+		// the max number of bytes of memory used to store the torrents and
+		// peers announced to the DHT node. When this is exceeded, the torrents
+		// that were announced to least recently are dropped. Each IPv4 peer
+		// takes 8 bytes and each IPv6 peer 20 bytes, plus around 100 bytes per
+		// torrent.
+		int max_peer_store_size;
+
 		// the max number of torrents to return in a torrent search query to the
 		// DHT
 		int max_torrent_search_reply;
@@ -1582,6 +1592,25 @@ namespace libtorrent
 		// the max number of packets per second a DHT node is allowed to send
 		// without getting banned.
 		int block_ratelimit;
+
+		// the number of threads parsing and answering incoming DHT requests.
+		// When 0, requests are handled by the network thread. Otherwise the
+		// network thread hands the queries off to these threads. They look
+		// up nodes in a snapshot of the routing table that's refreshed about
+		// once a second. Only the updates to the routing table and the sending
+		// of the replies are left to the network thread.
+		int request_threads;
+
+		// the max number of signatures of incoming mutable puts to verify
+		// together. Verifying them as a batch is about twice as fast as one
+		// at a time. The puts received in one go are held back until the
+		// socket has been drained, or this many have been received, and
+		// answered once their signatures have been checked. When set to 0 or
+		// 1, and for the puts answered by the request threads, each signature
+		// is verified as it's received. Both ways check the cofactored
+		// signature equation, so whether a put is accepted doesn't depend
+		// on this setting.
+		int put_verify_batch;
 	};
 
 
@@ -650,6 +650,88 @@ namespace libtorrent
 			// unlikely to matter anyway
 			auto_sequential,
 
+			// when enabled, and supported by the operating system, disk reads
+			// and writes that bypass the disk cache (i.e. when ``use_read_cache``
+			// or ``use_write_cache`` is disabled, or ``cache_size`` is 0) are
+			// issued asynchronously via io_uring. Each disk thread can then keep
+			// up to ``aio_max`` operations in flight, rather than blocking on one
+			// at a time. When io_uring is not available, reads and writes fall
+			// back to preadv() and pwritev(). Hash jobs are not affected, the
+			// pieces they read back are always read synchronously. This is off
+			// by default.
+			use_io_uring,
+
+			// when enabled, blocks requested by peers that aren't already in the
+			// disk cache are sent straight out of a read-only memory mapping of
+			// the file, rather than being read into a disk buffer first. This
+			// effectively makes the operating system's page cache the read
+			// cache, and leaves the disk cache to write blocks. Blocks that span
+			// files, and files that can't be mapped, are read the regular way.
+			// This requires ``mmap()`` and a 64 bit address space, it's ignored
+			// otherwise. Note that a file being truncated by another process
+			// while it's mapped may crash the process.
+			use_mmap_reads,
+
+			// when enabled, blocks uploaded to unencrypted peers over plain TCP
+			// are not read into a disk buffer. Instead, the file range is
+			// handed to the network thread and sent straight from the page
+			// cache to the socket with ``sendfile()``. Only ranges that are
+			// already in the page cache are sent this way, the disk thread
+			// reads the others into a buffer as usual. A range evicted before
+			// it's sent is read by the disk thread too.
+			// Blocks that span files, encrypted, SSL and uTP connections, and
+			// blocks already in the disk cache are sent the regular way. This
+			// is only supported on linux, it's ignored elsewhere.
+			use_sendfile,
+
+			// ``adaptive_read_ahead`` makes the read-ahead on read cache misses
+			// follow the access pattern of each peer, rather than always reading
+			// ``read_cache_line_size`` blocks. The read-ahead of a peer that
+			// keeps reading where its previous read ended is doubled, up to 4
+			// times ``read_cache_line_size``, and the read-ahead of a peer that
+			// jumps around is halved, down to a single block. If
+			// ``use_disk_read_ahead`` is also enabled, the operating system is
+			// told about the range a sequential peer is expected to read next.
+			adaptive_read_ahead,
+
+			// ``adaptive_request_queue`` sizes the queue of outstanding block
+			// requests to each peer to cover at least twice the bandwidth-delay
+			// product of the connection, measured by timing requests sent to
+			// the peer while it had no other requests outstanding. New
+			// connections start out in slow start, growing the queue by one
+			// request for every block received until the download rate stops
+			// increasing. ``request_queue_time`` and ``max_out_request_queue``
+			// still apply.
+			adaptive_request_queue,
+
+			// ``use_hugepage_cache`` reserves the whole disk cache
+			// (``cache_size``) up-front as one anonymous mapping, aligned to 2
+			// MiB and backed by huge pages where the system supports it
+			// (explicitly reserved huge pages are tried first, then
+			// transparent huge pages). Disk buffers are then handed out from
+			// this arena instead of the heap, which saves TLB misses when
+			// hashing and copying blocks. Low addresses are handed out first to
+			// keep the cache dense. The setting is ignored if ``mmap_cache`` is
+			// set, and it may only be changed while there are no disk buffers
+			// in use. This requires the ``mmap`` system call.
+			use_hugepage_cache,
+
+			// ``enable_udp_gso`` coalesces runs of equally sized uTP packets
+			// to the same peer into a single buffer, handed to the kernel with
+			// ``UDP_SEGMENT`` and split into packets by the kernel or the
+			// network card. It's only turned on if the kernel supports
+			// ``UDP_SEGMENT`` (linux 4.18 and later), and if a segmented send
+			// is rejected, packets are sent one at a time again. This only has
+			// an effect on linux.
+			enable_udp_gso,
+
+			// ``enable_udp_gro`` turns on ``UDP_GRO`` on the UDP socket, letting
+			// the kernel coalesce packets received from the same peer. This
+			// requires 64 kiB receive buffers per coalesced train, so fewer
+			// packets are read per system call when there's nothing to
+			// coalesce. This only has an effect on linux.
+			enable_udp_gro,
+
 			max_bool_setting_internal,
 			num_bool_settings = max_bool_setting_internal - bool_type_base
 		};
@@ -1385,6 +1467,11 @@ namespace libtorrent
 			// higher than the number of CPU cores would presumably not provide
 			// any benefit of setting it to the number of cores. If it's set to 0,
 			// hashing is done in the disk thread.
+			//
+			// The hashing threads are separate from the ``aio_threads`` and only
+			// hash blocks that are already in the disk cache. They never read
+			// from disk. Pieces that aren't fully cached (e.g. when checking
+			// files) are hashed by the regular disk threads.
 			hashing_threads,
 
 			// the number of blocks to keep outstanding at any given time when
@@ -1402,7 +1489,8 @@ namespace libtorrent
 
 			// for some aio back-ends, ``aio_threads`` specifies the number of
 			// io-threads to use,  and ``aio_max`` the max number of outstanding
-			// jobs.
+			// jobs. When using io_uring (see ``use_io_uring``), ``aio_max`` is
+			// the max number of operations each disk thread keeps in flight.
 			aio_threads,
 			aio_max,
 
@@ -1512,6 +1600,46 @@ namespace libtorrent
 			// .. _i2p: http://www.i2p2.de
 			i2p_port,
 
+			// selects the algorithm deciding which read cache pieces to evict
+			// when the disk cache is full. See cache_eviction_policy_t.
+			//
+			// ``arc_cache_policy`` is the adaptive replacement cache, balancing
+			// pieces requested once recently against pieces requested by more
+			// than one peer. ``tinylfu_cache_policy`` keeps new pieces in a
+			// small window LRU, and only lets them into the main part of the
+			// cache if they have been requested more often than the piece they
+			// would push out, according to a compact frequency sketch. This
+			// protects popular pieces from being flushed out of the cache by a
+			// full recheck or a peer downloading the torrent sequentially.
+			//
+			// The ``arc_cache_hits``, ``arc_cache_misses``,
+			// ``tinylfu_cache_hits`` and ``tinylfu_cache_misses`` counters can
+			// be used to compare their hit rates.
+			cache_eviction_policy,
+
+			// ``time_critical_window`` is the number of milliseconds ahead of
+			// now within which the deadlines of time critical pieces (see
+			// torrent_handle::set_piece_deadline()) have to fall, for them to
+			// be requested. It's the window a streaming client slides forward
+			// as playback progresses. The piece with the earliest deadline is
+			// always requested. 0 means the window is derived from the average
+			// time it takes to download a time critical piece.
+			time_critical_window,
+
+			// ``network_shards`` is the number of network threads that each
+			// run their own socket event loop. Plain TCP peer connections
+			// (not SSL, uTP, i2p or through a proxy) are assigned to a shard
+			// when their socket is created, outgoing connections by the
+			// torrent's info-hash and incoming connections in turn. Waiting
+			// for, sending and receiving on those sockets then happens on
+			// the shard's thread. The protocol logic, the piece picker,
+			// choker and rate limiter still run on the main network thread,
+			// which receives the completed operations. 0 means all sockets
+			// are handled by the main network thread. This setting only
+			// affects new connections. Shards are not stopped until the
+			// session is destructed.
+			network_shards,
+
 			max_int_setting_internal,
 
 			num_int_settings = max_int_setting_internal - int_type_base
@@ -1519,6 +1647,12 @@ namespace libtorrent
 
 		enum suggest_mode_t { no_piece_suggestions = 0, suggest_read_cache = 1 };
 
+		enum cache_eviction_policy_t
+		{
+			arc_cache_policy = 0,
+			tinylfu_cache_policy = 1
+		};
+
 		enum choking_algorithm_t
 		{
 			fixed_slots_choker = 0,
@@ -195,6 +195,29 @@ namespace libtorrent
 		dont_replace
 	};
 
+	// describes one contiguous range of a file that a read or write of a
+	// piece maps to. This is used by the disk thread to issue the file
+	// operations itself (asynchronously), rather than going through
+	// storage_interface::readv() and writev().
+	struct file_io_slice
+	{
+		// the open file to read from or write to. Holding on to this keeps
+		// the file open until the operation completes
+		file_handle handle;
+
+		// the offset into the file
+		boost::int64_t file_offset;
+
+		// the offset into the buffer of the operation, in bytes
+		int buffer_offset;
+
+		// the number of bytes of this slice
+		int size;
+
+		// the index of the file in the torrent, used for error reporting
+		int file_index;
+	};
+
 	// The storage interface is a pure virtual class that can be implemented to
 	// customize how and where data for a torrent is stored. The default storage
 	// implementation uses regular files in the filesystem, mapping the files in
@@ -267,6 +290,41 @@ namespace libtorrent
 		virtual int writev(file::iovec_t const* bufs, int num_bufs
 			, int piece, int offset, int flags, storage_error& ec) = 0;
 
+		// returns true if map_io() and map_read() may be used to bypass
+		// readv() and writev(). The default is false. default_storage
+		// returns true, a storage deriving from it that customizes readv()
+		// or writev() must override this to return false.
+		virtual bool supports_mapped_io() const { return false; }
+
+		// This is an optional optimization hook. If the storage is backed by
+		// regular files, it may map the range ``size`` bytes at ``offset``
+		// into ``piece`` onto the file ranges it corresponds to and return
+		// true. ``mode`` is the file open mode (file::read_only or
+		// file::read_write plus flags). The disk thread then performs the
+		// actual I/O itself, bypassing readv() and writev(). Returning false
+		// means the request must go through readv() or writev() as usual.
+		// This is the default.
+		//
+		// If an error occurs, ``storage_error`` should be set to reflect it
+		// and false returned.
+		virtual bool map_io(int, int, int, int, std::vector<file_io_slice>&
+			, storage_error&) { return false; }
+
+		// This is another optional optimization hook. If the storage is backed
+		// by regular files, it may return a pointer to the ``size`` bytes at
+		// ``offset`` into ``piece``, in a read-only memory mapping of the file
+		// they belong to. ``flags`` are the file open flags, as passed to
+		// readv(). ``mapping`` is set to the mapping the returned pointer
+		// points into, and must be held on to for as long as the pointer is
+		// used. Returning NULL means the range can't be mapped (for instance
+		// because it spans more than one file) and has to be read with
+		// readv(). This is the default.
+		//
+		// If an error occurs, ``storage_error`` should be set to reflect it
+		// and NULL returned.
+		virtual char const* map_read(int, int, int, int
+			, boost::intrusive_ptr<file_mapping>&, storage_error&) { return NULL; }
+
 		// This function is called when first checking (or re-checking) the
 		// storage for a torrent. It should return true if any of the files that
 		// is used in this storage exists on disk. If so, the storage will be
@@ -443,6 +501,11 @@ namespace libtorrent
 			, int piece, int offset, int flags, storage_error& ec);
 		int writev(file::iovec_t const* bufs, int num_bufs
 			, int piece, int offset, int flags, storage_error& ec);
+		bool supports_mapped_io() const { return true; }
+		bool map_io(int piece, int offset, int size, int mode
+			, std::vector<file_io_slice>& slices, storage_error& ec);
+		char const* map_read(int piece, int offset, int size, int flags
+			, boost::intrusive_ptr<file_mapping>& mapping, storage_error& ec);
 
 		// if the files in this storage are mapped, returns the mapped
 		// file_storage, otherwise returns the original file_storage object.
@@ -641,18 +704,70 @@ namespace libtorrent
 		void add_piece(cached_piece_entry* p);
 		void remove_piece(cached_piece_entry* p);
 		bool has_piece(cached_piece_entry* p) const;
-		int num_pieces() const { return m_cached_pieces.size(); }
-		boost::unordered_set<cached_piece_entry*> const& cached_pieces() const
-		{ return m_cached_pieces; }
+		int num_pieces() const;
+
+		// fills in the indices of all pieces belonging to this storage that
+		// are currently in the cache. The pieces may belong to different
+		// cache shards, so only the indices are returned. To access a piece
+		// the caller needs to look it up under the mutex of its shard
+		void cached_pieces(std::vector<int>& pieces) const;
 	private:
+		// pieces in different block_cache shards are added and removed
+		// concurrently, this mutex protects m_cached_pieces
+		mutable mutex m_cached_pieces_mutex;
+
 		// these are cached pieces belonging to this storage
 		boost::unordered_set<cached_piece_entry*> m_cached_pieces;
 	};
 
+	// this class keeps track of where each peer reading from a specific
+	// storage is reading, to adapt the read-ahead on cache misses to it.
+	// Peers reading sequentially get an increasingly large read-ahead, peers
+	// jumping around get less of it
+	struct TORRENT_EXTRA_EXPORT read_stream_tracker
+	{
+		// records a read cache miss by ``requester`` at ``offset`` bytes into
+		// the torrent and returns the number of blocks to read for it, in the
+		// range [1, ``max_blocks``]. A requester not seen before starts out
+		// with ``initial_blocks``. ``sequential`` is set to true if the read
+		// picks up where the read-ahead of the previous miss ended
+		int read_ahead(void* requester, boost::int64_t offset, int block_size
+			, int initial_blocks, int max_blocks, bool& sequential);
+
+	private:
+
+		struct read_stream
+		{
+			void* requester;
+
+			// the torrent offset of the last cache miss of this requester
+			boost::int64_t last_offset;
+
+			// the torrent offset where the read-ahead of the last cache miss
+			// ended
+			boost::int64_t end_offset;
+
+			// the current read-ahead of this requester, in blocks
+			int blocks;
+		};
+
+		// the number of requesters to remember. When a new one shows up, the
+		// least recently seen one is forgotten
+		enum { max_streams = 64 };
+
+		// the least recently seen requester first
+		std::vector<read_stream> m_streams;
+
+		// reads are issued from all disk threads, this mutex protects
+		// m_streams
+		mutable mutex m_streams_mutex;
+	};
+
 	class TORRENT_EXTRA_EXPORT piece_manager
 		: public boost::enable_shared_from_this<piece_manager>
 		, public disk_job_fence
 		, public storage_piece_set
+		, public read_stream_tracker
 		, boost::noncopyable
 	{
 	friend struct disk_io_thread;
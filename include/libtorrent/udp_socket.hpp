@@ -43,9 +43,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/debug.hpp"
 
 #include <deque>
+#include <vector>
 
 namespace libtorrent
 {
+	struct counters;
+
 	struct udp_socket_observer
 	{
 		// return true if the packet was handled (it won't be
@@ -66,10 +69,15 @@ namespace libtorrent
 	class udp_socket : single_threaded
 	{
 	public:
-		udp_socket(io_service& ios);
+		udp_socket(io_service& ios, counters& cnt);
 		~udp_socket();
 
-		enum flags_t { dont_drop = 1, peer_connection = 2, dont_queue = 4 };
+		// ``batch`` lets the packet be queued and sent together with other
+		// packets, once the handlers that are currently ready have run.
+		// Errors sending it are not reported back, except that if the
+		// socket is blocked, send() fails with would_block
+		enum flags_t { dont_drop = 1, peer_connection = 2, dont_queue = 4
+			, batch = 8 };
 
 		bool is_open() const
 		{
@@ -107,6 +115,16 @@ namespace libtorrent
 
 		void set_buf_size(int s);
 
+		// enables generic segmentation offload (``UDP_SEGMENT``) of packets
+		// sent with the batch flag, and generic receive offload
+		// (``UDP_GRO``) on the sockets. Runs of equally sized packets to the
+		// same endpoint are handed to the kernel as a single buffer, and
+		// coalesced packets received are split up again before they're
+		// passed on to the observers. This is only supported on linux, and
+		// the send side falls back to plain batches if the kernel or the
+		// network interface doesn't support it
+		void set_segmentation_offload(bool gso, bool gro);
+
 		template <class SocketOption>
 		void get_option(SocketOption const& opt, error_code& ec)
 		{
@@ -180,7 +198,8 @@ namespace libtorrent
 		void setup_read(udp::socket* s);
 		void on_read(error_code const& ec, udp::socket* s);
 		void on_read_impl(udp::socket* sock, udp::endpoint const& ep
-			, error_code const& e, std::size_t bytes_transferred);
+			, error_code const& e, char const* buf, std::size_t bytes_transferred);
+		void wait_writable(udp::socket* s);
 		void on_name_lookup(error_code const& e, tcp::resolver::iterator i);
 		void on_connect_timeout(error_code const& ec);
 		void on_connected(error_code const& ec);
@@ -195,10 +214,31 @@ namespace libtorrent
 
 		void drain_queue();
 
+#if TORRENT_USE_MMSG
+		// reads packets off of the socket with recvmmsg() until it would
+		// block, passing them on to the observers
+		void read_batches(udp::socket* s);
+
+		void queue_packet(udp::endpoint const& ep, char const* p, int len
+			, error_code& ec);
+		void flush_send_queue();
+		void on_flush();
+
+		// sets m_gso if m_want_gso is set and the open sockets support
+		// UDP_SEGMENT
+		void update_gso();
+
+		// turns UDP_GRO on or off on the open sockets, depending on
+		// m_want_gro
+		void update_gro();
+#endif
+
 		void wrap(udp::endpoint const& ep, char const* p, int len, error_code& ec);
 		void wrap(char const* hostname, int port, char const* p, int len, error_code& ec);
 		void unwrap(error_code const& e, char const* buf, int size);
 
+		counters& m_counters;
+
 		udp::socket m_ipv4_sock;
 		deadline_timer m_timer;
 		int m_buf_size;
@@ -250,6 +290,62 @@ namespace libtorrent
 		// operations hanging on this socket
 		int m_outstanding_ops;
 
+#if TORRENT_USE_MMSG
+		enum
+		{
+			// the max number of packets per recvmmsg() and sendmmsg() call
+			max_batch = 32,
+
+			// the max number of packets queued to be sent. With segmentation
+			// offload, this is also the max number of packets coalesced into
+			// one buffer (UDP_MAX_SEGMENTS in the kernel)
+			max_queued = 64,
+
+			// the max number of bytes of a single segmentation offload
+			// buffer. It has to fit in a single (IPv6) UDP datagram
+			max_gso_bytes = 64000,
+
+			// the size of the receive buffer slots when receive offload is
+			// enabled. They have to fit the largest coalesced buffer, or
+			// the kernel truncates it
+			gro_slot_size = 65536,
+
+			// the max number of bytes of receive buffers used by
+			// recvmmsg(). With large receive buffers (see set_buf_size())
+			// fewer packets are read per call
+			max_recv_batch_bytes = 256 * 1024
+		};
+
+		// packets sent with the batch flag, waiting to be sent. ``offset``
+		// is where the payload starts in m_send_queue_buf
+		struct batched_packet
+		{
+			udp::endpoint ep;
+			int offset;
+			int len;
+		};
+		std::vector<batched_packet> m_send_queue;
+		std::vector<char> m_send_queue_buf;
+
+		// one slot of m_buf_size bytes per packet received by recvmmsg()
+		std::vector<char> m_recv_batch_buf;
+
+		// true while there's a call to on_flush() posted to the io_service
+		bool m_flush_posted;
+
+		// m_want_gso is set by set_segmentation_offload(), m_gso is true if
+		// batched packets are sent with UDP_SEGMENT. That requires the
+		// sockets to support it, and is cleared if the kernel rejects a
+		// segmented send
+		bool m_want_gso;
+		bool m_gso;
+
+		// m_want_gro is set by set_segmentation_offload(), m_gro is true
+		// if UDP_GRO is actually enabled on one of the sockets
+		bool m_want_gro;
+		bool m_gro;
+#endif
+
 #if TORRENT_USE_IPV6
 		bool m_v6_write_subscribed:1;
 #endif
@@ -268,7 +364,7 @@ namespace libtorrent
 
 	struct rate_limited_udp_socket : public udp_socket
 	{
-		rate_limited_udp_socket(io_service& ios);
+		rate_limited_udp_socket(io_service& ios, counters& cnt);
 		void set_rate_limit(int limit) { m_rate_limit = limit; }
 		bool send(udp::endpoint const& ep, char const* p, int len
 			, error_code& ec, int flags = 0);
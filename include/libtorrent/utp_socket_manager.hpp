@@ -39,6 +39,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/session_status.hpp"
 #include "libtorrent/enum_net.hpp"
 #include "libtorrent/aux_/session_settings.hpp"
+#include "libtorrent/packet_pool.hpp"
 
 namespace libtorrent
 {
@@ -100,6 +101,12 @@ namespace libtorrent
 		// the counter is the enum from ``counters``.
 		void inc_stats_counter(int counter, int delta = 1);
 
+		// packet buffers of uTP sockets are allocated from a pool shared by
+		// all sockets. ``size`` must be the same when releasing a buffer as
+		// when allocating it
+		void* allocate_packet(int size) { return m_packet_pool.allocate(size); }
+		void release_packet(void* p, int size) { m_packet_pool.release(p, size); }
+
 	private:
 		udp_socket& m_sock;
 		incoming_utp_callback_t m_cb;
@@ -152,6 +159,8 @@ namespace libtorrent
 		// stats counters
 		counters& m_counters;
 
+		packet_pool m_packet_pool;
+
 		// this is  passed on to the instantiate connection
 		// if this is non-null it will create SSL connections over uTP
 		void* m_ssl_context;
@@ -0,0 +1,126 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/alert_arena.hpp"
+#include "libtorrent/alert.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <cstdlib> // for malloc
+
+namespace libtorrent
+{
+	alert_arena::alert_arena()
+		: m_block(0)
+		, m_used(0)
+	{}
+
+	alert_arena::~alert_arena()
+	{
+		clear();
+		for (std::vector<char*>::iterator i = m_blocks.begin()
+			, end(m_blocks.end()); i != end; ++i)
+			std::free(*i);
+	}
+
+	alert* alert_arena::push_back(alert const& a)
+	{
+		int const size = (a.storage_size() + alignment - 1) & ~(alignment - 1);
+
+		// alert types that don't report their size, and alerts that don't
+		// fit in a block, are heap allocated
+		if (size == 0 || size > block_size)
+			return push_back(a.clone());
+
+		if (m_blocks.empty() || m_used + size > block_size)
+		{
+			if (!m_blocks.empty()) ++m_block;
+			m_used = 0;
+			if (m_block == int(m_blocks.size()))
+			{
+				char* b = static_cast<char*>(std::malloc(block_size));
+				if (b == NULL) return push_back(a.clone());
+				m_blocks.push_back(b);
+			}
+		}
+
+		// make room in the lists before constructing the alert, so that
+		// we don't leak it if this throws
+		m_alerts.reserve(m_alerts.size() + 1);
+		m_heap_allocated.reserve(m_heap_allocated.size() + 1);
+
+		alert* ret = a.clone_into(m_blocks[m_block] + m_used);
+		TORRENT_ASSERT(ret != NULL);
+		m_used += size;
+		m_alerts.push_back(ret);
+		m_heap_allocated.push_back(false);
+		return ret;
+	}
+
+	alert* alert_arena::push_back(std::auto_ptr<alert> a)
+	{
+		m_alerts.reserve(m_alerts.size() + 1);
+		m_heap_allocated.reserve(m_heap_allocated.size() + 1);
+
+		alert* ret = a.release();
+		m_alerts.push_back(ret);
+		m_heap_allocated.push_back(true);
+		return ret;
+	}
+
+	std::auto_ptr<alert> alert_arena::release(int i)
+	{
+		TORRENT_ASSERT(i >= 0 && i < int(m_alerts.size()));
+		TORRENT_ASSERT(m_alerts[i] != NULL);
+
+		alert* a = m_alerts[i];
+		if (!m_heap_allocated[i]) return a->clone();
+
+		m_alerts[i] = NULL;
+		m_heap_allocated[i] = false;
+		return std::auto_ptr<alert>(a);
+	}
+
+	void alert_arena::clear()
+	{
+		for (int i = 0; i < int(m_alerts.size()); ++i)
+		{
+			if (m_alerts[i] == NULL) continue;
+			if (m_heap_allocated[i]) delete m_alerts[i];
+			else m_alerts[i]->~alert();
+		}
+		m_alerts.clear();
+		m_heap_allocated.clear();
+		m_block = 0;
+		m_used = 0;
+	}
+}
+
@@ -42,22 +42,25 @@ namespace libtorrent
 {
 
 	alert_manager::alert_manager(int queue_limit, boost::uint32_t alert_mask)
-		: m_alert_mask(alert_mask)
+		: m_generation(0)
+		, m_read_pos(0)
+		, m_alert_mask(alert_mask)
 		, m_queue_size_limit(queue_limit)
 		, m_num_queued_resume(0)
 	{}
 
 	alert_manager::~alert_manager()
 	{
-		while (!m_alerts.empty())
+#if TORRENT_USE_ASSERTS
+		alert_arena const& q = m_alerts[m_generation];
+		for (int i = m_read_pos; i < q.size(); ++i)
 		{
-			TORRENT_ASSERT(alert_cast<save_resume_data_alert>(m_alerts.front()) == 0
+			TORRENT_ASSERT(alert_cast<save_resume_data_alert>(q[i]) == 0
 				&& "shutting down session with remaining resume data alerts in the alert queue. "
 				"You proabably wany to make sure you always wait for all resume data "
 				"alerts before shutting down");
-			delete m_alerts.front();
-			m_alerts.pop_front();
 		}
+#endif
 	}
 
 	int alert_manager::num_queued_resume() const
@@ -70,11 +73,11 @@ namespace libtorrent
 	{
 		mutex::scoped_lock lock(m_mutex);
 
-		if (!m_alerts.empty()) return m_alerts.front();
+		if (num_queued() > 0) return m_alerts[m_generation][m_read_pos];
 		
 		// this call can be interrupted prematurely by other signals
 		m_condition.wait_for(lock, max_wait);
-		if (!m_alerts.empty()) return m_alerts.front();
+		if (num_queued() > 0) return m_alerts[m_generation][m_read_pos];
 
 		return NULL;
 	}
@@ -85,8 +88,14 @@ namespace libtorrent
 
 		m_dispatch = fun;
 
+		// the dispatch function takes ownership of the alerts. The ones in
+		// the arena need to be copied out of the queue
 		std::deque<alert*> alerts;
-		m_alerts.swap(alerts);
+		alert_arena& q = m_alerts[m_generation];
+		for (int i = m_read_pos; i < q.size(); ++i)
+			alerts.push_back(q.release(i).release());
+		q.clear();
+		m_read_pos = 0;
 		lock.unlock();
 
 		while (!alerts.empty())
@@ -120,13 +129,11 @@ namespace libtorrent
 #endif
 
 		mutex::scoped_lock lock(m_mutex);
-		post_impl(a, lock);
+		post_impl(*alert_, a, lock);
 	}
 
 	void alert_manager::post_alert(const alert& alert_)
 	{
-		std::auto_ptr<alert> a(alert_.clone());
-
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		for (ses_extension_list_t::iterator i = m_ses_extensions.begin()
 			, end(m_ses_extensions.end()); i != end; ++i)
@@ -138,28 +145,32 @@ namespace libtorrent
 #endif
 
 		mutex::scoped_lock lock(m_mutex);
-		post_impl(a, lock);
+		post_impl(alert_, std::auto_ptr<alert>(), lock);
 	}
-		
-	void alert_manager::post_impl(std::auto_ptr<alert>& alert_
+
+	// if ``owned`` is set, it holds ``alert_`` and the queue may take
+	// ownership of it. Otherwise ``alert_`` is copied into the queue
+	void alert_manager::post_impl(alert const& alert_, std::auto_ptr<alert> owned
 		, mutex::scoped_lock& /* l */)
 	{
-
-		if (alert_cast<save_resume_data_failed_alert>(alert_.get())
-			|| alert_cast<save_resume_data_alert>(alert_.get()))
+		if (alert_cast<save_resume_data_failed_alert>(&alert_)
+			|| alert_cast<save_resume_data_alert>(&alert_))
 			++m_num_queued_resume;
 
 		if (m_dispatch)
 		{
-			TORRENT_ASSERT(m_alerts.empty());
+			TORRENT_ASSERT(num_queued() == 0);
+			if (owned.get() == NULL) owned = alert_.clone();
 			TORRENT_TRY {
-				m_dispatch(alert_);
+				m_dispatch(owned);
 			} TORRENT_CATCH(std::exception&) {}
 		}
-		else if (m_alerts.size() < m_queue_size_limit || !alert_->discardable())
+		else if (size_t(num_queued()) < m_queue_size_limit || !alert_.discardable())
 		{
-			m_alerts.push_back(alert_.release());
-			if (m_alerts.size() == 1)
+			alert_arena& q = m_alerts[m_generation];
+			if (owned.get()) q.push_back(owned);
+			else q.push_back(alert_);
+			if (num_queued() == 1)
 				m_condition.notify_all();
 		}
 	}
@@ -175,16 +186,17 @@ namespace libtorrent
 	{
 		mutex::scoped_lock lock(m_mutex);
 		
-		if (m_alerts.empty())
+		if (num_queued() == 0)
 			return std::auto_ptr<alert>(0);
 
-		TORRENT_ASSERT(m_num_queued_resume <= int(m_alerts.size()));
+		TORRENT_ASSERT(m_num_queued_resume <= num_queued());
 
-		alert* result = m_alerts.front();
-		m_alerts.pop_front();
+		alert_arena& q = m_alerts[m_generation];
+		std::auto_ptr<alert> result = q.release(m_read_pos);
+		++m_read_pos;
 
-		if (alert_cast<save_resume_data_failed_alert>(result)
-				|| alert_cast<save_resume_data_alert>(result))
+		if (alert_cast<save_resume_data_failed_alert>(result.get())
+				|| alert_cast<save_resume_data_alert>(result.get()))
 		{
 			--m_num_queued_resume;
 			num_resume = 1;
@@ -193,24 +205,56 @@ namespace libtorrent
 		{
 			num_resume = 0;
 		}
-		return std::auto_ptr<alert>(result);
+
+		// once every alert in the buffer has been popped, its memory can be
+		// reused
+		if (m_read_pos == q.size())
+		{
+			q.clear();
+			m_read_pos = 0;
+		}
+		return result;
 	}
 
 	void alert_manager::get_all(std::deque<alert*>* alerts, int& num_resume)
 	{
 		mutex::scoped_lock lock(m_mutex);
-		TORRENT_ASSERT(m_num_queued_resume <= int(m_alerts.size()));
+		TORRENT_ASSERT(m_num_queued_resume <= num_queued());
 		num_resume = m_num_queued_resume;
 		m_num_queued_resume = 0;
-		if (m_alerts.empty()) return;
-		m_alerts.swap(*alerts);
+		if (num_queued() == 0) return;
+
+		// alerts posted with post_alert_ptr() are handed over, only the ones
+		// in the arena are copied
+		alert_arena& q = m_alerts[m_generation];
+		for (int i = m_read_pos; i < q.size(); ++i)
+			alerts->push_back(q.release(i).release());
+		q.clear();
+		m_read_pos = 0;
+	}
+
+	void alert_manager::get_all(std::vector<alert*>& alerts, int& num_resume)
+	{
+		mutex::scoped_lock lock(m_mutex);
+		TORRENT_ASSERT(m_num_queued_resume <= num_queued());
+		num_resume = m_num_queued_resume;
+		m_num_queued_resume = 0;
+
+		std::vector<alert*> const& q = m_alerts[m_generation].alerts();
+		alerts.assign(q.begin() + m_read_pos, q.end());
+
+		// the alerts returned by the previous call are no longer in use, the
+		// buffer they were in is reused for new alerts
+		m_generation ^= 1;
+		m_alerts[m_generation].clear();
+		m_read_pos = 0;
 	}
 
 	bool alert_manager::pending() const
 	{
 		mutex::scoped_lock lock(m_mutex);
 		
-		return !m_alerts.empty();
+		return num_queued() > 0;
 	}
 
 	size_t alert_manager::set_alert_queue_size_limit(size_t queue_size_limit_)
@@ -113,7 +113,7 @@ POSSIBILITY OF SUCH DAMAGE.
 	allocated (because it's not known what the block will be used for),
 	evictions are not done at the time of allocating blocks. Instead, whenever
 	an operation requires to add a new piece to the cache, it also records the
-	cache event leading to it, in m_last_cache_op. This is one of cache_miss
+	cache event leading to it, in last_cache_op. This is one of cache_miss
 	(piece did not exist in cache), lru1_ghost_hit (the piece was found in
 	lru1_ghost and it was promoted) or lru2_ghost_hit (the piece was found in
 	lru2_ghost and it was promoted). This cache operation then guides the cache
@@ -157,6 +157,19 @@ POSSIBILITY OF SUCH DAMAGE.
 	tried against the cache to see if it's a cache hit now. If it is, complete
 	it right away. If it isn't, put it back in the read_jobs list except for
 	one, which is issued into the regular job queue.
+
+	Shards
+	......
+
+	The cache is split into num_shards shards. A piece is assigned to a shard
+	by its storage and piece index. Each shard is a complete ARC cache on its
+	own, with its own piece table, LRU lists and ghost lists, and the disk
+	threads lock each shard independently. This lets disk threads operating on
+	different torrents (or different parts of the same torrent) hit the cache
+	in parallel. Only the block buffers are shared between shards, they are all
+	allocated from the same disk_buffer_pool, which also enforces the cache
+	size limit. When the cache needs to shrink, blocks are evicted one shard at
+	a time.
 */
 
 #define DEBUG_CACHE 0
@@ -219,6 +232,29 @@ void log_refcounts(cached_piece_entry const* pe)
 #define TORRENT_PIECE_ASSERT(cond, piece) do {} while(false)
 #endif
 
+#if TORRENT_USE_INVARIANT_CHECKS
+namespace {
+
+	// the block cache can only be checked one shard at a time, since the
+	// caller is only holding the mutex for the shard it's operating on
+	struct shard_invariant_checker
+	{
+		shard_invariant_checker(block_cache const& c, int shard)
+			: m_cache(c), m_shard(shard)
+		{ m_cache.check_invariant(m_shard); }
+		~shard_invariant_checker() { m_cache.check_invariant(m_shard); }
+	private:
+		block_cache const& m_cache;
+		int m_shard;
+	};
+}
+
+#define SHARD_INVARIANT_CHECK(s) \
+	shard_invariant_checker shard_invariant_checker__(*this, s)
+#else
+#define SHARD_INVARIANT_CHECK(s) do {} while (false)
+#endif
+
 cached_piece_entry::cached_piece_entry()
 	: storage()
 	, hash(0)
@@ -269,29 +305,54 @@ block_cache::block_cache(int block_size, io_service& ios
 	, boost::function<void()> const& trigger_trim
 	, alert_dispatcher* alert_disp)
 	: disk_buffer_pool(block_size, ios, trigger_trim, alert_disp)
-	, m_last_cache_op(cache_miss)
 	, m_ghost_size(8)
-	, m_read_cache_size(0)
-	, m_write_cache_size(0)
-	, m_send_buffer_blocks(0)
-	, m_pinned_blocks(0)
+	, m_policy(settings_pack::arc_cache_policy)
+{}
+
+block_cache::cache_shard::cache_shard()
+	: last_cache_op(cache_miss)
+	, read_cache_size(0)
+	, write_cache_size(0)
+	, send_buffer_blocks(0)
+	, pinned_blocks(0)
+	, read_ahead_hits(0)
+	, read_ahead_waste(0)
 {}
 
+int block_cache::shard_index(disk_io_job const* j)
+{
+	return shard_index(j->storage.get(), j->piece);
+}
+
+int block_cache::shard_index(block_cache_reference const& ref)
+{
+	return shard_index(static_cast<piece_manager const*>(ref.storage), ref.piece);
+}
+
+boost::uint32_t block_cache::piece_key(cached_piece_entry const* pe)
+{
+	return (boost::uint32_t(std::size_t(pe->storage.get()) >> 4) * 2654435761u)
+		^ boost::uint32_t(pe->piece);
+}
+
 // returns:
 // -1: not in cache
 // -2: no memory
 int block_cache::try_read(disk_io_job* j, bool expect_no_fail)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(j));
 
 	TORRENT_ASSERT(j->buffer == 0);
 
 #if TORRENT_USE_ASSERTS
 	// we're not allowed to add dirty blocks
 	// for a deleted storage!
-	TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
-		, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
-		== m_deleted_storages.end());
+	{
+		mutex::scoped_lock l(m_deleted_storages_mutex);
+		TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
+			, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
+			== m_deleted_storages.end());
+	}
 #endif
 
 	cached_piece_entry* p = find_piece(j);
@@ -317,9 +378,10 @@ int block_cache::try_read(disk_io_job* j, bool expect_no_fail)
 
 void block_cache::bump_lru(cached_piece_entry* p)
 {
+	cache_shard& s = shard(p);
 	// move to the top of the LRU list
 	TORRENT_PIECE_ASSERT(p->cache_state == cached_piece_entry::write_lru, p);
-	linked_list* lru_list = &m_lru[p->cache_state];
+	linked_list* lru_list = &s.lru[p->cache_state];
 
 	// move to the back (MRU) of the list
 	lru_list->erase(p);
@@ -331,12 +393,32 @@ void block_cache::bump_lru(cached_piece_entry* p)
 // are in the cache (including the ghost lists)
 void block_cache::cache_hit(cached_piece_entry* p, void* requester, bool volatile_read)
 {
+	cache_shard& s = shard(p);
 // this can be pretty expensive
-//	INVARIANT_CHECK;
+//	SHARD_INVARIANT_CHECK(shard_index(p));
 
 	TORRENT_ASSERT(p);
 	TORRENT_ASSERT(p->in_use);
 
+	if (m_policy == settings_pack::tinylfu_cache_policy
+		&& (p->cache_state == cached_piece_entry::read_lru1
+			|| p->cache_state == cached_piece_entry::read_lru2))
+	{
+		// TinyLFU doesn't promote pieces on hits. The hit is recorded in
+		// the frequency sketch (once per requester, for the same reason as
+		// below) and the piece is moved to the MRU end of its list. Pieces
+		// move from the window (L1) to the main cache (L2) in tinylfu_admit()
+		if (requester != NULL && p->last_requester != requester)
+		{
+			s.sketch.increment(piece_key(p));
+			p->last_requester = requester;
+		}
+		s.lru[p->cache_state].erase(p);
+		s.lru[p->cache_state].push_back(p);
+		p->expire = aux::time_now();
+		return;
+	}
+
 	// move the piece into this queue. Whenever we have a cahe
 	// hit, we move the piece into the lru2 queue (i.e. the most
 	// frequently used piece). However, we only do that if the
@@ -385,18 +467,18 @@ void block_cache::cache_hit(cached_piece_entry* p, void* requester, bool volatil
 	// from, next time we need to reclaim blocks
 	if (p->cache_state == cached_piece_entry::read_lru1_ghost)
 	{
-		m_last_cache_op = ghost_hit_lru1;
+		s.last_cache_op = ghost_hit_lru1;
 		p->storage->add_piece(p);
 	}
 	else if (p->cache_state == cached_piece_entry::read_lru2_ghost)
 	{
-		m_last_cache_op = ghost_hit_lru2;
+		s.last_cache_op = ghost_hit_lru2;
 		p->storage->add_piece(p);
 	}
 
 	// move into L2 (frequently used)
-	m_lru[p->cache_state].erase(p);
-	m_lru[target_queue].push_back(p);
+	s.lru[p->cache_state].erase(p);
+	s.lru[target_queue].push_back(p);
 	p->cache_state = target_queue;
 	p->expire = aux::time_now();
 #if TORRENT_USE_ASSERTS
@@ -420,6 +502,7 @@ void block_cache::cache_hit(cached_piece_entry* p, void* requester, bool volatil
 // cache as well, it's unclear if that ever happens though
 void block_cache::update_cache_state(cached_piece_entry* p)
 {
+	cache_shard& s = shard(p);
 	int state = p->cache_state;
 	int desired_state = p->cache_state;
 	if (p->num_dirty > 0 || p->hash != 0)
@@ -431,8 +514,8 @@ void block_cache::update_cache_state(cached_piece_entry* p)
 
 	TORRENT_PIECE_ASSERT(state < cached_piece_entry::num_lrus, p);
 	TORRENT_PIECE_ASSERT(desired_state < cached_piece_entry::num_lrus, p);
-	linked_list* src = &m_lru[state];
-	linked_list* dst = &m_lru[desired_state];
+	linked_list* src = &s.lru[state];
+	linked_list* dst = &s.lru[desired_state];
 
 	src->erase(p);
 	dst->push_back(p);
@@ -457,8 +540,9 @@ void block_cache::update_cache_state(cached_piece_entry* p)
 cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_state)
 {
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(j));
 #endif
+	cache_shard& s = m_shards[shard_index(j)];
 
 	TORRENT_ASSERT(cache_state < cached_piece_entry::num_lrus);
 
@@ -483,12 +567,12 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 		pe.last_requester = j->requester;
 		TORRENT_PIECE_ASSERT(pe.blocks, &pe);
 		if (!pe.blocks) return 0;
-		p = const_cast<cached_piece_entry*>(&*m_pieces.insert(pe).first);
+		p = const_cast<cached_piece_entry*>(&*s.pieces.insert(pe).first);
 
 		j->storage->add_piece(p);
 
 		TORRENT_PIECE_ASSERT(p->cache_state < cached_piece_entry::num_lrus, p);
-		linked_list* lru_list = &m_lru[p->cache_state];
+		linked_list* lru_list = &s.lru[p->cache_state];
 		lru_list->push_back(p);
 
 		// this piece is part of the ARC cache (as opposed to
@@ -497,7 +581,11 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 		// which end to evict blocks from next time we need to
 		// evict blocks
 		if (cache_state == cached_piece_entry::read_lru1)
-			m_last_cache_op = cache_miss;
+		{
+			s.last_cache_op = cache_miss;
+			if (m_policy == settings_pack::tinylfu_cache_policy)
+				s.sketch.increment(piece_key(p));
+		}
 
 #if TORRENT_USE_ASSERTS
 		switch (p->cache_state)
@@ -540,9 +628,9 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 				// we need to add it back to the storage
 				p->storage->add_piece(p);
 			}
-			m_lru[p->cache_state].erase(p);
+			s.lru[p->cache_state].erase(p);
 			p->cache_state = cache_state;
-			m_lru[p->cache_state].push_back(p);
+			s.lru[p->cache_state].push_back(p);
 			p->expire = aux::time_now();
 #if TORRENT_USE_ASSERTS
 			switch (p->cache_state)
@@ -567,6 +655,7 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 #if TORRENT_USE_ASSERTS
 void block_cache::mark_deleted(file_storage const& fs)
 {
+	mutex::scoped_lock l(m_deleted_storages_mutex);
 	m_deleted_storages.push_back(std::make_pair(fs.name(), (void const*)&fs));
 	if(m_deleted_storages.size() > 100)
 		m_deleted_storages.erase(m_deleted_storages.begin());
@@ -579,19 +668,24 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 	TORRENT_ASSERT(is_disk_buffer(j->buffer));
 #endif
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(j));
 #endif
 
 #if TORRENT_USE_ASSERTS
 	// we're not allowed to add dirty blocks
 	// for a deleted storage!
-	TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
-		, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
-		== m_deleted_storages.end());
+	{
+		mutex::scoped_lock l(m_deleted_storages_mutex);
+		TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
+			, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
+			== m_deleted_storages.end());
+	}
 #endif
 
+	cache_shard& s = m_shards[shard_index(j)];
+
 	TORRENT_ASSERT(j->buffer);
-	TORRENT_ASSERT(m_write_cache_size + m_read_cache_size + 1 <= in_use());
+	TORRENT_ASSERT(s.write_cache_size + s.read_cache_size + 1 <= in_use());
 
 	cached_piece_entry* pe = allocate_piece(j, cached_piece_entry::write_lru);
 	TORRENT_ASSERT(pe);
@@ -610,7 +704,7 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 	// this only evicts read blocks
 
 	int evict = num_to_evict(1);
-	if (evict > 0) try_evict_blocks(evict, pe);
+	if (evict > 0) try_evict_blocks(shard_index(pe), evict, pe);
 
 	TORRENT_PIECE_ASSERT(block < pe->blocks_in_piece, pe);
 	TORRENT_PIECE_ASSERT(j->piece == pe->piece, pe);
@@ -638,7 +732,7 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 	b.dirty = true;
 	++pe->num_blocks;
 	++pe->num_dirty;
-	++m_write_cache_size;
+	++s.write_cache_size;
 	j->buffer = 0;
 	TORRENT_PIECE_ASSERT(j->piece == pe->piece, pe);
 	TORRENT_PIECE_ASSERT(j->flags & disk_io_job::in_progress, pe);
@@ -663,6 +757,7 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 // incremented by the caller.
 void block_cache::blocks_flushed(cached_piece_entry* pe, int const* flushed, int num_flushed)
 {
+	cache_shard& s = shard(pe);
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 
 	for (int i = 0; i < num_flushed; ++i)
@@ -680,20 +775,24 @@ void block_cache::blocks_flushed(cached_piece_entry* pe, int const* flushed, int
 		dec_block_refcount(pe, block, block_cache::ref_flushing);
 	}
 
-	m_write_cache_size -= num_flushed;
-	m_read_cache_size += num_flushed;
+	s.write_cache_size -= num_flushed;
+	s.read_cache_size += num_flushed;
 	pe->num_dirty -= num_flushed;
 
 	update_cache_state(pe);
 }
 
-std::pair<block_cache::iterator, block_cache::iterator> block_cache::all_pieces() const
+std::pair<block_cache::iterator, block_cache::iterator> block_cache::all_pieces(
+	int shard) const
 {
-	return std::make_pair(m_pieces.begin(), m_pieces.end());
+	TORRENT_ASSERT(shard >= 0 && shard < num_shards);
+	cache_shard const& s = m_shards[shard];
+	return std::make_pair(s.pieces.begin(), s.pieces.end());
 }
 
 void block_cache::free_block(cached_piece_entry* pe, int block)
 {
+	cache_shard& s = shard(pe);
 	TORRENT_ASSERT(pe != 0);
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 	TORRENT_PIECE_ASSERT(block < pe->blocks_in_piece, pe);
@@ -709,13 +808,14 @@ void block_cache::free_block(cached_piece_entry* pe, int block)
 	{
 		--pe->num_dirty;
 		b.dirty = false;
-		TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-		--m_write_cache_size;
+		TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+		--s.write_cache_size;
 	}
 	else
 	{
-		TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-		--m_read_cache_size;
+		TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+		--s.read_cache_size;
+		read_block_freed(s, b);
 	}
 	TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 	--pe->num_blocks;
@@ -725,7 +825,8 @@ void block_cache::free_block(cached_piece_entry* pe, int block)
 
 bool block_cache::evict_piece(cached_piece_entry* pe, tailqueue& jobs)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(pe));
+	cache_shard& s = shard(pe);
 
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 
@@ -743,16 +844,17 @@ bool block_cache::evict_piece(cached_piece_entry* pe, tailqueue& jobs)
 		--pe->num_blocks;
 		if (!pe->blocks[i].dirty)
 		{
-			TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-			--m_read_cache_size;
+			TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+			--s.read_cache_size;
+			read_block_freed(s, pe->blocks[i]);
 		}
 		else
 		{
 			TORRENT_PIECE_ASSERT(pe->num_dirty > 0, pe);
 			--pe->num_dirty;
 			pe->blocks[i].dirty = false;
-			TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-			--m_write_cache_size;
+			TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+			--s.write_cache_size;
 		}
 		if (pe->num_blocks == 0) break;
 	}
@@ -784,7 +886,7 @@ bool block_cache::evict_piece(cached_piece_entry* pe, tailqueue& jobs)
 
 void block_cache::mark_for_deletion(cached_piece_entry* p)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(p));
 
 	DLOG(stderr, "[%p] block_cache mark-for-deletion "
 		"piece: %d\n", this, int(p->piece));
@@ -799,12 +901,13 @@ void block_cache::mark_for_deletion(cached_piece_entry* p)
 
 void block_cache::erase_piece(cached_piece_entry* pe)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(pe));
+	cache_shard& s = shard(pe);
 
 	TORRENT_PIECE_ASSERT(pe->ok_to_evict(), pe);
 	TORRENT_PIECE_ASSERT(pe->cache_state < cached_piece_entry::num_lrus, pe);
 	TORRENT_PIECE_ASSERT(pe->jobs.empty(), pe);
-	linked_list* lru_list = &m_lru[pe->cache_state];
+	linked_list* lru_list = &s.lru[pe->cache_state];
 	if (pe->hash)
 	{
 		TORRENT_PIECE_ASSERT(pe->hash->offset == 0, pe);
@@ -815,18 +918,22 @@ void block_cache::erase_piece(cached_piece_entry* pe)
 		&& pe->cache_state != cached_piece_entry::read_lru2_ghost)
 		pe->storage->remove_piece(pe);
 	lru_list->erase(pe);
-	m_pieces.erase(*pe);
+	s.pieces.erase(*pe);
 }
 
 // this only evicts read blocks. For write blocks, see
 // try_flush_write_blocks in disk_io_thread.cpp
-int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
+int block_cache::try_evict_blocks(int shard, int num, cached_piece_entry* ignore)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard);
+
+	TORRENT_ASSERT(shard >= 0 && shard < num_shards);
+	TORRENT_ASSERT(ignore == NULL || shard_index(ignore) == shard);
+	cache_shard& s = m_shards[shard];
 
 	if (num <= 0) return 0;
 
-	DLOG(stderr, "[%p] try_evict_blocks: %d\n", this, num);
+	DLOG(stderr, "[%p] try_evict_blocks: shard: %d num: %d\n", this, shard, num);
 
 	char** to_delete = TORRENT_ALLOCA(char*, num);
 	int num_to_delete = 0;
@@ -844,37 +951,53 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 	// from the volatile list. These are low priority pieces that were
 	// specifically marked as to not survive long in the cache. These are the
 	// first pieces to go when evicting
-	lru_list[0] = &m_lru[cached_piece_entry::volatile_read_lru];
+	lru_list[0] = &s.lru[cached_piece_entry::volatile_read_lru];
 
-	if (m_last_cache_op == cache_miss)
+	if (m_policy == settings_pack::tinylfu_cache_policy)
+	{
+		// the pieces that lost the admission to the main cache (L2) are at
+		// the LRU end of the window (L1). Evict those first. If all pieces
+		// were admitted, evict the pieces they pushed out from the main cache
+		if (tinylfu_admit(s))
+		{
+			lru_list[1] = &s.lru[cached_piece_entry::read_lru1];
+			lru_list[2] = &s.lru[cached_piece_entry::read_lru2];
+		}
+		else
+		{
+			lru_list[1] = &s.lru[cached_piece_entry::read_lru2];
+			lru_list[2] = &s.lru[cached_piece_entry::read_lru1];
+		}
+	}
+	else if (s.last_cache_op == cache_miss)
 	{
 		// when there was a cache miss, evict from the largest list, to tend to
 		// keep the lists of equal size when we don't know which one is
 		// performing better
-		if (m_lru[cached_piece_entry::read_lru2].size()
-			> m_lru[cached_piece_entry::read_lru1].size())
+		if (s.lru[cached_piece_entry::read_lru2].size()
+			> s.lru[cached_piece_entry::read_lru1].size())
 		{
-			lru_list[1] = &m_lru[cached_piece_entry::read_lru2];
-			lru_list[2] = &m_lru[cached_piece_entry::read_lru1];
+			lru_list[1] = &s.lru[cached_piece_entry::read_lru2];
+			lru_list[2] = &s.lru[cached_piece_entry::read_lru1];
 		}
 		else
 		{
-			lru_list[1] = &m_lru[cached_piece_entry::read_lru1];
-			lru_list[2] = &m_lru[cached_piece_entry::read_lru2];
+			lru_list[1] = &s.lru[cached_piece_entry::read_lru1];
+			lru_list[2] = &s.lru[cached_piece_entry::read_lru2];
 		}
 	}
-	else if (m_last_cache_op == ghost_hit_lru1)
+	else if (s.last_cache_op == ghost_hit_lru1)
 	{
 		// when we insert new items or move things from L1 to L2
 		// evict blocks from L2
-		lru_list[1] = &m_lru[cached_piece_entry::read_lru2];
-		lru_list[2] = &m_lru[cached_piece_entry::read_lru1];
+		lru_list[1] = &s.lru[cached_piece_entry::read_lru2];
+		lru_list[2] = &s.lru[cached_piece_entry::read_lru1];
 	}
 	else
 	{
 		// when we get cache hits in L2 evict from L1
-		lru_list[1] = &m_lru[cached_piece_entry::read_lru1];
-		lru_list[2] = &m_lru[cached_piece_entry::read_lru2];
+		lru_list[1] = &s.lru[cached_piece_entry::read_lru1];
+		lru_list[2] = &s.lru[cached_piece_entry::read_lru2];
 	}
 
 	// end refers to which end of the ARC cache we're evicting
@@ -923,8 +1046,9 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 				b.buf = NULL;
 				TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 				--pe->num_blocks;
-				TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-				--m_read_cache_size;
+				TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+				--s.read_cache_size;
+				read_block_freed(s, b);
 				--num;
 			}
 
@@ -947,11 +1071,11 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 	// cache, and we might not get to evict anything.
 
 	// TODO: this should probably only be done every n:th time
-	if (num > 0 && m_read_cache_size > m_pinned_blocks)
+	if (num > 0 && s.read_cache_size > s.pinned_blocks)
 	{
 		for (int pass = 0; pass < 2 && num > 0; ++pass)
 		{
-			for (list_iterator i = m_lru[cached_piece_entry::write_lru].iterate(); i.get() && num > 0;)
+			for (list_iterator i = s.lru[cached_piece_entry::write_lru].iterate(); i.get() && num > 0;)
 			{
 				cached_piece_entry* pe = reinterpret_cast<cached_piece_entry*>(i.get());
 				TORRENT_PIECE_ASSERT(pe->in_use, pe);
@@ -995,8 +1119,9 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 					b.buf = NULL;
 					TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 					--pe->num_blocks;
-					TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-					--m_read_cache_size;
+					TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+					--s.read_cache_size;
+					read_block_freed(s, b);
 					--num;
 				}
 
@@ -1021,42 +1146,93 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 	return num;
 }
 
-void block_cache::clear(tailqueue& jobs)
+bool block_cache::tinylfu_admit(cache_shard& s)
+{
+	linked_list& window = s.lru[cached_piece_entry::read_lru1];
+	linked_list& main = s.lru[cached_piece_entry::read_lru2];
+	int const window_size = (std::max)(1
+		, (window.size() + main.size()) * tinylfu_window_percent / 100);
+
+	// every piece that's pushed out of the window is compared against the
+	// next piece from the LRU end of the main cache. It's only admitted if
+	// it's been requested more often. Once a piece loses, the remaining (more
+	// recently used) pieces stay in the window
+	list_node* victim = main.front();
+	time_point const now = aux::time_now();
+	while (window.size() > window_size)
+	{
+		cached_piece_entry* candidate = static_cast<cached_piece_entry*>(window.front());
+		if (victim != NULL && s.sketch.estimate(piece_key(candidate))
+			<= s.sketch.estimate(piece_key(static_cast<cached_piece_entry*>(victim))))
+			return true;
+
+		window.erase(candidate);
+		main.push_back(candidate);
+		candidate->cache_state = cached_piece_entry::read_lru2;
+		candidate->expire = now;
+
+		// once we run out of pieces to push out, the pieces that were just
+		// admitted have to be competed against
+		victim = victim == NULL ? candidate : victim->next;
+	}
+	return false;
+}
+
+void block_cache::read_ahead_hit(cache_shard& s, cached_block_entry& b)
+{
+	if (!b.read_ahead) return;
+	b.read_ahead = false;
+	++s.read_ahead_hits;
+}
+
+void block_cache::read_block_freed(cache_shard& s, cached_block_entry& b)
 {
-	INVARIANT_CHECK;
+	if (!b.read_ahead) return;
+	b.read_ahead = false;
+	++s.read_ahead_waste;
+}
 
+void block_cache::clear(tailqueue& jobs)
+{
 	// this holds all the block buffers we want to free
 	// at the end
 	std::vector<char*> bufs;
 
-	for (iterator p = m_pieces.begin()
-		, end(m_pieces.end()); p != end; ++p)
+	for (int shard = 0; shard < num_shards; ++shard)
 	{
-		cached_piece_entry& pe = const_cast<cached_piece_entry&>(*p);
+		SHARD_INVARIANT_CHECK(shard);
+		cache_shard& s = m_shards[shard];
+
+		for (iterator p = s.pieces.begin()
+			, end(s.pieces.end()); p != end; ++p)
+		{
+			cached_piece_entry& pe = const_cast<cached_piece_entry&>(*p);
 #if TORRENT_USE_ASSERTS
-		for (tailqueue_iterator i = pe.jobs.iterate(); i.get(); i.next())
-			TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
-		for (tailqueue_iterator i = pe.read_jobs.iterate(); i.get(); i.next())
-			TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
+			for (tailqueue_iterator i = pe.jobs.iterate(); i.get(); i.next())
+				TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
+			for (tailqueue_iterator i = pe.read_jobs.iterate(); i.get(); i.next())
+				TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
 #endif
-		// this also removes the jobs from the piece
-		jobs.append(pe.jobs);
-		jobs.append(pe.read_jobs);
+			// this also removes the jobs from the piece
+			jobs.append(pe.jobs);
+			jobs.append(pe.read_jobs);
 
-		drain_piece_bufs(pe, bufs);
-	}
+			drain_piece_bufs(pe, bufs);
+		}
 
-	if (!bufs.empty()) free_multiple_buffers(&bufs[0], bufs.size());
+		// clear lru lists
+		for (int i = 0; i < cached_piece_entry::num_lrus; ++i)
+			s.lru[i].get_all();
 
-	// clear lru lists
-	for (int i = 0; i < cached_piece_entry::num_lrus; ++i)
-		m_lru[i].get_all();
+		s.pieces.clear();
+	}
 
-	m_pieces.clear();
+	if (!bufs.empty()) free_multiple_buffers(&bufs[0], bufs.size());
 }
 
 void block_cache::move_to_ghost(cached_piece_entry* pe)
 {
+	cache_shard& s = shard(pe);
 	TORRENT_PIECE_ASSERT(pe->refcount == 0, pe);
 	TORRENT_PIECE_ASSERT(pe->piece_refcount == 0, pe);
 	TORRENT_PIECE_ASSERT(pe->num_blocks == 0, pe);
@@ -1071,6 +1247,14 @@ void block_cache::move_to_ghost(cached_piece_entry* pe)
 	TORRENT_PIECE_ASSERT(pe->cache_state == cached_piece_entry::read_lru1
 		|| pe->cache_state == cached_piece_entry::read_lru2, pe);
 
+	// TinyLFU doesn't have ghost lists. The frequency sketch remembers how
+	// popular evicted pieces were
+	if (m_policy == settings_pack::tinylfu_cache_policy)
+	{
+		erase_piece(pe);
+		return;
+	}
+
 	// if the piece is in L1 or L2, move it into the ghost list
 	// i.e. recently evicted
 	if (pe->cache_state != cached_piece_entry::read_lru1
@@ -1078,7 +1262,7 @@ void block_cache::move_to_ghost(cached_piece_entry* pe)
 		return;
 
 	// if the ghost list is growing too big, remove the oldest entry
-	linked_list* ghost_list = &m_lru[pe->cache_state + 1];
+	linked_list* ghost_list = &s.lru[pe->cache_state + 1];
 	while (ghost_list->size() >= m_ghost_size)
 	{
 		cached_piece_entry* p = (cached_piece_entry*)ghost_list->front();
@@ -1090,7 +1274,7 @@ void block_cache::move_to_ghost(cached_piece_entry* pe)
 	}
 
 	pe->storage->remove_piece(pe);
-	m_lru[pe->cache_state].erase(pe);
+	s.lru[pe->cache_state].erase(pe);
 	pe->cache_state += 1;
 	ghost_list->push_back(pe);
 }
@@ -1113,7 +1297,8 @@ int block_cache::pad_job(disk_io_job const* j, int blocks_in_piece
 void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t *iov
 	, int iov_len, disk_io_job* j, int flags)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(pe));
+	cache_shard& s = shard(pe);
 
 	TORRENT_ASSERT(pe);
 	TORRENT_ASSERT(pe->in_use);
@@ -1122,15 +1307,23 @@ void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t
 #if TORRENT_USE_ASSERTS
 	// we're not allowed to add dirty blocks
 	// for a deleted storage!
-	TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
-		, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
-		== m_deleted_storages.end());
+	{
+		mutex::scoped_lock l(m_deleted_storages_mutex);
+		TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
+			, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
+			== m_deleted_storages.end());
+	}
 #endif
 
 	cache_hit(pe, j->requester, j->flags & disk_io_job::volatile_read);
 
 	TORRENT_ASSERT(pe->in_use);
 
+	// the blocks the job itself is asking for. Any other block is read-ahead
+	int const job_first = j->d.io.offset / block_size();
+	int const job_last = (j->d.io.offset + (std::max)(int(j->d.io.buffer_size), 1) - 1)
+		/ block_size();
+
 	for (int i = 0; i < iov_len; ++i, ++block)
 	{
 		// each iovec buffer has to be the size of a block (or the size of the last block)
@@ -1157,11 +1350,13 @@ void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t
 		else
 		{
 			pe->blocks[block].buf = (char*)iov[i].iov_base;
+			pe->blocks[block].read_ahead = (flags & blocks_read_ahead)
+				&& (block < job_first || block > job_last);
 
 			TORRENT_PIECE_ASSERT(iov[i].iov_base != NULL, pe);
 			TORRENT_PIECE_ASSERT(pe->blocks[block].dirty == false, pe);
 			++pe->num_blocks;
-			++m_read_cache_size;
+			++s.read_cache_size;
 
 			if (flags & blocks_inc_refcount)
 			{
@@ -1188,7 +1383,7 @@ void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t
 					free_buffer(pe->blocks[block].buf);
 					pe->blocks[block].buf = NULL;
 					--pe->num_blocks;
-					--m_read_cache_size;
+					--s.read_cache_size;
 				}
 #endif
 			}
@@ -1209,6 +1404,7 @@ void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t
 // return false if the memory was purged
 bool block_cache::inc_block_refcount(cached_piece_entry* pe, int block, int reason)
 {
+	cache_shard& s = shard(pe);
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 	TORRENT_PIECE_ASSERT(block < pe->blocks_in_piece, pe);
 	TORRENT_PIECE_ASSERT(block >= 0, pe);
@@ -1238,13 +1434,14 @@ bool block_cache::inc_block_refcount(cached_piece_entry* pe, int block, int reas
 				free_buffer(pe->blocks[block].buf);
 				pe->blocks[block].buf = NULL;
 				--pe->num_blocks;
-				--m_read_cache_size;
+				--s.read_cache_size;
+				read_block_freed(s, pe->blocks[block]);
 				return false;
 			}
 		}
 #endif
 		++pe->pinned;
-		++m_pinned_blocks;
+		++s.pinned_blocks;
 	}
 	++pe->blocks[block].refcount;
 	++pe->refcount;
@@ -1263,6 +1460,7 @@ bool block_cache::inc_block_refcount(cached_piece_entry* pe, int block, int reas
 
 void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reason)
 {
+	cache_shard& s = shard(pe);
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 	TORRENT_PIECE_ASSERT(block < pe->blocks_in_piece, pe);
 	TORRENT_PIECE_ASSERT(block >= 0, pe);
@@ -1276,8 +1474,8 @@ void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reas
 	{
 		TORRENT_PIECE_ASSERT(pe->pinned > 0, pe);
 		--pe->pinned;
-		TORRENT_PIECE_ASSERT(m_pinned_blocks > 0, pe);
-		--m_pinned_blocks;
+		TORRENT_PIECE_ASSERT(s.pinned_blocks > 0, pe);
+		--s.pinned_blocks;
 
 #if TORRENT_USE_PURGABLE_CONTROL && TORRENT_DISABLE_POOL_ALLOCATOR
 		// we're removing the last refcount to this block, first make sure
@@ -1301,7 +1499,8 @@ void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reas
 				free_buffer(pe->blocks[block].buf);
 				pe->blocks[block].buf = NULL;
 				--pe->num_blocks;
-				--m_read_cache_size;
+				--s.read_cache_size;
+				read_block_freed(s, pe->blocks[block]);
 			}
 		}
 #endif
@@ -1320,7 +1519,8 @@ void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reas
 
 void block_cache::abort_dirty(cached_piece_entry* pe)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(pe));
+	cache_shard& s = shard(pe);
 
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 
@@ -1339,8 +1539,8 @@ void block_cache::abort_dirty(cached_piece_entry* pe)
 		pe->blocks[i].dirty = false;
 		TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 		--pe->num_blocks;
-		TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-		--m_write_cache_size;
+		TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+		--s.write_cache_size;
 		TORRENT_PIECE_ASSERT(pe->num_dirty > 0, pe);
 		--pe->num_dirty;
 	}
@@ -1353,7 +1553,8 @@ void block_cache::abort_dirty(cached_piece_entry* pe)
 // be called for pieces with a refcount of 0
 void block_cache::free_piece(cached_piece_entry* pe)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(pe));
+	cache_shard& s = shard(pe);
 
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 
@@ -1377,15 +1578,16 @@ void block_cache::free_piece(cached_piece_entry* pe)
 		--pe->num_blocks;
 		if (pe->blocks[i].dirty)
 		{
-			TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-			--m_write_cache_size;
+			TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+			--s.write_cache_size;
 			TORRENT_PIECE_ASSERT(pe->num_dirty > 0, pe);
 			--pe->num_dirty;
 		}
 		else
 		{
-			TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-			--m_read_cache_size;
+			TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+			--s.read_cache_size;
+			read_block_freed(s, pe->blocks[i]);
 		}
 	}
 	if (num_to_delete) free_multiple_buffers(to_delete, num_to_delete);
@@ -1394,6 +1596,7 @@ void block_cache::free_piece(cached_piece_entry* pe)
 
 int block_cache::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf)
 {
+	cache_shard& s = shard(&p);
 	int piece_size = p.storage->files()->piece_size(p.piece);
 	int blocks_in_piece = (piece_size + block_size() - 1) / block_size();
 	int ret = 0;
@@ -1412,15 +1615,16 @@ int block_cache::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf
 
 		if (p.blocks[i].dirty)
 		{
-			TORRENT_ASSERT(m_write_cache_size > 0);
-			--m_write_cache_size;
+			TORRENT_ASSERT(s.write_cache_size > 0);
+			--s.write_cache_size;
 			TORRENT_PIECE_ASSERT(p.num_dirty > 0, &p);
 			--p.num_dirty;
 		}
 		else
 		{
-			TORRENT_ASSERT(m_read_cache_size > 0);
-			--m_read_cache_size;
+			TORRENT_ASSERT(s.read_cache_size > 0);
+			--s.read_cache_size;
+			read_block_freed(s, p.blocks[i]);
 		}
 	}
 	update_cache_state(&p);
@@ -1429,50 +1633,125 @@ int block_cache::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf
 
 void block_cache::update_stats_counters(counters& c) const
 {
-	c.set_value(counters::write_cache_blocks, m_write_cache_size);
-	c.set_value(counters::read_cache_blocks, m_read_cache_size);
-	c.set_value(counters::pinned_blocks, m_pinned_blocks);
-
-	c.set_value(counters::arc_mru_size, m_lru[cached_piece_entry::read_lru1].size());
-	c.set_value(counters::arc_mru_ghost_size, m_lru[cached_piece_entry::read_lru1_ghost].size());
-	c.set_value(counters::arc_mfu_size, m_lru[cached_piece_entry::read_lru2].size());
-	c.set_value(counters::arc_mfu_ghost_size, m_lru[cached_piece_entry::read_lru2_ghost].size());
-	c.set_value(counters::arc_write_size, m_lru[cached_piece_entry::write_lru].size());
-	c.set_value(counters::arc_volatile_size, m_lru[cached_piece_entry::volatile_read_lru].size());
+	int write_cache_size = 0;
+	int read_cache_size = 0;
+	int pinned_blocks = 0;
+	boost::int64_t read_ahead_hits = 0;
+	boost::int64_t read_ahead_waste = 0;
+	int lru_size[cached_piece_entry::num_lrus] = { 0 };
+	for (int shard = 0; shard < num_shards; ++shard)
+	{
+		cache_shard const& s = m_shards[shard];
+		write_cache_size += s.write_cache_size;
+		read_cache_size += s.read_cache_size;
+		pinned_blocks += s.pinned_blocks;
+		read_ahead_hits += s.read_ahead_hits;
+		read_ahead_waste += s.read_ahead_waste;
+		for (int i = 0; i < cached_piece_entry::num_lrus; ++i)
+			lru_size[i] += s.lru[i].size();
+	}
+
+	c.set_value(counters::read_ahead_useful_blocks, read_ahead_hits);
+	c.set_value(counters::read_ahead_wasted_blocks, read_ahead_waste);
+
+	c.set_value(counters::write_cache_blocks, write_cache_size);
+	c.set_value(counters::read_cache_blocks, read_cache_size);
+	c.set_value(counters::pinned_blocks, pinned_blocks);
+
+	c.set_value(counters::arc_mru_size, lru_size[cached_piece_entry::read_lru1]);
+	c.set_value(counters::arc_mru_ghost_size, lru_size[cached_piece_entry::read_lru1_ghost]);
+	c.set_value(counters::arc_mfu_size, lru_size[cached_piece_entry::read_lru2]);
+	c.set_value(counters::arc_mfu_ghost_size, lru_size[cached_piece_entry::read_lru2_ghost]);
+	c.set_value(counters::arc_write_size, lru_size[cached_piece_entry::write_lru]);
+	c.set_value(counters::arc_volatile_size, lru_size[cached_piece_entry::volatile_read_lru]);
+
+	disk_buffer_pool::update_stats_counters(c);
 }
 
 #ifndef TORRENT_NO_DEPRECATE
 void block_cache::get_stats(cache_status* ret) const
 {
-	ret->write_cache_size = m_write_cache_size;
-	ret->read_cache_size = m_read_cache_size;
-	ret->pinned_blocks = m_pinned_blocks;
-	ret->cache_size = m_read_cache_size + m_write_cache_size;
-
-	ret->arc_mru_size = m_lru[cached_piece_entry::read_lru1].size();
-	ret->arc_mru_ghost_size = m_lru[cached_piece_entry::read_lru1_ghost].size();
-	ret->arc_mfu_size = m_lru[cached_piece_entry::read_lru2].size();
-	ret->arc_mfu_ghost_size = m_lru[cached_piece_entry::read_lru2_ghost].size();
-	ret->arc_write_size = m_lru[cached_piece_entry::write_lru].size();
-	ret->arc_volatile_size = m_lru[cached_piece_entry::volatile_read_lru].size();
+	ret->write_cache_size = 0;
+	ret->read_cache_size = 0;
+	ret->pinned_blocks = 0;
+	ret->arc_mru_size = 0;
+	ret->arc_mru_ghost_size = 0;
+	ret->arc_mfu_size = 0;
+	ret->arc_mfu_ghost_size = 0;
+	ret->arc_write_size = 0;
+	ret->arc_volatile_size = 0;
+
+	for (int shard = 0; shard < num_shards; ++shard)
+	{
+		cache_shard const& s = m_shards[shard];
+		ret->write_cache_size += s.write_cache_size;
+		ret->read_cache_size += s.read_cache_size;
+		ret->pinned_blocks += s.pinned_blocks;
+
+		ret->arc_mru_size += s.lru[cached_piece_entry::read_lru1].size();
+		ret->arc_mru_ghost_size += s.lru[cached_piece_entry::read_lru1_ghost].size();
+		ret->arc_mfu_size += s.lru[cached_piece_entry::read_lru2].size();
+		ret->arc_mfu_ghost_size += s.lru[cached_piece_entry::read_lru2_ghost].size();
+		ret->arc_write_size += s.lru[cached_piece_entry::write_lru].size();
+		ret->arc_volatile_size += s.lru[cached_piece_entry::volatile_read_lru].size();
+	}
+	ret->cache_size = ret->read_cache_size + ret->write_cache_size;
 }
 #endif
 
+int block_cache::pinned_blocks() const
+{
+	int ret = 0;
+	for (int shard = 0; shard < num_shards; ++shard)
+		ret += m_shards[shard].pinned_blocks;
+	return ret;
+}
+
 void block_cache::set_settings(aux::session_settings const& sett)
 {
 	// the ghost size is the number of pieces to keep track of
 	// after they are evicted. Since cache_size is blocks, the
 	// assumption is that there are about 128 blocks per piece,
-	// and there are two ghost lists, so divide by 2.
+	// and there are two ghost lists, so divide by 2. Every shard
+	// has its own ghost lists, each gets its share.
 
 	m_ghost_size = (std::max)(8, sett.get_int(settings_pack::cache_size)
-		/ (std::max)(sett.get_int(settings_pack::read_cache_line_size), 4) / 2);
+		/ (std::max)(sett.get_int(settings_pack::read_cache_line_size), 4) / 2
+		/ num_shards);
 	disk_buffer_pool::set_settings(sett);
+
+	int const policy = sett.get_int(settings_pack::cache_eviction_policy);
+	if (policy == settings_pack::tinylfu_cache_policy)
+	{
+		// the sketch should know about several times as many pieces as fit
+		// in the cache, to be able to tell which ones are worth keeping
+		int const pieces = m_max_use
+			/ (std::max)(sett.get_int(settings_pack::read_cache_line_size), 4)
+			/ num_shards;
+		for (int shard = 0; shard < num_shards; ++shard)
+		{
+			cache_shard& s = m_shards[shard];
+			s.sketch.resize(pieces * 8);
+
+			// the ghost lists aren't used by TinyLFU
+			if (m_policy == policy) continue;
+			for (int i = cached_piece_entry::read_lru1_ghost;
+				i <= cached_piece_entry::read_lru2_ghost; i += 2)
+			{
+				while (s.lru[i].size() > 0)
+					erase_piece(static_cast<cached_piece_entry*>(s.lru[i].front()));
+			}
+		}
+	}
+	m_policy = policy;
 }
 
 #if TORRENT_USE_INVARIANT_CHECKS
-void block_cache::check_invariant() const
+void block_cache::check_invariant(int shard) const
 {
+	TORRENT_ASSERT(shard >= 0 && shard < num_shards);
+	cache_shard const& s = m_shards[shard];
+
 	int cached_write_blocks = 0;
 	int cached_read_blocks = 0;
 	int num_pinned = 0;
@@ -1483,10 +1762,11 @@ void block_cache::check_invariant() const
 	{
 		time_point timeout = min_time();
 
-		for (list_iterator p = m_lru[i].iterate(); p.get(); p.next())
+		for (list_iterator p = s.lru[i].iterate(); p.get(); p.next())
 		{
 			cached_piece_entry* pe = (cached_piece_entry*)p.get();
 			TORRENT_PIECE_ASSERT(pe->cache_state == i, pe);
+			TORRENT_PIECE_ASSERT(shard_index(pe) == shard, pe);
 			if (pe->num_dirty > 0)
 				TORRENT_PIECE_ASSERT(i == cached_piece_entry::write_lru, pe);
 
@@ -1523,16 +1803,22 @@ void block_cache::check_invariant() const
 	for (std::set<piece_manager*>::iterator i = storages.begin()
 		, end(storages.end()); i != end; ++i)
 	{
-		for (boost::unordered_set<cached_piece_entry*>::iterator j = (*i)->cached_pieces().begin()
-			, end((*i)->cached_pieces().end()); j != end; ++j)
+		std::vector<int> pieces;
+		(*i)->cached_pieces(pieces);
+		for (std::vector<int>::iterator j = pieces.begin()
+			, end2(pieces.end()); j != end2; ++j)
 		{
-			cached_piece_entry* pe = *j;
+			// pieces in other shards can't be inspected, we're not
+			// holding their mutex
+			if (shard_index(*i, *j) != shard) continue;
+			cached_piece_entry* pe = const_cast<block_cache*>(this)->find_piece(*i, *j);
+			TORRENT_ASSERT(pe != NULL);
 			TORRENT_PIECE_ASSERT(pe->storage.get() == *i, pe);
 		}
 	}
 
 	boost::unordered_set<char*> buffers;
-	for (iterator i = m_pieces.begin(), end(m_pieces.end()); i != end; ++i)
+	for (iterator i = s.pieces.begin(), end(s.pieces.end()); i != end; ++i)
 	{
 		cached_piece_entry const& p = *i;
 		TORRENT_PIECE_ASSERT(p.blocks, &p);
@@ -1602,10 +1888,10 @@ void block_cache::check_invariant() const
 		TORRENT_PIECE_ASSERT(num_refcount == p.refcount, &p);
 		TORRENT_PIECE_ASSERT(num_dirty == p.num_dirty, &p);
 	}
-	TORRENT_ASSERT(m_read_cache_size == cached_read_blocks);
-	TORRENT_ASSERT(m_write_cache_size == cached_write_blocks);
-	TORRENT_ASSERT(m_pinned_blocks == num_pinned);
-	TORRENT_ASSERT(m_write_cache_size + m_read_cache_size <= in_use());
+	TORRENT_ASSERT(s.read_cache_size == cached_read_blocks);
+	TORRENT_ASSERT(s.write_cache_size == cached_write_blocks);
+	TORRENT_ASSERT(s.pinned_blocks == num_pinned);
+	TORRENT_ASSERT(s.write_cache_size + s.read_cache_size <= in_use());
 }
 #endif
 
@@ -1615,7 +1901,8 @@ void block_cache::check_invariant() const
 
 int block_cache::copy_from_piece(cached_piece_entry* pe, disk_io_job* j, bool expect_no_fail)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_index(pe));
+	cache_shard& s = shard(pe);
 
 	TORRENT_PIECE_ASSERT(j->buffer == 0, pe);
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
@@ -1644,6 +1931,7 @@ int block_cache::copy_from_piece(cached_piece_entry* pe, disk_io_job* j, bool ex
 		TORRENT_ASSERT(!expect_no_fail);
 		return -1;
 	}
+	read_ahead_hit(s, pe->blocks[start_block]);
 
 	// if block_offset > 0, we need to read two blocks, and then
 	// copy parts of both, because it's not aligned to the block
@@ -1660,8 +1948,9 @@ int block_cache::copy_from_piece(cached_piece_entry* pe, disk_io_job* j, bool ex
 		j->d.io.ref.storage = j->storage.get();
 		j->d.io.ref.piece = pe->piece;
 		j->d.io.ref.block = start_block;
+		j->d.io.ref.mapping = 0;
 		j->buffer = bl.buf + (j->d.io.offset & (block_size()-1));
-		++m_send_buffer_blocks;
+		++s.send_buffer_blocks;
 		return j->d.io.buffer_size;
 	}
 
@@ -1672,6 +1961,7 @@ int block_cache::copy_from_piece(cached_piece_entry* pe, disk_io_job* j, bool ex
 		dec_block_refcount(pe, start_block, ref_reading);
 		return -1;
 	}
+	if (blocks_to_read == 2) read_ahead_hit(s, pe->blocks[start_block + 1]);
 
 	j->buffer = allocate_buffer("send buffer");
 	if (j->buffer == 0) return -2;
@@ -1708,8 +1998,9 @@ void block_cache::reclaim_block(block_cache_reference const& ref)
 	TORRENT_PIECE_ASSERT(pe->blocks[ref.block].buf, pe);
 	dec_block_refcount(pe, ref.block, block_cache::ref_reading);
 
-	TORRENT_PIECE_ASSERT(m_send_buffer_blocks > 0, pe);
-	--m_send_buffer_blocks;
+	cache_shard& s = shard(pe);
+	TORRENT_PIECE_ASSERT(s.send_buffer_blocks > 0, pe);
+	--s.send_buffer_blocks;
 
 	maybe_free_piece(pe);
 }
@@ -1750,9 +2041,10 @@ cached_piece_entry* block_cache::find_piece(piece_manager* st, int piece)
 	cached_piece_entry model;
 	model.storage = st->shared_from_this();
 	model.piece = piece;
-	iterator i = m_pieces.find(model);
-	TORRENT_ASSERT(i == m_pieces.end() || (i->storage.get() == st && i->piece == piece));
-	if (i == m_pieces.end()) return 0;
+	cache_t& pieces = m_shards[shard_index(st, piece)].pieces;
+	iterator i = pieces.find(model);
+	TORRENT_ASSERT(i == pieces.end() || (i->storage.get() == st && i->piece == piece));
+	if (i == pieces.end()) return 0;
 	TORRENT_PIECE_ASSERT(i->in_use, &*i);
 
 #if TORRENT_USE_ASSERTS
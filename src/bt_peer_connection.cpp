@@ -58,6 +58,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alloca.hpp"
 #include "libtorrent/socket_type.hpp"
 #include "libtorrent/performance_counters.hpp" // for counters
+#include "libtorrent/storage.hpp" // for file_io_slice
 
 #if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
 #include "libtorrent/pe_crypto.hpp"
@@ -2440,10 +2441,8 @@ namespace libtorrent
 		buf->free_disk_buffer(buffer);
 	}
 
-	void bt_peer_connection::write_piece(peer_request const& r, disk_buffer_holder& buffer)
+	void bt_peer_connection::write_piece_header(peer_request const& r)
 	{
-		INVARIANT_CHECK;
-
 		TORRENT_ASSERT(m_sent_handshake && m_sent_bitfield);
 
 		boost::shared_ptr<torrent> t = associated_torrent().lock();
@@ -2496,6 +2495,13 @@ namespace libtorrent
 		{
 			send_buffer(msg, 13);
 		}
+	}
+
+	void bt_peer_connection::write_piece(peer_request const& r, disk_buffer_holder& buffer)
+	{
+		INVARIANT_CHECK;
+
+		write_piece_header(r);
 
 		if (buffer.ref().storage == 0)
 		{
@@ -2515,6 +2521,44 @@ namespace libtorrent
 		stats_counters().inc_stats_counter(counters::num_outgoing_piece);
 	}
 
+	void bt_peer_connection::write_piece_file(peer_request const& r
+		, file_io_slice const& slice)
+	{
+		INVARIANT_CHECK;
+
+		TORRENT_ASSERT(slice.size == r.length);
+
+		write_piece_header(r);
+		append_send_file(slice.handle, slice.file_offset, r);
+
+		m_payloads.push_back(range(send_buffer_size() - r.length, r.length));
+		setup_send();
+
+		stats_counters().inc_stats_counter(counters::num_outgoing_piece);
+	}
+
+	bool bt_peer_connection::can_send_file() const
+	{
+#if TORRENT_USE_SENDFILE
+		if (!m_settings.get_bool(settings_pack::use_sendfile)) return false;
+
+		// the payload has to go out on the wire exactly as it is on disk.
+		// That rules out SSL, uTP, proxies and encryption
+		if (get_socket()->get<tcp::socket>() == NULL) return false;
+
+		// sendfile() and the wait for the socket to become writable run on
+		// this thread, sockets on a network shard are only touched by the
+		// shard's thread
+		if (socket_on_shard()) return false;
+#if !defined(TORRENT_DISABLE_ENCRYPTION) && !defined(TORRENT_DISABLE_EXTENSIONS)
+		if (!m_enc_handler.is_send_plaintext()) return false;
+#endif
+		return true;
+#else
+		return false;
+#endif
+	}
+
 	// --------------------------
 	// RECEIVE DATA
 	// --------------------------
@@ -35,6 +35,10 @@ POSSIBILITY OF SUCH DAMAGE.
 
 namespace libtorrent
 {
+	namespace {
+		void nop_free(char*, void*, block_cache_reference) {}
+	}
+
 	void chained_buffer::pop_front(int bytes_to_pop)
 	{
 		TORRENT_ASSERT(is_single_thread());
@@ -44,7 +48,8 @@ namespace libtorrent
 			buffer_t& b = m_vec.front();
 			if (b.used_size > bytes_to_pop)
 			{
-				b.start += bytes_to_pop;
+				if (b.file) b.file_offset += bytes_to_pop;
+				else b.start += bytes_to_pop;
 				b.used_size -= bytes_to_pop;
 				m_bytes -= bytes_to_pop;
 				TORRENT_ASSERT(m_bytes <= m_capacity);
@@ -85,6 +90,69 @@ namespace libtorrent
 		TORRENT_ASSERT(m_bytes <= m_capacity);
 	}
 
+	void chained_buffer::append_file(file_handle const& f
+		, boost::int64_t offset, peer_request const& r)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(f);
+		TORRENT_ASSERT(r.length > 0);
+		int const s = r.length;
+		buffer_t b;
+		b.buf = NULL;
+		b.size = s;
+		b.start = NULL;
+		b.used_size = s;
+		b.free_fun = &nop_free;
+		b.userdata = NULL;
+		b.ref = block_cache_reference();
+		b.file = f;
+		b.file_offset = offset;
+		b.request = r;
+		m_vec.push_back(b);
+
+		m_bytes += s;
+		m_capacity += s;
+		TORRENT_ASSERT(m_bytes <= m_capacity);
+	}
+
+	file* chained_buffer::front_file(boost::int64_t& offset, int& s)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		if (m_vec.empty()) return NULL;
+		buffer_t& b = m_vec.front();
+		if (!b.file) return NULL;
+		offset = b.file_offset;
+		s = b.used_size;
+		return b.file.get();
+	}
+
+	peer_request const& chained_buffer::front_file_request() const
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(!m_vec.empty());
+		TORRENT_ASSERT(m_vec.front().file);
+		return m_vec.front().request;
+	}
+
+	void chained_buffer::replace_front_file(char* buffer
+		, free_buffer_fun destructor, void* userdata
+		, block_cache_reference ref)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(!m_vec.empty());
+		buffer_t& b = m_vec.front();
+		TORRENT_ASSERT(b.file);
+		TORRENT_ASSERT(b.size == b.request.length);
+		TORRENT_ASSERT(b.used_size <= b.size);
+		b.buf = buffer;
+		b.start = buffer + b.size - b.used_size;
+		b.free_fun = destructor;
+		b.userdata = userdata;
+		b.ref = ref;
+		b.file.reset();
+		b.file_offset = 0;
+	}
+
 	void chained_buffer::prepend_buffer(char* buffer, int s, int used_size
 		, free_buffer_fun destructor, void* userdata
 		, block_cache_reference ref)
@@ -135,6 +203,7 @@ namespace libtorrent
 		TORRENT_ASSERT(is_single_thread());
 		if (m_vec.empty()) return 0;
 		buffer_t& b = m_vec.back();
+		if (b.file) return 0;
 		char* insert = b.start + b.used_size;
 		if (insert + s > b.buf + b.size) return 0;
 		b.used_size += s;
@@ -162,6 +231,8 @@ namespace libtorrent
 		for (std::deque<buffer_t>::iterator i = m_vec.begin()
 			, end(m_vec.end()); bytes > 0 && i != end; ++i)
 		{
+			// file ranges are sent separately
+			if (i->file) break;
 			if (i->used_size > bytes)
 			{
 				TORRENT_ASSERT(bytes > 0);
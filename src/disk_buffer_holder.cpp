@@ -44,7 +44,10 @@ namespace libtorrent
 	}
 
 	disk_buffer_holder::disk_buffer_holder(buffer_allocator_interface& alloc, disk_io_job const& j)
-		: m_allocator(alloc), m_buf(j.buffer), m_ref(j.d.io.ref)
+		: m_allocator(alloc)
+		// a file reference isn't a disk buffer, it's owned by the job
+		, m_buf((j.flags & disk_io_job::file_reference) ? NULL : j.buffer)
+		, m_ref(j.d.io.ref)
 	{
 		TORRENT_ASSERT(m_ref.storage == 0 || m_ref.piece >= 0);
 		TORRENT_ASSERT(m_ref.storage == 0 || m_ref.block >= 0);
@@ -40,13 +40,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alert_types.hpp"
 #include "libtorrent/alert_dispatcher.hpp"
 #include "libtorrent/disk_observer.hpp"
+#include "libtorrent/performance_counters.hpp"
 
 #include <algorithm>
+#include <functional> // for std::greater
 #include <boost/bind.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/shared_ptr.hpp>
 
-#if TORRENT_USE_MLOCK && !defined TORRENT_WINDOWS
+#if (TORRENT_USE_MLOCK || TORRENT_HAVE_MMAP) && !defined TORRENT_WINDOWS
 #include <sys/mman.h>
 #endif
 
@@ -113,6 +115,8 @@ namespace libtorrent
 #if TORRENT_HAVE_MMAP
 		, m_cache_fd(-1)
 		, m_cache_pool(0)
+		, m_arena_size(0)
+		, m_arena_pages_in_use(0)
 #endif
 		, m_post_alert(alert_disp)
 #ifndef TORRENT_DISABLE_POOL_ALLOCATOR
@@ -135,7 +139,11 @@ namespace libtorrent
 #endif
 
 #if TORRENT_HAVE_MMAP
-		if (m_cache_pool)
+		if (using_arena())
+		{
+			unmap_arena();
+		}
+		else if (m_cache_pool)
 		{
 			munmap(m_cache_pool, boost::uint64_t(m_max_use) * 0x4000);
 			m_cache_pool = 0;
@@ -349,10 +357,22 @@ namespace libtorrent
 				m_trigger_cache_trim();
 			}
 			if (m_free_list.empty()) return 0;
+			if (using_arena())
+			{
+				std::pop_heap(m_free_list.begin(), m_free_list.end()
+					, std::greater<int>());
+			}
 			boost::uint64_t slot_index = m_free_list.back();
 			m_free_list.pop_back();
 			ret = m_cache_pool + (slot_index * 0x4000);
 			TORRENT_ASSERT(is_disk_buffer(ret, l));
+
+			if (using_arena())
+			{
+				boost::uint16_t& page_use = m_arena_page_use[
+					(slot_index * 0x4000) / arena_page_size];
+				if (page_use++ == 0) ++m_arena_pages_in_use;
+			}
 		}
 		else
 #endif
@@ -546,8 +566,19 @@ namespace libtorrent
 #endif
 
 #if TORRENT_HAVE_MMAP
+		bool const want_arena = sett.get_str(settings_pack::mmap_cache).empty()
+			&& sett.get_bool(settings_pack::use_hugepage_cache);
+
+		if (using_arena())
+		{
+			// the arena is re-created whenever the cache size changes. We only
+			// get here if there are no blocks in use
+			TORRENT_ASSERT(m_in_use == 0);
+			if (!want_arena || m_free_list.size() != size_t(m_max_use))
+				unmap_arena();
+		}
 		// #error support resizing the map
-		if (m_cache_pool && sett.get_str(settings_pack::mmap_cache).empty())
+		else if (m_cache_pool && sett.get_str(settings_pack::mmap_cache).empty())
 		{
 			TORRENT_ASSERT(m_in_use == 0);
 			munmap(m_cache_pool, boost::uint64_t(m_max_use) * 0x4000);
@@ -606,9 +637,104 @@ namespace libtorrent
 				}
 			}
 		}
+
+		if (m_cache_pool == 0 && want_arena && m_max_use > 0)
+		{
+			error_code ec;
+			if (!map_arena(ec) && m_post_alert)
+				m_ios.post(boost::bind(alert_callback, m_post_alert, new mmap_cache_alert(ec)));
+		}
 #endif
 	}
 
+#if TORRENT_HAVE_MMAP
+	bool disk_buffer_pool::map_arena(error_code& ec)
+	{
+		TORRENT_ASSERT(m_cache_pool == 0);
+		TORRENT_ASSERT(m_cache_fd < 0);
+		TORRENT_ASSERT(m_in_use == 0);
+
+		boost::uint64_t const size = (boost::uint64_t(m_max_use) * 0x4000
+			+ arena_page_size - 1) & ~boost::uint64_t(arena_page_size - 1);
+
+		void* pool = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		// this only succeeds if the system has huge pages reserved
+		pool = mmap(0, size, PROT_READ | PROT_WRITE
+			, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if (pool == MAP_FAILED)
+		{
+			// fall back to regular pages. Over-allocate by one huge page to be
+			// able to align the arena to a huge page boundary, which lets
+			// transparent huge pages back it
+			boost::uint64_t const padded = size + arena_page_size;
+			char* p = (char*)mmap(0, padded, PROT_READ | PROT_WRITE
+				, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+			{
+				ec.assign(errno, boost::system::generic_category());
+				return false;
+			}
+			char* start = (char*)((boost::uint64_t(p) + arena_page_size - 1)
+				& ~boost::uint64_t(arena_page_size - 1));
+			if (start > p) munmap(p, start - p);
+			char* end = p + padded;
+			if (end > start + size) munmap(start + size, end - start - size);
+			pool = start;
+#ifdef MADV_HUGEPAGE
+			madvise(pool, size, MADV_HUGEPAGE);
+#endif
+		}
+
+		m_cache_pool = (char*)pool;
+		m_arena_size = size;
+		m_arena_page_use.assign(size / arena_page_size, 0);
+		m_arena_pages_in_use = 0;
+
+		// in arena mode, the free list is a min-heap, to always hand out the
+		// free block with the lowest address and keep the used part of the
+		// arena dense. A sorted list is a valid heap
+		m_free_list.clear();
+		m_free_list.reserve(m_max_use);
+		for (int i = 0; i < m_max_use; ++i)
+			m_free_list.push_back(i);
+		return true;
+	}
+
+	void disk_buffer_pool::unmap_arena()
+	{
+		TORRENT_ASSERT(using_arena());
+		TORRENT_ASSERT(m_arena_pages_in_use == 0);
+		munmap(m_cache_pool, m_arena_size);
+		m_cache_pool = 0;
+		m_arena_size = 0;
+		m_arena_pages_in_use = 0;
+		std::vector<boost::uint16_t>().swap(m_arena_page_use);
+		std::vector<int>().swap(m_free_list);
+	}
+#endif
+
+	void disk_buffer_pool::update_stats_counters(counters& c) const
+	{
+#if TORRENT_HAVE_MMAP
+		mutex::scoped_lock l(m_pool_mutex);
+		if (using_arena())
+		{
+			int const blocks_per_page = arena_page_size / 0x4000;
+			int const blocks_in_use = m_max_use - int(m_free_list.size());
+			c.set_value(counters::disk_arena_blocks, m_max_use);
+			c.set_value(counters::disk_arena_pages_in_use, m_arena_pages_in_use);
+			c.set_value(counters::disk_arena_fragmented_blocks
+				, m_arena_pages_in_use * blocks_per_page - blocks_in_use);
+			return;
+		}
+#endif
+		c.set_value(counters::disk_arena_blocks, 0);
+		c.set_value(counters::disk_arena_pages_in_use, 0);
+		c.set_value(counters::disk_arena_fragmented_blocks, 0);
+	}
+
 	void disk_buffer_pool::free_buffer_impl(char* buf, mutex::scoped_lock& l)
 	{
 		TORRENT_ASSERT(buf);
@@ -634,6 +760,21 @@ namespace libtorrent
 			TORRENT_ASSERT(buf <  m_cache_pool + boost::uint64_t(m_max_use) * 0x4000);
 			int slot_index = (buf - m_cache_pool) / 0x4000;
 			m_free_list.push_back(slot_index);
+			if (using_arena())
+			{
+				std::push_heap(m_free_list.begin(), m_free_list.end()
+					, std::greater<int>());
+
+				// the arena is private anonymous memory, there's nothing to
+				// write back. Handing the pages back to the kernel block by
+				// block would split the huge pages
+				boost::uint16_t& page_use = m_arena_page_use[
+					(buf - m_cache_pool) / arena_page_size];
+				TORRENT_ASSERT(page_use > 0);
+				if (--page_use == 0) --m_arena_pages_in_use;
+			}
+			else
+			{
 #if defined MADV_FREE
 			// tell the virtual memory system that we don't actually care
 			// about the data in these pages anymore. If this block was
@@ -646,6 +787,7 @@ namespace libtorrent
 			// http://kerneltrap.org/mailarchive/linux-kernel/2007/5/1/84410
 			madvise(buf, 0x4000, MADV_DONTNEED);
 #endif
+			}
 		}
 		else
 #endif
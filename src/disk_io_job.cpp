@@ -56,6 +56,7 @@ namespace libtorrent
 		d.io.ref.storage = 0;
 		d.io.ref.piece = 0;
 		d.io.ref.block = 0;
+		d.io.ref.mapping = 0;
 	}
 
 	disk_io_job::~disk_io_job()
@@ -64,6 +65,8 @@ namespace libtorrent
 			free(buffer);
 		if (action == save_resume_data)
 			delete (entry*)buffer;
+		if (action == read && (flags & file_reference))
+			delete (file_io_slice*)buffer;
 	}
 
 	bool disk_io_job::completed(cached_piece_entry const* pe, int block_size)
@@ -39,10 +39,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/error.hpp"
 #include "libtorrent/file_pool.hpp"
 #include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/bind.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <set>
 #include <vector>
+#include <algorithm> // for std::find
 
 #include "libtorrent/time.hpp"
 #include "libtorrent/disk_buffer_pool.hpp"
@@ -51,6 +53,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alert_dispatcher.hpp"
 #include "libtorrent/uncork_interface.hpp"
 #include "libtorrent/performance_counters.hpp"
+#include "libtorrent/io_uring_queue.hpp"
+#include "libtorrent/multi_hasher.hpp"
 
 #include "libtorrent/debug.hpp"
 
@@ -152,6 +156,54 @@ namespace libtorrent
 		return ret;
 	}
 
+	// locks the mutexes of all cache shards, in order. This is used by
+	// operations that need a consistent view of the whole cache. Since no
+	// thread holding one shard mutex ever waits for another one, this
+	// can't deadlock
+	struct all_shards_lock : boost::noncopyable
+	{
+		explicit all_shards_lock(mutex* m) : m_mutex(m)
+		{
+			for (int i = 0; i < block_cache::num_shards; ++i)
+				m_mutex[i].lock();
+		}
+		~all_shards_lock()
+		{
+			for (int i = block_cache::num_shards - 1; i >= 0; --i)
+				m_mutex[i].unlock();
+		}
+	private:
+		mutex* m_mutex;
+	};
+
+	// the state of a read or write job whose file operations have been
+	// queued in a disk thread's io_uring. A job may span multiple files,
+	// in which case there's one operation per file
+	struct uring_job
+	{
+		// the userdata attached to each file operation, to find our way
+		// back to the job (and the slice) when it completes
+		struct op_t
+		{
+			uring_job* parent;
+			int index;
+		};
+
+		disk_io_job* job;
+		time_point start_time;
+
+		// the number of file operations that haven't completed yet
+		int outstanding;
+
+		std::vector<file_io_slice> slices;
+		std::vector<file::iovec_t> iov;
+		std::vector<op_t> ops;
+
+		// the number of bytes transferred (or negative errno) by each
+		// file operation
+		std::vector<int> results;
+	};
+
 // ------- disk_io_thread ------
 
 	disk_io_thread::disk_io_thread(io_service& ios
@@ -161,11 +213,14 @@ namespace libtorrent
 		, int block_size)
 		: m_num_threads(0)
 		, m_num_running_threads(0)
+		, m_num_hashing_threads(0)
+		, m_num_running_hashing_threads(0)
 		, m_userdata(userdata)
 		, m_last_cache_expiry(min_time())
 		, m_last_file_check(clock_type::now())
 		, m_file_pool(40)
 		, m_disk_cache(block_size, ios, boost::bind(&disk_io_thread::trigger_cache_trim, this), alert_disp)
+		, m_next_evict_shard(0)
 		, m_stats_counters(cnt)
 		, m_ios(ios)
 		, m_work(io_service::work(m_ios))
@@ -210,9 +265,8 @@ namespace libtorrent
 
 #if TORRENT_USE_ASSERTS
 		// by now, all pieces should have been evicted
-		std::pair<block_cache::iterator, block_cache::iterator> pieces
-			= m_disk_cache.all_pieces();
-		TORRENT_ASSERT(pieces.first == pieces.second);
+		for (int i = 0; i < block_cache::num_shards; ++i)
+			TORRENT_ASSERT(m_disk_cache.num_pieces(i) == 0);
 #endif
 
 #ifdef TORRENT_DISK_STATS
@@ -234,6 +288,11 @@ namespace libtorrent
 	void disk_io_thread::set_num_threads(int i, bool wait)
 	{
 		TORRENT_ASSERT(m_magic == 0x1337);
+
+		// the hashing threads hand jobs over to the generic threads. When
+		// shutting down, stop them first
+		if (i == 0) set_num_hashing_threads(0, wait);
+
 		if (i == m_num_threads) return;
 
 		if (i > m_num_threads)
@@ -241,13 +300,8 @@ namespace libtorrent
 			while (m_num_threads < i)
 			{
 				int thread_id = (++m_num_threads) - 1;
-				thread_type_t type = generic_thread;
-
-				// the magic number 3 is also used in add_job()
-				// every 4:th thread is a hasher thread
-				if ((thread_id & 0x3) == 3) type = hasher_thread;
 				m_threads.push_back(boost::shared_ptr<thread>(
-					new thread(boost::bind(&disk_io_thread::thread_fun, this, thread_id, type))));
+					new thread(boost::bind(&disk_io_thread::thread_fun, this, thread_id, generic_thread))));
 			}
 		}
 		else
@@ -255,6 +309,7 @@ namespace libtorrent
 			while (m_num_threads > i) { --m_num_threads; }
 			mutex::scoped_lock l(m_job_mutex);
 			m_job_cond.notify_all();
+			wake_uring_waiters();
 			m_hash_job_cond.notify_all();
 			l.unlock();
 			if (wait) for (int i = m_num_threads; i < m_threads.size(); ++i) m_threads[i]->join();
@@ -263,6 +318,39 @@ namespace libtorrent
 		}
 	}
 
+	void disk_io_thread::set_num_hashing_threads(int i, bool wait)
+	{
+		TORRENT_ASSERT(m_magic == 0x1337);
+		TORRENT_ASSERT(i >= 0);
+		if (i == m_num_hashing_threads) return;
+
+		if (i > m_num_hashing_threads)
+		{
+			mutex::scoped_lock l(m_job_mutex);
+			while (m_num_hashing_threads < i)
+			{
+				int thread_id = (++m_num_hashing_threads) - 1;
+				++m_num_running_hashing_threads;
+				m_hash_threads.push_back(boost::shared_ptr<thread>(
+					new thread(boost::bind(&disk_io_thread::thread_fun, this, thread_id, hasher_thread))));
+			}
+		}
+		else
+		{
+			mutex::scoped_lock l(m_job_mutex);
+			m_num_hashing_threads = i;
+			m_hash_job_cond.notify_all();
+			l.unlock();
+			if (wait)
+			{
+				for (int k = m_num_hashing_threads; k < int(m_hash_threads.size()); ++k)
+					m_hash_threads[k]->join();
+			}
+			// this will detach the threads
+			m_hash_threads.resize(m_num_hashing_threads);
+		}
+	}
+
 	char* disk_io_thread::async_allocate_disk_buffer(char const* category
 		, boost::function<void(char*)> const& handler)
 	{ return m_disk_cache.async_allocate_buffer(category, handler); }
@@ -271,6 +359,15 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(m_magic == 0x1337);
 		TORRENT_ASSERT(ref.storage);
+
+		// blocks from a memory mapped file don't involve the cache. Dropping
+		// the last reference to a mapping unmaps it
+		if (ref.mapping)
+		{
+			intrusive_ptr_release(ref.mapping);
+			return;
+		}
+
 		m_blocks_to_reclaim.push_back(ref);
 		if (m_outstanding_reclaim_message) return;
 
@@ -283,16 +380,20 @@ namespace libtorrent
 		TORRENT_ASSERT(m_magic == 0x1337);
 		TORRENT_ASSERT(m_outstanding_reclaim_message);
 		m_outstanding_reclaim_message = false;
-		mutex::scoped_lock l(m_cache_mutex);
 		for (int i = 0; i < m_blocks_to_reclaim.size(); ++i)
-			m_disk_cache.reclaim_block(m_blocks_to_reclaim[i]);
+		{
+			block_cache_reference const& ref = m_blocks_to_reclaim[i];
+			mutex::scoped_lock l(cache_mutex(
+				static_cast<piece_manager const*>(ref.storage), ref.piece));
+			m_disk_cache.reclaim_block(ref);
+		}
 		m_blocks_to_reclaim.clear();
 	}
 
 	void disk_io_thread::set_settings(settings_pack* pack)
 	{
 		TORRENT_ASSERT(m_magic == 0x1337);
-		mutex::scoped_lock l(m_cache_mutex);
+		all_shards_lock l(m_cache_mutex);
 		apply_pack(pack, m_settings);
 		m_disk_cache.set_settings(m_settings);
 	}
@@ -363,7 +464,21 @@ namespace libtorrent
 		// to download whole stripes at a time. This is why this setting is turned
 		// off by default, flushing only one piece at a time
 
-		if (cont_pieces <= 1 || m_settings.get_bool(settings_pack::allow_partial_disk_writes))
+		// piece range
+		int range_start = cont_pieces > 1 ? (p->piece / cont_pieces) * cont_pieces : int(p->piece);
+		int range_end = (std::min)(range_start + (std::max)(cont_pieces, 1)
+			, p->storage->files()->num_pieces());
+
+		// we're only holding the mutex for the cache shard of this piece. If
+		// the stripe spans pieces in other shards, it can't be flushed as
+		// a unit
+		bool same_shard = true;
+		int const shard = block_cache::shard_index(p);
+		for (int i = range_start; i < range_end && same_shard; ++i)
+			same_shard = block_cache::shard_index(p->storage.get(), i) == shard;
+
+		if (cont_pieces <= 1 || !same_shard
+			|| m_settings.get_bool(settings_pack::allow_partial_disk_writes))
 		{
 			DLOG("try_flush_hashed: (%d) blocks_in_piece: %d end: %d\n"
 				, int(p->piece), int(p->blocks_in_piece), end);
@@ -371,10 +486,6 @@ namespace libtorrent
 			return flush_range(p, 0, end, 0, completed_jobs, l);
 		}
 
-		// piece range
-		int range_start = (p->piece / cont_pieces) * cont_pieces;
-		int range_end = (std::min)(range_start + cont_pieces, p->storage->files()->num_pieces());
-
 		// look through all the pieces in this range to see if
 		// they are ready to be flushed. If so, flush them all,
 		// otherwise, hold off
@@ -542,7 +653,7 @@ namespace libtorrent
 		// if the cache is under high pressure, we need to evict
 		// the blocks we just flushed to make room for more write pieces
 		int evict = m_disk_cache.num_to_evict(0);
-		if (evict > 0) m_disk_cache.try_evict_blocks(evict);
+		if (evict > 0) m_disk_cache.try_evict_blocks(shard, evict);
 
 		return iov_len;
 	}
@@ -770,13 +881,155 @@ namespace libtorrent
 		// if the cache is under high pressure, we need to evict
 		// the blocks we just flushed to make room for more write pieces
 		int evict = m_disk_cache.num_to_evict(0);
-		if (evict > 0) m_disk_cache.try_evict_blocks(evict);
+		if (evict > 0) m_disk_cache.try_evict_blocks(block_cache::shard_index(pe), evict);
 
 		m_disk_cache.maybe_free_piece(pe);
 
 		return iov_len;
 	}
 
+	namespace {
+
+	bool compare_piece_position(cached_piece_entry const* lhs
+		, cached_piece_entry const* rhs)
+	{
+		if (lhs->storage != rhs->storage)
+			return std::less<piece_manager const*>()(lhs->storage.get(), rhs->storage.get());
+		return lhs->piece < rhs->piece;
+	}
+
+	// a run is a sequence of adjacent pieces of the same storage, flushed
+	// by flush_pieces_sorted(). All the blocks of a run are written by a
+	// single call to flush_iovec(), which merges contiguous blocks, even
+	// across piece boundaries, into a single write operation
+	struct flush_run
+	{
+		// the range of pieces in the (sorted) pieces array
+		int first_piece;
+		int end_piece;
+		// the range of blocks in the iov and flushing arrays
+		int first_block;
+		int end_block;
+		storage_error error;
+	};
+
+	}
+
+	int disk_io_thread::flush_pieces_sorted(cached_piece_entry** pieces, int num_pieces
+		, tailqueue& completed_jobs, mutex::scoped_lock& l)
+	{
+		TORRENT_ASSERT(l.locked());
+		INVARIANT_CHECK;
+
+		if (num_pieces == 0) return 0;
+
+		int const shard = block_cache::shard_index(pieces[0]);
+
+		// the pieces are sorted by their position in the torrent, which is
+		// also the order of their position in the files
+		std::sort(pieces, pieces + num_pieces, &compare_piece_position);
+
+		int total_blocks = 0;
+		for (int i = 0; i < num_pieces; ++i)
+			total_blocks += pieces[i]->blocks_in_piece;
+
+		std::vector<file::iovec_t> iov(total_blocks);
+		std::vector<int> flushing(total_blocks);
+		// the offset into iov and flushing of each piece's blocks
+		std::vector<int> iovec_offset(num_pieces + 1);
+		std::vector<flush_run> runs;
+		int iov_len = 0;
+
+		for (int i = 0; i < num_pieces; ++i)
+		{
+			cached_piece_entry* pe = pieces[i];
+			TORRENT_PIECE_ASSERT(pe->in_use, pe);
+			TORRENT_PIECE_ASSERT(block_cache::shard_index(pe) == shard, pe);
+
+			if (runs.empty()
+				|| pieces[i-1]->storage != pe->storage
+				|| pieces[i-1]->piece + 1 != pe->piece)
+			{
+				flush_run r;
+				r.first_piece = i;
+				r.first_block = iov_len;
+				runs.push_back(r);
+			}
+			flush_run& r = runs.back();
+			r.end_piece = i + 1;
+
+			// the block indices of a run are relative to the first block of
+			// its first piece
+			int const block_base = (pe->piece - pieces[r.first_piece]->piece)
+				* pieces[r.first_piece]->blocks_in_piece;
+
+			iovec_offset[i] = iov_len;
+			++pe->piece_refcount;
+#if TORRENT_USE_ASSERTS
+			pe->piece_log.push_back(piece_log_t(piece_log_t::flush_range, -1));
+#endif
+			iov_len += build_iovec(pe, 0, pe->blocks_in_piece
+				, &iov[iov_len], &flushing[iov_len], block_base);
+			r.end_block = iov_len;
+		}
+		iovec_offset[num_pieces] = iov_len;
+
+		// start with the first run at or after where the last sweep of this
+		// shard ended, and wrap around to the beginning from the end
+		std::pair<piece_manager const*, int> const cursor = m_flush_cursor[shard];
+		int first_run = 0;
+		for (; first_run < int(runs.size()); ++first_run)
+		{
+			cached_piece_entry const* pe = pieces[runs[first_run].first_piece];
+			if (!std::less<piece_manager const*>()(pe->storage.get(), cursor.first)
+				&& (pe->storage.get() != cursor.first || int(pe->piece) >= cursor.second))
+				break;
+		}
+		if (first_run == int(runs.size())) first_run = 0;
+
+		if (iov_len > 0)
+		{
+			cached_piece_entry const* last = pieces[runs[(first_run + runs.size() - 1)
+				% runs.size()].end_piece - 1];
+			m_flush_cursor[shard] = std::make_pair(last->storage.get(), int(last->piece) + 1);
+		}
+
+		l.unlock();
+
+		for (int k = 0; k < int(runs.size()); ++k)
+		{
+			flush_run& r = runs[(first_run + k) % runs.size()];
+			if (r.first_block == r.end_block) continue;
+			flush_iovec(pieces[r.first_piece], &iov[r.first_block]
+				, &flushing[r.first_block], r.end_block - r.first_block, r.error);
+		}
+
+		l.lock();
+
+		for (std::vector<flush_run>::iterator r = runs.begin()
+			, end(runs.end()); r != end; ++r)
+		{
+			for (int i = r->first_piece; i < r->end_piece; ++i)
+			{
+				cached_piece_entry* pe = pieces[i];
+				int const block_base = (pe->piece - pieces[r->first_piece]->piece)
+					* pieces[r->first_piece]->blocks_in_piece;
+				TORRENT_PIECE_ASSERT(pe->piece_refcount > 0, pe);
+				--pe->piece_refcount;
+				iovec_flushed(pe, &flushing[iovec_offset[i]]
+					, iovec_offset[i+1] - iovec_offset[i], block_base
+					, r->error, completed_jobs);
+			}
+		}
+
+		// if the cache is under high pressure, we need to evict
+		// the blocks we just flushed to make room for more write pieces
+		int evict = m_disk_cache.num_to_evict(0);
+		if (evict > 0) m_disk_cache.try_evict_blocks(shard, evict);
+
+		return iov_len;
+	}
+
 	void disk_io_thread::fail_jobs(storage_error const& e, tailqueue& jobs_)
 	{
 		tailqueue jobs;
@@ -830,30 +1083,60 @@ namespace libtorrent
 	}
 
 	void disk_io_thread::flush_cache(piece_manager* storage, boost::uint32_t flags
-		, tailqueue& completed_jobs, mutex::scoped_lock& l)
+		, tailqueue& completed_jobs)
 	{
 		if (storage)
 		{
-			boost::unordered_set<cached_piece_entry*> const& pieces = storage->cached_pieces();
 			std::vector<int> piece_index;
-			piece_index.reserve(pieces.size());
-			for (boost::unordered_set<cached_piece_entry*>::const_iterator i = pieces.begin()
-				, end(pieces.end()); i != end; ++i)
-			{
-				if ((*i)->get_storage() != storage) continue;
-				piece_index.push_back((*i)->piece);
-			}
+			storage->cached_pieces(piece_index);
 
-			for (std::vector<int>::iterator i = piece_index.begin()
-				, end(piece_index.end()); i != end; ++i)
+			// the pieces of this storage are spread across the cache shards.
+			// Flush them one shard at a time, only holding that shard's mutex
+			std::vector<cached_piece_entry*> to_flush;
+			for (int shard = 0; shard < block_cache::num_shards; ++shard)
 			{
-				cached_piece_entry* pe = m_disk_cache.find_piece(storage, *i);
-				if (pe == NULL) continue;
-				TORRENT_PIECE_ASSERT(pe->storage.get() == storage, pe);
-				flush_piece(pe, flags, completed_jobs, l);
+				mutex::scoped_lock l(m_cache_mutex[shard]);
+
+				// unless the dirty blocks are discarded, write them all out
+				// first, sorted by their position
+				if ((flags & flush_write_cache) && (flags & flush_delete_cache) == 0)
+				{
+					to_flush.clear();
+					for (std::vector<int>::iterator i = piece_index.begin()
+						, end(piece_index.end()); i != end; ++i)
+					{
+						if (block_cache::shard_index(storage, *i) != shard) continue;
+						cached_piece_entry* pe = m_disk_cache.find_piece(storage, *i);
+						if (pe == NULL || pe->num_dirty == 0) continue;
+						++pe->piece_refcount;
+						to_flush.push_back(pe);
+					}
+
+					if (!to_flush.empty())
+					{
+						flush_pieces_sorted(&to_flush[0], int(to_flush.size())
+							, completed_jobs, l);
+						for (std::vector<cached_piece_entry*>::iterator i = to_flush.begin()
+							, end(to_flush.end()); i != end; ++i)
+						{
+							TORRENT_PIECE_ASSERT((*i)->piece_refcount > 0, *i);
+							--(*i)->piece_refcount;
+							m_disk_cache.maybe_free_piece(*i);
+						}
+					}
+				}
+
+				for (std::vector<int>::iterator i = piece_index.begin()
+					, end(piece_index.end()); i != end; ++i)
+				{
+					if (block_cache::shard_index(storage, *i) != shard) continue;
+					cached_piece_entry* pe = m_disk_cache.find_piece(storage, *i);
+					if (pe == NULL) continue;
+					TORRENT_PIECE_ASSERT(pe->storage.get() == storage, pe);
+					flush_piece(pe, flags, completed_jobs, l);
+				}
 			}
 #if TORRENT_USE_ASSERTS
-			TORRENT_ASSERT(l.locked());
 			// if the user asked to delete the cache for this storage
 			// we really should not have any pieces left. This is only called
 			// from disk_io_thread::do_delete, which is a fence job and should
@@ -861,11 +1144,13 @@ namespace libtorrent
 			// keeping pieces or blocks alive
 			if ((flags & flush_delete_cache) && (flags & flush_expect_clear))
 			{
-				boost::unordered_set<cached_piece_entry*> const& storage_pieces = storage->cached_pieces();
-				for (boost::unordered_set<cached_piece_entry*>::const_iterator i = storage_pieces.begin()
+				std::vector<int> storage_pieces;
+				storage->cached_pieces(storage_pieces);
+				for (std::vector<int>::iterator i = storage_pieces.begin()
 					, end(storage_pieces.end()); i != end; ++i)
 				{
-					cached_piece_entry* pe = m_disk_cache.find_piece(storage, (*i)->piece);
+					mutex::scoped_lock l(cache_mutex(storage, *i));
+					cached_piece_entry* pe = m_disk_cache.find_piece(storage, *i);
 					TORRENT_PIECE_ASSERT(pe->num_dirty == 0, pe);
 				}
 			}
@@ -873,25 +1158,29 @@ namespace libtorrent
 		}
 		else
 		{
-			std::pair<block_cache::iterator, block_cache::iterator> range = m_disk_cache.all_pieces();
-			while (range.first != range.second)
+			for (int shard = 0; shard < block_cache::num_shards; ++shard)
 			{
-				// TODO: it would be nice to optimize this by having the cache
-				// pieces also ordered by
-				if ((flags & (flush_read_cache | flush_delete_cache)) == 0)
+				mutex::scoped_lock l(m_cache_mutex[shard]);
+				std::pair<block_cache::iterator, block_cache::iterator> range
+					= m_disk_cache.all_pieces(shard);
+				while (range.first != range.second)
 				{
-					// if we're not flushing the read cache, and not deleting the
-					// cache, skip pieces with no dirty blocks, i.e. read cache
-					// pieces
-					while (range.first->num_dirty == 0)
+					// TODO: it would be nice to optimize this by having the cache
+					// pieces also ordered by
+					if ((flags & (flush_read_cache | flush_delete_cache)) == 0)
 					{
-						++range.first;
-						if (range.first == range.second) return;
+						// if we're not flushing the read cache, and not deleting the
+						// cache, skip pieces with no dirty blocks, i.e. read cache
+						// pieces
+						while (range.first != range.second
+							&& range.first->num_dirty == 0)
+							++range.first;
+						if (range.first == range.second) break;
 					}
+					cached_piece_entry* pe = const_cast<cached_piece_entry*>(&*range.first);
+					flush_piece(pe, flags, completed_jobs, l);
+					range = m_disk_cache.all_pieces(shard);
 				}
-				cached_piece_entry* pe = const_cast<cached_piece_entry*>(&*range.first);
-				flush_piece(pe, flags, completed_jobs, l);
-				range = m_disk_cache.all_pieces();
 			}
 		}
 	}
@@ -900,14 +1189,15 @@ namespace libtorrent
 	// size limit. This means we should not restrict ourselves to contiguous
 	// blocks of write cache line size, but try to flush all old blocks
 	// this is why we pass in 1 as cont_block to the flushing functions
-	void disk_io_thread::try_flush_write_blocks(int num, tailqueue& completed_jobs
-		, mutex::scoped_lock& l)
+	void disk_io_thread::try_flush_write_blocks(int shard, int num
+		, tailqueue& completed_jobs, mutex::scoped_lock& l)
 	{
-		DLOG("try_flush_write_blocks: %d\n", num);
+		DLOG("try_flush_write_blocks: shard: %d num: %d\n", shard, num);
+		TORRENT_ASSERT(l.locked());
 
-		list_iterator range = m_disk_cache.write_lru_pieces();
+		list_iterator range = m_disk_cache.write_lru_pieces(shard);
 		std::vector<std::pair<piece_manager*, int> > pieces;
-		pieces.reserve(m_disk_cache.num_write_lru_pieces());
+		pieces.reserve(m_disk_cache.num_write_lru_pieces(shard));
 
 		for (list_iterator p = range; p.get() && num > 0; p.next())
 		{
@@ -944,8 +1234,11 @@ namespace libtorrent
 
 		if (num == 0 || m_stats_counters[counters::num_writing_threads] > 0) return;
 
-		// if we still need to flush blocks, start over and flush
-		// everything in LRU order (degrade to lru cache eviction)
+		// if we still need to flush blocks, start over and flush everything.
+		// Rather than flushing in LRU order, write the blocks sorted by their
+		// position, to keep seeking down
+		std::vector<cached_piece_entry*> to_flush;
+		to_flush.reserve(pieces.size());
 		for (std::vector<std::pair<piece_manager*, int> >::iterator i = pieces.begin()
 			, end(pieces.end()); i != end; ++i)
 		{
@@ -964,58 +1257,72 @@ namespace libtorrent
 			pe->piece_log.push_back(piece_log_t(piece_log_t::try_flush_write_blocks2, -1));
 #endif
 			++pe->piece_refcount;
+			to_flush.push_back(pe);
+		}
 
-			num -= flush_range(pe, 0, INT_MAX, 0, completed_jobs, l);
-			--pe->piece_refcount;
+		if (to_flush.empty()) return;
+
+		flush_pieces_sorted(&to_flush[0], int(to_flush.size()), completed_jobs, l);
 
+		for (std::vector<cached_piece_entry*>::iterator i = to_flush.begin()
+			, end(to_flush.end()); i != end; ++i)
+		{
+			cached_piece_entry* pe = *i;
+			TORRENT_PIECE_ASSERT(pe->piece_refcount > 0, pe);
+			--pe->piece_refcount;
 			m_disk_cache.maybe_free_piece(pe);
 		}
 	}
 
-	void disk_io_thread::flush_expired_write_blocks(tailqueue& completed_jobs, mutex::scoped_lock& l)
+	void disk_io_thread::flush_expired_write_blocks(tailqueue& completed_jobs)
 	{
 		DLOG("flush_expired_write_blocks\n");
 
 		time_point now = aux::time_now();
 		time_duration expiration_limit = seconds(m_settings.get_int(settings_pack::cache_expiry));
 
-#if TORRENT_USE_ASSERTS
-		time_point timeout = min_time();
-#endif
-
 		cached_piece_entry** to_flush = TORRENT_ALLOCA(cached_piece_entry*, 200);
-		int num_flush = 0;
 
-		for (list_iterator p = m_disk_cache.write_lru_pieces(); p.get(); p.next())
+		for (int shard = 0; shard < block_cache::num_shards; ++shard)
 		{
-			cached_piece_entry* e = (cached_piece_entry*)p.get();
 #if TORRENT_USE_ASSERTS
-			TORRENT_PIECE_ASSERT(e->expire >= timeout, e);
-			timeout = e->expire;
+			time_point timeout = min_time();
 #endif
+			mutex::scoped_lock l(m_cache_mutex[shard]);
+			int num_flush = 0;
 
-			// since we're iterating in order of last use, if this piece
-			// shouldn't be evicted, none of the following ones will either
-			if (now - e->expire < expiration_limit) break;
-			if (e->num_dirty == 0) continue;
+			for (list_iterator p = m_disk_cache.write_lru_pieces(shard); p.get(); p.next())
+			{
+				cached_piece_entry* e = (cached_piece_entry*)p.get();
+#if TORRENT_USE_ASSERTS
+				TORRENT_PIECE_ASSERT(e->expire >= timeout, e);
+				timeout = e->expire;
+#endif
 
-			TORRENT_PIECE_ASSERT(e->cache_state <= cached_piece_entry::read_lru1 || e->cache_state == cached_piece_entry::read_lru2, e);
+				// since we're iterating in order of last use, if this piece
+				// shouldn't be evicted, none of the following ones will either
+				if (now - e->expire < expiration_limit) break;
+				if (e->num_dirty == 0) continue;
+
+				TORRENT_PIECE_ASSERT(e->cache_state <= cached_piece_entry::read_lru1 || e->cache_state == cached_piece_entry::read_lru2, e);
 #if TORRENT_USE_ASSERTS
-			e->piece_log.push_back(piece_log_t(piece_log_t::flush_expired, -1));
+				e->piece_log.push_back(piece_log_t(piece_log_t::flush_expired, -1));
 #endif
-			++e->piece_refcount;
-			// We can rely on the piece entry not being removed by
-			// incrementing the piece_refcount
-			to_flush[num_flush++] = e;
-			if (num_flush == 200) break;
-		}
+				++e->piece_refcount;
+				// We can rely on the piece entry not being removed by
+				// incrementing the piece_refcount
+				to_flush[num_flush++] = e;
+				if (num_flush == 200) break;
+			}
 
-		for (int i = 0; i < num_flush; ++i)
-		{
-			flush_range(to_flush[i], 0, INT_MAX, 0, completed_jobs, l);
-			TORRENT_ASSERT(to_flush[i]->piece_refcount > 0);
-			--to_flush[i]->piece_refcount;
-			m_disk_cache.maybe_free_piece(to_flush[i]);
+			flush_pieces_sorted(to_flush, num_flush, completed_jobs, l);
+
+			for (int i = 0; i < num_flush; ++i)
+			{
+				TORRENT_ASSERT(to_flush[i]->piece_refcount > 0);
+				--to_flush[i]->piece_refcount;
+				m_disk_cache.maybe_free_piece(to_flush[i]);
+			}
 		}
 	}
 
@@ -1093,19 +1400,32 @@ namespace libtorrent
 	// below the number of blocks we flushed by the time we're done flushing
 	// that's why we need to call this fairly often. Both before and after
 	// a disk job is executed
-	void disk_io_thread::check_cache_level(mutex::scoped_lock& l, tailqueue& completed_jobs)
+	void disk_io_thread::check_cache_level(tailqueue& completed_jobs)
 	{
 		int evict = m_disk_cache.num_to_evict(0);
-		if (evict > 0)
+		if (evict <= 0) return;
+
+		// the cache size limit is global, but blocks can only be evicted
+		// from one shard at a time. Start with a different shard every time
+		// to not make the first one take all the churn
+		int const first = (m_next_evict_shard++ & 0x7fffffff) % block_cache::num_shards;
+		for (int i = 0; i < block_cache::num_shards && evict > 0; ++i)
 		{
-			evict = m_disk_cache.try_evict_blocks(evict);
-			// don't evict write jobs if at least one other thread
-			// is flushing right now. Doing so could result in
-			// unnecessary flushing of the wrong pieces
-			if (evict > 0 && m_stats_counters[counters::num_writing_threads] == 0)
-			{
-				try_flush_write_blocks(evict, completed_jobs, l);
-			}
+			int const shard = (first + i) % block_cache::num_shards;
+			mutex::scoped_lock l(m_cache_mutex[shard]);
+			evict = m_disk_cache.try_evict_blocks(shard, evict);
+		}
+
+		// don't evict write jobs if at least one other thread
+		// is flushing right now. Doing so could result in
+		// unnecessary flushing of the wrong pieces
+		for (int i = 0; i < block_cache::num_shards && evict > 0
+			&& m_stats_counters[counters::num_writing_threads] == 0; ++i)
+		{
+			int const shard = (first + i) % block_cache::num_shards;
+			mutex::scoped_lock l(m_cache_mutex[shard]);
+			try_flush_write_blocks(shard, evict, completed_jobs, l);
+			evict = m_disk_cache.num_to_evict(0);
 		}
 	}
 
@@ -1115,9 +1435,7 @@ namespace libtorrent
 		TORRENT_ASSERT(j->next == 0);
 		TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
 
-		mutex::scoped_lock l(m_cache_mutex);
-
-		check_cache_level(l, completed_jobs);
+		check_cache_level(completed_jobs);
 
 		DLOG("perform_job job: %s ( %s%s) piece: %d offset: %d outstanding: %d\n"
 			, job_action_name[j->action]
@@ -1126,8 +1444,6 @@ namespace libtorrent
 			, j->piece, j->d.io.offset
 			, j->storage ? j->storage->num_outstanding_jobs() : -1);
 
-		l.unlock();
-
 		boost::shared_ptr<piece_manager> storage = j->storage;
 
 		// TODO: instead of doing this. pass in the settings to each storage_interface
@@ -1166,6 +1482,11 @@ namespace libtorrent
 	
 			bool need_sleep = m_queued_jobs.empty();
 			m_queued_jobs.push_back(j);
+			add_write_in_flight(j);
+			// jobs retried by a hashing thread are picked up by one of the
+			// generic disk threads, which may all be waiting for jobs
+			m_job_cond.notify();
+			wake_uring_waiters();
 			l.unlock();
 			if (need_sleep) sleep(0);
 			return;
@@ -1195,6 +1516,284 @@ namespace libtorrent
 		completed_jobs.push_back(j);
 	}
 
+	bool disk_io_thread::try_issue_uring_job(disk_io_job* j, io_uring_queue& ring)
+	{
+		bool const read = j->action == disk_io_job::read;
+		if (!read && j->action != disk_io_job::write) return false;
+		if (!j->storage) return false;
+		if (!m_settings.get_bool(settings_pack::use_io_uring)) return false;
+
+		// reads served out of memory mapped files or as file references are
+		// handled by do_read()
+		if (read && bypass_read_cache(j)) return false;
+
+		// jobs going through the cache are left alone, the block cache
+		// operations are all synchronous
+		if (read && m_settings.get_bool(settings_pack::use_read_cache)
+			&& m_settings.get_int(settings_pack::cache_size) > 0)
+			return false;
+		if (!read && m_settings.get_bool(settings_pack::use_write_cache)
+			&& m_settings.get_int(settings_pack::cache_size) > 0)
+			return false;
+
+		storage_interface* st = j->storage->get_storage_impl();
+		if (st->m_settings == 0) st->m_settings = &m_settings;
+
+		if (read)
+		{
+			j->buffer = m_disk_cache.allocate_buffer("send buffer");
+			// let the regular code path report the error
+			if (j->buffer == 0) return false;
+		}
+
+		uring_job* u = new uring_job;
+		int const mode = (read ? file::read_only : file::read_write)
+			| file_flags_for_job(j);
+		if (!st->map_io(j->piece, j->d.io.offset, j->d.io.buffer_size, mode
+			, u->slices, j->error)
+			|| int(u->slices.size()) > ring.capacity())
+		{
+			// this storage (or this particular piece) has to go through
+			// readv()/writev(). In case of an error, it will be reported
+			// from there too
+			delete u;
+			j->error = storage_error();
+			if (read)
+			{
+				m_disk_cache.free_buffer(j->buffer);
+				j->buffer = NULL;
+			}
+			return false;
+		}
+
+		int const num_ops = int(u->slices.size());
+
+		// make room in the queue for all operations of this job
+		while (ring.capacity() - ring.num_pending() < num_ops)
+			wait_uring_jobs(ring);
+
+		u->job = j;
+		u->start_time = clock_type::now();
+		u->outstanding = num_ops;
+		u->iov.resize(num_ops);
+		u->ops.resize(num_ops);
+		u->results.resize(num_ops, 0);
+
+		m_stats_counters.inc_stats_counter(counters::num_running_disk_jobs, 1);
+
+		for (int i = 0; i < num_ops; ++i)
+		{
+			file_io_slice const& s = u->slices[i];
+			u->iov[i].iov_base = j->buffer + s.buffer_offset;
+			u->iov[i].iov_len = s.size;
+			u->ops[i].parent = u;
+			u->ops[i].index = i;
+
+			bool ret;
+			if (read)
+				ret = ring.async_readv(s.handle->native_handle(), &u->iov[i], 1
+					, s.file_offset, &u->ops[i]);
+			else
+				ret = ring.async_writev(s.handle->native_handle(), &u->iov[i], 1
+					, s.file_offset, &u->ops[i]);
+			TORRENT_ASSERT(ret);
+			(void)ret;
+		}
+
+		DLOG("try_issue_uring_job: %s piece: %d offset: %d ops: %d\n"
+			, job_action_name[j->action], j->piece, j->d.io.offset, num_ops);
+
+		// u is deleted by uring_job_done(), once the last operation
+		// completes
+		return true;
+	}
+
+	void disk_io_thread::submit_uring_jobs(io_uring_queue& ring)
+	{
+		if (ring.num_unsubmitted() == 0) return;
+
+		for (int i = 0; i < 4; ++i)
+		{
+			error_code ec;
+			if (ring.submit(false, ec) >= 0) return;
+
+			DLOG("io_uring submit failed: %s\n", ec.message().c_str());
+
+			// EAGAIN and EBUSY mean the kernel is temporarily out of
+			// resources or the completion queue needs to be drained. Give it
+			// a moment and try again, a few times
+			if (ec.value() != EAGAIN && ec.value() != EBUSY) break;
+			reap_uring_jobs(ring);
+			sleep(1);
+		}
+
+		// give up on the ring for these operations, and perform them
+		// synchronously instead
+		std::vector<void*> ops;
+		ring.take_unsubmitted(ops);
+		tailqueue completed_jobs;
+		for (std::vector<void*>::iterator i = ops.begin(), end(ops.end());
+			i != end; ++i)
+		{
+			uring_job::op_t* op = static_cast<uring_job::op_t*>(*i);
+			uring_job* u = op->parent;
+			file_io_slice const& s = u->slices[op->index];
+			error_code ec;
+			int const ret = int(u->job->action == disk_io_job::read
+				? s.handle->readv(s.file_offset, &u->iov[op->index], 1, ec)
+				: s.handle->writev(s.file_offset, &u->iov[op->index], 1, ec));
+			uring_op_done(op, ret < 0 ? -ec.value() : ret, completed_jobs);
+		}
+
+		if (completed_jobs.size())
+			add_completed_jobs(completed_jobs);
+	}
+
+	void disk_io_thread::wait_uring_jobs(io_uring_queue& ring)
+	{
+		submit_uring_jobs(ring);
+		int const pending = ring.num_pending();
+		reap_uring_jobs(ring);
+		while (pending > 0 && ring.num_pending() == pending)
+		{
+			// the ring's eventfd is signalled by every completion posted
+			// since it was last waited on, so one that was posted after the
+			// reap above isn't missed
+			ring.wait();
+			reap_uring_jobs(ring);
+		}
+	}
+
+	void disk_io_thread::reap_uring_jobs(io_uring_queue& ring)
+	{
+		tailqueue completed_jobs;
+		io_uring_queue::completion c[32];
+		for (;;)
+		{
+			int const num = ring.reap(c, sizeof(c)/sizeof(c[0]));
+			if (num == 0) break;
+			for (int i = 0; i < num; ++i)
+				uring_op_done(c[i].userdata, c[i].result, completed_jobs);
+		}
+
+		if (completed_jobs.size())
+			add_completed_jobs(completed_jobs);
+	}
+
+	void disk_io_thread::uring_op_done(void* userdata, int result
+		, tailqueue& completed_jobs)
+	{
+		uring_job::op_t* op = static_cast<uring_job::op_t*>(userdata);
+		uring_job* u = op->parent;
+		u->results[op->index] = result;
+		TORRENT_ASSERT(u->outstanding > 0);
+		if (--u->outstanding == 0)
+			uring_job_done(u, completed_jobs);
+	}
+
+	void disk_io_thread::wake_uring_waiters()
+	{
+		for (std::vector<io_uring_queue*>::iterator i = m_uring_waiters.begin()
+			, end(m_uring_waiters.end()); i != end; ++i)
+			(*i)->wake();
+	}
+
+	void disk_io_thread::uring_job_done(uring_job* u, tailqueue& completed_jobs)
+	{
+		disk_io_job* j = u->job;
+		bool const read = j->action == disk_io_job::read;
+
+		// this mirrors how default_storage::readwritev() reports errors and
+		// short reads or writes
+		int ret = 0;
+		for (int i = 0; i < int(u->slices.size()); ++i)
+		{
+			int const res = u->results[i];
+			if (res < 0)
+			{
+				j->error.ec.assign(-res, get_posix_category());
+				j->error.file = u->slices[i].file_index;
+				j->error.operation = read ? storage_error::read : storage_error::write;
+				ret = -1;
+				break;
+			}
+			ret += res;
+			if (res != u->slices[i].size)
+			{
+				j->error.file = u->slices[i].file_index;
+				j->error.operation = read ? storage_error::read : storage_error::write;
+				break;
+			}
+		}
+
+		time_point now = clock_type::now();
+		boost::uint32_t const job_time = total_microseconds(now - u->start_time);
+
+		if (!j->error.ec)
+		{
+			if (read)
+			{
+				m_read_time.add_sample(job_time);
+				m_stats_counters.inc_stats_counter(counters::num_read_back);
+				m_stats_counters.inc_stats_counter(counters::num_blocks_read);
+				m_stats_counters.inc_stats_counter(counters::num_read_ops);
+				m_stats_counters.inc_stats_counter(counters::disk_read_time, job_time);
+			}
+			else
+			{
+				m_write_time.add_sample(job_time);
+				m_stats_counters.inc_stats_counter(counters::num_blocks_written);
+				m_stats_counters.inc_stats_counter(counters::num_write_ops);
+				m_stats_counters.inc_stats_counter(counters::disk_write_time, job_time);
+			}
+			m_stats_counters.inc_stats_counter(counters::disk_job_time, job_time);
+		}
+
+		if (read)
+		{
+			mutex::scoped_lock l(cache_mutex(j));
+			cached_piece_entry* pe = m_disk_cache.find_piece(j);
+			if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
+		}
+		else
+		{
+			m_disk_cache.free_buffer(j->buffer);
+			j->buffer = NULL;
+
+			mutex::scoped_lock l(m_job_mutex);
+			clear_write_in_flight(j->storage.get(), j->piece);
+		}
+
+		delete u;
+
+		m_stats_counters.inc_stats_counter(counters::num_running_disk_jobs, -1);
+
+		j->ret = ret;
+		m_job_time.add_sample(job_time);
+		completed_jobs.push_back(j);
+	}
+
+	bool disk_io_thread::write_in_flight(disk_io_job const* j) const
+	{
+		mutex::scoped_lock l(m_job_mutex);
+		return m_writes_in_flight.count(std::make_pair(j->storage.get()
+			, int(j->piece))) > 0;
+	}
+
+	void disk_io_thread::add_write_in_flight(disk_io_job const* j)
+	{
+		if (j->action != disk_io_job::write) return;
+		m_writes_in_flight.insert(std::make_pair(j->storage.get(), int(j->piece)));
+	}
+
+	void disk_io_thread::clear_write_in_flight(piece_manager const* storage, int piece)
+	{
+		std::multiset<std::pair<piece_manager const*, int> >::iterator i
+			= m_writes_in_flight.find(std::make_pair(storage, piece));
+		TORRENT_ASSERT(i != m_writes_in_flight.end());
+		if (i != m_writes_in_flight.end()) m_writes_in_flight.erase(i);
+	}
+
 	int disk_io_thread::do_uncached_read(disk_io_job* j)
 	{
 		j->buffer = m_disk_cache.allocate_buffer("send buffer");
@@ -1229,8 +1828,123 @@ namespace libtorrent
 		return ret;
 	}
 
+	int disk_io_thread::do_mapped_read(disk_io_job* j)
+	{
+		time_point start_time = clock_type::now();
+
+		boost::intrusive_ptr<file_mapping> mapping;
+		char const* buf = j->storage->get_storage_impl()->map_read(j->piece
+			, j->d.io.offset, j->d.io.buffer_size, file_flags_for_job(j)
+			, mapping, j->error);
+		if (j->error) return -1;
+		if (buf == NULL) return -2;
+
+		// touch every page of the block here, in the disk thread. Otherwise
+		// the page faults, and the disk reads they imply, would happen in the
+		// network thread once the block is sent
+		int const page = page_size();
+		char const* end = buf + j->d.io.buffer_size;
+		volatile char sink = 0;
+		for (char const* p = buf; p < end; p += page) sink += *p;
+		sink += end[-1];
+
+		// the requester holds a reference to the mapping until it
+		// reclaims the block
+		intrusive_ptr_add_ref(mapping.get());
+		j->buffer = const_cast<char*>(buf);
+		j->d.io.ref.storage = j->storage.get();
+		j->d.io.ref.piece = j->piece;
+		j->d.io.ref.block = j->d.io.offset / m_disk_cache.block_size();
+		j->d.io.ref.mapping = mapping.get();
+
+		boost::uint32_t read_time = total_microseconds(clock_type::now() - start_time);
+		m_read_time.add_sample(read_time);
+
+		m_stats_counters.inc_stats_counter(counters::num_blocks_read);
+		m_stats_counters.inc_stats_counter(counters::num_read_ops);
+		m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+		m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+		return j->d.io.buffer_size;
+	}
+
+	int disk_io_thread::do_file_reference_read(disk_io_job* j)
+	{
+		time_point start_time = clock_type::now();
+
+		std::vector<file_io_slice> slices;
+		if (!j->storage->get_storage_impl()->map_io(j->piece, j->d.io.offset
+			, j->d.io.buffer_size, file::read_only | file_flags_for_job(j)
+			, slices, j->error))
+		{
+			// let the regular read report the error, if any
+			j->error = storage_error();
+			return -2;
+		}
+		if (slices.size() != 1) return -2;
+
+		// the network thread sends the range straight from the page cache.
+		// If it isn't all there, sendfile() would block the network thread
+		// on the disk. Read it into a buffer on this thread instead
+		if (!slices[0].handle->is_resident(slices[0].file_offset, slices[0].size))
+			return -2;
+
+		file_io_slice* s = new file_io_slice(slices[0]);
+
+		j->buffer = reinterpret_cast<char*>(s);
+		j->flags |= disk_io_job::file_reference;
+
+		boost::uint32_t read_time = total_microseconds(clock_type::now() - start_time);
+		m_read_time.add_sample(read_time);
+
+		m_stats_counters.inc_stats_counter(counters::num_blocks_read);
+		m_stats_counters.inc_stats_counter(counters::num_read_ops);
+		m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+		m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+		return j->d.io.buffer_size;
+	}
+
+	void disk_io_thread::hint_read_ahead(disk_io_job* j, int piece, int offset, int size)
+	{
+		std::vector<file_io_slice> slices;
+		storage_error ec;
+		if (!j->storage->get_storage_impl()->map_io(piece, offset, size
+			, file::read_only | file_flags_for_job(j), slices, ec))
+			return;
+
+		for (std::vector<file_io_slice>::iterator i = slices.begin()
+			, end(slices.end()); i != end; ++i)
+			i->handle->hint_read(i->file_offset, i->size);
+	}
+
+	bool disk_io_thread::bypass_read_cache(disk_io_job const* j) const
+	{
+		if (j->flags & disk_io_job::force_copy) return false;
+		if (m_settings.get_bool(settings_pack::use_mmap_reads)) return true;
+		return (j->flags & disk_io_job::allow_file_reference)
+			&& m_settings.get_bool(settings_pack::use_sendfile);
+	}
+
 	int disk_io_thread::do_read(disk_io_job* j, tailqueue& completed_jobs)
 	{
+		if (bypass_read_cache(j))
+		{
+			// read misses don't allocate pieces in the cache in this mode
+			// (see prep_read_job_impl()). If the block can't be referenced or
+			// mapped, read it into a buffer without involving the cache
+			int ret = -2;
+			if ((j->flags & disk_io_job::allow_file_reference)
+				&& m_settings.get_bool(settings_pack::use_sendfile))
+				ret = do_file_reference_read(j);
+			if (ret == -2 && m_settings.get_bool(settings_pack::use_mmap_reads))
+				ret = do_mapped_read(j);
+			if (ret == -2) ret = do_uncached_read(j);
+
+			mutex::scoped_lock l(cache_mutex(j));
+			cached_piece_entry* pe = m_disk_cache.find_piece(j);
+			if (pe && pe->outstanding_read) maybe_issue_queued_read_jobs(pe, completed_jobs);
+			return ret;
+		}
+
 		if (!m_settings.get_bool(settings_pack::use_read_cache)
 			|| m_settings.get_int(settings_pack::cache_size) == 0)
 		{
@@ -1238,7 +1952,7 @@ namespace libtorrent
 			// just read straight from the file
 			int ret = do_uncached_read(j);
 
-			mutex::scoped_lock l(m_cache_mutex);
+			mutex::scoped_lock l(cache_mutex(j));
 			cached_piece_entry* pe = m_disk_cache.find_piece(j);
 			if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
 			return ret;
@@ -1247,15 +1961,23 @@ namespace libtorrent
 		int block_size = m_disk_cache.block_size();
 		int piece_size = j->storage->files()->piece_size(j->piece);
 		int blocks_in_piece = (piece_size + block_size - 1) / block_size;
-		int iov_len = m_disk_cache.pad_job(j, blocks_in_piece
-			, m_settings.get_int(settings_pack::read_cache_line_size));
+		int read_ahead = m_settings.get_int(settings_pack::read_cache_line_size);
+		bool sequential = false;
+		if (m_settings.get_bool(settings_pack::adaptive_read_ahead) && read_ahead > 0)
+		{
+			boost::int64_t const torrent_offset = boost::int64_t(j->piece)
+				* j->storage->files()->piece_length() + j->d.io.offset;
+			read_ahead = j->storage->read_ahead(j->requester, torrent_offset
+				, block_size, read_ahead, read_ahead * 4, sequential);
+		}
+		int iov_len = m_disk_cache.pad_job(j, blocks_in_piece, read_ahead);
 
 		file::iovec_t* iov = TORRENT_ALLOCA(file::iovec_t, iov_len);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 
 		int evict = m_disk_cache.num_to_evict(iov_len);
-		if (evict > 0) m_disk_cache.try_evict_blocks(evict);
+		if (evict > 0) m_disk_cache.try_evict_blocks(block_cache::shard_index(j), evict);
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == NULL)
@@ -1292,7 +2014,7 @@ namespace libtorrent
 		{
 			ret = do_uncached_read(j);
 
-			mutex::scoped_lock l(m_cache_mutex);
+			mutex::scoped_lock l(cache_mutex(j));
 			cached_piece_entry* pe = m_disk_cache.find_piece(j);
 			if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
 			return ret;
@@ -1327,6 +2049,25 @@ namespace libtorrent
 			m_stats_counters.inc_stats_counter(counters::num_read_ops);
 			m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
 			m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+
+			// the next cache miss of a sequential reader is expected where
+			// this read ended. Give the operating system a head start on it
+			if (sequential && m_settings.get_bool(settings_pack::use_disk_read_ahead))
+			{
+				int next_piece = j->piece;
+				int next_offset = int(adjusted_offset) + iov_len * block_size;
+				if (next_offset >= piece_size)
+				{
+					++next_piece;
+					next_offset = 0;
+				}
+				if (next_piece < j->storage->files()->num_pieces())
+				{
+					int const size = (std::min)(read_ahead * block_size
+						, j->storage->files()->piece_size(next_piece) - next_offset);
+					if (size > 0) hint_read_ahead(j, next_piece, next_offset, size);
+				}
+			}
 		}
 
 		l.lock();
@@ -1364,7 +2105,8 @@ namespace libtorrent
 		// as soon we insert the blocks they may be evicted
 		// (if using purgeable memory). In order to prevent that
 		// until we can read from them, increment the refcounts
-		m_disk_cache.insert_blocks(pe, block, iov, iov_len, j, block_cache::blocks_inc_refcount);
+		m_disk_cache.insert_blocks(pe, block, iov, iov_len, j
+			, block_cache::blocks_inc_refcount | block_cache::blocks_read_ahead);
 
 		TORRENT_ASSERT(pe->blocks[block].buf);
 
@@ -1501,7 +2243,7 @@ namespace libtorrent
 		if (m_settings.get_bool(settings_pack::use_write_cache)
 				&& m_settings.get_int(settings_pack::cache_size) > 0)
 		{
-			mutex::scoped_lock l(m_cache_mutex);
+			mutex::scoped_lock l(cache_mutex(j));
 
 			cached_piece_entry* pe = m_disk_cache.find_piece(j);
 			if (pe && pe->hashing_done)
@@ -1583,7 +2325,7 @@ namespace libtorrent
 		j->requester = requester;
 		j->callback = handler;
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 		int ret = prep_read_job_impl(j);
 		l.unlock();
 
@@ -1617,6 +2359,18 @@ namespace libtorrent
 			&& m_settings.get_int(settings_pack::cache_size) > 0)
 		{
 			int ret = m_disk_cache.try_read(j);
+
+			// jobs are only checked against the fence the first time they're
+			// looked up. Don't count them twice
+			if (check_fence && ret != -2)
+			{
+				bool const tinylfu = m_disk_cache.eviction_policy()
+					== settings_pack::tinylfu_cache_policy;
+				m_stats_counters.inc_stats_counter(ret >= 0
+					? (tinylfu ? counters::tinylfu_cache_hits : counters::arc_cache_hits)
+					: (tinylfu ? counters::tinylfu_cache_misses : counters::arc_cache_misses));
+			}
+
 			if (ret >= 0)
 			{
 				m_stats_counters.inc_stats_counter(counters::num_blocks_cache_hits);
@@ -1643,6 +2397,11 @@ namespace libtorrent
 				return 2;
 			}
 
+			// when blocks are served out of memory mapped files or sent
+			// straight from the files, the page cache is the read cache.
+			// Don't allocate a piece for the miss
+			if (bypass_read_cache(j)) return 1;
+
 			cached_piece_entry* pe = m_disk_cache.allocate_piece(j, cached_piece_entry::read_lru1);
 			if (pe == NULL)
 			{
@@ -1693,7 +2452,7 @@ namespace libtorrent
 		j->flags = flags;
 
 #if TORRENT_USE_ASSERT
-		mutex::scoped_lock l3_(m_cache_mutex);
+		mutex::scoped_lock l3_(cache_mutex(j));
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe)
 		{
@@ -1708,22 +2467,25 @@ namespace libtorrent
 #endif
 
 #if TORRENT_USE_ASSERT && defined TORRENT_EXPENSIVE_INVARIANT_CHECKS
-		mutex::scoped_lock l2_(m_cache_mutex);
-		std::pair<block_cache::iterator, block_cache::iterator> range = m_disk_cache.all_pieces();
-		for (block_cache::iterator i = range.first; i != range.second; ++i)
+		for (int shard = 0; shard < block_cache::num_shards; ++shard)
 		{
-			cached_piece_entry const& p = *i;
-			int bs = m_disk_cache.block_size();
-			int piece_size = p.storage->files()->piece_size(p.piece);
-			int blocks_in_piece = (piece_size + bs - 1) / bs;
-			for (int k = 0; k < blocks_in_piece; ++k)
-				TORRENT_PIECE_ASSERT(p.blocks[k].buf != j->buffer, &p);
+			mutex::scoped_lock l2_(m_cache_mutex[shard]);
+			std::pair<block_cache::iterator, block_cache::iterator> range
+				= m_disk_cache.all_pieces(shard);
+			for (block_cache::iterator i = range.first; i != range.second; ++i)
+			{
+				cached_piece_entry const& p = *i;
+				int bs = m_disk_cache.block_size();
+				int piece_size = p.storage->files()->piece_size(p.piece);
+				int blocks_in_piece = (piece_size + bs - 1) / bs;
+				for (int k = 0; k < blocks_in_piece; ++k)
+					TORRENT_PIECE_ASSERT(p.blocks[k].buf != j->buffer, &p);
+			}
 		}
-		l2_.unlock();
 #endif
 
 #if !defined TORRENT_DISABLE_POOL_ALLOCATOR && TORRENT_USE_ASSERTS
-		mutex::scoped_lock l_(m_cache_mutex);
+		mutex::scoped_lock l_(cache_mutex(j));
 		TORRENT_ASSERT(m_disk_cache.is_disk_buffer(j->buffer));
 		l_.unlock();
 #endif
@@ -1747,7 +2509,7 @@ namespace libtorrent
 				return;
 			}
 
-			mutex::scoped_lock l(m_cache_mutex);
+			mutex::scoped_lock l(cache_mutex(j));
 			// if we succeed in adding the block to the cache, the job will
 			// be added along with it. we may not free j if so
 			cached_piece_entry* pe = m_disk_cache.add_dirty_block(j);
@@ -1798,7 +2560,7 @@ namespace libtorrent
 		int piece_size = storage->files()->piece_size(piece);
 
 		// first check to see if the hashing is already done
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe && !pe->hashing && pe->hash && pe->hash->offset == piece_size)
 		{
@@ -1821,6 +2583,13 @@ namespace libtorrent
 			return;
 		}
 
+		// only pieces that are entirely in the cache are worth handing to
+		// the hashing threads. Anything else would just be bounced back to
+		// a generic disk thread, to read the missing blocks
+		if (m_num_hashing_threads > 0 && pe && pe->num_blocks == pe->blocks_in_piece)
+			j->flags |= disk_io_job::cached_only;
+		l.unlock();
+
 		add_job(j);
 	}
 
@@ -1879,16 +2648,18 @@ namespace libtorrent
 			qj->next = NULL;
 #endif
 			if (qj->storage.get() == storage)
+			{
+				if (qj->action == disk_io_job::write)
+					clear_write_in_flight(storage, qj->piece);
 				to_abort.push_back(qj);
+			}
 			else
 				m_queued_jobs.push_back(qj);
 			qj = next;
 		}
 		l2.unlock();
 
-		mutex::scoped_lock l(m_cache_mutex);
-		flush_cache(storage, flush_delete_cache, completed_jobs, l);
-		l.unlock();
+		flush_cache(storage, flush_delete_cache, completed_jobs);
 
 		disk_io_job* j = allocate_job(disk_io_job::delete_files);
 		j->storage = storage->shared_from_this();
@@ -2093,15 +2864,21 @@ namespace libtorrent
 
 	void disk_io_thread::clear_read_cache(piece_manager* storage)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		// the pieces of this storage may live in any of the cache shards.
+		// take a snapshot of the piece indices and evict them one at a time,
+		// under the lock of the shard each one belongs to
+		std::vector<int> pieces;
+		storage->cached_pieces(pieces);
 
 		tailqueue jobs;
-		boost::unordered_set<cached_piece_entry*> const& cache = storage->cached_pieces();
-		for (boost::unordered_set<cached_piece_entry*>::const_iterator i = cache.begin()
-			, end(cache.end()); i != end; ++i)
+		for (std::vector<int>::iterator i = pieces.begin(), end(pieces.end());
+			i != end; ++i)
 		{
+			mutex::scoped_lock l(cache_mutex(storage, *i));
+			cached_piece_entry* pe = m_disk_cache.find_piece(storage, *i);
+			if (pe == NULL) continue;
 			tailqueue temp;
-			m_disk_cache.evict_piece(*(i++), temp);
+			m_disk_cache.evict_piece(pe, temp);
 			jobs.append(temp);
 		}
 		fail_jobs(storage_error(boost::asio::error::operation_aborted), jobs);
@@ -2132,7 +2909,7 @@ namespace libtorrent
 
 	void disk_io_thread::clear_piece(piece_manager* storage, int index)	
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(storage, index));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(storage, index);
 		if (pe == 0) return;
@@ -2309,17 +3086,159 @@ namespace libtorrent
 		return ret >= 0 ? 0 : -1;
 	}
 
+	bool disk_io_thread::can_batch_hash(disk_io_job* j)
+	{
+		TORRENT_ASSERT(j->action == disk_io_job::hash);
+
+		// pieces being checked are read with volatile_read. There's little
+		// point in pulling those through the cache, other than to hash them
+		if (m_settings.get_int(settings_pack::cache_size) > 0
+			&& m_settings.get_bool(settings_pack::use_read_cache)
+			&& (j->flags & disk_io_job::volatile_read) == 0)
+			return false;
+
+		if ((!m_settings.get_bool(settings_pack::use_write_cache)
+			|| m_settings.get_int(settings_pack::cache_size) == 0)
+			&& write_in_flight(j))
+			return false;
+
+		// if any part of the piece is in the cache, it has to be hashed via
+		// the cache, since it may not have been written to disk yet
+		mutex::scoped_lock l(cache_mutex(j));
+		return m_disk_cache.find_piece(j) == NULL;
+	}
+
+	void disk_io_thread::perform_hash_batch(disk_io_job** jobs, int num_jobs
+		, tailqueue& completed_jobs)
+	{
+		TORRENT_ASSERT(num_jobs <= multi_hasher::max_lanes);
+
+		// jobs that can't be hashed straight from disk are performed
+		// individually
+		disk_io_job* batch[multi_hasher::max_lanes];
+		int num_batch = 0;
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			disk_io_job* j = jobs[i];
+			storage_interface* st = j->storage->get_storage_impl();
+			if (st->m_settings == 0) st->m_settings = &m_settings;
+			if (can_batch_hash(j)) batch[num_batch++] = j;
+			else perform_job(j, completed_jobs);
+		}
+
+		if (num_batch == 1)
+		{
+			perform_job(batch[0], completed_jobs);
+			return;
+		}
+		if (num_batch == 0) return;
+
+		DLOG("perform_hash_batch: %d pieces\n", num_batch);
+
+		m_stats_counters.inc_stats_counter(counters::num_running_disk_jobs, num_batch);
+		time_point const start_time = clock_type::now();
+
+		int const block_size = m_disk_cache.block_size();
+		TORRENT_ASSERT((block_size & 63) == 0);
+
+		multi_hasher h;
+		char* buffers[multi_hasher::max_lanes];
+		int piece_size[multi_hasher::max_lanes];
+		int ret[multi_hasher::max_lanes];
+		int max_blocks = 0;
+		for (int i = 0; i < num_batch; ++i)
+		{
+			buffers[i] = m_disk_cache.allocate_buffer("hashing");
+			piece_size[i] = batch[i]->storage->files()->piece_size(batch[i]->piece);
+			ret[i] = 0;
+			if (buffers[i] == NULL)
+			{
+				batch[i]->error.ec = error::no_memory;
+				batch[i]->error.operation = storage_error::alloc_cache_piece;
+				ret[i] = -1;
+			}
+			max_blocks = (std::max)(max_blocks
+				, (piece_size[i] + block_size - 1) / block_size);
+		}
+
+		// read one block of each piece at a time and hash the full blocks in
+		// parallel
+		for (int block = 0; block < max_blocks; ++block)
+		{
+			int const offset = block * block_size;
+			char const* lanes[multi_hasher::max_lanes] = { NULL };
+			for (int i = 0; i < num_batch; ++i)
+			{
+				disk_io_job* j = batch[i];
+				if (ret[i] < 0 || offset >= piece_size[i]) continue;
+
+				time_point const read_start = clock_type::now();
+
+				file::iovec_t iov = { buffers[i]
+					, size_t((std::min)(block_size, piece_size[i] - offset)) };
+				ret[i] = j->storage->get_storage_impl()->readv(&iov, 1, j->piece
+					, offset, file_flags_for_job(j), j->error);
+				if (ret[i] < 0) continue;
+
+				if (!j->error.ec)
+				{
+					boost::uint32_t read_time = total_microseconds(clock_type::now() - read_start);
+					m_read_time.add_sample(read_time);
+
+					m_stats_counters.inc_stats_counter(counters::num_blocks_read);
+					m_stats_counters.inc_stats_counter(counters::num_read_ops);
+					m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+					m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+				}
+
+				if (int(iov.iov_len) == block_size) lanes[i] = buffers[i];
+				else h.update(i, buffers[i], iov.iov_len);
+			}
+			h.update_lanes(lanes, block_size);
+		}
+
+		time_point const now = clock_type::now();
+		for (int i = 0; i < num_batch; ++i)
+		{
+			disk_io_job* j = batch[i];
+			if (buffers[i]) m_disk_cache.free_buffer(buffers[i]);
+
+			sha1_hash piece_hash = h.final(i);
+			memcpy(j->d.piece_hash, &piece_hash[0], 20);
+			j->ret = ret[i] >= 0 ? 0 : -1;
+
+			m_job_time.add_sample(total_microseconds(now - start_time));
+			completed_jobs.push_back(j);
+		}
+
+		m_stats_counters.inc_stats_counter(counters::num_running_disk_jobs, -num_batch);
+	}
+
 	int disk_io_thread::do_hash(disk_io_job* j, tailqueue& completed_jobs)
 	{
 		INVARIANT_CHECK;
 
+		// jobs run by a hashing thread may not read anything from disk.
+		// If they need to, they're retried by a generic disk thread. Clear
+		// the flag up front, since the job is requeued as it's returned
+		bool const cached_only = (j->flags & disk_io_job::cached_only) != 0;
+		j->flags &= ~disk_io_job::cached_only;
+
+		// when not using a write cache, the hash is computed by reading
+		// the piece back from disk. If some of its blocks are still being
+		// written, we can't do that yet
+		if ((!m_settings.get_bool(settings_pack::use_write_cache)
+			|| m_settings.get_int(settings_pack::cache_size) == 0)
+			&& write_in_flight(j))
+			return retry_job;
+
 		if (m_settings.get_int(settings_pack::cache_size) == 0)
-			return do_uncached_hash(j);
+			return cached_only ? retry_job : do_uncached_hash(j);
 
 		int piece_size = j->storage->files()->piece_size(j->piece);
 		int file_flags = file_flags_for_job(j);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe)
@@ -2356,6 +3275,8 @@ namespace libtorrent
 			}
 		}
 	
+		if (pe == NULL && cached_only) return retry_job;
+
 		if (pe == NULL && !m_settings.get_bool(settings_pack::use_read_cache))
 		{
 			l.unlock();
@@ -2433,6 +3354,20 @@ namespace libtorrent
 			locked_blocks[num_locked_blocks++] = i;
 		}
 
+		if (cached_only && num_locked_blocks < blocks_in_piece - ph->offset / block_size)
+		{
+			// some blocks would have to be read from disk. Leave that to a
+			// generic disk thread
+			for (int i = 0; i < num_locked_blocks; ++i)
+				m_disk_cache.dec_block_refcount(pe, locked_blocks[i], block_cache::ref_hashing);
+
+			--pe->piece_refcount;
+			pe->hashing = 0;
+			m_disk_cache.maybe_free_piece(pe);
+			DLOG("do_hash: piece not cached, handing over to disk thread\n");
+			return retry_job;
+		}
+
 		l.unlock();
 
 		int next_locked_block = 0;
@@ -2573,9 +3508,7 @@ namespace libtorrent
 		// if this assert fails, something's wrong with the fence logic
 		TORRENT_ASSERT(j->storage->num_outstanding_jobs() == 1);
 
-		mutex::scoped_lock l(m_cache_mutex);
-		flush_cache(j->storage.get(), flush_write_cache, completed_jobs, l);
-		l.unlock();
+		flush_cache(j->storage.get(), flush_write_cache, completed_jobs);
 
 		j->storage->get_storage_impl()->release_files(j->error);
 		return j->error ? -1 : 0;
@@ -2589,13 +3522,11 @@ namespace libtorrent
 		// if this assert fails, something's wrong with the fence logic
 		TORRENT_ASSERT(j->storage->num_outstanding_jobs() == 1);
 
-		mutex::scoped_lock l(m_cache_mutex);
 #if TORRENT_USE_ASSERTS
 		m_disk_cache.mark_deleted(*j->storage->files());
 #endif
-		
-		flush_cache(j->storage.get(), flush_delete_cache | flush_expect_clear, completed_jobs, l);
-		l.unlock();
+
+		flush_cache(j->storage.get(), flush_delete_cache | flush_expect_clear, completed_jobs);
 
 		j->storage->get_storage_impl()->delete_files(j->error);
 		return j->error ? -1 : 0;
@@ -2619,9 +3550,7 @@ namespace libtorrent
 		// if this assert fails, something's wrong with the fence logic
 		TORRENT_ASSERT(j->storage->num_outstanding_jobs() == 1);
 
-		mutex::scoped_lock l(m_cache_mutex);
-		flush_cache(j->storage.get(), flush_write_cache, completed_jobs, l);
-		l.unlock();
+		flush_cache(j->storage.get(), flush_write_cache, completed_jobs);
 
 		entry* resume_data = new entry(entry::dictionary_t);
 		j->storage->get_storage_impl()->write_resume_data(*resume_data, j->error);
@@ -2647,9 +3576,7 @@ namespace libtorrent
 
 		// issue write commands for all dirty blocks
 		// and clear all read jobs
-		mutex::scoped_lock l(m_cache_mutex);
-		flush_cache(j->storage.get(), flush_read_cache | flush_write_cache, completed_jobs, l);
-		l.unlock();
+		flush_cache(j->storage.get(), flush_read_cache | flush_write_cache, completed_jobs);
 
 		m_disk_cache.release_memory();
 
@@ -2668,7 +3595,7 @@ namespace libtorrent
 
 		int file_flags = file_flags_for_job(j);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == NULL)
@@ -2794,10 +3721,11 @@ namespace libtorrent
 		c.set_value(counters::num_jobs, jobs_in_use());
 		c.set_value(counters::queued_disk_jobs, m_queued_jobs.size()
 			+ m_queued_hash_jobs.size());
+		c.set_value(counters::queued_hash_jobs, m_queued_hash_jobs.size());
 
 		jl.unlock();
 
-		mutex::scoped_lock l(m_cache_mutex);
+		all_shards_lock l(m_cache_mutex);
 
 		// gauges
 		c.set_value(counters::disk_blocks_in_use, m_disk_cache.in_use());
@@ -2808,7 +3736,13 @@ namespace libtorrent
 	void disk_io_thread::get_cache_info(cache_status* ret, bool no_pieces
 		, piece_manager const* storage) const
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+#ifndef TORRENT_NO_DEPRECATE
+		mutex::scoped_lock jl(m_job_mutex);
+		ret->queued_jobs = m_queued_jobs.size() + m_queued_hash_jobs.size();
+		jl.unlock();
+#endif
+
+		all_shards_lock l(m_cache_mutex);
 
 #ifndef TORRENT_NO_DEPRECATE
 		ret->total_used_buffers = m_disk_cache.in_use();
@@ -2859,32 +3793,28 @@ namespace libtorrent
 		{
 			int block_size = m_disk_cache.block_size();
    
+			// the pieces of a storage are spread across all shards, so both
+			// cases walk every shard, optionally filtering on storage
 			if (storage)
 			{
 				ret->pieces.reserve(storage->num_pieces());
-   
-				for (boost::unordered_set<cached_piece_entry*>::iterator i
-					= storage->cached_pieces().begin(), end(storage->cached_pieces().end());
-					i != end; ++i)
-				{
-					TORRENT_ASSERT((*i)->storage.get() == storage);
-   
-					if ((*i)->cache_state == cached_piece_entry::read_lru2_ghost
-						|| (*i)->cache_state == cached_piece_entry::read_lru1_ghost)
-						continue;
-					ret->pieces.push_back(cached_piece_info());
-					get_cache_info_impl(ret->pieces.back(), *i, block_size);
-				}
 			}
 			else
 			{
-				ret->pieces.reserve(m_disk_cache.num_pieces());
-   
+				int num_pieces = 0;
+				for (int shard = 0; shard < block_cache::num_shards; ++shard)
+					num_pieces += m_disk_cache.num_pieces(shard);
+				ret->pieces.reserve(num_pieces);
+			}
+
+			for (int shard = 0; shard < block_cache::num_shards; ++shard)
+			{
 				std::pair<block_cache::iterator, block_cache::iterator> range
-					= m_disk_cache.all_pieces();
-   
+					= m_disk_cache.all_pieces(shard);
+
 				for (block_cache::iterator i = range.first; i != range.second; ++i)
 				{
+					if (storage && i->storage.get() != storage) continue;
 					if (i->cache_state == cached_piece_entry::read_lru2_ghost
 						|| i->cache_state == cached_piece_entry::read_lru1_ghost)
 						continue;
@@ -2893,19 +3823,11 @@ namespace libtorrent
 				}
 			}
 		}
-
-		l.unlock();
-
-#ifndef TORRENT_NO_DEPRECATE
-		mutex::scoped_lock jl(m_job_mutex);
-		ret->queued_jobs = m_queued_jobs.size() + m_queued_hash_jobs.size();
-		jl.unlock();
-#endif
 	}
 
 	int disk_io_thread::do_flush_piece(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == NULL) return 0;
@@ -2923,7 +3845,7 @@ namespace libtorrent
 	// triggered by another mechanism.
 	int disk_io_thread::do_flush_hashed(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 
@@ -2975,8 +3897,7 @@ namespace libtorrent
 
 	int disk_io_thread::do_flush_storage(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
-		flush_cache(j->storage.get(), flush_write_cache, completed_jobs, l);
+		flush_cache(j->storage.get(), flush_write_cache, completed_jobs);
 		return 0;
 	}
 
@@ -3022,7 +3943,7 @@ namespace libtorrent
 	// have been evicted
 	int disk_io_thread::do_clear_piece(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == 0) return 0;
@@ -3136,6 +4057,7 @@ namespace libtorrent
 			mutex::scoped_lock l(m_job_mutex);
 			TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
 			m_queued_jobs.push_back(j);
+			add_write_in_flight(j);
 			return;
 		}
 
@@ -3161,30 +4083,46 @@ namespace libtorrent
 
 		TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
 		
-		// if there are at least 3 threads, there's a hasher thread
-		// and the hash jobs go into a separate queue
-		// see set_num_threads()
-		if (m_num_threads > 3 && j->action == disk_io_job::hash)
+		// if there are hashing threads, the hash jobs for pieces in the cache
+		// go into a separate queue. see set_num_hashing_threads() and
+		// async_hash()
+		if (m_num_hashing_threads > 0 && j->action == disk_io_job::hash
+			&& (j->flags & disk_io_job::cached_only))
 			m_queued_hash_jobs.push_back(j);
 		else
 			m_queued_jobs.push_back(j);
+		add_write_in_flight(j);
 	}
 
 	void disk_io_thread::submit_jobs()
 	{
 		mutex::scoped_lock l(m_job_mutex);
 		if (!m_queued_jobs.empty())
+		{
 			m_job_cond.notify_all();
+			wake_uring_waiters();
+		}
 		if (!m_queued_hash_jobs.empty())
 			m_hash_job_cond.notify_all();
 	}
 
 	void disk_io_thread::thread_fun(int thread_id, thread_type_t type)
 	{
-		DLOG("started disk thread %d\n", int(thread_id));
+		DLOG("started %s thread %d\n", type == hasher_thread ? "hasher" : "disk"
+			, int(thread_id));
 
 		++m_num_running_threads;
-		m_stats_counters.inc_stats_counter(counters::num_running_threads, 1);
+		m_stats_counters.inc_stats_counter(type == hasher_thread
+			? counters::num_hashing_threads : counters::num_running_threads, 1);
+
+		// each generic disk thread has its own io_uring, used for uncached
+		// reads and writes. It's created the first time it's needed. If it
+		// fails, we won't try again, but fall back to blocking I/O
+		boost::scoped_ptr<io_uring_queue> ring;
+		bool ring_failed = false;
+
+		disk_io_job* hash_batch[multi_hasher::max_lanes];
+		int num_hash_batch = 0;
 
 		mutex::scoped_lock l(m_job_mutex);
 		for (;;)
@@ -3193,67 +4131,220 @@ namespace libtorrent
 			if (type == generic_thread)
 			{
 				TORRENT_ASSERT(l.locked());
-				while (m_queued_jobs.empty() && thread_id < m_num_threads) m_job_cond.wait(l);
+				// the last thread also waits for the hashing threads to
+				// exit, since they may hand jobs over to us
+				while (m_queued_jobs.empty() && (thread_id < m_num_threads
+					|| (thread_id == 0 && m_num_running_hashing_threads > 0)))
+				{
+					if (ring && ring->num_pending() > 0)
+					{
+						// we have file operations in flight. Make sure
+						// they're all submitted, then block on the ring
+						// rather than on m_job_cond. New jobs (and changes
+						// to the number of threads) wake us up via
+						// wake_uring_waiters()
+						l.unlock();
+						submit_uring_jobs(*ring);
+						reap_uring_jobs(*ring);
+						l.lock();
+						if (ring->num_pending() > 0 && m_queued_jobs.empty()
+							&& (thread_id < m_num_threads
+								|| (thread_id == 0 && m_num_running_hashing_threads > 0)))
+						{
+							m_uring_waiters.push_back(ring.get());
+							l.unlock();
+							ring->wait();
+							l.lock();
+							m_uring_waiters.erase(std::find(m_uring_waiters.begin()
+								, m_uring_waiters.end(), ring.get()));
+						}
+						continue;
+					}
+					m_job_cond.wait(l);
+				}
 
 				// if the number of wanted threads is decreased,
 				// we may stop this thread
 				// when we're terminating the last thread (id=0), make sure
 				// we finish up all queued jobs first
-				if (thread_id >= m_num_threads && !(thread_id == 0 && m_queued_jobs.size() > 0))
+				if (thread_id >= m_num_threads && !(thread_id == 0
+					&& (m_queued_jobs.size() > 0 || m_num_running_hashing_threads > 0)))
 				{
+					if (ring && ring->num_pending() > 0)
+					{
+						// finish the outstanding file operations before
+						// exiting
+						l.unlock();
+						wait_uring_jobs(*ring);
+						l.lock();
+						continue;
+					}
 					// time to exit this thread.
 					break;
 				}
 
+				// writes were recorded in m_writes_in_flight when they were
+				// queued, they stay there until they've been performed
 				j = (disk_io_job*)m_queued_jobs.pop_front();
 			}
 			else if (type == hasher_thread)
 			{
 				TORRENT_ASSERT(l.locked());
-				while (m_queued_hash_jobs.empty() && thread_id < m_num_threads) m_hash_job_cond.wait(l);
-				if (m_queued_hash_jobs.empty() && thread_id >= m_num_threads) break;
+				while (m_queued_hash_jobs.empty() && thread_id < m_num_hashing_threads)
+					m_hash_job_cond.wait(l);
+				if (thread_id >= m_num_hashing_threads)
+				{
+					// if this was the last hashing thread, the remaining
+					// hash jobs go back to the generic disk threads
+					if (m_num_hashing_threads == 0 && !m_queued_hash_jobs.empty())
+					{
+						m_queued_jobs.append(m_queued_hash_jobs);
+						m_job_cond.notify_all();
+						wake_uring_waiters();
+					}
+					break;
+				}
 				j = (disk_io_job*)m_queued_hash_jobs.pop_front();
+				TORRENT_ASSERT(j->action == disk_io_job::hash);
+
+				// we don't touch any files in this thread. If the piece
+				// was evicted since the job was queued, do_hash() will
+				// bounce the job over to a generic disk thread
+				TORRENT_ASSERT(j->flags & disk_io_job::cached_only);
+			}
+
+			// if there are more hash jobs lined up behind this one, grab them
+			// too. Pieces that aren't in the cache can then be hashed in
+			// parallel. Only the first job waits for the writes to its piece
+			// to complete (below), so the batch stops at a piece that still
+			// has a write in flight
+			num_hash_batch = 0;
+			if (type == generic_thread && j->action == disk_io_job::hash)
+			{
+				hash_batch[num_hash_batch++] = j;
+				while (num_hash_batch < multi_hasher::max_lanes
+					&& !m_queued_jobs.empty())
+				{
+					disk_io_job* next = static_cast<disk_io_job*>(m_queued_jobs.first());
+					if (next->action != disk_io_job::hash
+						|| m_writes_in_flight.count(std::make_pair(next->storage.get()
+							, int(next->piece))) > 0)
+						break;
+					hash_batch[num_hash_batch++] = static_cast<disk_io_job*>(m_queued_jobs.pop_front());
+				}
 			}
 
 			l.unlock();
 
 			TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
 
-			if (thread_id == 0)
+			if (thread_id == 0 && type == generic_thread)
 			{
 				// there's no need for all threads to be doing this
 				time_point now = clock_type::now();
 				if (now > m_last_cache_expiry + seconds(5))
 				{
-					mutex::scoped_lock l2(m_cache_mutex);
 					DLOG("blocked_jobs: %d queued_jobs: %d num_threads %d\n"
 						, int(m_stats_counters[counters::blocked_disk_jobs])
 						, m_queued_jobs.size(), int(m_num_threads));
 					m_last_cache_expiry = now;
 					tailqueue completed_jobs;
-					flush_expired_write_blocks(completed_jobs, l2);
-					l2.unlock();
+					flush_expired_write_blocks(completed_jobs);
 					if (completed_jobs.size())
 						add_completed_jobs(completed_jobs);
 				}
 			}
 
+#if TORRENT_USE_IO_URING
+			if (type == generic_thread && !ring && !ring_failed
+				&& m_settings.get_bool(settings_pack::use_io_uring))
+			{
+				ring.reset(new io_uring_queue((std::max)(1
+					, m_settings.get_int(settings_pack::aio_max))));
+				if (!ring->is_open())
+				{
+					DLOG("disk thread %d: failed to set up io_uring\n", thread_id);
+					ring.reset();
+					ring_failed = true;
+				}
+			}
+#endif
+
+			if (ring)
+			{
+				// post any jobs whose file operations have completed
+				reap_uring_jobs(*ring);
+
+				if (try_issue_uring_job(j, *ring))
+				{
+					// the operations are submitted in a batch, once we run
+					// out of jobs or hit a job that can't be issued this way
+					l.lock();
+					continue;
+				}
+
+				// don't hold back the queued operations while we perform
+				// a blocking job
+				submit_uring_jobs(*ring);
+
+				// if we're about to hash a piece we're still writing, wait
+				// for the writes to complete rather than spinning on the job
+				while (j->action == disk_io_job::hash
+					&& ring->num_pending() > 0
+					&& write_in_flight(j))
+				{
+					wait_uring_jobs(*ring);
+				}
+			}
+
+			// once the job has been performed, it may have been completed
+			// and freed by another thread
+			piece_manager const* write_storage = j->action == disk_io_job::write
+				? j->storage.get() : NULL;
+			int const write_piece = j->piece;
+
 			tailqueue completed_jobs;
-			perform_job(j, completed_jobs);
+			if (num_hash_batch > 1)
+			{
+				perform_hash_batch(hash_batch, num_hash_batch, completed_jobs);
+			}
+			else if (type == hasher_thread)
+			{
+				m_stats_counters.inc_stats_counter(counters::num_running_hash_jobs, 1);
+				perform_job(j, completed_jobs);
+				m_stats_counters.inc_stats_counter(counters::num_running_hash_jobs, -1);
+			}
+			else
+			{
+				perform_job(j, completed_jobs);
+			}
+
+			if (write_storage)
+			{
+				l.lock();
+				clear_write_in_flight(write_storage, write_piece);
+				l.unlock();
+			}
 
-			mutex::scoped_lock l2(m_cache_mutex);
-			check_cache_level(l2, completed_jobs);
-			l2.unlock();
+			check_cache_level(completed_jobs);
 
 			if (completed_jobs.size())
 				add_completed_jobs(completed_jobs);
 
 			l.lock();
 		}
+		if (type == hasher_thread)
+		{
+			// the last generic disk thread may be waiting for us to exit
+			--m_num_running_hashing_threads;
+			m_job_cond.notify_all();
+			wake_uring_waiters();
+		}
 		l.unlock();
 
 		// do cleanup in the last running thread 
-		m_stats_counters.inc_stats_counter(counters::num_running_threads, -1);
+		m_stats_counters.inc_stats_counter(type == hasher_thread
+			? counters::num_hashing_threads : counters::num_running_threads, -1);
 		if (--m_num_running_threads > 0)
 		{
 			DLOG("exiting disk thread %d. num_threads: %d\n", thread_id, int(m_num_threads));
@@ -3267,14 +4358,14 @@ namespace libtorrent
 		// to read blocks in the disk cache. We need to wait until all
 		// references are removed from other threads before we can go
 		// ahead with the cleanup.
-		mutex::scoped_lock l2(m_cache_mutex);
-		while (m_disk_cache.pinned_blocks() > 0)
+		for (;;)
 		{
-			l2.unlock();
+			{
+				all_shards_lock l2(m_cache_mutex);
+				if (m_disk_cache.pinned_blocks() == 0) break;
+			}
 			sleep(100);
-			l2.lock();
 		}
-		l2.unlock();
 
 		DLOG("disk thread %d is the last one alive. cleaning up\n", thread_id);
 
@@ -3292,9 +4383,8 @@ namespace libtorrent
 
 #if TORRENT_USE_ASSERTS
 		// by now, all pieces should have been evicted
-		std::pair<block_cache::iterator, block_cache::iterator> pieces
-			= m_disk_cache.all_pieces();
-		TORRENT_ASSERT(pieces.first == pieces.second);
+		for (int i = 0; i < block_cache::num_shards; ++i)
+			TORRENT_ASSERT(m_disk_cache.num_pieces(i) == 0);
 #endif
 		// release the io_service to allow the run() call to return
 		// we do this once we stop posting new callbacks to it.
@@ -3396,7 +4486,7 @@ namespace libtorrent
 
 				if (j->action == disk_io_job::write)
 				{
-					mutex::scoped_lock l(m_cache_mutex);
+					mutex::scoped_lock l(cache_mutex(j));
 					cached_piece_entry* pe = m_disk_cache.find_piece(j);
 					if (pe)
 					{
@@ -3409,10 +4499,10 @@ namespace libtorrent
 #endif
 			tailqueue other_jobs;
 			tailqueue flush_jobs;
-			mutex::scoped_lock l_(m_cache_mutex);
 			while (new_jobs.size() > 0)
 			{
 				disk_io_job* j = (disk_io_job*)new_jobs.pop_front();
+				mutex::scoped_lock l_(cache_mutex(j));
 
 				if (j->action == disk_io_job::read
 					&& m_settings.get_bool(settings_pack::use_read_cache)
@@ -3475,9 +4565,10 @@ namespace libtorrent
 					flush_jobs.push_back(fj);
 				}
 			}
-			l_.unlock();
 
 			mutex::scoped_lock l(m_job_mutex);
+			for (tailqueue_iterator i = other_jobs.iterate(); i.get(); i.next())
+				add_write_in_flight(static_cast<disk_io_job const*>(i.get()));
 			m_queued_jobs.append(other_jobs);
 			l.unlock();
 
@@ -3487,7 +4578,9 @@ namespace libtorrent
 				add_job(j);
 			}
 
+			l.lock();
 			m_job_cond.notify_all();
+			wake_uring_waiters();
 		}
 
 		mutex::scoped_lock l(m_completed_jobs_mutex);
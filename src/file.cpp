@@ -97,6 +97,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <sys/types.h>
 #include <errno.h>
 #include <dirent.h>
+#if TORRENT_HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #ifdef TORRENT_LINUX
 // linux specifics
@@ -2154,6 +2157,55 @@ typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
 #endif
 	}
 
+	bool file::is_resident(boost::int64_t file_offset, int size) const
+	{
+#if TORRENT_HAVE_MMAP && defined TORRENT_LINUX
+		TORRENT_ASSERT(size > 0);
+		static size_t const page_size = size_t(sysconf(_SC_PAGESIZE));
+		boost::int64_t const start = file_offset & ~boost::int64_t(page_size - 1);
+		size_t const len = size_t(file_offset + size - start);
+
+		// mapping the range doesn't read anything, it's only there to ask
+		// mincore() about it
+		void* m = mmap(NULL, len, PROT_READ, MAP_SHARED, native_handle(), start);
+		if (m == MAP_FAILED) return false;
+
+		bool ret = true;
+		unsigned char vec[64];
+		for (size_t i = 0; i < len && ret; i += sizeof(vec) * page_size)
+		{
+			size_t const n = (std::min)(len - i, sizeof(vec) * page_size);
+			if (mincore(static_cast<char*>(m) + i, n, vec) != 0)
+			{
+				ret = false;
+				break;
+			}
+			for (size_t p = 0; p < (n + page_size - 1) / page_size; ++p)
+			{
+				if (vec[p] & 1) continue;
+				ret = false;
+				break;
+			}
+		}
+		munmap(m, len);
+		return ret;
+#else
+		(void)file_offset;
+		(void)size;
+		return false;
+#endif
+	}
+
+	void file::hint_read(boost::int64_t file_offset, int size)
+	{
+#if defined POSIX_FADV_WILLNEED && !defined TORRENT_WINDOWS
+		posix_fadvise(native_handle(), file_offset, size, POSIX_FADV_WILLNEED);
+#else
+		(void)file_offset;
+		(void)size;
+#endif
+	}
+
 	boost::int64_t file::sparse_end(boost::int64_t start) const
 	{
 #ifdef TORRENT_WINDOWS
@@ -2205,6 +2257,46 @@ typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
 #endif
 	}
 
+	bool file_mapping::supported()
+	{
+#if TORRENT_HAVE_MMAP && !defined TORRENT_WINDOWS
+		return sizeof(void*) >= 8;
+#else
+		return false;
+#endif
+	}
+
+	file_mapping::file_mapping(handle_type fd, boost::int64_t size, error_code& ec)
+		: m_base(NULL)
+		, m_size(0)
+		, m_refs(0)
+	{
+		if (!supported())
+		{
+			ec.assign(ENOSYS, get_posix_category());
+			return;
+		}
+#if TORRENT_HAVE_MMAP && !defined TORRENT_WINDOWS
+		TORRENT_ASSERT(size > 0);
+		void* ret = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (ret == MAP_FAILED)
+		{
+			ec.assign(errno, get_posix_category());
+			return;
+		}
+		m_base = static_cast<char*>(ret);
+		m_size = size;
+#endif
+	}
+
+	file_mapping::~file_mapping()
+	{
+		TORRENT_ASSERT(m_refs == 0);
+#if TORRENT_HAVE_MMAP && !defined TORRENT_WINDOWS
+		if (m_base) munmap(m_base, m_size);
+#endif
+	}
+
 #if TORRENT_DEBUG_FILE_LEAKS
 	std::set<file_handle*> global_file_handles;
 	mutex file_handle_mutex;
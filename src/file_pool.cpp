@@ -222,6 +222,36 @@ namespace libtorrent
 		return file_ptr;
 	}
 
+	boost::intrusive_ptr<file_mapping> file_pool::map_file(void* st
+		, int file_index, file_handle const& f, boost::int64_t size
+		, error_code& ec)
+	{
+		TORRENT_ASSERT(f);
+		TORRENT_ASSERT(size > 0);
+
+		mutex::scoped_lock l(m_mutex);
+
+		file_set::iterator i = m_files.find(std::make_pair(st, file_index));
+		if (i != m_files.end() && i->second.mapping
+			&& i->second.mapping->size() >= size)
+			return i->second.mapping;
+
+		// the file has grown since it was mapped, or it hasn't been mapped
+		// yet. Map all of it. Outstanding references keep the old mapping
+		// alive until they're released
+		boost::int64_t const file_size = f->get_size(ec);
+		if (ec || file_size < size) return boost::intrusive_ptr<file_mapping>();
+
+		boost::intrusive_ptr<file_mapping> ret(new file_mapping(
+			f->native_handle(), file_size, ec));
+		if (ec) return boost::intrusive_ptr<file_mapping>();
+
+		// the file may have been closed after it was opened by the caller, in
+		// which case the mapping just isn't cached
+		if (i != m_files.end()) i->second.mapping = ret;
+		return ret;
+	}
+
 	void file_pool::get_status(std::vector<pool_file_status>* files, void* st) const
 	{
 		mutex::scoped_lock l(m_mutex);
@@ -247,11 +277,13 @@ namespace libtorrent
 		if (i == m_files.end()) return;
 
 		file_handle file_ptr = i->second.file_ptr;
+		boost::intrusive_ptr<file_mapping> mapping = i->second.mapping;
 		m_files.erase(i);
 
 		// closing a file may be long running operation (mac os x)
 		l.unlock();
 		file_ptr.reset();
+		mapping.reset();
 		l.lock();
 	}
 
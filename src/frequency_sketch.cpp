@@ -0,0 +1,104 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/frequency_sketch.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <algorithm>
+
+namespace libtorrent
+{
+	namespace {
+		// odd multipliers used to derive the index of a key in each row
+		boost::uint32_t const row_seeds[frequency_sketch::depth] =
+		{ 0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu };
+	}
+
+	frequency_sketch::frequency_sketch()
+		: m_mask(0)
+		, m_additions(0)
+	{
+		resize(0);
+	}
+
+	void frequency_sketch::resize(int num_keys)
+	{
+		boost::uint32_t w = 64;
+		while (w < boost::uint32_t(num_keys) && w < 0x100000) w <<= 1;
+		if (w - 1 == m_mask && !m_table.empty()) return;
+
+		m_mask = w - 1;
+		m_table.assign(std::size_t(depth) * w, 0);
+		m_additions = 0;
+	}
+
+	int frequency_sketch::index(boost::uint32_t key, int row) const
+	{
+		boost::uint32_t h = key * row_seeds[row];
+		h ^= h >> 15;
+		return row * width() + int(h & m_mask);
+	}
+
+	void frequency_sketch::increment(boost::uint32_t key)
+	{
+		bool added = false;
+		for (int i = 0; i < depth; ++i)
+		{
+			boost::uint8_t& c = m_table[index(key, i)];
+			if (c >= max_count) continue;
+			++c;
+			added = true;
+		}
+
+		// keys that are saturated in every row don't count towards the
+		// sample, just like in TinyLFU
+		if (!added) return;
+		if (++m_additions >= 10 * width()) age();
+	}
+
+	int frequency_sketch::estimate(boost::uint32_t key) const
+	{
+		int ret = max_count;
+		for (int i = 0; i < depth; ++i)
+			ret = (std::min)(ret, int(m_table[index(key, i)]));
+		return ret;
+	}
+
+	void frequency_sketch::age()
+	{
+		for (std::vector<boost::uint8_t>::iterator i = m_table.begin()
+			, end(m_table.end()); i != end; ++i)
+			*i >>= 1;
+		m_additions /= 2;
+	}
+}
+
@@ -0,0 +1,358 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/io_uring_queue.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <errno.h>
+
+#if TORRENT_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+namespace libtorrent
+{
+#if TORRENT_USE_IO_URING
+	namespace
+	{
+		int sys_io_uring_setup(unsigned entries, io_uring_params* p)
+		{
+			return int(syscall(__NR_io_uring_setup, entries, p));
+		}
+
+		int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete
+			, unsigned flags)
+		{
+			return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete
+				, flags, NULL, 0));
+		}
+
+		int sys_io_uring_register(int fd, unsigned opcode, void* arg
+			, unsigned nr_args)
+		{
+			return int(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+		}
+
+		// the ring head and tail indices are shared with the kernel. The
+		// producer side publishes with release semantics and the consumer
+		// side reads with acquire semantics
+		unsigned load_acquire(unsigned const* p)
+		{ return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+
+		void store_release(unsigned* p, unsigned v)
+		{ __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+		char* offset_ptr(void* base, boost::uint32_t offset)
+		{ return static_cast<char*>(base) + offset; }
+	}
+#endif
+
+	io_uring_queue::io_uring_queue(int entries)
+		: m_ring_fd(-1)
+		, m_event_fd(-1)
+		, m_sq_ring(NULL)
+		, m_cq_ring(NULL)
+		, m_sqes(NULL)
+		, m_sq_ring_size(0)
+		, m_cq_ring_size(0)
+		, m_sqes_size(0)
+		, m_sq_head(NULL)
+		, m_sq_tail(NULL)
+		, m_sq_mask(NULL)
+		, m_sq_array(NULL)
+		, m_cq_head(NULL)
+		, m_cq_tail(NULL)
+		, m_cq_mask(NULL)
+		, m_cqes(NULL)
+		, m_capacity(0)
+		, m_pending(0)
+		, m_unsubmitted(0)
+	{
+#if TORRENT_USE_IO_URING
+		TORRENT_ASSERT(entries > 0);
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		int fd = sys_io_uring_setup(entries, &p);
+		// this is expected to fail on older kernels, or when the system call
+		// has been disabled. The caller will fall back to blocking I/O
+		if (fd < 0) return;
+		m_ring_fd = fd;
+
+		m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+
+		m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (m_sq_ring == MAP_FAILED) { m_sq_ring = NULL; close(); return; }
+
+		m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (m_cq_ring == MAP_FAILED) { m_cq_ring = NULL; close(); return; }
+
+		m_sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (m_sqes == MAP_FAILED) { m_sqes = NULL; close(); return; }
+
+		m_sq_head = reinterpret_cast<unsigned*>(offset_ptr(m_sq_ring, p.sq_off.head));
+		m_sq_tail = reinterpret_cast<unsigned*>(offset_ptr(m_sq_ring, p.sq_off.tail));
+		m_sq_mask = reinterpret_cast<unsigned*>(offset_ptr(m_sq_ring, p.sq_off.ring_mask));
+		m_sq_array = reinterpret_cast<unsigned*>(offset_ptr(m_sq_ring, p.sq_off.array));
+
+		m_cq_head = reinterpret_cast<unsigned*>(offset_ptr(m_cq_ring, p.cq_off.head));
+		m_cq_tail = reinterpret_cast<unsigned*>(offset_ptr(m_cq_ring, p.cq_off.tail));
+		m_cq_mask = reinterpret_cast<unsigned*>(offset_ptr(m_cq_ring, p.cq_off.ring_mask));
+		m_cqes = offset_ptr(m_cq_ring, p.cq_off.cqes);
+
+		// the owner blocks on this eventfd while operations are in flight,
+		// rather than in the kernel, to be able to also be woken up by
+		// wake(). Registering it requires linux 5.2
+		m_event_fd = eventfd(0, EFD_CLOEXEC);
+		if (m_event_fd < 0) { close(); return; }
+		if (sys_io_uring_register(m_ring_fd, IORING_REGISTER_EVENTFD
+			, &m_event_fd, 1) != 0)
+		{
+			close();
+			return;
+		}
+
+		// the completion queue is (at least) as large as the submission
+		// queue. By never having more operations outstanding than fit in the
+		// submission queue, the completion queue can't overflow
+		m_capacity = int(p.sq_entries);
+#else
+		(void)entries;
+#endif
+	}
+
+	io_uring_queue::~io_uring_queue()
+	{
+		// it's the owner's responsibility to reap all outstanding operations
+		// before destructing the queue. The buffers they refer to are owned
+		// by someone else
+		TORRENT_ASSERT(m_pending == 0);
+		close();
+	}
+
+	void io_uring_queue::close()
+	{
+#if TORRENT_USE_IO_URING
+		if (m_sqes) munmap(m_sqes, m_sqes_size);
+		if (m_cq_ring) munmap(m_cq_ring, m_cq_ring_size);
+		if (m_sq_ring) munmap(m_sq_ring, m_sq_ring_size);
+		if (m_ring_fd >= 0) ::close(m_ring_fd);
+		if (m_event_fd >= 0) ::close(m_event_fd);
+#endif
+		m_sqes = NULL;
+		m_cq_ring = NULL;
+		m_sq_ring = NULL;
+		m_ring_fd = -1;
+		m_event_fd = -1;
+		m_capacity = 0;
+	}
+
+	bool io_uring_queue::async_readv(handle_type fd, file::iovec_t const* bufs
+		, int num_bufs, boost::int64_t file_offset, void* userdata)
+	{
+#if TORRENT_USE_IO_URING
+		return queue_op(IORING_OP_READV, fd, bufs, num_bufs, file_offset, userdata);
+#else
+		return queue_op(0, fd, bufs, num_bufs, file_offset, userdata);
+#endif
+	}
+
+	bool io_uring_queue::async_writev(handle_type fd, file::iovec_t const* bufs
+		, int num_bufs, boost::int64_t file_offset, void* userdata)
+	{
+#if TORRENT_USE_IO_URING
+		return queue_op(IORING_OP_WRITEV, fd, bufs, num_bufs, file_offset, userdata);
+#else
+		return queue_op(0, fd, bufs, num_bufs, file_offset, userdata);
+#endif
+	}
+
+	bool io_uring_queue::queue_op(int op, handle_type fd, file::iovec_t const* bufs
+		, int num_bufs, boost::int64_t file_offset, void* userdata)
+	{
+#if TORRENT_USE_IO_URING
+		TORRENT_ASSERT(is_open());
+		TORRENT_ASSERT(num_bufs > 0);
+		if (!is_open() || m_pending >= m_capacity) return false;
+
+		// we're the only producer of the submission queue, no need to
+		// synchronize with ourself when reading the tail
+		unsigned const tail = *m_sq_tail;
+		unsigned const index = tail & *m_sq_mask;
+		io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = boost::uint8_t(op);
+		sqe->fd = fd;
+		sqe->off = boost::uint64_t(file_offset);
+		sqe->addr = reinterpret_cast<boost::uint64_t>(bufs);
+		sqe->len = boost::uint32_t(num_bufs);
+		sqe->user_data = reinterpret_cast<boost::uint64_t>(userdata);
+		m_sq_array[index] = index;
+		store_release(m_sq_tail, tail + 1);
+
+		++m_pending;
+		++m_unsubmitted;
+		return true;
+#else
+		(void)op;
+		(void)fd;
+		(void)bufs;
+		(void)num_bufs;
+		(void)file_offset;
+		(void)userdata;
+		return false;
+#endif
+	}
+
+	int io_uring_queue::submit(bool wait, error_code& ec)
+	{
+#if TORRENT_USE_IO_URING
+		TORRENT_ASSERT(is_open());
+		TORRENT_ASSERT(!wait || m_pending > 0);
+
+		int submitted = 0;
+		for (;;)
+		{
+			unsigned const flags = wait ? IORING_ENTER_GETEVENTS : 0;
+			int const ret = sys_io_uring_enter(m_ring_fd, m_unsubmitted
+				, wait ? 1 : 0, flags);
+			if (ret < 0)
+			{
+				// if we got interrupted, just try again
+				if (errno == EINTR) continue;
+				ec.assign(errno, get_posix_category());
+				return -1;
+			}
+			TORRENT_ASSERT(ret <= m_unsubmitted);
+			m_unsubmitted -= ret;
+			submitted += ret;
+			if (m_unsubmitted == 0) break;
+			// the kernel may accept fewer entries than we passed in, in
+			// which case we just keep pushing
+		}
+		return submitted;
+#else
+		(void)wait;
+		ec.assign(ENOSYS, get_posix_category());
+		return -1;
+#endif
+	}
+
+	int io_uring_queue::reap(completion* out, int num)
+	{
+#if TORRENT_USE_IO_URING
+		TORRENT_ASSERT(is_open());
+		unsigned head = *m_cq_head;
+		unsigned const tail = load_acquire(m_cq_tail);
+		unsigned const mask = *m_cq_mask;
+
+		int ret = 0;
+		while (head != tail && ret < num)
+		{
+			io_uring_cqe const* cqe = static_cast<io_uring_cqe const*>(m_cqes)
+				+ (head & mask);
+			out[ret].userdata = reinterpret_cast<void*>(cqe->user_data);
+			out[ret].result = cqe->res;
+			++ret;
+			++head;
+		}
+		// tell the kernel it can reuse the entries we just consumed
+		store_release(m_cq_head, head);
+		m_pending -= ret;
+		TORRENT_ASSERT(m_pending >= 0);
+		return ret;
+#else
+		(void)out;
+		(void)num;
+		return 0;
+#endif
+	}
+
+	void io_uring_queue::wait()
+	{
+#if TORRENT_USE_IO_URING
+		TORRENT_ASSERT(is_open());
+		boost::uint64_t count;
+		// reading resets the counter
+		while (read(m_event_fd, &count, sizeof(count)) < 0)
+		{
+			if (errno != EINTR) break;
+		}
+#endif
+	}
+
+	void io_uring_queue::wake()
+	{
+#if TORRENT_USE_IO_URING
+		TORRENT_ASSERT(is_open());
+		boost::uint64_t const one = 1;
+		while (write(m_event_fd, &one, sizeof(one)) < 0)
+		{
+			if (errno != EINTR) break;
+		}
+#endif
+	}
+
+	void io_uring_queue::take_unsubmitted(std::vector<void*>& out)
+	{
+#if TORRENT_USE_IO_URING
+		TORRENT_ASSERT(is_open());
+		// without SQPOLL, the kernel only consumes entries from the
+		// submission queue in io_uring_enter(). The ones it hasn't accepted
+		// are the last m_unsubmitted ones, and can be taken back by moving
+		// the tail
+		unsigned const tail = *m_sq_tail;
+		unsigned const mask = *m_sq_mask;
+		for (unsigned i = tail - unsigned(m_unsubmitted); i != tail; ++i)
+		{
+			io_uring_sqe const* sqe = static_cast<io_uring_sqe const*>(m_sqes)
+				+ m_sq_array[i & mask];
+			out.push_back(reinterpret_cast<void*>(sqe->user_data));
+		}
+		store_release(m_sq_tail, tail - unsigned(m_unsubmitted));
+		m_pending -= m_unsubmitted;
+		m_unsubmitted = 0;
+		TORRENT_ASSERT(m_pending >= 0);
+#else
+		(void)out;
+#endif
+	}
+}
@@ -0,0 +1,941 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/kademlia/dht_storage.hpp"
+
+#if TORRENT_HAVE_MMAP && !defined TORRENT_WINDOWS
+
+#include "libtorrent/kademlia/peer_store.hpp"
+#include "libtorrent/kademlia/item.hpp"
+#include "libtorrent/session_settings.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/bloom_filter.hpp"
+#include "libtorrent/socket_io.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/entry.hpp"
+#include "libtorrent/file.hpp" // for combine_path, rename, parent_path
+#include "libtorrent/crc32c.hpp"
+#include "libtorrent/aux_/time.hpp" // for aux::time_now()
+#include "libtorrent/assert.hpp"
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cstring> // for memcpy
+#include <ctime>
+#include <boost/noncopyable.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace libtorrent { namespace dht
+{
+
+namespace
+{
+	// The log is a file header followed by records. Every record starts with
+	// a record_header, followed by its payload, and is padded to a multiple
+	// of 8 bytes. The integers are stored in host byte order. The payloads
+	// are:
+	//
+	// peer_record       endpoint length (1 byte), compact endpoint, torrent
+	//                   name. flags is 1 for seeds
+	// immutable_record  the bencoded value
+	// mutable_record    seq (8 bytes), signature, public key, salt length (2
+	//                   bytes), salt, the bencoded value
+	// touch_record      empty. The item was put again at ``time``
+	// remove_record     empty. The item was evicted
+	//
+	// For item records and touch records, flags is the number of nodes that
+	// have put the item.
+	enum record_type
+	{
+		peer_record = 1,
+		immutable_record,
+		mutable_record,
+		touch_record,
+		remove_record
+	};
+
+	struct record_header
+	{
+		// crc32c of the record, from ``length`` to the end of the padding
+		boost::uint32_t crc;
+		boost::uint32_t magic;
+		// the size of the whole record, including this header and padding
+		boost::uint32_t length;
+		boost::uint16_t type;
+		boost::uint16_t flags;
+		// posix time of when this was logged
+		boost::int64_t time;
+		// the size of the payload
+		boost::uint32_t size;
+		// the info-hash or item target
+		char key[20];
+	};
+
+	char const file_magic[16] = "lt-dht-storage1";
+	boost::uint32_t const record_magic = 0x4c544452;
+	int const header_size = sizeof(record_header);
+	int const mutable_header_size = 8 + item_sig_len + item_pk_len + 2;
+
+	// immutable items expire this long (in seconds) after the last put
+	int const item_timeout = 60 * 60;
+
+	// the mapping (and the file) grows in steps of this many bytes
+	boost::int64_t const map_granularity = 1024 * 1024;
+
+	// the log is compacted when it's twice the size it had after the last
+	// compaction, and at least this large
+	boost::int64_t const min_compact_size = 1024 * 1024;
+
+	int pad(int size) { return (size + 7) & ~7; }
+
+	// extends the file to ``new_size`` bytes. The blocks are allocated up
+	// front where possible. A sparse file would only fail once the mapping
+	// is written to, with a SIGBUS, if the disk is full
+	bool grow_file(int fd, boost::int64_t old_size, boost::int64_t new_size)
+	{
+#if TORRENT_HAS_FALLOCATE
+		int const ret = posix_fallocate(fd, old_size, new_size - old_size);
+		if (ret == 0) return true;
+		// EINVAL means the filesystem doesn't support it
+		if (ret != EINVAL && ret != EOPNOTSUPP) return false;
+#else
+		(void)old_size;
+#endif
+		return ftruncate(fd, new_size) == 0;
+	}
+
+	// flushes the directory entries of the directory ``path`` is in, to make
+	// a rename of ``path`` durable
+	bool sync_parent_dir(std::string const& path)
+	{
+		std::string dir = parent_path(path);
+		if (dir.empty()) dir = ".";
+		int const fd = ::open(dir.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		bool const ret = fsync(fd) == 0;
+		::close(fd);
+		return ret;
+	}
+
+	boost::uint32_t record_crc(char const* rec, int length)
+	{
+		TORRENT_ASSERT(length % 8 == 0);
+		return crc32c(reinterpret_cast<boost::uint64_t const*>(rec + 8)
+			, (length - 8) / 8);
+	}
+
+	// writes the header of a record with a payload of ``size`` bytes to
+	// ``rec``, and clears the padding. Returns the length of the record
+	int init_record(char* rec, int type, int flags, sha1_hash const& key
+		, boost::int64_t time, int size)
+	{
+		int const length = pad(header_size + size);
+
+		record_header h;
+		memset(&h, 0, sizeof(h));
+		h.magic = record_magic;
+		h.length = boost::uint32_t(length);
+		h.type = boost::uint16_t(type);
+		h.flags = boost::uint16_t((std::min)(flags, 0xffff));
+		h.time = time;
+		h.size = boost::uint32_t(size);
+		memcpy(h.key, &key[0], sizeof(h.key));
+
+		memcpy(rec, &h, header_size);
+		// the padding is part of the checksum
+		memset(rec + length - 8, 0, 8);
+		return length;
+	}
+
+	// sets the checksum of a record, once its payload is in place
+	void seal_record(char* rec)
+	{
+		record_header h;
+		memcpy(&h, rec, header_size);
+		h.crc = record_crc(rec, h.length);
+		memcpy(rec, &h.crc, sizeof(h.crc));
+	}
+
+	int peer_payload_size(tcp::endpoint const& ep, int name_len)
+	{
+		return 1 + (ep.address().is_v4() ? 6 : 18) + name_len;
+	}
+
+	void write_peer_payload(char* p, tcp::endpoint const& ep
+		, char const* name, int name_len)
+	{
+		char* out = p + 1;
+		detail::write_endpoint(ep, out);
+		*p = char(out - p - 1);
+		if (name_len > 0) memcpy(out, name, name_len);
+	}
+
+	// the new log, written sequentially when compacting
+	struct log_writer
+	{
+		log_writer(int f) : fd(f), written(0), ok(true)
+		{ buf.reserve(flush_size + 0x10000); }
+
+		// reserves ``size`` bytes at the end of the log
+		char* append(int size)
+		{
+			buf.resize(buf.size() + size);
+			return &buf[buf.size() - size];
+		}
+
+		// the offset of the next byte appended
+		boost::int64_t offset() const { return written + buf.size(); }
+
+		void maybe_flush()
+		{
+			if (buf.size() >= flush_size) flush();
+		}
+
+		void flush()
+		{
+			char const* p = buf.empty() ? NULL : &buf[0];
+			int size = int(buf.size());
+			while (ok && size > 0)
+			{
+				int const ret = int(::write(fd, p, size));
+				if (ret <= 0) ok = false;
+				else
+				{
+					p += ret;
+					size -= ret;
+				}
+			}
+			written += buf.size();
+			buf.clear();
+		}
+
+		enum { flush_size = 1024 * 1024 };
+
+		int fd;
+		std::vector<char> buf;
+		boost::int64_t written;
+		bool ok;
+	};
+
+	// logs the peers of the peer_store when compacting
+	struct peer_writer
+	{
+		peer_writer(log_writer& w, boost::int64_t now) : m_w(w), m_now(now) {}
+
+		void operator()(sha1_hash const& info_hash, tcp::endpoint const& ep
+			, bool seed, int age, char const* name, int name_len) const
+		{
+			int const size = peer_payload_size(ep, name_len);
+			char* rec = m_w.append(pad(header_size + size));
+			init_record(rec, peer_record, seed ? 1 : 0, info_hash, m_now - age
+				, size);
+			write_peer_payload(rec + header_size, ep, name, name_len);
+			seal_record(rec);
+			m_w.maybe_flush();
+		}
+
+		log_writer& m_w;
+		boost::int64_t m_now;
+	};
+
+	struct item_index
+	{
+		item_index() : offset(0), num_announcers(0) {}
+
+		// the offset of the item's record in the log
+		boost::int64_t offset;
+		boost::int64_t seq;
+
+		// this counts the number of IPs we have seen
+		// announcing this item, this is used to determine
+		// popularity if we reach the limit of items to store
+		bloom_filter<128> ips;
+		// the last time we heard about this
+		time_point last_seen;
+		int num_announcers;
+	};
+
+	typedef std::map<sha1_hash, item_index> index_t;
+
+	// the on-disk storage. Peers are kept in a peer_store, as the default
+	// storage does, but every announce is logged as well so they can be
+	// restored. Items are only indexed in RAM, their records are read from
+	// the mapping.
+	class dht_disk_storage : public dht_storage_interface, boost::noncopyable
+	{
+	public:
+		dht_disk_storage(std::string const& path, sha1_hash const& id
+			, dht_settings const& settings, counters& cnt)
+			: m_id(id)
+			, m_settings(settings)
+			, m_counters(cnt)
+			, m_peers(settings, cnt)
+			, m_path(combine_path(path, "dht_storage.log"))
+			, m_fd(-1)
+			, m_map(NULL)
+			, m_map_size(0)
+			, m_end(0)
+			, m_compacted_size(0)
+		{
+			error_code ec;
+			create_directories(path, ec);
+			if (!open_log()) return;
+			replay();
+		}
+
+		~dht_disk_storage()
+		{
+			if (m_map)
+			{
+				msync(m_map, m_end, MS_ASYNC);
+				munmap(m_map, m_map_size);
+			}
+			if (m_fd >= 0) ::close(m_fd);
+			m_counters.inc_stats_counter(counters::dht_immutable_data
+				, -int(m_immutable.size()));
+			m_counters.inc_stats_counter(counters::dht_mutable_data
+				, -int(m_mutable.size()));
+		}
+
+		bool is_open() const { return m_map != NULL; }
+
+		bool get_peers(sha1_hash const& info_hash, bool noseed, bool scrape
+			, entry& peers) const
+		{
+			return m_peers.get_peers(info_hash, noseed, scrape, peers);
+		}
+
+		void announce_peer(sha1_hash const& info_hash
+			, tcp::endpoint const& endp, char const* name, int name_len
+			, bool seed)
+		{
+			m_peers.announce(info_hash, endp, seed, name, name_len
+				, aux::time_now());
+
+			if (name == NULL) name_len = 0;
+
+			boost::int64_t offset;
+			char* p = append_record(peer_record, seed ? 1 : 0, info_hash
+				, peer_payload_size(endp, name_len), offset);
+			if (p == NULL) return;
+			write_peer_payload(p, endp, name, name_len);
+			finish_record(offset);
+		}
+
+		bool get_immutable_item(sha1_hash const& target, entry& item) const
+		{
+			index_t::const_iterator i = m_immutable.find(target);
+			if (i == m_immutable.end()) return false;
+
+			record_header h = header(i->second.offset);
+			char const* v = m_map + i->second.offset + header_size;
+			item["v"] = bdecode(v, v + h.size);
+			return true;
+		}
+
+		void put_immutable_item(sha1_hash const& target, char const* buf
+			, int size, address const& addr)
+		{
+			index_t::iterator i = m_immutable.find(target);
+			if (i != m_immutable.end())
+			{
+				touch_item(target, i->second, addr);
+				return;
+			}
+
+			// make sure we don't add too many items
+			if (int(m_immutable.size()) >= m_settings.max_dht_items)
+				evict_immutable();
+
+			item_index to_add;
+			touch(to_add, addr);
+			char* p = append_record(immutable_record, to_add.num_announcers
+				, target, size, to_add.offset);
+			if (p == NULL) return;
+			memcpy(p, buf, size);
+			finish_record(to_add.offset);
+
+			m_immutable.insert(std::make_pair(target, to_add));
+			m_counters.inc_stats_counter(counters::dht_immutable_data);
+		}
+
+		bool get_mutable_item_seq(sha1_hash const& target
+			, boost::int64_t& seq) const
+		{
+			index_t::const_iterator i = m_mutable.find(target);
+			if (i == m_mutable.end()) return false;
+
+			seq = i->second.seq;
+			return true;
+		}
+
+		bool get_mutable_item(sha1_hash const& target, boost::int64_t seq
+			, bool force_fill, entry& item) const
+		{
+			index_t::const_iterator i = m_mutable.find(target);
+			if (i == m_mutable.end()) return false;
+
+			item["seq"] = i->second.seq;
+			if (force_fill || seq < i->second.seq)
+			{
+				record_header h = header(i->second.offset);
+				char const* p = m_map + i->second.offset + header_size + 8;
+				item["sig"] = std::string(p, item_sig_len);
+				p += item_sig_len;
+				item["k"] = std::string(p, item_pk_len);
+				p += item_pk_len;
+				boost::uint16_t salt_size;
+				memcpy(&salt_size, p, 2);
+				p += 2 + salt_size;
+				int const size = int(h.size) - mutable_header_size - salt_size;
+				item["v"] = bdecode(p, p + size);
+			}
+			return true;
+		}
+
+		void put_mutable_item(sha1_hash const& target
+			, char const* buf, int size
+			, char const* sig
+			, boost::int64_t seq
+			, char const* pk
+			, char const* salt, int salt_size
+			, address const& addr)
+		{
+			index_t::iterator i = m_mutable.find(target);
+			if (i != m_mutable.end() && i->second.seq >= seq)
+			{
+				touch_item(target, i->second, addr);
+				return;
+			}
+
+			// make sure we don't add too many items
+			if (i == m_mutable.end()
+				&& int(m_mutable.size()) >= m_settings.max_dht_items)
+				evict_mutable();
+
+			item_index to_add;
+			if (i != m_mutable.end()) to_add = i->second;
+			touch(to_add, addr);
+			to_add.seq = seq;
+
+			boost::int64_t offset;
+			char* p = append_record(mutable_record, to_add.num_announcers
+				, target, mutable_header_size + salt_size + size, offset);
+			if (p == NULL) return;
+			memcpy(p, &seq, 8);
+			p += 8;
+			memcpy(p, sig, item_sig_len);
+			p += item_sig_len;
+			memcpy(p, pk, item_pk_len);
+			p += item_pk_len;
+			boost::uint16_t const salt_len = boost::uint16_t(salt_size);
+			memcpy(p, &salt_len, 2);
+			p += 2;
+			if (salt_size > 0) memcpy(p, salt, salt_size);
+			memcpy(p + salt_size, buf, size);
+			finish_record(offset);
+			to_add.offset = offset;
+
+			if (i != m_mutable.end())
+			{
+				i->second = to_add;
+				return;
+			}
+			m_mutable.insert(std::make_pair(target, to_add));
+			m_counters.inc_stats_counter(counters::dht_mutable_data);
+		}
+
+		void tick()
+		{
+			time_point const now(aux::time_now());
+			expire_items(now);
+
+			// look through all peers and see if any have timed out
+			m_peers.tick(now);
+
+			if (m_map == NULL) return;
+			msync(m_map, m_end, MS_ASYNC);
+
+			if (m_end > 2 * m_compacted_size && m_end > min_compact_size)
+				compact();
+		}
+
+		int num_torrents() const { return m_peers.num_torrents(); }
+		int num_peers() const { return m_peers.num_peers(); }
+
+	private:
+
+		record_header header(boost::int64_t offset) const
+		{
+			record_header ret;
+			memcpy(&ret, m_map + offset, header_size);
+			return ret;
+		}
+
+		void touch(item_index& f, address const& addr)
+		{
+			f.last_seen = aux::time_now();
+
+			// maybe increase num_announcers if we haven't seen this IP before
+			sha1_hash iphash;
+			hash_address(addr, iphash);
+			if (!f.ips.find(iphash))
+			{
+				f.ips.set(iphash);
+				++f.num_announcers;
+			}
+		}
+
+		// an item was put again, without changing it
+		void touch_item(sha1_hash const& target, item_index& f
+			, address const& addr)
+		{
+			touch(f, addr);
+			boost::int64_t offset;
+			if (append_record(touch_record, f.num_announcers, target, 0, offset))
+				finish_record(offset);
+		}
+
+		void log_removal(sha1_hash const& target)
+		{
+			boost::int64_t offset;
+			if (append_record(remove_record, 0, target, 0, offset))
+				finish_record(offset);
+		}
+
+		// delete the least important item (i.e. the one the fewest peers are
+		// announcing, and farthest from our node ID)
+		void evict_immutable()
+		{
+			index_t::iterator j = m_immutable.end();
+			int worst = 0;
+			for (index_t::iterator i = m_immutable.begin()
+				, end(m_immutable.end()); i != end; ++i)
+			{
+				int const score = item_importance(i->first, m_id
+					, i->second.num_announcers);
+				if (j != m_immutable.end() && score >= worst) continue;
+				j = i;
+				worst = score;
+			}
+			if (j == m_immutable.end()) return;
+			log_removal(j->first);
+			m_immutable.erase(j);
+			m_counters.inc_stats_counter(counters::dht_immutable_data, -1);
+		}
+
+		// delete the least important mutable item (i.e. the one the fewest
+		// peers are announcing)
+		void evict_mutable()
+		{
+			index_t::iterator j = m_mutable.end();
+			for (index_t::iterator i = m_mutable.begin()
+				, end(m_mutable.end()); i != end; ++i)
+			{
+				if (j != m_mutable.end()
+					&& i->second.num_announcers >= j->second.num_announcers)
+					continue;
+				j = i;
+			}
+			if (j == m_mutable.end()) return;
+			log_removal(j->first);
+			m_mutable.erase(j);
+			m_counters.inc_stats_counter(counters::dht_mutable_data, -1);
+		}
+
+		void expire_items(time_point now)
+		{
+			for (index_t::iterator i = m_immutable.begin(); i != m_immutable.end();)
+			{
+				if (i->second.last_seen + seconds(item_timeout) > now)
+				{
+					++i;
+					continue;
+				}
+				m_immutable.erase(i++);
+				m_counters.inc_stats_counter(counters::dht_immutable_data, -1);
+			}
+		}
+
+		bool open_log()
+		{
+			m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0666);
+			if (m_fd < 0) return false;
+
+			struct stat st;
+			if (fstat(m_fd, &st) != 0) return false;
+			boost::int64_t size = st.st_size;
+
+			// start over if this isn't one of our logs
+			char magic[sizeof(file_magic)];
+			if (size < boost::int64_t(sizeof(file_magic))
+				|| pread(m_fd, magic, sizeof(magic), 0) != sizeof(magic)
+				|| memcmp(magic, file_magic, sizeof(magic)) != 0)
+			{
+				if (ftruncate(m_fd, 0) != 0) return false;
+				if (pwrite(m_fd, file_magic, sizeof(file_magic), 0)
+					!= sizeof(file_magic)) return false;
+				size = sizeof(file_magic);
+			}
+
+			m_end = sizeof(file_magic);
+			return map_file(size);
+		}
+
+		// maps the log, making sure at least ``size`` bytes of it are mapped
+		bool map_file(boost::int64_t size)
+		{
+			boost::int64_t const map_size = (size + map_granularity - 1)
+				& ~(map_granularity - 1);
+
+			if (m_map)
+			{
+				munmap(m_map, m_map_size);
+				m_map = NULL;
+				m_map_size = 0;
+			}
+
+			struct stat st;
+			if (fstat(m_fd, &st) != 0) return false;
+			if (st.st_size < map_size && !grow_file(m_fd, st.st_size, map_size))
+				return false;
+
+			void* p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED
+				, m_fd, 0);
+			if (p == MAP_FAILED) return false;
+			m_map = static_cast<char*>(p);
+			m_map_size = map_size;
+			return true;
+		}
+
+		// reserves space for a record at the end of the log and fills in its
+		// header. Returns a pointer to where the payload goes, or NULL if the
+		// log couldn't be grown. The record must be completed with
+		// finish_record() before the next call
+		char* append_record(int type, int flags, sha1_hash const& key
+			, int size, boost::int64_t& offset)
+		{
+			if (m_map == NULL) return NULL;
+
+			int const length = pad(header_size + size);
+			if (m_end + length > m_map_size)
+			{
+				// grow by at least the current size, up to 64 MiB at a time
+				boost::int64_t const grow = (std::min)(m_map_size
+					, boost::int64_t(64) * map_granularity);
+				if (!map_file((std::max)(m_end + length, m_map_size + grow)))
+				{
+					// we can't write to the log anymore. Keep the mapping
+					// we had, if possible
+					if (!map_file(m_end)) drop_items();
+					return NULL;
+				}
+			}
+
+			offset = m_end;
+			m_end += length;
+
+			char* rec = m_map + offset;
+			init_record(rec, type, flags, key, std::time(NULL), size);
+			return rec + header_size;
+		}
+
+		void finish_record(boost::int64_t offset)
+		{
+			seal_record(m_map + offset);
+		}
+
+		// returns the length of the record at ``offset``, or 0 if there's no
+		// valid record there
+		int valid_record(char const* buf, boost::int64_t offset
+			, boost::int64_t end) const
+		{
+			if (offset + header_size > end) return 0;
+			record_header h;
+			memcpy(&h, buf + offset, header_size);
+			if (h.magic != record_magic
+				|| h.length < boost::uint32_t(header_size)
+				|| h.length % 8 != 0
+				|| h.length > end - offset
+				|| h.size > h.length - header_size
+				|| h.type < peer_record || h.type > remove_record)
+				return 0;
+			if (record_crc(buf + offset, h.length) != h.crc) return 0;
+			if (h.type == mutable_record)
+			{
+				if (h.size < boost::uint32_t(mutable_header_size)) return 0;
+				boost::uint16_t salt_size;
+				memcpy(&salt_size, buf + offset + header_size
+					+ mutable_header_size - 2, 2);
+				if (salt_size > h.size - mutable_header_size) return 0;
+			}
+			if (h.type == peer_record)
+			{
+				if (h.size < 1) return 0;
+				int const ep_len = boost::uint8_t(buf[offset + header_size]);
+				if ((ep_len != 6 && ep_len != 18) || ep_len + 1 > int(h.size))
+					return 0;
+			}
+			return int(h.length);
+		}
+
+		// restores the peers and items from the log. The log ends at the
+		// first record that isn't valid, which is where the next record will
+		// be written
+		void replay()
+		{
+			boost::int64_t const now_posix = std::time(NULL);
+			time_point const now = aux::time_now();
+
+			boost::int64_t offset = m_end;
+			for (;;)
+			{
+				int const length = valid_record(m_map, offset, m_map_size);
+				if (length == 0) break;
+
+				record_header h = header(offset);
+				sha1_hash key(h.key);
+				// clamp the age, in case the clock has been set back
+				boost::int64_t const age = (std::max)(boost::int64_t(0)
+					, now_posix - h.time);
+				time_point const t = now - seconds(int((std::min)(age
+					, boost::int64_t(10 * item_timeout))));
+
+				switch (h.type)
+				{
+					case peer_record:
+					{
+						if (age >= peer_store::peer_timeout) break;
+						char const* p = m_map + offset + header_size;
+						int const ep_len = boost::uint8_t(*p++);
+						tcp::endpoint ep;
+#if TORRENT_USE_IPV6
+						if (ep_len == 18) ep = detail::read_v6_endpoint<tcp::endpoint>(p);
+						else
+#endif
+						if (ep_len == 6) ep = detail::read_v4_endpoint<tcp::endpoint>(p);
+						else break;
+						int const name_len = int(h.size) - 1 - ep_len;
+						m_peers.announce(key, ep, h.flags & 1
+							, name_len > 0 ? p : NULL, name_len, t);
+						break;
+					}
+					case immutable_record:
+					case mutable_record:
+					{
+						item_index& f = (h.type == immutable_record
+							? m_immutable : m_mutable)[key];
+						f.offset = offset;
+						f.last_seen = t;
+						f.num_announcers = h.flags;
+						if (h.type == mutable_record)
+							memcpy(&f.seq, m_map + offset + header_size, 8);
+						break;
+					}
+					case touch_record:
+					{
+						index_t::iterator i = m_immutable.find(key);
+						item_index* f = i == m_immutable.end() ? NULL : &i->second;
+						if (f == NULL)
+						{
+							i = m_mutable.find(key);
+							if (i == m_mutable.end()) break;
+							f = &i->second;
+						}
+						f->last_seen = t;
+						f->num_announcers = h.flags;
+						break;
+					}
+					case remove_record:
+						m_immutable.erase(key);
+						m_mutable.erase(key);
+						break;
+				}
+				offset += length;
+			}
+			m_end = offset;
+			m_compacted_size = offset;
+
+			m_counters.inc_stats_counter(counters::dht_immutable_data
+				, int(m_immutable.size()));
+			m_counters.inc_stats_counter(counters::dht_mutable_data
+				, int(m_mutable.size()));
+
+			expire_items(now);
+			while (int(m_immutable.size()) > m_settings.max_dht_items)
+				evict_immutable();
+			while (int(m_mutable.size()) > m_settings.max_dht_items)
+				evict_mutable();
+		}
+
+		// rewrites the log to a new file, with the peers we have and a record
+		// for each item, and replaces the log with it. This is called from
+		// tick(), i.e. on the network thread with the node's storage mutex
+		// held, so DHT requests (including the ones handled by request
+		// threads) wait for it. The work is bounded by the live content, at
+		// most max_dht_items items of each kind plus the peer_store, not by
+		// the size of the log
+		void compact()
+		{
+			std::string const tmp_path = m_path + ".tmp";
+			int const fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+			if (fd < 0) return;
+
+			boost::int64_t const now_posix = std::time(NULL);
+			time_point const now = aux::time_now();
+
+			log_writer w(fd);
+			memcpy(w.append(sizeof(file_magic)), file_magic, sizeof(file_magic));
+
+			m_peers.for_each_peer(peer_writer(w, now_posix), now);
+
+			// the new offsets of the items, applied once the new log is in place
+			std::vector<std::pair<item_index*, boost::int64_t> > moved;
+			moved.reserve(m_immutable.size() + m_mutable.size());
+
+			index_t* tables[] = { &m_immutable, &m_mutable };
+			for (int t = 0; t < 2; ++t)
+			{
+				for (index_t::iterator i = tables[t]->begin()
+					, end(tables[t]->end()); i != end; ++i)
+				{
+					item_index& f = i->second;
+					record_header h = header(f.offset);
+					moved.push_back(std::make_pair(&f, w.offset()));
+
+					// fold the touch records into the item record
+					char* rec = w.append(h.length);
+					init_record(rec, h.type, f.num_announcers, i->first
+						, now_posix - total_seconds(now - f.last_seen), h.size);
+					memcpy(rec + header_size, m_map + f.offset + header_size, h.size);
+					seal_record(rec);
+					w.maybe_flush();
+				}
+			}
+			w.flush();
+
+			// the new log has to be on disk before it replaces the old one,
+			// or a crash could leave a truncated log in its place
+			if (w.ok && fsync(fd) != 0) w.ok = false;
+
+			error_code ec;
+			if (w.ok) rename(tmp_path, m_path, ec);
+			if (!w.ok || ec)
+			{
+				::close(fd);
+				remove(tmp_path, ec);
+				return;
+			}
+			sync_parent_dir(m_path);
+
+			munmap(m_map, m_map_size);
+			m_map = NULL;
+			m_map_size = 0;
+			::close(m_fd);
+			m_fd = fd;
+			m_end = w.written;
+			m_compacted_size = w.written;
+
+			for (std::vector<std::pair<item_index*, boost::int64_t> >::iterator i
+				= moved.begin(), end(moved.end()); i != end; ++i)
+				i->first->offset = i->second;
+
+			if (!map_file(m_end)) drop_items();
+		}
+
+		// called when the log can't be mapped anymore. The items are read
+		// from the mapping, so they're lost too
+		void drop_items()
+		{
+			TORRENT_ASSERT(m_map == NULL);
+			m_counters.inc_stats_counter(counters::dht_immutable_data
+				, -int(m_immutable.size()));
+			m_counters.inc_stats_counter(counters::dht_mutable_data
+				, -int(m_mutable.size()));
+			m_immutable.clear();
+			m_mutable.clear();
+		}
+
+		sha1_hash m_id;
+		dht_settings const& m_settings;
+		counters& m_counters;
+
+		peer_store m_peers;
+		index_t m_immutable;
+		index_t m_mutable;
+
+		std::string m_path;
+		int m_fd;
+
+		// the log is mapped from the start, m_map_size bytes. m_end is where
+		// the next record goes
+		char* m_map;
+		boost::int64_t m_map_size;
+		boost::int64_t m_end;
+
+		// the size of the log when it was last compacted (or opened)
+		boost::int64_t m_compacted_size;
+	};
+}
+
+dht_storage_interface* dht_disk_storage_constructor(std::string const& path
+	, sha1_hash const& id, dht_settings const& settings, counters& cnt)
+{
+	dht_disk_storage* ret = new dht_disk_storage(path, id, settings, cnt);
+	if (ret->is_open()) return ret;
+	delete ret;
+	return dht_default_storage_constructor(id, settings, cnt);
+}
+
+} } // namespace libtorrent::dht
+
+#else
+
+namespace libtorrent { namespace dht
+{
+
+dht_storage_interface* dht_disk_storage_constructor(std::string const&
+	, sha1_hash const& id, dht_settings const& settings, counters& cnt)
+{
+	return dht_default_storage_constructor(id, settings, cnt);
+}
+
+} } // namespace libtorrent::dht
+
+#endif // TORRENT_HAVE_MMAP
@@ -0,0 +1,353 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/kademlia/dht_storage.hpp"
+#include "libtorrent/kademlia/peer_store.hpp"
+#include "libtorrent/kademlia/node_id.hpp"
+#include "libtorrent/kademlia/item.hpp"
+#include "libtorrent/session_settings.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/bloom_filter.hpp"
+#include "libtorrent/socket_io.hpp" // for hash_address
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/entry.hpp"
+#include "libtorrent/aux_/time.hpp" // for aux::time_now()
+#include "libtorrent/assert.hpp"
+
+#include <map>
+#include <algorithm>
+#include <cstdlib> // for malloc
+#include <cstring> // for memcpy
+#include <boost/tuple/tuple.hpp>
+
+namespace libtorrent { namespace dht
+{
+
+int item_importance(sha1_hash const& target, sha1_hash const& our_id
+	, int num_announcers)
+{
+	return num_announcers / 5 - distance_exp(target, our_id);
+}
+
+namespace
+{
+	struct dht_immutable_item
+	{
+		dht_immutable_item() : value(0), num_announcers(0), size(0) {}
+		// malloced space for the actual value
+		char* value;
+		// this counts the number of IPs we have seen
+		// announcing this item, this is used to determine
+		// popularity if we reach the limit of items to store
+		bloom_filter<128> ips;
+		// the last time we heard about this
+		time_point last_seen;
+		// number of IPs in the bloom filter
+		int num_announcers;
+		// size of malloced space pointed to by value
+		int size;
+	};
+
+	struct dht_mutable_item : dht_immutable_item
+	{
+		char sig[item_sig_len];
+		boost::int64_t seq;
+		char key[item_pk_len];
+		char* salt;
+		int salt_size;
+	};
+
+	void touch_item(dht_immutable_item* f, address const& addr)
+	{
+		f->last_seen = aux::time_now();
+
+		// maybe increase num_announcers if we haven't seen this IP before
+		sha1_hash iphash;
+		hash_address(addr, iphash);
+		if (!f->ips.find(iphash))
+		{
+			f->ips.set(iphash);
+			++f->num_announcers;
+		}
+	}
+
+	// return true of the first argument is a better canidate for removal,
+	// i.e. less important to keep
+	struct immutable_item_comparator
+	{
+		immutable_item_comparator(node_id const& our_id) : m_our_id(our_id) {}
+
+		bool operator() (std::pair<node_id const, dht_immutable_item> const& lhs
+			, std::pair<node_id const, dht_immutable_item> const& rhs) const
+		{
+			return item_importance(lhs.first, m_our_id, lhs.second.num_announcers)
+				< item_importance(rhs.first, m_our_id, rhs.second.num_announcers);
+		}
+
+		node_id const& m_our_id;
+	};
+
+	struct mutable_item_comparator
+	{
+		bool operator() (std::pair<node_id const, dht_mutable_item> const& lhs
+			, std::pair<node_id const, dht_mutable_item> const& rhs) const
+		{ return lhs.second.num_announcers < rhs.second.num_announcers; }
+	};
+
+	// the default storage, keeping everything in RAM
+	class dht_default_storage : public dht_storage_interface, boost::noncopyable
+	{
+		typedef std::map<node_id, dht_immutable_item> dht_immutable_table_t;
+		typedef std::map<node_id, dht_mutable_item> dht_mutable_table_t;
+
+	public:
+		dht_default_storage(sha1_hash const& id, dht_settings const& settings
+			, counters& cnt)
+			: m_id(id)
+			, m_settings(settings)
+			, m_counters(cnt)
+			, m_peers(settings, cnt)
+		{}
+
+		~dht_default_storage()
+		{
+			for (dht_immutable_table_t::iterator i = m_immutable_table.begin()
+				, end(m_immutable_table.end()); i != end; ++i)
+			{
+				free(i->second.value);
+			}
+			for (dht_mutable_table_t::iterator i = m_mutable_table.begin()
+				, end(m_mutable_table.end()); i != end; ++i)
+			{
+				free(i->second.value);
+				free(i->second.salt);
+			}
+			m_counters.inc_stats_counter(counters::dht_immutable_data
+				, -int(m_immutable_table.size()));
+			m_counters.inc_stats_counter(counters::dht_mutable_data
+				, -int(m_mutable_table.size()));
+		}
+
+		bool get_peers(sha1_hash const& info_hash, bool noseed, bool scrape
+			, entry& peers) const
+		{
+			return m_peers.get_peers(info_hash, noseed, scrape, peers);
+		}
+
+		void announce_peer(sha1_hash const& info_hash
+			, tcp::endpoint const& endp, char const* name, int name_len
+			, bool seed)
+		{
+			m_peers.announce(info_hash, endp, seed, name, name_len
+				, aux::time_now());
+		}
+
+		bool get_immutable_item(sha1_hash const& target, entry& item) const
+		{
+			dht_immutable_table_t::const_iterator i = m_immutable_table.find(target);
+			if (i == m_immutable_table.end()) return false;
+
+			item["v"] = bdecode(i->second.value, i->second.value + i->second.size);
+			return true;
+		}
+
+		void put_immutable_item(sha1_hash const& target, char const* buf
+			, int size, address const& addr)
+		{
+			dht_immutable_table_t::iterator i = m_immutable_table.find(target);
+			if (i == m_immutable_table.end())
+			{
+				// make sure we don't add too many items
+				if (int(m_immutable_table.size()) >= m_settings.max_dht_items)
+				{
+					// delete the least important one (i.e. the one
+					// the fewest peers are announcing, and farthest
+					// from our node ID)
+					dht_immutable_table_t::iterator j = std::min_element(m_immutable_table.begin()
+						, m_immutable_table.end()
+						, immutable_item_comparator(m_id));
+
+					TORRENT_ASSERT(j != m_immutable_table.end());
+					free(j->second.value);
+					m_immutable_table.erase(j);
+					m_counters.inc_stats_counter(counters::dht_immutable_data, -1);
+				}
+				dht_immutable_item to_add;
+				to_add.value = (char*)malloc(size);
+				to_add.size = size;
+				memcpy(to_add.value, buf, size);
+
+				boost::tie(i, boost::tuples::ignore) = m_immutable_table.insert(
+					std::make_pair(target, to_add));
+				m_counters.inc_stats_counter(counters::dht_immutable_data);
+			}
+
+			touch_item(&i->second, addr);
+		}
+
+		bool get_mutable_item_seq(sha1_hash const& target
+			, boost::int64_t& seq) const
+		{
+			dht_mutable_table_t::const_iterator i = m_mutable_table.find(target);
+			if (i == m_mutable_table.end()) return false;
+
+			seq = i->second.seq;
+			return true;
+		}
+
+		bool get_mutable_item(sha1_hash const& target, boost::int64_t seq
+			, bool force_fill, entry& item) const
+		{
+			dht_mutable_table_t::const_iterator i = m_mutable_table.find(target);
+			if (i == m_mutable_table.end()) return false;
+
+			dht_mutable_item const& f = i->second;
+			item["seq"] = f.seq;
+			if (force_fill || seq < f.seq)
+			{
+				item["v"] = bdecode(f.value, f.value + f.size);
+				item["sig"] = std::string(f.sig, f.sig + sizeof(f.sig));
+				item["k"] = std::string(f.key, f.key + sizeof(f.key));
+			}
+			return true;
+		}
+
+		void put_mutable_item(sha1_hash const& target
+			, char const* buf, int size
+			, char const* sig
+			, boost::int64_t seq
+			, char const* pk
+			, char const* salt, int salt_size
+			, address const& addr)
+		{
+			dht_mutable_table_t::iterator i = m_mutable_table.find(target);
+			if (i == m_mutable_table.end())
+			{
+				// this is the case where we don't have an item in this slot
+				// make sure we don't add too many items
+				if (int(m_mutable_table.size()) >= m_settings.max_dht_items)
+				{
+					// delete the least important one (i.e. the one
+					// the fewest peers are announcing)
+					dht_mutable_table_t::iterator j = std::min_element(m_mutable_table.begin()
+						, m_mutable_table.end()
+						, mutable_item_comparator());
+					TORRENT_ASSERT(j != m_mutable_table.end());
+					free(j->second.value);
+					free(j->second.salt);
+					m_mutable_table.erase(j);
+					m_counters.inc_stats_counter(counters::dht_mutable_data, -1);
+				}
+				dht_mutable_item to_add;
+				to_add.value = (char*)malloc(size);
+				to_add.size = size;
+				to_add.seq = seq;
+				to_add.salt = NULL;
+				to_add.salt_size = 0;
+				if (salt_size > 0)
+				{
+					to_add.salt = (char*)malloc(salt_size);
+					to_add.salt_size = salt_size;
+					memcpy(to_add.salt, salt, salt_size);
+				}
+				memcpy(to_add.sig, sig, sizeof(to_add.sig));
+				memcpy(to_add.value, buf, size);
+				memcpy(to_add.key, pk, sizeof(to_add.key));
+
+				boost::tie(i, boost::tuples::ignore) = m_mutable_table.insert(
+					std::make_pair(target, to_add));
+				m_counters.inc_stats_counter(counters::dht_mutable_data);
+			}
+			else
+			{
+				// this is the case where we already have the item
+				dht_mutable_item* item = &i->second;
+
+				if (item->seq < seq)
+				{
+					if (item->size != size)
+					{
+						free(item->value);
+						item->value = (char*)malloc(size);
+						item->size = size;
+					}
+					item->seq = seq;
+					memcpy(item->sig, sig, sizeof(item->sig));
+					memcpy(item->value, buf, size);
+				}
+			}
+
+			touch_item(&i->second, addr);
+		}
+
+		void tick()
+		{
+			time_point const now(aux::time_now());
+
+			for (dht_immutable_table_t::iterator i = m_immutable_table.begin();
+				i != m_immutable_table.end();)
+			{
+				if (i->second.last_seen + minutes(60) > now)
+				{
+					++i;
+					continue;
+				}
+				free(i->second.value);
+				m_immutable_table.erase(i++);
+				m_counters.inc_stats_counter(counters::dht_immutable_data, -1);
+			}
+
+			// look through all peers and see if any have timed out
+			m_peers.tick(now);
+		}
+
+		int num_torrents() const { return m_peers.num_torrents(); }
+		int num_peers() const { return m_peers.num_peers(); }
+
+	private:
+		sha1_hash m_id;
+		dht_settings const& m_settings;
+		counters& m_counters;
+
+		peer_store m_peers;
+		dht_immutable_table_t m_immutable_table;
+		dht_mutable_table_t m_mutable_table;
+	};
+}
+
+dht_storage_interface* dht_default_storage_constructor(sha1_hash const& id
+	, dht_settings const& settings, counters& cnt)
+{
+	return new dht_default_storage(id, settings, cnt);
+}
+
+} } // namespace libtorrent::dht
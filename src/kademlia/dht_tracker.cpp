@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <numeric>
 #include <boost/bind.hpp>
 #include <boost/ref.hpp>
+#include <boost/make_shared.hpp>
 
 #include "libtorrent/kademlia/node.hpp"
 #include "libtorrent/kademlia/node_id.hpp"
@@ -136,10 +137,12 @@ namespace libtorrent { namespace dht
 	// unit and connecting them together.
 	dht_tracker::dht_tracker(libtorrent::aux::session_impl& ses
 		, rate_limited_udp_socket& sock
-		, dht_settings const& settings, counters& cnt, entry const* state)
+		, dht_settings const& settings, counters& cnt, entry const* state
+		, dht_storage_constructor_type const& storage_constructor)
 		: m_counters(cnt)
 		, m_dht(&ses, this, settings, extract_node_id(state)
-			, ses.external_address().external_address(address_v4()), &ses, cnt)
+			, ses.external_address().external_address(address_v4()), &ses, cnt
+			, storage_constructor)
 		, m_sock(sock)
 		, m_last_new_key(aux::time_now() - minutes(int(key_refresh)))
 		, m_timer(sock.get_io_service())
@@ -149,6 +152,9 @@ namespace libtorrent { namespace dht
 		, m_refresh_bucket(160)
 		, m_abort(false)
 		, m_host_resolver(sock.get_io_service())
+		, m_request_threads(0)
+		, m_queued_requests(0)
+		, m_last_snapshot(min_time())
 	{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		// turns on and off individual components' logging
@@ -162,7 +168,23 @@ namespace libtorrent { namespace dht
 #endif
 	}
 
-	dht_tracker::~dht_tracker() {}
+	dht_tracker::~dht_tracker()
+	{
+		m_request_pool.stop();
+	}
+
+	void dht_request_pool::process_job(dht_request_job const& j, bool)
+	{
+		j.tracker->process_request(j);
+	}
+
+	void dht_tracker::update_request_threads()
+	{
+		int const n = (std::max)(0, m_settings.request_threads);
+		if (n == m_request_threads) return;
+		m_request_pool.set_num_threads(n);
+		m_request_threads = n;
+	}
 
 	// defined in node.cpp
 	extern void nop();
@@ -190,6 +212,8 @@ namespace libtorrent { namespace dht
 
 		m_refresh_timer.expires_from_now(seconds(5), ec);
 		m_refresh_timer.async_wait(boost::bind(&dht_tracker::refresh_timeout, self(), _1));
+
+		update_request_threads();
 		m_dht.bootstrap(initial_nodes, f);
 	}
 
@@ -201,6 +225,10 @@ namespace libtorrent { namespace dht
 		m_connection_timer.cancel(ec);
 		m_refresh_timer.cancel(ec);
 		m_host_resolver.cancel();
+
+		// this waits for the queries already handed to the request threads
+		m_request_pool.stop();
+		m_request_threads = 0;
 	}
 
 #ifndef TORRENT_NO_DEPRECATE
@@ -235,6 +263,7 @@ namespace libtorrent { namespace dht
 		// periodically update the DOS blocker's settings from the dht_settings
 		m_blocker.set_block_timer(m_settings.block_timeout);
 		m_blocker.set_rate_limit(m_settings.block_ratelimit);
+		update_request_threads();
 
 		error_code ec;
 		m_refresh_timer.expires_from_now(seconds(5), ec);
@@ -386,6 +415,47 @@ namespace libtorrent { namespace dht
 		if (!m_blocker.incoming(ep.address(), aux::time_now()))
 			return true;
 
+		// queries are answered by the request threads, if there are any. The
+		// keys of a bencoded dictionary are sorted, so a query normally ends
+		// with its "y" key. Everything else, including queries that don't end
+		// that way, is handled on this thread
+		if (m_request_threads > 0 && memcmp(buf + size - 7, "1:y1:qe", 7) == 0)
+		{
+			if (!m_sock.has_quota()
+				|| m_queued_requests >= max_queued_requests * m_request_threads)
+			{
+				m_counters.inc_stats_counter(counters::dht_messages_in_dropped);
+				return true;
+			}
+
+			time_point const now = aux::time_now();
+			if (now - m_last_snapshot > seconds(1))
+			{
+				m_dht.update_snapshot();
+				m_last_snapshot = now;
+			}
+
+			dht_request_job j;
+			j.tracker = self();
+			j.ep = ep;
+			j.buf.assign(buf, buf + size);
+			++m_queued_requests;
+			m_request_pool.post_job(j);
+			return true;
+		}
+
+		return incoming_message(ep, buf, size);
+	}
+
+	void dht_tracker::socket_drained()
+	{
+		if (m_abort) return;
+		m_dht.verify_pending_puts();
+	}
+
+	bool dht_tracker::incoming_message(udp::endpoint const& ep
+		, char const* buf, int size)
+	{
 		using libtorrent::entry;
 		using libtorrent::bdecode;
 			
@@ -422,6 +492,52 @@ namespace libtorrent { namespace dht
 		return true;
 	}
 
+	void dht_tracker::process_request(dht_request_job const& j)
+	{
+		--m_queued_requests;
+
+		bdecode_node n;
+		int pos;
+		error_code err;
+		int ret = bdecode(&j.buf[0], &j.buf[0] + j.buf.size(), n, err, &pos
+			, 10, 500);
+		if (ret != 0 || n.type() != bdecode_node::dict_t) return;
+
+		// only plain queries are answered here. Anything that may touch more
+		// of the node's state than the reply is handled by the network thread
+		if (n.dict_find_string_value("y") != "q" || n.dict_find("ip"))
+		{
+			m_sock.get_io_service().post(boost::bind(
+				&dht_tracker::requeue_message, j.tracker, j.ep, j.buf));
+			return;
+		}
+
+		boost::shared_ptr<entry> e = boost::make_shared<entry>();
+		boost::shared_ptr<request_effects> effects
+			= boost::make_shared<request_effects>();
+		msg m(n, j.ep);
+		m_dht.incoming_query(m, *e, *effects);
+
+		m_sock.get_io_service().post(boost::bind(
+			&dht_tracker::send_reply, j.tracker, e, effects, j.ep));
+	}
+
+	void dht_tracker::requeue_message(udp::endpoint const& ep
+		, std::vector<char> const& buf)
+	{
+		if (m_abort) return;
+		incoming_message(ep, &buf[0], int(buf.size()));
+	}
+
+	void dht_tracker::send_reply(boost::shared_ptr<entry> const& e
+		, boost::shared_ptr<request_effects> const& effects
+		, udp::endpoint const& ep)
+	{
+		if (m_abort) return;
+		m_dht.apply(*effects);
+		send_packet(*e, ep, 0);
+	}
+
 	void add_node_fun(void* userdata, node_entry const& e)
 	{
 		entry* n = (entry*)userdata;
@@ -507,7 +623,8 @@ namespace libtorrent { namespace dht
 		log_line << print_entry(print, true);
 #endif
 
-		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec, send_flags))
+		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec
+			, send_flags | udp_socket::batch))
 		{
 			if (ec)
 			{
@@ -0,0 +1,229 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/kademlia/flat_routing_table.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <algorithm>
+
+#if TORRENT_HAS_SSE && (defined __SSE2__ || defined _M_X64 || defined _M_AMD64 \
+	|| (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#define TORRENT_FLAT_ROUTING_TABLE_SSE2 1
+#include <emmintrin.h>
+#else
+#define TORRENT_FLAT_ROUTING_TABLE_SSE2 0
+#endif
+
+namespace libtorrent { namespace dht
+{
+
+namespace
+{
+	boost::uint32_t load_be32(unsigned char const* p)
+	{
+		return (boost::uint32_t(p[0]) << 24)
+			| (boost::uint32_t(p[1]) << 16)
+			| (boost::uint32_t(p[2]) << 8)
+			| boost::uint32_t(p[3]);
+	}
+
+	struct candidate
+	{
+		candidate(boost::uint64_t d, int i) : distance(d), index(i) {}
+		boost::uint64_t distance;
+		int index;
+	};
+
+	// orders candidates by their distance to the target. The first 64 bits
+	// of the distances are precomputed, ties are broken by the remaining
+	// words of the IDs
+	struct compare_candidates
+	{
+		bool operator()(candidate const& lhs, candidate const& rhs) const
+		{
+			if (lhs.distance != rhs.distance) return lhs.distance < rhs.distance;
+			for (int k = 2; k < node_id::size / 4; ++k)
+			{
+				boost::uint32_t const l = lanes[k][lhs.index] ^ target[k];
+				boost::uint32_t const r = lanes[k][rhs.index] ^ target[k];
+				if (l != r) return l < r;
+			}
+			return false;
+		}
+
+		boost::uint32_t const* lanes[node_id::size / 4];
+		boost::uint32_t target[node_id::size / 4];
+	};
+}
+
+flat_routing_table::flat_routing_table(routing_table::table_t const& buckets
+	, node_id const& our_id, int bucket_size)
+	: m_id(our_id)
+	, m_bucket_size(bucket_size)
+{
+	int num_nodes = 0;
+	for (routing_table::table_t::const_iterator i = buckets.begin()
+		, end(buckets.end()); i != end; ++i)
+		num_nodes += int(i->live_nodes.size());
+
+	m_nodes.reserve(num_nodes);
+	m_bucket_start.reserve(buckets.size() + 1);
+	m_confirmed_before.reserve(buckets.size() + 1);
+
+	int confirmed = 0;
+	for (routing_table::table_t::const_iterator i = buckets.begin()
+		, end(buckets.end()); i != end; ++i)
+	{
+		m_bucket_start.push_back(int(m_nodes.size()));
+		m_confirmed_before.push_back(confirmed);
+		for (bucket_t::const_iterator j = i->live_nodes.begin()
+			, end2(i->live_nodes.end()); j != end2; ++j)
+		{
+			m_nodes.push_back(*j);
+			if (j->confirmed()) ++confirmed;
+		}
+	}
+	m_bucket_start.push_back(int(m_nodes.size()));
+	m_confirmed_before.push_back(confirmed);
+
+	for (int k = 0; k < num_lanes; ++k)
+		m_lanes[k].resize(num_nodes);
+
+	for (int i = 0; i < num_nodes; ++i)
+	{
+		unsigned char const* id = &m_nodes[i].id[0];
+		for (int k = 0; k < num_lanes; ++k)
+			m_lanes[k][i] = load_be32(id + k * 4);
+	}
+}
+
+void flat_routing_table::distances(node_id const& target, int first, int last
+	, boost::uint64_t* out) const
+{
+	TORRENT_ASSERT(first >= 0);
+	TORRENT_ASSERT(last <= size());
+
+	boost::uint32_t const t0 = load_be32(&target[0]);
+	boost::uint32_t const t1 = load_be32(&target[4]);
+	boost::uint32_t const* w0 = m_lanes[0].empty() ? NULL : &m_lanes[0][0];
+	boost::uint32_t const* w1 = m_lanes[1].empty() ? NULL : &m_lanes[1][0];
+
+	int i = first;
+#if TORRENT_FLAT_ROUTING_TABLE_SSE2
+	// the SSE2 path is x86 only, so little endian. The high word of a 64 bit
+	// lane is the one that's stored second
+	__m128i const tv0 = _mm_set1_epi32(int(t0));
+	__m128i const tv1 = _mm_set1_epi32(int(t1));
+	for (; i + 4 <= last; i += 4)
+	{
+		__m128i const hi = _mm_xor_si128(
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(w0 + i)), tv0);
+		__m128i const lo = _mm_xor_si128(
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(w1 + i)), tv1);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i - first)
+			, _mm_unpacklo_epi32(lo, hi));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i - first + 2)
+			, _mm_unpackhi_epi32(lo, hi));
+	}
+#endif
+	for (; i < last; ++i)
+	{
+		out[i - first] = (boost::uint64_t(w0[i] ^ t0) << 32)
+			| boost::uint64_t(w1[i] ^ t1);
+	}
+}
+
+void flat_routing_table::find_node(node_id const& target
+	, std::vector<node_entry>& l, int options, int count) const
+{
+	l.clear();
+	if (count == 0) count = m_bucket_size;
+	if (num_buckets() == 0) return;
+
+	bool const include_failed = (options & routing_table::include_failed) != 0;
+
+	// the nodes in the target's bucket are closer to it than the ones in the
+	// buckets closer to us, which in turn are closer than the ones in the
+	// buckets further away from us. Pick from as few buckets as that allows
+	int bucket = (std::min)(159 - distance_exp(m_id, target), num_buckets() - 1);
+	int first = m_bucket_start[bucket];
+	int last = m_bucket_start[bucket + 1];
+	int available = include_failed ? last - first
+		: m_confirmed_before[bucket + 1] - m_confirmed_before[bucket];
+	if (available < count)
+	{
+		// add the buckets closer to us, then the ones further away, until
+		// there are enough nodes
+		last = size();
+		for (; bucket > 0; --bucket)
+		{
+			available = include_failed
+				? size() - m_bucket_start[bucket]
+				: m_confirmed_before.back() - m_confirmed_before[bucket];
+			if (available >= count) break;
+		}
+		first = m_bucket_start[bucket];
+	}
+	if (first == last) return;
+
+	std::vector<boost::uint64_t> d(last - first);
+	distances(target, first, last, &d[0]);
+
+	std::vector<candidate> c;
+	c.reserve(last - first);
+	for (int i = first; i < last; ++i)
+	{
+		if (!include_failed && !m_nodes[i].confirmed()) continue;
+		c.push_back(candidate(d[i - first], i));
+	}
+
+	compare_candidates cmp;
+	for (int k = 0; k < num_lanes; ++k)
+	{
+		cmp.lanes[k] = &m_lanes[k][0];
+		cmp.target[k] = load_be32(&target[k * 4]);
+	}
+
+	int const num = (std::min)(count, int(c.size()));
+	if (num == 0) return;
+	// partial_sort() degrades when asked for a large share of the
+	// candidates, select the closest ones first and only sort those
+	std::nth_element(c.begin(), c.begin() + num - 1, c.end(), cmp);
+	std::sort(c.begin(), c.begin() + num, cmp);
+
+	l.reserve(num);
+	for (int i = 0; i < num; ++i)
+		l.push_back(m_nodes[c[i].index]);
+}
+
+} } // namespace libtorrent::dht
+
@@ -113,12 +113,45 @@ bool verify_mutable_item(
 	char str[canonical_length];
 	int len = canonical_string(v, seq, salt, str);
 
-	return ed25519_verify((unsigned char const*)sig,
+	// cofactored, to give the same answer as verify_mutable_items()
+	return ed25519_verify_cofactored((unsigned char const*)sig,
 		(unsigned char const*)str,
 		len,
 		(unsigned char const*)pk) == 1;
 }
 
+bool verify_mutable_items(signed_item_ref const* items, int num, bool* valid)
+{
+	if (num <= 0) return true;
+
+	std::vector<char> str(num * canonical_length);
+	std::vector<unsigned char const*> sigs(num);
+	std::vector<unsigned char const*> msgs(num);
+	std::vector<size_t> lens(num);
+	std::vector<unsigned char const*> pks(num);
+	std::vector<int> ret(num);
+
+	for (int i = 0; i < num; ++i)
+	{
+		signed_item_ref const& it = items[i];
+#ifdef TORRENT_USE_VALGRIND
+		VALGRIND_CHECK_MEM_IS_DEFINED(it.v.first, it.v.second);
+		VALGRIND_CHECK_MEM_IS_DEFINED(it.pk, item_pk_len);
+		VALGRIND_CHECK_MEM_IS_DEFINED(it.sig, item_sig_len);
+#endif
+		char* out = &str[i * canonical_length];
+		lens[i] = canonical_string(it.v, it.seq, it.salt, out);
+		msgs[i] = (unsigned char const*)out;
+		sigs[i] = (unsigned char const*)it.sig;
+		pks[i] = (unsigned char const*)it.pk;
+	}
+
+	bool all_valid = ed25519_verify_batch(&sigs[0], &msgs[0], &lens[0]
+		, &pks[0], num, &ret[0]) == 1;
+	for (int i = 0; i < num; ++i) valid[i] = ret[i] == 1;
+	return all_valid;
+}
+
 // given the bencoded buffer ``v``, the salt (which is optional and may have
 // a length of zero to be omitted), sequence number ``seq``, public key (32
 // bytes ed25519 key) ``pk`` and a secret/private key ``sk`` (64 bytes ed25519
@@ -33,6 +33,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <utility>
 #include <boost/bind.hpp>
 #include <boost/function/function1.hpp>
+#include <boost/scoped_array.hpp>
 
 #include "libtorrent/io.hpp"
 #include "libtorrent/bencode.hpp"
@@ -45,6 +46,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/kademlia/node_id.hpp"
 #include "libtorrent/kademlia/rpc_manager.hpp"
 #include "libtorrent/kademlia/routing_table.hpp"
+#include "libtorrent/kademlia/flat_routing_table.hpp"
 #include "libtorrent/kademlia/node.hpp"
 #include "libtorrent/kademlia/dht_observer.hpp"
 
@@ -64,39 +66,18 @@ void incoming_error(entry& e, char const* msg, int error_code = 203);
 
 using detail::write_endpoint;
 
-// TODO: 2 make this configurable in dht_settings
-enum { announce_interval = 30 };
-
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 TORRENT_DEFINE_LOG(node)
 #endif
 
-// remove peers that have timed out
-void purge_peers(std::set<peer_entry>& peers)
-{
-	for (std::set<peer_entry>::iterator i = peers.begin()
-		  , end(peers.end()); i != end;)
-	{
-		// the peer has timed out
-		if (i->added + minutes(int(announce_interval * 1.5f)) < aux::time_now())
-		{
-#ifdef TORRENT_DHT_VERBOSE_LOGGING
-			TORRENT_LOG(node) << "peer timed out at: " << i->addr;
-#endif
-			peers.erase(i++);
-		}
-		else
-			++i;
-	}
-}
-
 void nop() {}
 
 node_impl::node_impl(alert_dispatcher* alert_disp
 	, udp_socket_interface* sock
 	, dht_settings const& settings, node_id nid, address const& external_address
 	, dht_observer* observer
-	, struct counters& cnt)
+	, struct counters& cnt
+	, dht_storage_constructor_type const& storage_constructor)
 	: m_settings(settings)
 	, m_id(nid == (node_id::min)() || !verify_id(nid, external_address) ? generate_id(external_address) : nid)
 	, m_table(m_id, 8, settings)
@@ -110,6 +91,10 @@ node_impl::node_impl(alert_dispatcher* alert_disp
 {
 	m_secret[0] = random();
 	m_secret[1] = random();
+
+	m_storage.reset(storage_constructor
+		? storage_constructor(m_id, settings, cnt)
+		: dht_default_storage_constructor(m_id, settings, cnt));
 }
 
 void node_impl::post_alert(alert* a)
@@ -120,6 +105,23 @@ void node_impl::post_alert(alert* a)
 		m_post_alert->post_alert(a);
 }
 
+void node_impl::post_alert(alert* a, request_effects* effects) const
+{
+	if (effects)
+	{
+		effects->alerts.push_back(a);
+		return;
+	}
+	if (!m_post_alert || !m_post_alert->post_alert(a)) delete a;
+}
+
+request_effects::~request_effects()
+{
+	for (std::vector<alert*>::iterator i = alerts.begin()
+		, end(alerts.end()); i != end; ++i)
+		delete *i;
+}
+
 bool node_impl::verify_token(std::string const& token, char const* info_hash
 	, udp::endpoint const& addr)
 {
@@ -131,12 +133,19 @@ bool node_impl::verify_token(std::string const& token, char const* info_hash
 		return false;
 	}
 
+	int secret[2];
+	{
+		mutex_t::scoped_lock l(m_secret_mutex);
+		secret[0] = m_secret[0];
+		secret[1] = m_secret[1];
+	}
+
 	hasher h1;
 	error_code ec;
 	std::string address = addr.address().to_string(ec);
 	if (ec) return false;
 	h1.update(&address[0], address.length());
-	h1.update((char*)&m_secret[0], sizeof(m_secret[0]));
+	h1.update((char*)&secret[0], sizeof(secret[0]));
 	h1.update((char*)info_hash, sha1_hash::size);
 	
 	sha1_hash h = h1.final();
@@ -145,7 +154,7 @@ bool node_impl::verify_token(std::string const& token, char const* info_hash
 		
 	hasher h2;
 	h2.update(&address[0], address.length());
-	h2.update((char*)&m_secret[1], sizeof(m_secret[1]));
+	h2.update((char*)&secret[1], sizeof(secret[1]));
 	h2.update((char*)info_hash, sha1_hash::size);
 	h = h2.final();
 	if (std::equal(token.begin(), token.end(), (char*)&h[0]))
@@ -155,6 +164,12 @@ bool node_impl::verify_token(std::string const& token, char const* info_hash
 
 std::string node_impl::generate_token(udp::endpoint const& addr, char const* info_hash)
 {
+	int secret;
+	{
+		mutex_t::scoped_lock l(m_secret_mutex);
+		secret = m_secret[0];
+	}
+
 	std::string token;
 	token.resize(4);
 	hasher h;
@@ -162,7 +177,7 @@ std::string node_impl::generate_token(udp::endpoint const& addr, char const* inf
 	std::string address = addr.address().to_string(ec);
 	TORRENT_ASSERT(!ec);
 	h.update(&address[0], address.length());
-	h.update((char*)&m_secret[0], sizeof(m_secret[0]));
+	h.update((char*)&secret, sizeof(secret));
 	h.update(info_hash, sha1_hash::size);
 
 	sha1_hash hash = h.final();
@@ -209,6 +224,7 @@ int node_impl::bucket_size(int bucket)
 
 void node_impl::new_write_key()
 {
+	mutex_t::scoped_lock l(m_secret_mutex);
 	m_secret[1] = m_secret[0];
 	m_secret[0] = random();
 }
@@ -276,8 +292,8 @@ void node_impl::incoming(msg const& m)
 		{
 			TORRENT_ASSERT(m.message.dict_find_string_value("y") == "q");
 			entry e;
-			incoming_request(m, e);
-			m_sock->send_packet(e, m.addr, 0);
+			if (incoming_request(m, e))
+				m_sock->send_packet(e, m.addr, 0);
 			break;
 		}
 		case 'e':
@@ -451,6 +467,10 @@ struct ping_observer : observer
 
 void node_impl::tick()
 {
+	// the puts are normally verified when the socket has been drained, this
+	// is just in case that was missed
+	verify_pending_puts();
+
 	// every now and then we refresh our own ID, just to keep
 	// expanding the routing table buckets closer to us.
 	time_point now = aux::time_now();
@@ -525,37 +545,10 @@ time_duration node_impl::connection_timeout()
 	if (now - minutes(2) < m_last_tracker_tick) return d;
 	m_last_tracker_tick = now;
 
-	for (dht_immutable_table_t::iterator i = m_immutable_table.begin();
-		i != m_immutable_table.end();)
+	// expire peers and items that haven't been announced in a while
 	{
-		if (i->second.last_seen + minutes(60) > now)
-		{
-			++i;
-			continue;
-		}
-		free(i->second.value);
-		m_immutable_table.erase(i++);
-		m_counters.inc_stats_counter(counters::dht_immutable_data, -1);
-	}
-
-	// look through all peers and see if any have timed out
-	for (table_t::iterator i = m_map.begin(), end(m_map.end()); i != end;)
-	{
-		torrent_entry& t = i->second;
-		node_id const& key = i->first;
-		++i;
-		purge_peers(t.peers);
-
-		// if there are no more peers, remove the entry altogether
-		if (t.peers.empty())
-		{
-			table_t::iterator i = m_map.find(key);
-			if (i != m_map.end())
-			{
-				m_map.erase(i);
-				m_counters.inc_stats_counter(counters::dht_torrents, -1);
-			}
-		}
+		mutex_t::scoped_lock l(m_storage_mutex);
+		m_storage->tick();
 	}
 
 	return d;
@@ -584,7 +577,7 @@ void node_impl::status(session_status& s)
 	mutex_t::scoped_lock l(m_mutex);
 
 	m_table.status(s);
-	s.dht_torrents = int(m_map.size());
+	s.dht_torrents = num_torrents();
 	s.active_requests.clear();
 	s.dht_total_allocations = m_rpc.num_allocated_observers();
 	for (std::set<traversal_algorithm*>::iterator i = m_running_requests.begin()
@@ -598,60 +591,46 @@ void node_impl::status(session_status& s)
 #endif
 
 void node_impl::lookup_peers(sha1_hash const& info_hash, entry& reply
-	, bool noseed, bool scrape) const
+	, bool noseed, bool scrape, request_effects* effects) const
 {
 	if (m_post_alert)
-	{
-		alert* a = new dht_get_peers_alert(info_hash);
-		if (!m_post_alert->post_alert(a)) delete a;
-	}
-
-	table_t::const_iterator i = m_map.lower_bound(info_hash);
-	if (i == m_map.end()) return;
-	if (i->first != info_hash) return;
+		post_alert(new dht_get_peers_alert(info_hash), effects);
 
-	torrent_entry const& v = i->second;
-
-	if (!v.name.empty()) reply["n"] = v.name;
+	mutex_t::scoped_lock l(m_storage_mutex);
+	m_storage->get_peers(info_hash, noseed, scrape, reply);
+}
 
-	if (scrape)
+void node_impl::closest_nodes(node_id const& target, nodes_t& n
+	, request_effects* effects)
+{
+	if (effects == NULL)
 	{
-		bloom_filter<256> downloaders;
-		bloom_filter<256> seeds;
+		m_table.find_node(target, n, 0);
+		return;
+	}
 
-		for (std::set<peer_entry>::const_iterator i = v.peers.begin()
-			, end(v.peers.end()); i != end; ++i)
-		{
-			sha1_hash iphash;
-			hash_address(i->addr.address(), iphash);
-			if (i->seed) seeds.set(iphash);
-			else downloaders.set(iphash);
-		}
+	routing_table::snapshot_t t = m_table.snapshot();
+	if (t) t->find_node(target, n, 0);
+	else n.clear();
+}
 
-		reply["BFpe"] = downloaders.to_string();
-		reply["BFsd"] = seeds.to_string();
-	}
-	else
-	{
-		int num = (std::min)((int)v.peers.size(), m_settings.max_peers_reply);
-		std::set<peer_entry>::const_iterator iter = v.peers.begin();
-		entry::list_type& pe = reply["values"].list();
-		std::string endpoint;
+void node_impl::incoming_query(msg const& m, entry& e
+	, request_effects& effects)
+{
+	incoming_request(m, e, &effects);
+}
 
-		for (int t = 0, m = 0; m < num && iter != v.peers.end(); ++iter, ++t)
-		{
-			if ((random() / float(UINT_MAX + 1.f)) * (num - t) >= num - m) continue;
-			if (noseed && iter->seed) continue;
-			endpoint.resize(18);
-			std::string::iterator out = endpoint.begin();
-			write_endpoint(iter->addr, out);
-			endpoint.resize(out - endpoint.begin());
-			pe.push_back(entry(endpoint));
-
-			++m;
-		}
-	}
-	return;
+void node_impl::apply(request_effects& effects)
+{
+	if (effects.heard_about)
+		m_table.heard_about(effects.id, effects.ep);
+	if (effects.node_seen)
+		m_table.node_seen(effects.id, effects.ep, 0xffff);
+
+	for (std::vector<alert*>::iterator i = effects.alerts.begin()
+		, end(effects.alerts.end()); i != end; ++i)
+		post_alert(*i);
+	effects.alerts.clear();
 }
 
 namespace detail
@@ -776,35 +755,12 @@ void incoming_error(entry& e, char const* msg, int error_code)
 	l.push_back(entry(msg));
 }
 
-// return true of the first argument is a better canidate for removal, i.e.
-// less important to keep
-struct immutable_item_comparator
-{
-	immutable_item_comparator(node_id const& our_id) : m_our_id(our_id) {}
-
-	bool operator() (std::pair<node_id, dht_immutable_item> const& lhs
-		, std::pair<node_id, dht_immutable_item> const& rhs) const
-	{
-		int l_distance = distance_exp(lhs.first, m_our_id);
-		int r_distance = distance_exp(rhs.first, m_our_id);
-
-		// this is a score taking the popularity (number of announcers) and the
-		// fit, in terms of distance from ideal storing node, into account.
-		// each additional 5 announcers is worth one extra bit in the distance.
-		// that is, an item with 10 announcers is allowed to be twice as far
-		// from another item with 5 announcers, from our node ID. Twice as far
-		// because it gets one more bit.
-		return lhs.second.num_announcers / 5 - l_distance < rhs.second.num_announcers / 5 - r_distance;
-	}
-
-	node_id const& m_our_id;
-};
-
 // build response
-void node_impl::incoming_request(msg const& m, entry& e)
+bool node_impl::incoming_request(msg const& m, entry& e
+	, request_effects* effects)
 {
-	if (!m_sock->has_quota())
-		return;
+	if (effects == NULL && !m_sock->has_quota())
+		return true;
 
 	e = entry(entry::dictionary_t);
 	e["y"] = "r";
@@ -823,7 +779,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		, sizeof(error_string)))
 	{
 		incoming_error(e, error_string);
-		return;
+		return true;
 	}
 
 	e["ip"] = endpoint_to_bytes(m.addr);
@@ -841,11 +797,20 @@ void node_impl::incoming_request(msg const& m, entry& e)
 	if (m_settings.enforce_node_id && !verify_id(id, m.addr.address()))
 	{
 		incoming_error(e, "invalid node ID");
-		return;
+		return true;
+	}
+
+	if (effects)
+	{
+		effects->id = id;
+		effects->ep = m.addr;
 	}
 
 	if (!read_only)
-		m_table.heard_about(id, m.addr);
+	{
+		if (effects) effects->heard_about = true;
+		else m_table.heard_about(id, m.addr);
+	}
 
 	entry& reply = e["r"];
 	m_rpc.add_our_id(reply);
@@ -873,7 +838,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_get_peers);
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		reply["token"] = generate_token(m.addr, msg_keys[0].string_ptr());
@@ -883,14 +848,14 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		sha1_hash info_hash(msg_keys[0].string_ptr());
 		nodes_t n;
 		// always return nodes as well as peers
-		m_table.find_node(info_hash, n, 0);
+		closest_nodes(info_hash, n, effects);
 		write_nodes_entry(reply, n);
 
 		bool noseed = false;
 		bool scrape = false;
 		if (msg_keys[1] && msg_keys[1].int_value() != 0) noseed = true;
 		if (msg_keys[2] && msg_keys[2].int_value() != 0) scrape = true;
-		lookup_peers(info_hash, reply, noseed, scrape);
+		lookup_peers(info_hash, reply, noseed, scrape, effects);
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		if (reply.find_key("values"))
 		{
@@ -908,7 +873,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		if (!verify_message(arg_ent, msg_desc, msg_keys, 1, error_string, sizeof(error_string)))
 		{
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		m_counters.inc_stats_counter(counters::dht_find_node_in);
@@ -916,7 +881,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 
 		// TODO: 2 find_node should write directly to the response entry
 		nodes_t n;
-		m_table.find_node(target, n, 0);
+		closest_nodes(target, n, effects);
 		write_nodes_entry(reply, n);
 	}
 	else if (query_len == 13 && memcmp(query, "announce_peer", 13) == 0)
@@ -935,7 +900,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_announce);
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		int port = int(msg_keys[1].int_value());
@@ -949,22 +914,20 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_announce);
 			incoming_error(e, "invalid port");
-			return;
+			return true;
 		}
 
 		sha1_hash info_hash(msg_keys[0].string_ptr());
 
 		if (m_post_alert)
-		{
-			alert* a = new dht_announce_alert(m.addr.address(), port, info_hash);
-			if (!m_post_alert->post_alert(a)) delete a;
-		}
+			post_alert(new dht_announce_alert(m.addr.address(), port, info_hash)
+				, effects);
 
 		if (!verify_token(msg_keys[2].string_value(), msg_keys[0].string_ptr(), m.addr))
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_announce);
 			incoming_error(e, "invalid token");
-			return;
+			return true;
 		}
 
 		m_counters.inc_stats_counter(counters::dht_announce_peer_in);
@@ -972,55 +935,22 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		// the token was correct. That means this
 		// node is not spoofing its address. So, let
 		// the table get a chance to add it.
-		m_table.node_seen(id, m.addr, 0xffff);
-
-		table_t::iterator ti = m_map.find(info_hash);
-		torrent_entry* v;
-		if (ti == m_map.end())
+		if (effects) effects->node_seen = true;
+		else m_table.node_seen(id, m.addr, 0xffff);
+
+		// the peer may announce a torrent name, which is stored if we don't
+		// have a name for this torrent yet
+		char const* name = NULL;
+		int name_len = 0;
+		if (msg_keys[3])
 		{
-			// we don't have this torrent, add it
-			// do we need to remove another one first?
-			if (!m_map.empty() && int(m_map.size()) >= m_settings.max_torrents)
-			{
-				// we need to remove some. Remove the ones with the
-				// fewest peers
-				int num_peers = m_map.begin()->second.peers.size();
-				table_t::iterator candidate = m_map.begin();
-				for (table_t::iterator i = m_map.begin()
-					, end(m_map.end()); i != end; ++i)
-				{
-					if (int(i->second.peers.size()) > num_peers) continue;
-					if (i->first == info_hash) continue;
-					num_peers = i->second.peers.size();
-					candidate = i;
-				}
-				m_map.erase(candidate);
-				m_counters.inc_stats_counter(counters::dht_torrents, -1);
-			}
-			m_counters.inc_stats_counter(counters::dht_torrents);
-	  		v = &m_map[info_hash];
-		}
-		else
-		{
-			v = &ti->second;
-		}
-
-		// the peer announces a torrent name, and we don't have a name
-		// for this torrent. Store it.
-		if (msg_keys[3] && v->name.empty())
-		{
-			std::string name = msg_keys[3].string_value();
-			if (name.size() > 50) name.resize(50);
-			v->name = name;
+			name = msg_keys[3].string_ptr();
+			name_len = msg_keys[3].string_length();
 		}
 
-		peer_entry peer;
-		peer.addr = tcp::endpoint(m.addr.address(), port);
-		peer.added = aux::time_now();
-		peer.seed = msg_keys[4] && msg_keys[4].int_value();
-		std::set<peer_entry>::iterator i = v->peers.find(peer);
-		if (i != v->peers.end()) v->peers.erase(i++);
-		v->peers.insert(i, peer);
+		mutex_t::scoped_lock l(m_storage_mutex);
+		m_storage->announce_peer(info_hash, tcp::endpoint(m.addr.address(), port)
+			, name, name_len, msg_keys[4] && msg_keys[4].int_value());
 	}
 	else if (query_len == 3 && memcmp(query, "put", 3) == 0)
 	{
@@ -1043,7 +973,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_put);
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		m_counters.inc_stats_counter(counters::dht_put_in);
@@ -1065,7 +995,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_put);
 			incoming_error(e, "message too big", 205);
-			return;
+			return true;
 		}
 
 		std::pair<char const*, int> salt(static_cast<char const*>(NULL), 0);
@@ -1076,7 +1006,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_put);
 			incoming_error(e, "salt too big", 207);
-			return;
+			return true;
 		}
 
 		sha1_hash target;
@@ -1097,44 +1027,14 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_put);
 			incoming_error(e, "invalid token");
-			return;
+			return true;
 		}
 
-		dht_immutable_item* f = 0;
-
 		if (!mutable_put)
 		{
-			dht_immutable_table_t::iterator i = m_immutable_table.find(target);
-			if (i == m_immutable_table.end())
-			{
-				// make sure we don't add too many items
-				if (int(m_immutable_table.size()) >= m_settings.max_dht_items)
-				{
-					// delete the least important one (i.e. the one
-					// the fewest peers are announcing, and farthest
-					// from our node ID)
-					dht_immutable_table_t::iterator j = std::min_element(m_immutable_table.begin()
-						, m_immutable_table.end()
-						, immutable_item_comparator(m_id));
-
-					TORRENT_ASSERT(j != m_immutable_table.end());
-					free(j->second.value);
-					m_immutable_table.erase(j);
-					m_counters.inc_stats_counter(counters::dht_immutable_data, -1);
-				}
-				dht_immutable_item to_add;
-				to_add.value = (char*)malloc(buf.second);
-				to_add.size = buf.second;
-				memcpy(to_add.value, buf.first, buf.second);
-		
-				boost::tie(i, boost::tuples::ignore) = m_immutable_table.insert(
-					std::make_pair(target, to_add));
-				m_counters.inc_stats_counter(counters::dht_immutable_data);
-			}
-
-//			fprintf(stderr, "added immutable item (%d)\n", int(m_immutable_table.size()));
-
-			f = &i->second;
+			mutex_t::scoped_lock l(m_storage_mutex);
+			m_storage->put_immutable_item(target, buf.first, buf.second
+				, m.addr.address());
 		}
 		else
 		{
@@ -1144,111 +1044,43 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			VALGRIND_CHECK_MEM_IS_DEFINED(msg_keys[4].string_ptr(), item_sig_len);
 			VALGRIND_CHECK_MEM_IS_DEFINED(pk, item_pk_len);
 #endif
+			pending_put p;
+			p.ep = m.addr;
+			p.id = id;
+			p.target = target;
+			p.value.assign(buf.first, buf.second);
+			if (salt.second > 0) p.salt.assign(salt.first, salt.second);
+			memcpy(p.pk, pk, item_pk_len);
+			memcpy(p.sig, sig, item_sig_len);
+			p.seq = msg_keys[2].int_value();
+			p.has_cas = bool(msg_keys[5]);
+			p.cas = p.has_cas ? msg_keys[5].int_value() : 0;
+
+			// the request threads don't hold puts back, they're verifying
+			// signatures in parallel already
+			if (effects == NULL && m_settings.put_verify_batch > 1)
+			{
+				p.reply.swap(e);
+				m_pending_puts.push_back(p);
+				if (int(m_pending_puts.size()) >= m_settings.put_verify_batch)
+					verify_pending_puts();
+				return false;
+			}
+
 			// msg_keys[4] is the signature, msg_keys[3] is the public key
 			if (!verify_mutable_item(buf, salt
 				, msg_keys[2].int_value(), pk, sig))
 			{
 				m_counters.inc_stats_counter(counters::dht_invalid_put);
 				incoming_error(e, "invalid signature", 206);
-				return;
+				return true;
 			}
 
-			dht_mutable_table_t::iterator i = m_mutable_table.find(target);
-			if (i == m_mutable_table.end())
-			{
-				// this is the case where we don't have an item in this slot
-				// make sure we don't add too many items
-				if (int(m_mutable_table.size()) >= m_settings.max_dht_items)
-				{
-					// delete the least important one (i.e. the one
-					// the fewest peers are announcing)
-					dht_mutable_table_t::iterator j = std::min_element(m_mutable_table.begin()
-						, m_mutable_table.end()
-						, boost::bind(&dht_immutable_item::num_announcers
-							, boost::bind(&dht_mutable_table_t::value_type::second, _1)));
-					TORRENT_ASSERT(j != m_mutable_table.end());
-					free(j->second.value);
-					free(j->second.salt);
-					m_mutable_table.erase(j);
-					m_counters.inc_stats_counter(counters::dht_mutable_data, -1);
-				}
-				dht_mutable_item to_add;
-				to_add.value = (char*)malloc(buf.second);
-				to_add.size = buf.second;
-				to_add.seq = msg_keys[2].int_value();
-				to_add.salt = NULL;
-				to_add.salt_size = 0;
-				if (salt.second > 0)
-				{
-					to_add.salt = (char*)malloc(salt.second);
-					to_add.salt_size = salt.second;
-					memcpy(to_add.salt, salt.first, salt.second);
-				}
-				memcpy(to_add.sig, sig, sizeof(to_add.sig));
-				TORRENT_ASSERT(sizeof(to_add.sig) == msg_keys[4].string_length());
-				memcpy(to_add.value, buf.first, buf.second);
-				memcpy(&to_add.key, pk, sizeof(to_add.key));
-		
-				boost::tie(i, boost::tuples::ignore) = m_mutable_table.insert(
-					std::make_pair(target, to_add));
-				m_counters.inc_stats_counter(counters::dht_mutable_data);
-
-//				fprintf(stderr, "added mutable item (%d)\n", int(m_mutable_table.size()));
-			}
-			else
-			{
-				// this is the case where we already 
-				dht_mutable_item* item = &i->second;
-
-				// this is the "cas" field in the put message
-				// if it was specified, we MUST make sure the current sequence
-				// number matches the expected value before replacing it
-				// this is critical for avoiding race conditions when multiple
-				// writers are accessing the same slot
-				if (msg_keys[5] && item->seq != msg_keys[5].int_value())
-				{
-					m_counters.inc_stats_counter(counters::dht_invalid_put);
-					incoming_error(e, "CAS mismatch", 301);
-					return;
-				}
-
-				if (item->seq > boost::uint64_t(msg_keys[2].int_value()))
-				{
-					m_counters.inc_stats_counter(counters::dht_invalid_put);
-					incoming_error(e, "old sequence number", 302);
-					return;
-				}
-
-				if (item->seq < boost::uint64_t(msg_keys[2].int_value()))
-				{
-					if (item->size != buf.second)
-					{
-						free(item->value);
-						item->value = (char*)malloc(buf.second);
-						item->size = buf.second;
-					}
-					item->seq = msg_keys[2].int_value();
-					memcpy(item->sig, msg_keys[4].string_ptr(), sizeof(item->sig));
-					TORRENT_ASSERT(sizeof(item->sig) == msg_keys[4].string_length());
-					memcpy(item->value, buf.first, buf.second);
-				}
-			}
-
-			f = &i->second;
+			if (!put_mutable_item(p, e)) return true;
 		}
 
-		m_table.node_seen(id, m.addr, 0xffff);
-
-		f->last_seen = aux::time_now();
-
-		// maybe increase num_announcers if we haven't seen this IP before
-		sha1_hash iphash;
-		hash_address(m.addr.address(), iphash);
-		if (!f->ips.find(iphash))
-		{
-			f->ips.set(iphash);
-			++f->num_announcers;
-		}
+		if (effects) effects->node_seen = true;
+		else m_table.node_seen(id, m.addr, 0xffff);
 	}
 	else if (query_len == 3 && memcmp(query, "get", 3) == 0)
 	{
@@ -1266,7 +1098,7 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		{
 			m_counters.inc_stats_counter(counters::dht_invalid_get);
 			incoming_error(e, error_string);
-			return;
+			return true;
 		}
 
 		m_counters.inc_stats_counter(counters::dht_get_in);
@@ -1280,35 +1112,20 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		
 		nodes_t n;
 		// always return nodes as well as peers
-		m_table.find_node(target, n, 0);
+		closest_nodes(target, n, effects);
 		write_nodes_entry(reply, n);
 
-		dht_immutable_table_t::iterator i = m_immutable_table.end();
-
 		// if the get has a sequence number it must be for a mutable item
 		// so don't bother searching the immutable table
-		if (!msg_keys[0])
-			i = m_immutable_table.find(target);
-
-		if (i != m_immutable_table.end())
+		mutex_t::scoped_lock l(m_storage_mutex);
+		if (msg_keys[0])
 		{
-			dht_immutable_item const& f = i->second;
-			reply["v"] = bdecode(f.value, f.value + f.size);
+			m_storage->get_mutable_item(target, msg_keys[0].int_value(), false
+				, reply);
 		}
-		else
+		else if (!m_storage->get_immutable_item(target, reply))
 		{
-			dht_mutable_table_t::iterator i = m_mutable_table.find(target);
-			if (i != m_mutable_table.end())
-			{
-				dht_mutable_item const& f = i->second;
-				reply["seq"] = f.seq;
-				if (!msg_keys[0] || boost::uint64_t(msg_keys[0].int_value()) < f.seq)
-				{
-					reply["v"] = bdecode(f.value, f.value + f.size);
-					reply["sig"] = std::string(f.sig, f.sig + sizeof(f.sig));
-					reply["k"] = std::string(f.key.bytes, f.key.bytes + sizeof(f.key.bytes));
-				}
-			}
+			m_storage->get_mutable_item(target, 0, true, reply);
 		}
 	}
 	else
@@ -1323,16 +1140,89 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			if (!target_ent || target_ent.string_length() != 20)
 			{
 				incoming_error(e, "unknown message");
-				return;
+				return true;
 			}
 		}
 
 		sha1_hash target(target_ent.string_ptr());
 		nodes_t n;
 		// always return nodes as well as peers
-		m_table.find_node(target, n, 0);
+		closest_nodes(target, n, effects);
 		write_nodes_entry(reply, n);
-		return;
+		return true;
+	}
+	return true;
+}
+
+bool node_impl::put_mutable_item(pending_put const& p, entry& e)
+{
+	// the sequence number checks and the put have to be atomic
+	mutex_t::scoped_lock l(m_storage_mutex);
+	boost::int64_t item_seq;
+	if (m_storage->get_mutable_item_seq(p.target, item_seq))
+	{
+		// this is the "cas" field in the put message
+		// if it was specified, we MUST make sure the current sequence
+		// number matches the expected value before replacing it
+		// this is critical for avoiding race conditions when multiple
+		// writers are accessing the same slot
+		if (p.has_cas && item_seq != p.cas)
+		{
+			m_counters.inc_stats_counter(counters::dht_invalid_put);
+			incoming_error(e, "CAS mismatch", 301);
+			return false;
+		}
+
+		if (item_seq > p.seq)
+		{
+			m_counters.inc_stats_counter(counters::dht_invalid_put);
+			incoming_error(e, "old sequence number", 302);
+			return false;
+		}
+	}
+
+	m_storage->put_mutable_item(p.target, p.value.c_str(), int(p.value.size())
+		, p.sig, p.seq, p.pk, p.salt.c_str(), int(p.salt.size())
+		, p.ep.address());
+	return true;
+}
+
+void node_impl::verify_pending_puts()
+{
+	if (m_pending_puts.empty()) return;
+
+	std::vector<pending_put> puts;
+	puts.swap(m_pending_puts);
+
+	int const num = int(puts.size());
+	std::vector<signed_item_ref> items(num);
+	for (int i = 0; i < num; ++i)
+	{
+		pending_put const& p = puts[i];
+		signed_item_ref& it = items[i];
+		it.v = std::make_pair(p.value.c_str(), int(p.value.size()));
+		it.salt = std::make_pair(p.salt.c_str(), int(p.salt.size()));
+		it.seq = p.seq;
+		it.pk = p.pk;
+		it.sig = p.sig;
+	}
+
+	boost::scoped_array<bool> valid(new bool[num]);
+	verify_mutable_items(&items[0], num, valid.get());
+
+	for (int i = 0; i < num; ++i)
+	{
+		pending_put& p = puts[i];
+		if (!valid[i])
+		{
+			m_counters.inc_stats_counter(counters::dht_invalid_put);
+			incoming_error(p.reply, "invalid signature", 206);
+		}
+		else if (put_mutable_item(p, p.reply))
+		{
+			m_table.node_seen(p.id, p.ep, 0xffff);
+		}
+		m_sock->send_packet(p.reply, p.ep, 0);
 	}
 }
 
@@ -0,0 +1,552 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/kademlia/peer_store.hpp"
+#include "libtorrent/session_settings.hpp" // for dht_settings
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/socket_io.hpp"
+#include "libtorrent/bloom_filter.hpp"
+#include "libtorrent/entry.hpp"
+#include "libtorrent/random.hpp"
+#include "libtorrent/aux_/time.hpp" // for aux::time_now()
+#include "libtorrent/assert.hpp"
+
+#include <algorithm>
+#include <cstdlib> // for malloc
+#include <cstring> // for memcpy
+#include <climits> // for UINT_MAX
+
+namespace libtorrent { namespace dht
+{
+
+namespace
+{
+	int const entry_size[2] = { peer_store::v4_entry_size, peer_store::v6_entry_size };
+	int const endpoint_size[2] = { 6, 18 };
+
+	enum { seed_flag = 0x8000, stamp_mask = 0x7fff };
+
+	// the longest torrent name we store
+	enum { max_name_len = 50 };
+
+	int home_slot(sha1_hash const& h, int mask)
+	{
+		// info-hashes are uniformly distributed, but the ones we store are
+		// close to our node ID, i.e. they share a prefix with it. Fold all
+		// of the hash, so the bits that actually differ determine the slot
+		boost::uint32_t ret = 0;
+		for (int i = 0; i < int(sha1_hash::size); i += 4)
+		{
+			boost::uint32_t v;
+			memcpy(&v, &h[i], sizeof(v));
+			ret ^= v;
+		}
+		return int(ret & mask);
+	}
+
+	void set_stamp(char* e, int v, boost::uint16_t st)
+	{ memcpy(e + endpoint_size[v], &st, sizeof(st)); }
+
+	boost::uint16_t stamp(char const* e, int v)
+	{
+		boost::uint16_t ret;
+		memcpy(&ret, e + endpoint_size[v], sizeof(ret));
+		return ret;
+	}
+
+	// returns the index of the first entry not less than ``ep``
+	int lower_bound(char const* peers, int num, int v, char const* ep)
+	{
+		int low = 0;
+		int high = num;
+		while (low < high)
+		{
+			int const mid = low + (high - low) / 2;
+			if (memcmp(peers + mid * entry_size[v], ep, endpoint_size[v]) < 0)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		return low;
+	}
+
+	address peer_address(char const* e, int v)
+	{
+#if TORRENT_USE_IPV6
+		if (v == 1) return detail::read_v6_endpoint<tcp::endpoint>(e).address();
+#endif
+		TORRENT_ASSERT(v == 0);
+		return detail::read_v4_endpoint<tcp::endpoint>(e).address();
+	}
+
+	struct oldest_first
+	{
+		bool operator()(std::pair<boost::uint32_t, sha1_hash> const& lhs
+			, std::pair<boost::uint32_t, sha1_hash> const& rhs) const
+		{ return lhs.first < rhs.first; }
+	};
+}
+
+peer_store::peer_store(dht_settings const& settings, counters& cnt)
+	: m_settings(settings)
+	, m_counters(cnt)
+	, m_epoch(aux::time_now() - seconds(peer_timeout))
+	, m_num_torrents(0)
+	, m_num_peers(0)
+	, m_memory_used(0)
+{}
+
+peer_store::~peer_store()
+{
+	for (std::vector<torrent_slot>::iterator i = m_table.begin()
+		, end(m_table.end()); i != end; ++i)
+	{
+		if (i->last_announce == 0) continue;
+		free_slot(*i);
+	}
+	m_counters.inc_stats_counter(counters::dht_torrents, -m_num_torrents);
+	update_memory(-boost::int64_t(m_table.size() * sizeof(torrent_slot)));
+	TORRENT_ASSERT(m_num_peers == 0);
+	TORRENT_ASSERT(m_memory_used == 0);
+}
+
+boost::uint32_t peer_store::clock(time_point now) const
+{
+	return boost::uint32_t(total_seconds(now - m_epoch)) + 1;
+}
+
+void peer_store::update_memory(boost::int64_t delta)
+{
+	m_memory_used += delta;
+	TORRENT_ASSERT(m_memory_used >= 0);
+	m_counters.inc_stats_counter(counters::dht_peer_store_bytes, delta);
+}
+
+void peer_store::update_peers(int delta)
+{
+	m_num_peers += delta;
+	TORRENT_ASSERT(m_num_peers >= 0);
+	m_counters.inc_stats_counter(counters::dht_peers, delta);
+}
+
+int peer_store::find_slot(sha1_hash const& info_hash) const
+{
+	if (m_table.empty()) return -1;
+	int const mask = int(m_table.size()) - 1;
+	int idx = home_slot(info_hash, mask);
+	for (;;)
+	{
+		torrent_slot const& t = m_table[idx];
+		if (t.last_announce == 0 || t.info_hash == info_hash) return idx;
+		idx = (idx + 1) & mask;
+	}
+}
+
+int peer_store::probe_length(sha1_hash const& info_hash) const
+{
+	int const idx = find_slot(info_hash);
+	if (idx < 0 || m_table[idx].last_announce == 0) return -1;
+	int const mask = int(m_table.size()) - 1;
+	return (idx - home_slot(info_hash, mask)) & mask;
+}
+
+void peer_store::resize_table(int capacity)
+{
+	TORRENT_ASSERT((capacity & (capacity - 1)) == 0);
+	TORRENT_ASSERT(capacity > m_num_torrents);
+
+	std::vector<torrent_slot> old;
+	old.swap(m_table);
+	torrent_slot empty = torrent_slot();
+	m_table.resize(capacity, empty);
+
+	for (std::vector<torrent_slot>::iterator i = old.begin()
+		, end(old.end()); i != end; ++i)
+	{
+		if (i->last_announce == 0) continue;
+		m_table[find_slot(i->info_hash)] = *i;
+	}
+	update_memory((boost::int64_t(capacity) - boost::int64_t(old.size()))
+		* boost::int64_t(sizeof(torrent_slot)));
+}
+
+void peer_store::free_slot(torrent_slot& t)
+{
+	for (int v = 0; v < 2; ++v)
+	{
+		std::free(t.peers[v]);
+		update_memory(-boost::int64_t(t.capacity[v]) * entry_size[v]);
+		update_peers(-int(t.num_peers[v]));
+		t.peers[v] = NULL;
+		t.num_peers[v] = 0;
+		t.capacity[v] = 0;
+	}
+	if (t.name)
+	{
+		update_memory(-(t.name[0] + 1));
+		std::free(t.name);
+		t.name = NULL;
+	}
+}
+
+void peer_store::erase_slot(int idx)
+{
+	free_slot(m_table[idx]);
+
+	// backward shift deletion. Move the following entries of the probe
+	// sequence up, unless they're already at, or before, their home slot.
+	// This keeps the table free of tombstones
+	int const mask = int(m_table.size()) - 1;
+	int hole = idx;
+	int j = idx;
+	for (;;)
+	{
+		j = (j + 1) & mask;
+		torrent_slot const& t = m_table[j];
+		if (t.last_announce == 0) break;
+		int const home = home_slot(t.info_hash, mask);
+		bool const stays = hole <= j
+			? (hole < home && home <= j)
+			: (hole < home || home <= j);
+		if (stays) continue;
+		m_table[hole] = t;
+		hole = j;
+	}
+	m_table[hole] = torrent_slot();
+
+	--m_num_torrents;
+	m_counters.inc_stats_counter(counters::dht_torrents, -1);
+}
+
+void peer_store::evict(boost::int64_t extra_bytes, int extra_torrents
+	, sha1_hash const& keep)
+{
+	// evicting by size is done in batches, down to 7/8 of the limit, to
+	// avoid sorting all torrents for every announce
+	boost::int64_t const max_bytes = m_settings.max_peer_store_size;
+	boost::int64_t const target_bytes = max_bytes - max_bytes / 8;
+
+	if (m_memory_used + extra_bytes > max_bytes)
+	{
+		std::vector<std::pair<boost::uint32_t, sha1_hash> > lru;
+		lru.reserve(m_num_torrents);
+		for (std::vector<torrent_slot>::iterator i = m_table.begin()
+			, end(m_table.end()); i != end; ++i)
+		{
+			if (i->last_announce == 0 || i->info_hash == keep) continue;
+			lru.push_back(std::make_pair(i->last_announce, i->info_hash));
+		}
+		std::sort(lru.begin(), lru.end(), oldest_first());
+
+		for (std::vector<std::pair<boost::uint32_t, sha1_hash> >::iterator i
+			= lru.begin(), end(lru.end()); i != end
+			&& m_memory_used + extra_bytes > target_bytes; ++i)
+		{
+			erase_slot(find_slot(i->second));
+			m_counters.inc_stats_counter(counters::dht_torrents_evicted);
+		}
+	}
+
+	// the torrent limit is enforced one torrent at a time
+	while (m_num_torrents > 0
+		&& m_num_torrents + extra_torrents > m_settings.max_torrents)
+	{
+		if (!evict_oldest(keep)) break;
+	}
+}
+
+bool peer_store::evict_oldest(sha1_hash const& keep)
+{
+	int oldest = -1;
+	for (int i = 0; i < int(m_table.size()); ++i)
+	{
+		torrent_slot const& t = m_table[i];
+		if (t.last_announce == 0 || t.info_hash == keep) continue;
+		if (oldest == -1 || t.last_announce < m_table[oldest].last_announce)
+			oldest = i;
+	}
+	if (oldest == -1) return false;
+	erase_slot(oldest);
+	m_counters.inc_stats_counter(counters::dht_torrents_evicted);
+	return true;
+}
+
+int peer_store::insert_torrent(sha1_hash const& info_hash, boost::uint32_t now)
+{
+	int idx = find_slot(info_hash);
+	if (idx >= 0 && m_table[idx].last_announce != 0) return idx;
+
+	// we don't have this torrent, do we need to remove another one first?
+	evict(sizeof(torrent_slot), 1, info_hash);
+
+	// keep the load factor below 3/4. If growing the table would exceed the
+	// memory limit, make room in it instead
+	if ((m_num_torrents + 1) * 4 > int(m_table.size()) * 3)
+	{
+		int const new_size = (std::max)(16, int(m_table.size()) * 2);
+		boost::int64_t const growth = boost::int64_t(new_size - int(m_table.size()))
+			* boost::int64_t(sizeof(torrent_slot));
+		if (m_table.empty() || m_memory_used + growth <= m_settings.max_peer_store_size
+			|| !evict_oldest(info_hash))
+		{
+			resize_table(new_size);
+		}
+	}
+
+	idx = find_slot(info_hash);
+	torrent_slot& t = m_table[idx];
+	TORRENT_ASSERT(t.last_announce == 0);
+	t.info_hash = info_hash;
+	t.last_announce = now;
+	++m_num_torrents;
+	m_counters.inc_stats_counter(counters::dht_torrents);
+	return idx;
+}
+
+void peer_store::announce(sha1_hash const& info_hash, tcp::endpoint const& ep
+	, bool seed, char const* name, int name_len, time_point now)
+{
+	char endpoint[18];
+	char* out = endpoint;
+	detail::write_endpoint(ep, out);
+	int const v = (out - endpoint) == endpoint_size[0] ? 0 : 1;
+	TORRENT_ASSERT(out - endpoint == endpoint_size[v]);
+
+	boost::uint32_t const t = clock(now);
+	torrent_slot& s = m_table[insert_torrent(info_hash, t)];
+	s.last_announce = t;
+
+	// the peer announces a torrent name, and we don't have a name
+	// for this torrent. Store it.
+	if (name != NULL && name_len > 0 && s.name == NULL)
+	{
+		int const len = (std::min)(name_len, int(max_name_len));
+		s.name = static_cast<char*>(std::malloc(len + 1));
+		if (s.name)
+		{
+			s.name[0] = char(len);
+			memcpy(s.name + 1, name, len);
+			update_memory(len + 1);
+		}
+	}
+
+	boost::uint16_t const st = boost::uint16_t((t & stamp_mask)
+		| (seed ? seed_flag : 0));
+
+	int const num = s.num_peers[v];
+	int const pos = lower_bound(s.peers[v], num, v, endpoint);
+	char* e = s.peers[v] + pos * entry_size[v];
+	if (pos < num && memcmp(e, endpoint, endpoint_size[v]) == 0)
+	{
+		// the peer is already in there, just refresh it
+		set_stamp(e, v, st);
+		return;
+	}
+
+	if (num == s.capacity[v])
+	{
+		if (num == 0xffff) return;
+		int const new_cap = (std::min)(0xffff, (std::max)(4, num * 2));
+		char* p = static_cast<char*>(std::realloc(s.peers[v]
+			, new_cap * entry_size[v]));
+		if (p == NULL) return;
+		s.peers[v] = p;
+		update_memory(boost::int64_t(new_cap - s.capacity[v]) * entry_size[v]);
+		s.capacity[v] = boost::uint16_t(new_cap);
+		e = s.peers[v] + pos * entry_size[v];
+	}
+
+	memmove(e + entry_size[v], e, (num - pos) * entry_size[v]);
+	memcpy(e, endpoint, endpoint_size[v]);
+	set_stamp(e, v, st);
+	++s.num_peers[v];
+	update_peers(1);
+
+	if (m_memory_used > m_settings.max_peer_store_size)
+		evict(0, 0, info_hash);
+}
+
+bool peer_store::get_peers(sha1_hash const& info_hash, bool noseed, bool scrape
+	, entry& reply) const
+{
+	int const idx = find_slot(info_hash);
+	if (idx < 0) return false;
+	torrent_slot const& s = m_table[idx];
+	if (s.last_announce == 0) return false;
+
+	if (s.name) reply["n"] = std::string(s.name + 1, s.name[0]);
+
+	if (scrape)
+	{
+		bloom_filter<256> downloaders;
+		bloom_filter<256> seeds;
+
+		for (int v = 0; v < 2; ++v)
+		{
+			for (int i = 0; i < s.num_peers[v]; ++i)
+			{
+				char const* e = s.peers[v] + i * entry_size[v];
+				sha1_hash iphash;
+				hash_address(peer_address(e, v), iphash);
+				if (stamp(e, v) & seed_flag) seeds.set(iphash);
+				else downloaders.set(iphash);
+			}
+		}
+
+		reply["BFpe"] = downloaders.to_string();
+		reply["BFsd"] = seeds.to_string();
+		return true;
+	}
+
+	int const total = s.num_peers[0] + s.num_peers[1];
+	int const num = (std::min)(total, m_settings.max_peers_reply);
+	entry::list_type& pe = reply["values"].list();
+
+	// pick a random sample of the peers. The compact endpoints are already
+	// in the format they're sent in
+	for (int t = 0, m = 0; m < num && t < total; ++t)
+	{
+		if ((random() / float(UINT_MAX + 1.f)) * (num - t) >= num - m) continue;
+		int const v = t < s.num_peers[0] ? 0 : 1;
+		int const i = v == 0 ? t : t - s.num_peers[0];
+		char const* e = s.peers[v] + i * entry_size[v];
+		if (noseed && (stamp(e, v) & seed_flag)) continue;
+		pe.push_back(entry(std::string(e, endpoint_size[v])));
+		++m;
+	}
+	return true;
+}
+
+void peer_store::for_each_peer(peer_fun const& f, time_point now) const
+{
+	boost::uint32_t const t = clock(now);
+
+	for (std::vector<torrent_slot>::const_iterator i = m_table.begin()
+		, end(m_table.end()); i != end; ++i)
+	{
+		if (i->last_announce == 0) continue;
+
+		char const* name = i->name ? i->name + 1 : NULL;
+		int name_len = i->name ? i->name[0] : 0;
+		for (int v = 0; v < 2; ++v)
+		{
+			for (int k = 0; k < i->num_peers[v]; ++k)
+			{
+				char const* e = i->peers[v] + k * entry_size[v];
+				boost::uint16_t const st = stamp(e, v);
+				int const age = (t - st) & stamp_mask;
+				char const* in = e;
+				tcp::endpoint ep;
+#if TORRENT_USE_IPV6
+				if (v == 1) ep = detail::read_v6_endpoint<tcp::endpoint>(in);
+				else
+#endif
+				ep = detail::read_v4_endpoint<tcp::endpoint>(in);
+				f(i->info_hash, ep, (st & seed_flag) != 0, age, name, name_len);
+				name = NULL;
+				name_len = 0;
+			}
+		}
+	}
+}
+
+void peer_store::tick(time_point now)
+{
+	boost::uint32_t const t = clock(now);
+
+	for (int idx = 0; idx < int(m_table.size());)
+	{
+		torrent_slot& s = m_table[idx];
+		if (s.last_announce == 0)
+		{
+			++idx;
+			continue;
+		}
+
+		// remove the peers that have timed out
+		for (int v = 0; v < 2; ++v)
+		{
+			char* out = s.peers[v];
+			for (int i = 0; i < s.num_peers[v]; ++i)
+			{
+				char const* e = s.peers[v] + i * entry_size[v];
+				int const age = (t - stamp(e, v)) & stamp_mask;
+				if (age > peer_timeout) continue;
+				if (out != e) memcpy(out, e, entry_size[v]);
+				out += entry_size[v];
+			}
+			int const left = int(out - s.peers[v]) / entry_size[v];
+			update_peers(left - s.num_peers[v]);
+			s.num_peers[v] = boost::uint16_t(left);
+
+			// give back memory of arrays that have shrunk a lot
+			if (left > 0 && left * 4 <= s.capacity[v] && s.capacity[v] > 4)
+			{
+				int const new_cap = (std::max)(4, left * 2);
+				char* p = static_cast<char*>(std::realloc(s.peers[v]
+					, new_cap * entry_size[v]));
+				if (p == NULL) continue;
+				s.peers[v] = p;
+				update_memory(-boost::int64_t(s.capacity[v] - new_cap) * entry_size[v]);
+				s.capacity[v] = boost::uint16_t(new_cap);
+			}
+		}
+
+		// if there are no more peers, remove the entry altogether. This
+		// shifts a later entry into this slot, so look at it again
+		if (s.num_peers[0] == 0 && s.num_peers[1] == 0)
+		{
+			erase_slot(idx);
+			continue;
+		}
+		++idx;
+	}
+
+	// shrink the hash table if it's mostly empty
+	int capacity = int(m_table.size());
+	while (capacity > 16 && m_num_torrents * 8 < capacity) capacity /= 2;
+	if (capacity < int(m_table.size()))
+	{
+		if (m_num_torrents == 0)
+		{
+			update_memory(-boost::int64_t(m_table.size() * sizeof(torrent_slot)));
+			std::vector<torrent_slot>().swap(m_table);
+		}
+		else
+		{
+			resize_table(capacity);
+		}
+	}
+}
+
+} } // namespace libtorrent::dht
+
@@ -37,8 +37,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <numeric>
 #include <boost/cstdint.hpp>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 
 #include "libtorrent/kademlia/routing_table.hpp"
+#include "libtorrent/kademlia/flat_routing_table.hpp"
 #include "libtorrent/broadcast_socket.hpp" // for cidr_distance
 #include "libtorrent/session_status.hpp"
 #include "libtorrent/kademlia/node_id.hpp"
@@ -1147,6 +1149,21 @@ void routing_table::find_node(node_id const& target
 	TORRENT_ASSERT(int(l.size()) <= count);
 }
 
+routing_table::snapshot_t routing_table::snapshot() const
+{
+	mutex::scoped_lock l(m_snapshot_mutex);
+	return m_snapshot;
+}
+
+void routing_table::update_snapshot()
+{
+	snapshot_t t = boost::make_shared<flat_routing_table>(m_buckets, m_id
+		, m_bucket_size);
+
+	mutex::scoped_lock l(m_snapshot_mutex);
+	m_snapshot = t;
+}
+
 #if TORRENT_USE_INVARIANT_CHECKS
 void routing_table::check_invariant() const
 {
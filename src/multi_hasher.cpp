@@ -0,0 +1,311 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/multi_hasher.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <cstring>
+#include <algorithm> // for min
+
+#if TORRENT_HAS_SSE && (defined __SSE2__ || defined _M_X64 || defined _M_AMD64 \
+	|| (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#define TORRENT_MULTI_HASHER_SSE2 1
+#include <emmintrin.h>
+#else
+#define TORRENT_MULTI_HASHER_SSE2 0
+#endif
+
+typedef boost::uint32_t u32;
+typedef boost::uint8_t u8;
+
+namespace libtorrent
+{
+	namespace
+	{
+		u32 const initial_state[5] =
+		{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+		u32 const round_constants[4] =
+		{ 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+
+		u32 load_be32(u8 const* p)
+		{
+			return (u32(p[0]) << 24) | (u32(p[1]) << 16)
+				| (u32(p[2]) << 8) | u32(p[3]);
+		}
+
+		void store_be32(u8* p, u32 v)
+		{
+			p[0] = u8(v >> 24);
+			p[1] = u8(v >> 16);
+			p[2] = u8(v >> 8);
+			p[3] = u8(v);
+		}
+
+		u32 rol(u32 v, int bits) { return (v << bits) | (v >> (32 - bits)); }
+
+		// hash a single 64 byte block into ``state``
+		void transform(u32 state[5], u8 const* block)
+		{
+			u32 w[80];
+			for (int i = 0; i < 16; ++i) w[i] = load_be32(block + i * 4);
+			for (int i = 16; i < 80; ++i)
+				w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+			u32 a = state[0];
+			u32 b = state[1];
+			u32 c = state[2];
+			u32 d = state[3];
+			u32 e = state[4];
+
+			for (int i = 0; i < 80; ++i)
+			{
+				u32 f;
+				if (i < 20) f = (b & c) | (~b & d);
+				else if (i < 40) f = b ^ c ^ d;
+				else if (i < 60) f = (b & c) | (b & d) | (c & d);
+				else f = b ^ c ^ d;
+
+				u32 const t = rol(a, 5) + f + e + round_constants[i / 20] + w[i];
+				e = d;
+				d = c;
+				c = rol(b, 30);
+				b = a;
+				a = t;
+			}
+
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+		}
+
+#if TORRENT_MULTI_HASHER_SSE2
+		typedef __m128i v4;
+
+		inline v4 rol4(v4 v, int bits)
+		{
+			return _mm_or_si128(_mm_slli_epi32(v, bits), _mm_srli_epi32(v, 32 - bits));
+		}
+
+		inline v4 load_word4(u8 const* const* blocks, int offset)
+		{
+			return _mm_set_epi32(int(load_be32(blocks[3] + offset))
+				, int(load_be32(blocks[2] + offset))
+				, int(load_be32(blocks[1] + offset))
+				, int(load_be32(blocks[0] + offset)));
+		}
+
+		// hash one 64 byte block in each of the 4 lanes. Each 32 bit element
+		// of the vectors belongs to one lane, element i to lane i
+		void transform4(v4 state[5], u8 const* const* blocks)
+		{
+			v4 w[80];
+			for (int i = 0; i < 16; ++i) w[i] = load_word4(blocks, i * 4);
+			for (int i = 16; i < 80; ++i)
+			{
+				w[i] = rol4(_mm_xor_si128(_mm_xor_si128(w[i-3], w[i-8])
+					, _mm_xor_si128(w[i-14], w[i-16])), 1);
+			}
+
+			v4 a = state[0];
+			v4 b = state[1];
+			v4 c = state[2];
+			v4 d = state[3];
+			v4 e = state[4];
+
+			for (int i = 0; i < 80; ++i)
+			{
+				v4 f;
+				if (i < 20)
+					f = _mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d));
+				else if (i < 40 || i >= 60)
+					f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+				else
+					f = _mm_or_si128(_mm_and_si128(b, c)
+						, _mm_and_si128(d, _mm_or_si128(b, c)));
+
+				v4 const t = _mm_add_epi32(_mm_add_epi32(rol4(a, 5), f)
+					, _mm_add_epi32(_mm_add_epi32(e, w[i])
+						, _mm_set1_epi32(int(round_constants[i / 20]))));
+				e = d;
+				d = c;
+				c = rol4(b, 30);
+				b = a;
+				a = t;
+			}
+
+			state[0] = _mm_add_epi32(state[0], a);
+			state[1] = _mm_add_epi32(state[1], b);
+			state[2] = _mm_add_epi32(state[2], c);
+			state[3] = _mm_add_epi32(state[3], d);
+			state[4] = _mm_add_epi32(state[4], e);
+		}
+#endif
+	}
+
+	multi_hasher::multi_hasher()
+	{
+		reset();
+	}
+
+	bool multi_hasher::is_parallel()
+	{
+		return TORRENT_MULTI_HASHER_SSE2 != 0;
+	}
+
+	void multi_hasher::reset()
+	{
+		for (int i = 0; i < max_lanes; ++i) reset(i);
+	}
+
+	void multi_hasher::reset(int lane)
+	{
+		lane_t& l = m_lanes[lane];
+		std::memcpy(l.state, initial_state, sizeof(l.state));
+		l.count = 0;
+	}
+
+	void multi_hasher::update(int lane, char const* data, int len)
+	{
+		TORRENT_ASSERT(lane >= 0 && lane < max_lanes);
+		TORRENT_ASSERT(len >= 0);
+		lane_t& l = m_lanes[lane];
+		u8 const* p = reinterpret_cast<u8 const*>(data);
+
+		int const used = int(l.count & 63);
+		l.count += len;
+
+		if (used > 0)
+		{
+			int const n = (std::min)(64 - used, len);
+			std::memcpy(l.buffer + used, p, n);
+			p += n;
+			len -= n;
+			if (used + n < 64) return;
+			transform(l.state, l.buffer);
+		}
+
+		for (; len >= 64; p += 64, len -= 64)
+			transform(l.state, p);
+
+		if (len > 0) std::memcpy(l.buffer, p, len);
+	}
+
+	void multi_hasher::update_lanes(char const* const* data, int len)
+	{
+		TORRENT_ASSERT(len >= 0);
+		TORRENT_ASSERT((len & 63) == 0);
+
+#if TORRENT_MULTI_HASHER_SSE2
+		// lanes that aren't fed are run on a dummy block, and their state is
+		// thrown away afterwards
+		static u8 const dummy[64] = { 0 };
+
+		u8 const* blocks[max_lanes];
+		u32 lanes[max_lanes][5];
+		for (int i = 0; i < max_lanes; ++i)
+		{
+			if (data[i])
+			{
+				TORRENT_ASSERT((m_lanes[i].count & 63) == 0);
+				blocks[i] = reinterpret_cast<u8 const*>(data[i]);
+			}
+			else
+			{
+				blocks[i] = dummy;
+			}
+			std::memcpy(lanes[i], m_lanes[i].state, sizeof(lanes[i]));
+		}
+
+		// transpose the lane states into one vector per state word
+		v4 state[5];
+		for (int k = 0; k < 5; ++k)
+		{
+			state[k] = _mm_set_epi32(int(lanes[3][k]), int(lanes[2][k])
+				, int(lanes[1][k]), int(lanes[0][k]));
+		}
+
+		for (int offset = 0; offset < len; offset += 64)
+		{
+			transform4(state, blocks);
+			for (int i = 0; i < max_lanes; ++i)
+				if (data[i]) blocks[i] += 64;
+		}
+
+		u32 out[5][max_lanes];
+		for (int k = 0; k < 5; ++k)
+			_mm_storeu_si128(reinterpret_cast<v4*>(out[k]), state[k]);
+
+		for (int i = 0; i < max_lanes; ++i)
+		{
+			if (!data[i]) continue;
+			for (int k = 0; k < 5; ++k) m_lanes[i].state[k] = out[k][i];
+			m_lanes[i].count += len;
+		}
+#else
+		for (int i = 0; i < max_lanes; ++i)
+		{
+			if (!data[i]) continue;
+			TORRENT_ASSERT((m_lanes[i].count & 63) == 0);
+			update(i, data[i], len);
+		}
+#endif
+	}
+
+	sha1_hash multi_hasher::final(int lane)
+	{
+		TORRENT_ASSERT(lane >= 0 && lane < max_lanes);
+		lane_t& l = m_lanes[lane];
+
+		u8 length[8];
+		boost::uint64_t const bits = l.count * 8;
+		for (int i = 0; i < 8; ++i)
+			length[i] = u8(bits >> ((7 - i) * 8));
+
+		// pad with a single 1 bit followed by zeroes, up to 8 bytes short of
+		// a block boundary, where the message length goes
+		static u8 const padding[64] = { 0x80 };
+		int const used = int(l.count & 63);
+		int const pad = used < 56 ? 56 - used : 120 - used;
+		update(lane, reinterpret_cast<char const*>(padding), pad);
+		update(lane, reinterpret_cast<char const*>(length), 8);
+		TORRENT_ASSERT((l.count & 63) == 0);
+
+		u8 digest[20];
+		for (int i = 0; i < 5; ++i) store_be32(digest + i * 4, l.state[i]);
+		reset(lane);
+		return sha1_hash(reinterpret_cast<char const*>(digest));
+	}
+}
+
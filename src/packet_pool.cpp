@@ -0,0 +1,127 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/packet_pool.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <cstdlib> // for malloc
+
+namespace libtorrent
+{
+	namespace
+	{
+		// small packets (SYN, FIN and short payloads), packets up to the
+		// ethernet MTU (including the teredo MTU) and jumbo frames. Each
+		// class leaves room for the packet bookkeeping in front of the
+		// payload
+		int const class_sizes[packet_pool::num_size_classes] =
+		{ 256, 1536, 9216 };
+	}
+
+	packet_pool::packet_pool(counters& cnt)
+		: m_cached_bytes(0)
+		, m_counters(cnt)
+	{}
+
+	packet_pool::~packet_pool()
+	{
+		for (int c = 0; c < num_size_classes; ++c)
+		{
+			for (std::vector<void*>::iterator i = m_free_list[c].begin()
+				, end(m_free_list[c].end()); i != end; ++i)
+			{
+				std::free(*i);
+			}
+		}
+		m_counters.inc_stats_counter(counters::utp_packet_pool_bytes
+			, -m_cached_bytes);
+	}
+
+	int packet_pool::size_class(int size)
+	{
+		for (int c = 0; c < num_size_classes; ++c)
+			if (size <= class_sizes[c]) return c;
+		return -1;
+	}
+
+	int packet_pool::class_size(int c)
+	{
+		TORRENT_ASSERT(c >= 0 && c < num_size_classes);
+		return class_sizes[c];
+	}
+
+	void* packet_pool::allocate(int size)
+	{
+		int const c = size_class(size);
+		if (c < 0)
+		{
+			m_counters.inc_stats_counter(counters::utp_packet_pool_misses);
+			return std::malloc(size);
+		}
+
+		std::vector<void*>& l = m_free_list[c];
+		if (l.empty())
+		{
+			m_counters.inc_stats_counter(counters::utp_packet_pool_misses);
+			// allocate the whole class size, so the buffer can be reused for
+			// any size in the class
+			return std::malloc(class_sizes[c]);
+		}
+
+		m_counters.inc_stats_counter(counters::utp_packet_pool_hits);
+		void* ret = l.back();
+		l.pop_back();
+		m_cached_bytes -= class_sizes[c];
+		m_counters.inc_stats_counter(counters::utp_packet_pool_bytes
+			, -class_sizes[c]);
+		return ret;
+	}
+
+	void packet_pool::release(void* p, int size)
+	{
+		if (p == NULL) return;
+
+		int const c = size_class(size);
+		if (c < 0 || m_cached_bytes + class_sizes[c] > max_cached_bytes)
+		{
+			std::free(p);
+			return;
+		}
+
+		m_free_list[c].push_back(p);
+		m_cached_bytes += class_sizes[c];
+		m_counters.inc_stats_counter(counters::utp_packet_pool_bytes
+			, class_sizes[c]);
+	}
+}
+
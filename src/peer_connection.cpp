@@ -33,6 +33,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <boost/limits.hpp>
 #include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/cstdint.hpp>
 
 #ifdef TORRENT_LOGGING
@@ -71,6 +72,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/kademlia/node_id.hpp"
 #include "libtorrent/close_reason.hpp"
 #include "libtorrent/aux_/time.hpp"
+#include "libtorrent/storage.hpp" // for file_io_slice
 
 #ifdef TORRENT_DEBUG
 #include <set>
@@ -80,6 +82,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <openssl/rand.h>
 #endif
 
+#if TORRENT_USE_SENDFILE
+#include <sys/sendfile.h>
+#include <errno.h>
+#endif
+
 //#define TORRENT_CORRUPT_DATA
 
 using boost::shared_ptr;
@@ -98,6 +105,26 @@ namespace libtorrent
 		return pb.send_buffer_offset != pending_block::not_in_buffer;
 	}
 
+	namespace {
+
+	typedef boost::function<void(error_code const&)> connect_handler;
+
+	// these are posted to the io_service of a network shard, to operate
+	// on a socket that belongs to it from the shard's own thread
+	void async_connect_socket(boost::shared_ptr<socket_type> s
+		, tcp::endpoint const& ep, connect_handler const& h)
+	{
+		s->async_connect(ep, h);
+	}
+
+	void close_socket(boost::shared_ptr<socket_type> s)
+	{
+		error_code ec;
+		s->close(ec);
+	}
+
+	} // anonymous namespace
+
 #if defined TORRENT_REQUEST_LOGGING
 	void write_request_log(FILE* f, sha1_hash const& ih
 		, peer_connection* p, peer_request const& r)
@@ -182,6 +209,10 @@ namespace libtorrent
 		, m_upload_rate_peak(0)
 		, m_send_barrier(INT_MAX)
 		, m_desired_queue_size(2)
+		, m_slow_start_queue(min_request_queue)
+		, m_base_rtt(0)
+		, m_slow_start_rate(0)
+		, m_rtt_probe(piece_block::invalid)
 		, m_prefer_contiguous_blocks(0)
 		, m_disk_read_failures(0)
 		, m_outstanding_piece_verification(0)
@@ -203,6 +234,7 @@ namespace libtorrent
 		, m_need_interest_update(false)
 		, m_has_metadata(true)
 		, m_exceeded_limit(false)
+		, m_slow_start(true)
 #if TORRENT_USE_ASSERTS
 		, m_in_constructor(true)
 		, m_disconnect_started(false)
@@ -414,8 +446,26 @@ namespace libtorrent
 			t->debug_log("START connect [%p] (%d)", this, int(t->num_peers()));
 #endif
 
-		m_socket->async_connect(m_remote
-			, boost::bind(&peer_connection::on_connection_complete, self(), _1));
+#if defined TORRENT_LOGGING
+		peer_log("*** LOCAL ENDPOINT[ e: %s ]", print_endpoint(m_socket->local_endpoint(ec)).c_str());
+#endif
+
+		io_service* ios = handler_io_service();
+		if (ios)
+		{
+			// the socket belongs to a network shard. The connect is issued by
+			// the shard's thread, and the handler posted back to the network
+			// thread. From here on, this thread doesn't touch the socket
+			// until the connection completes
+			m_socket->get_io_service().post(boost::bind(&async_connect_socket
+				, m_socket, m_remote, connect_handler(ios->wrap(
+				boost::bind(&peer_connection::on_connection_complete, self(), _1)))));
+		}
+		else
+		{
+			m_socket->async_connect(m_remote
+				, boost::bind(&peer_connection::on_connection_complete, self(), _1));
+		}
 		m_connect = clock_type::now();
 
 		sent_syn(m_remote.address().is_v6());
@@ -425,9 +475,6 @@ namespace libtorrent
 			t->alerts().post_alert(peer_connect_alert(
 				t->get_handle(), remote(), pid(), m_socket->type()));
 		}
-#if defined TORRENT_LOGGING
-		peer_log("*** LOCAL ENDPOINT[ e: %s ]", print_endpoint(m_socket->local_endpoint(ec)).c_str());
-#endif
 	}
 
 	void peer_connection::update_interest()
@@ -990,12 +1037,9 @@ namespace libtorrent
 		return m_requests;
 	}
 
-	time_duration peer_connection::download_queue_time(int extra_bytes) const
+	int peer_connection::estimated_download_rate() const
 	{
 		TORRENT_ASSERT(is_single_thread());
-		boost::shared_ptr<torrent> t = m_torrent.lock();
-		TORRENT_ASSERT(t);
-
 		int rate = 0;
 
 		// if we haven't received any data recently, the current download rate
@@ -1015,6 +1059,9 @@ namespace libtorrent
 			// avoid division by 0
 			if (peers_with_requests == 0) peers_with_requests = 1;
 
+			boost::shared_ptr<torrent> t = m_torrent.lock();
+			TORRENT_ASSERT(t);
+
 			// TODO: this should be the global download rate
 			rate = t->statistics().transfer_rate(stat::download_payload) / peers_with_requests;
 		}
@@ -1030,8 +1077,104 @@ namespace libtorrent
 		// average of current rate and peak
 //		rate = (rate + m_download_rate_peak) / 2;
 
-		return milliseconds((m_outstanding_bytes
-			+ m_queued_time_critical * t->block_size() * 1000) / rate);
+		return rate;
+	}
+
+	time_duration peer_connection::download_queue_time(int extra_bytes) const
+	{
+		TORRENT_ASSERT(is_single_thread());
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		TORRENT_ASSERT(t);
+
+		boost::int64_t const bytes = m_outstanding_bytes + extra_bytes
+			+ boost::int64_t(m_queued_time_critical) * t->block_size();
+		return transfer_time(bytes, estimated_download_rate());
+	}
+
+	time_duration peer_connection::expected_arrival_time(int extra_bytes) const
+	{
+		TORRENT_ASSERT(is_single_thread());
+		return download_queue_time(extra_bytes) + milliseconds(m_request_time.mean());
+	}
+
+	time_duration peer_connection::expected_arrival_time(piece_block const& b) const
+	{
+		TORRENT_ASSERT(is_single_thread());
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		TORRENT_ASSERT(t);
+
+		return block_arrival_time(b, m_download_queue, m_request_queue
+			, m_outstanding_bytes, t->block_size(), estimated_download_rate()
+			, m_request_time.mean());
+	}
+
+	time_duration transfer_time(boost::int64_t bytes, int rate)
+	{
+		TORRENT_ASSERT(rate > 0);
+		return milliseconds(bytes * 1000 / rate);
+	}
+
+	time_duration block_arrival_time(piece_block const& b
+		, std::vector<pending_block> const& download_queue
+		, std::vector<pending_block> const& request_queue
+		, int outstanding_bytes, int block_size, int rate, int request_time)
+	{
+		std::vector<pending_block>::const_iterator i = std::find_if(
+			download_queue.begin(), download_queue.end(), has_block(b));
+		if (i != download_queue.end())
+		{
+			// the request has been sent. Everything ahead of it in the queue
+			// has to be received first
+			boost::int64_t const bytes = (std::min)(boost::int64_t(outstanding_bytes)
+				, boost::int64_t(i - download_queue.begin() + 1) * block_size);
+			return transfer_time(bytes, rate);
+		}
+
+		i = std::find_if(request_queue.begin(), request_queue.end()
+			, has_block(b));
+		int const queue_pos = i == request_queue.end()
+			? int(request_queue.size()) : int(i - request_queue.begin());
+		boost::int64_t const bytes = outstanding_bytes
+			+ boost::int64_t(queue_pos + 1) * block_size;
+		return transfer_time(bytes, rate) + milliseconds(request_time);
+	}
+
+	int adaptive_queue_size(int queue_size, int download_rate, int block_size
+		, int base_rtt, int slow_start_queue)
+	{
+		TORRENT_ASSERT(block_size > 0);
+
+		// keep at least the bandwidth-delay product of the connection
+		// outstanding (with as much again for headroom). On high latency
+		// links, a queue sized by the download rate alone may be too short
+		// to ever reach the rate the link is capable of
+		if (base_rtt > 0)
+		{
+			int const bdp = int(boost::int64_t(download_rate) * base_rtt
+				* 2 / 1000 / block_size);
+			queue_size = (std::max)(queue_size, bdp);
+		}
+
+		// the download rate of a new connection is limited by the size of
+		// its request queue, so it can't be used to size it. Instead, it's
+		// grown by the slow start queue until the rate stops increasing
+		return (std::max)(queue_size, slow_start_queue);
+	}
+
+	bool slow_start_done(int queue_size, int max_queue_size, int rate
+		, int prev_rate)
+	{
+		if (queue_size >= max_queue_size) return true;
+		return rate > 0 && rate <= prev_rate + prev_rate / 8;
+	}
+
+	int update_base_rtt(int base_rtt, int sample)
+	{
+		// keep the lowest sample, but let it follow increases slowly in case
+		// the path changed
+		sample = (std::max)(sample, 1);
+		if (base_rtt == 0 || sample < base_rtt) return sample;
+		return (base_rtt * 7 + sample) / 8;
 	}
 
 	void peer_connection::add_stat(boost::int64_t downloaded, boost::int64_t uploaded)
@@ -2769,6 +2912,20 @@ namespace libtorrent
 			, m_request_time.mean(), m_request_time.avg_deviation());
 #endif
 
+		if (m_rtt_probe == block_finished)
+		{
+			// this block was requested when there were no other requests
+			// outstanding, so it wasn't queued up behind other blocks. Other
+			// blocks may arrive before it (e.g. ones we cancelled), those
+			// aren't samples of the round-trip
+			m_rtt_probe = piece_block::invalid;
+			m_base_rtt = update_base_rtt(m_base_rtt
+				, int(total_milliseconds(now - m_rtt_probe_sent)));
+		}
+
+		if (m_slow_start && m_slow_start_queue < m_max_out_request_queue)
+			++m_slow_start_queue;
+
 		// we completed an incoming block, and there are still outstanding
 		// requests. The next block we expect to receive now has another
 		// timeout period until we time out. So, reset the timer.
@@ -3829,8 +3986,11 @@ namespace libtorrent
 		{
 			// This means we just added a request to this connection that
 			// previously did not have a request. That's when we start the
-			// request timeout.
+			// request timeout. The first block to arrive is also a sample
+			// of the request round-trip time
 			m_requested = aux::time_now();
+			m_rtt_probe = m_download_queue.front().block;
+			m_rtt_probe_sent = m_requested;
 #if defined TORRENT_LOGGING
 			t->debug_log("REQUEST [%p] (%d ms)", this
 				, int(total_milliseconds(clock_type::now() - m_unchoke_time)));
@@ -4164,7 +4324,13 @@ namespace libtorrent
 		m_disconnecting = true;
 		error_code e;
 
-		async_shutdown(*m_socket, m_socket);
+		// a socket that belongs to a network shard may have operations in
+		// flight on the shard's thread. It has to be closed there too. It's
+		// a plain TCP socket, there's no SSL shutdown to do
+		if (socket_on_shard())
+			m_socket->get_io_service().post(boost::bind(&close_socket, m_socket));
+		else
+			async_shutdown(*m_socket, m_socket);
 
 		m_ses.close_connection(this, ec);
 	}
@@ -4230,6 +4396,7 @@ namespace libtorrent
 		p.download_rate_peak = m_download_rate_peak;
 		p.upload_rate_peak = m_upload_rate_peak;
 		p.rtt = m_request_time.mean();
+		p.base_rtt = m_base_rtt;
 		p.down_speed = statistics().download_rate();
 		p.up_speed = statistics().upload_rate();
 		p.payload_down_speed = statistics().download_payload_rate();
@@ -4354,8 +4521,11 @@ namespace libtorrent
 
 		p.estimated_reciprocation_rate = m_est_reciprocation_rate;
 
+		// the socket of a connection on a network shard may only be used by
+		// the shard's thread
 		error_code ec;
-		p.local_endpoint = get_socket()->local_endpoint(ec);
+		p.local_endpoint = socket_on_shard() ? m_local
+			: get_socket()->local_endpoint(ec);
 	}
 
 	// allocates a disk buffer of size 'disk_buffer_size' and replaces the
@@ -4474,12 +4644,19 @@ namespace libtorrent
 
 		TORRENT_ASSERT(block_size > 0);
 		
-		m_desired_queue_size = queue_time * download_rate / block_size;
+		int queue_size = queue_time * download_rate / block_size;
+
+		if (m_settings.get_bool(settings_pack::adaptive_request_queue))
+		{
+			queue_size = adaptive_queue_size(queue_size, download_rate, block_size
+				, m_base_rtt, m_slow_start ? int(m_slow_start_queue) : 0);
+		}
 
-		if (m_desired_queue_size > m_max_out_request_queue)
-			m_desired_queue_size = m_max_out_request_queue;
-		if (m_desired_queue_size < min_request_queue)
-			m_desired_queue_size = min_request_queue;
+		if (queue_size > m_max_out_request_queue)
+			queue_size = m_max_out_request_queue;
+		if (queue_size < min_request_queue)
+			queue_size = min_request_queue;
+		m_desired_queue_size = queue_size;
 	}
 
 	void peer_connection::second_tick(int tick_interval_ms)
@@ -4708,6 +4885,23 @@ namespace libtorrent
 
 		if (!t->ready_for_connections()) return;
 
+		if (m_slow_start && !m_download_queue.empty())
+		{
+			// leave slow start once a larger request queue no longer makes
+			// the download rate grow, or the queue can't grow any further
+			int const rate = m_statistics.download_payload_rate();
+			if (slow_start_done(m_slow_start_queue, m_max_out_request_queue
+				, rate, m_slow_start_rate))
+			{
+				m_slow_start = false;
+#if defined TORRENT_LOGGING
+				peer_log("*** LEAVING SLOW START [ queue: %d rate: %d base-rtt: %d ms ]"
+					, int(m_slow_start_queue), rate, m_base_rtt);
+#endif
+			}
+			m_slow_start_rate = rate;
+		}
+
 		update_desired_queue_size();
 
 		if (m_desired_queue_size == m_max_out_request_queue 
@@ -4774,6 +4968,12 @@ namespace libtorrent
 		}
 		m_desired_queue_size = 1;
 
+		// once the peer starts sending again, ramp the request queue up
+		// from scratch
+		m_slow_start = true;
+		m_slow_start_queue = min_request_queue;
+		m_slow_start_rate = 0;
+
 		if (on_parole()) return;
 
 		if (!t->has_picker()) return;
@@ -4984,7 +5184,8 @@ namespace libtorrent
 				t->inc_refcount("async_read");
 				m_disk_thread.async_read(&t->storage(), r
 					, boost::bind(&peer_connection::on_disk_read_complete
-					, self(), _1, r, clock_type::now()), this);
+					, self(), _1, r, clock_type::now()), this
+					, can_send_file() ? disk_io_job::allow_file_reference : 0);
 			}
 			m_requests.erase(m_requests.begin() + i);
 
@@ -5129,6 +5330,24 @@ namespace libtorrent
 			return;
 		}
 
+		if ((j->flags & disk_io_job::file_reference) && !can_send_file())
+		{
+			// use_sendfile was turned off (or the connection started to
+			// encrypt) while the read was in flight. The file range can't be
+			// sent anymore, read the block into a buffer instead
+#if defined TORRENT_LOGGING
+			peer_log("*** FILE ASYNC READ [ piece: %d | s: %x | l: %x ] sendfile disabled"
+				, r.piece, r.start, r.length);
+#endif
+			if (!t->need_loaded()) return;
+			m_reading_bytes += r.length;
+			t->inc_refcount("async_read");
+			m_disk_thread.async_read(&t->storage(), r
+				, boost::bind(&peer_connection::on_disk_read_complete
+				, self(), _1, r, clock_type::now()), this);
+			return;
+		}
+
 #if defined TORRENT_LOGGING
 		peer_log("==> PIECE   [ piece: %d s: %x l: %x ]"
 			, r.piece, r.start, r.length);
@@ -5144,7 +5363,11 @@ namespace libtorrent
 		{
 			t->add_suggest_piece(r.piece);
 		}
-		write_piece(r, buffer);
+
+		if (j->flags & disk_io_job::file_reference)
+			write_piece_file(r, *reinterpret_cast<file_io_slice const*>(j->buffer));
+		else
+			write_piece(r, buffer);
 	}
 
 	void peer_connection::assign_bandwidth(int channel, int amount)
@@ -5396,6 +5619,35 @@ namespace libtorrent
 		}
 
 		TORRENT_ASSERT((m_channel_state[upload_channel] & peer_info::bw_network) == 0);
+
+#if TORRENT_USE_SENDFILE
+		boost::int64_t file_offset;
+		int file_size;
+		if (m_send_buffer.front_file(file_offset, file_size))
+		{
+			// the front of the send buffer is a range of a file. Wait for
+			// the socket to become writable and sendfile() it from there
+			tcp::socket* s = m_socket->get<tcp::socket>();
+			TORRENT_ASSERT(s);
+#if defined TORRENT_LOGGING
+			peer_log(">>> ASYNC_SENDFILE [ bytes: %d ]"
+				, (std::min)(amount_to_send, file_size));
+#endif
+#if defined TORRENT_ASIO_DEBUGGING
+			add_outstanding_async("peer_connection::on_send_data");
+#endif
+#if TORRENT_USE_ASSERTS
+			TORRENT_ASSERT(!m_socket_is_writing);
+			m_socket_is_writing = true;
+#endif
+			s->async_write_some(asio::null_buffers(), make_write_handler(
+				boost::bind(&peer_connection::on_send_file_ready, self(), _1
+				, amount_to_send)));
+			m_channel_state[upload_channel] |= peer_info::bw_network;
+			return;
+		}
+#endif
+
 #if defined TORRENT_LOGGING
 		peer_log(">>> ASYNC_WRITE [ bytes: %d ]", amount_to_send);
 #endif
@@ -5427,6 +5679,135 @@ namespace libtorrent
 		m_channel_state[upload_channel] |= peer_info::bw_network;
 	}
 
+#if TORRENT_USE_SENDFILE
+	void peer_connection::on_send_file_ready(error_code const& error, int amount)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		if (error)
+		{
+			on_send_data(error, 0);
+			return;
+		}
+
+		boost::int64_t file_offset;
+		int file_size;
+		file* f = m_send_buffer.front_file(file_offset, file_size);
+		tcp::socket* s = m_socket->get<tcp::socket>();
+		TORRENT_ASSERT(f);
+		TORRENT_ASSERT(s);
+
+		int const to_send = (std::min)(amount, file_size);
+		if (!f->is_resident(file_offset, to_send))
+		{
+			// the range was evicted from the page cache since the disk thread
+			// looked at it. sendfile() would block this thread on the disk,
+			// have the disk thread read the block into a buffer instead. The
+			// upload channel stays blocked on the network until it's done
+			boost::shared_ptr<torrent> t = m_torrent.lock();
+			if (!t)
+			{
+				on_send_data(errors::torrent_aborted, 0);
+				return;
+			}
+			peer_request const& r = m_send_buffer.front_file_request();
+#if defined TORRENT_LOGGING
+			peer_log("*** FILE ASYNC READ [ piece: %d | s: %x | l: %x ] not in page cache"
+				, r.piece, r.start, r.length);
+#endif
+#if TORRENT_USE_ASSERTS
+			TORRENT_ASSERT(m_socket_is_writing);
+			m_socket_is_writing = false;
+#endif
+#if defined TORRENT_ASIO_DEBUGGING
+			complete_async("peer_connection::on_send_data");
+#endif
+			if (!t->need_loaded()) return;
+			m_reading_bytes += r.length;
+			t->inc_refcount("async_read");
+			m_disk_thread.async_read(&t->storage(), r
+				, boost::bind(&peer_connection::on_send_file_read, self(), _1, r)
+				, this, disk_io_job::force_copy);
+			return;
+		}
+
+		error_code ec;
+		// sendfile() must not block the network thread. This leaves
+		// asio's synchronous operations on the socket unaffected
+		s->native_non_blocking(true, ec);
+
+		off_t offset = file_offset;
+		ssize_t ret = 0;
+		if (!ec)
+		{
+			ret = ::sendfile(s->native_handle(), f->native_handle(), &offset
+				, to_send);
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			{
+				// someone else filled the socket buffer first, wait again
+				s->async_write_some(asio::null_buffers(), make_write_handler(
+					boost::bind(&peer_connection::on_send_file_ready, self(), _1
+					, amount)));
+				return;
+			}
+			if (ret < 0) ec.assign(errno, boost::system::system_category());
+			// the file was truncated under us
+			else if (ret == 0) ec = errors::file_too_short;
+		}
+		on_send_data(ec, ret < 0 ? 0 : ret);
+	}
+
+	namespace {
+
+	void free_send_file_block(char* buffer, void* userdata
+		, block_cache_reference ref)
+	{
+		buffer_allocator_interface* buf = (buffer_allocator_interface*)userdata;
+		if (ref.storage) buf->reclaim_block(ref);
+		else buf->free_disk_buffer(buffer);
+	}
+
+	}
+
+	void peer_connection::on_send_file_read(disk_io_job const* j
+		, peer_request r)
+	{
+		TORRENT_ASSERT(is_single_thread());
+
+		m_reading_bytes -= r.length;
+
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		torrent_ref_holder h(t.get(), "async_read");
+		if (t) t->dec_refcount("async_read");
+
+		if (j->ret != r.length)
+		{
+			TORRENT_ASSERT(j->buffer == 0);
+			disconnect(j->error.ec ? j->error.ec
+				: error_code(errors::file_too_short), op_file_read);
+			return;
+		}
+
+		disk_buffer_holder buffer(m_allocator, *j);
+
+		if (m_disconnecting) return;
+
+		TORRENT_ASSERT(m_channel_state[upload_channel] & peer_info::bw_network);
+#if TORRENT_USE_ASSERTS
+		boost::int64_t file_offset;
+		int file_size;
+		TORRENT_ASSERT(m_send_buffer.front_file(file_offset, file_size));
+		TORRENT_ASSERT(m_send_buffer.front_file_request() == r);
+#endif
+
+		m_send_buffer.replace_front_file(buffer.get(), &free_send_file_block
+			, &m_allocator, buffer.ref());
+		buffer.release();
+
+		m_channel_state[upload_channel] &= ~peer_info::bw_network;
+		setup_send();
+	}
+#endif
+
 	void peer_connection::on_disk()
 	{
 		TORRENT_ASSERT(is_single_thread());
@@ -5519,9 +5900,12 @@ namespace libtorrent
 		int num_bufs = 0;
 		// only apply the contiguous receive buffer when we don't have any
 		// outstanding requests. When we're likely to receive pieces, we'll
-		// save more time from avoiding copying data from the socket
+		// save more time from avoiding copying data from the socket. That
+		// involves reading from the socket on this thread, which sockets on
+		// a network shard can't do
 		if ((m_settings.get_bool(settings_pack::contiguous_recv_buffer)
-			|| m_download_queue.empty()) && !m_recv_buffer.has_disk_buffer())
+			|| m_download_queue.empty()) && !m_recv_buffer.has_disk_buffer()
+			&& !socket_on_shard())
 		{
 			if (s == read_sync)
 			{
@@ -5609,6 +5993,14 @@ namespace libtorrent
 			return 0;
 		}
 
+		// sockets on a network shard are only read from by the shard's
+		// thread
+		if (socket_on_shard())
+		{
+			ec = asio::error::would_block;
+			return 0;
+		}
+
 		size_t ret = 0;
 		if (num_bufs == 1)
 		{
@@ -5645,6 +6037,14 @@ namespace libtorrent
 			, userdata, ref);
 	}
 
+	void peer_connection::append_send_file(file_handle const& f
+		, boost::int64_t offset, peer_request const& r)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(can_send_file());
+		m_send_buffer.append_file(f, offset, r);
+	}
+
 	void session_free_buffer(char* buffer, void* userdata, block_cache_reference)
 	{
 		aux::session_interface* ses = (aux::session_interface*)userdata;
@@ -6183,6 +6583,17 @@ namespace libtorrent
 	// SEND DATA
 	// --------------------------
 
+	bool peer_connection::socket_on_shard() const
+	{
+		return handler_io_service() != NULL;
+	}
+
+	io_service* peer_connection::handler_io_service() const
+	{
+		io_service& ios = m_ses.get_io_service();
+		return &m_socket->get_io_service() == &ios ? NULL : &ios;
+	}
+
 	void peer_connection::on_send_data(error_code const& error
 		, std::size_t bytes_transferred)
 	{
@@ -33,6 +33,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <functional>
 #include <numeric>
 #include <limits>
 
@@ -57,6 +58,14 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/invariant_check.hpp"
 
+#if TORRENT_HAS_SSE && (defined __SSE2__ || defined _M_X64 || defined _M_AMD64 \
+	|| (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#define TORRENT_PICKER_SSE2 1
+#include <emmintrin.h>
+#else
+#define TORRENT_PICKER_SSE2 0
+#endif
+
 #define TORRENT_PIECE_PICKER_INVARIANT_CHECK INVARIANT_CHECK
 //#define TORRENT_NO_EXPENSIVE_INVARIANT_CHECK
 //#define TORRENT_PIECE_PICKER_INVARIANT_CHECK
@@ -66,6 +75,97 @@ namespace libtorrent
 
 	const piece_block piece_block::invalid(0x7FFFF, 0x1FFF);
 
+namespace {
+
+	// adds delta (1 or -1) times the number of bitfields that have a piece to
+	// that piece's counter. The bitfields are walked in lock-step, one byte
+	// (8 pieces) at a time, so that every counter is loaded and stored once
+	// regardless of how many bitfields are added. With SSE2, the bits of each
+	// byte are expanded into 8 16 bit lanes and summed in a vector register
+	void add_to_counters(boost::uint16_t* counters, int const num_counters
+		, bitfield const* const* bits, int const num_bitfields, int const delta)
+	{
+		TORRENT_ASSERT(delta == 1 || delta == -1);
+		int num_bytes = 0;
+		for (int i = 0; i < num_bitfields; ++i)
+		{
+			TORRENT_ASSERT(bits[i]->size() <= num_counters);
+			num_bytes = (std::max)(num_bytes, (bits[i]->size() + 7) / 8);
+		}
+
+#if TORRENT_PICKER_SSE2
+		// the first piece of each byte is its most significant bit, and
+		// goes in the lowest lane
+		__m128i const bit_mask = _mm_set_epi16(0x01, 0x02, 0x04, 0x08
+			, 0x10, 0x20, 0x40, 0x80);
+#endif
+
+		for (int j = 0; j < num_bytes; ++j)
+		{
+			boost::uint16_t* c = counters + j * 8;
+			int const n = (std::min)(8, num_counters - j * 8);
+#if TORRENT_PICKER_SSE2
+			if (n == 8)
+			{
+				__m128i sum = _mm_setzero_si128();
+				bool any_set = false;
+				for (int i = 0; i < num_bitfields; ++i)
+				{
+					if (j >= (bits[i]->size() + 7) / 8) continue;
+					int const byte = boost::uint8_t(bits[i]->bytes()[j]);
+					if (byte == 0) continue;
+					any_set = true;
+					// lanes whose bit is set compare equal and become -1
+					__m128i const set = _mm_cmpeq_epi16(
+						_mm_and_si128(_mm_set1_epi16(short(byte)), bit_mask), bit_mask);
+					sum = _mm_sub_epi16(sum, set);
+				}
+				if (!any_set) continue;
+				__m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(c));
+				v = delta > 0 ? _mm_add_epi16(v, sum) : _mm_sub_epi16(v, sum);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(c), v);
+				continue;
+			}
+#endif
+			for (int i = 0; i < num_bitfields; ++i)
+			{
+				if (j >= (bits[i]->size() + 7) / 8) continue;
+				int const byte = boost::uint8_t(bits[i]->bytes()[j]);
+				if (byte == 0) continue;
+				for (int k = 0; k < n; ++k)
+					c[k] += ((byte >> (7 - k)) & 1) * delta;
+			}
+		}
+	}
+
+	void add_to_counters(std::vector<boost::uint16_t>& counters
+		, bitfield const& bits, int const delta)
+	{
+		bitfield const* b = &bits;
+		add_to_counters(&counters[0], int(counters.size()), &b, 1, delta);
+	}
+
+	// returns true if any piece whose bit is set in the bitfield has a
+	// counter of 0
+	bool any_counter_zero(boost::uint16_t const* counters, bitfield const& bits)
+	{
+		boost::uint32_t const* words
+			= reinterpret_cast<boost::uint32_t const*>(bits.bytes());
+		int const num_bits = bits.size();
+		int const num_words = bits.num_words();
+		for (int w = 0; w < num_words; ++w)
+		{
+			boost::uint32_t const word = ntohl(words[w]);
+			if (word == 0) continue;
+			boost::uint16_t const* c = counters + w * 32;
+			int const n = (std::min)(32, num_bits - w * 32);
+			for (int k = 0; k < n; ++k)
+				if (((word >> (31 - k)) & 1) && c[k] == 0) return true;
+		}
+		return false;
+	}
+}
+
 	piece_picker::piece_picker()
 		: m_seeds(0)
 		, m_num_passed(0)
@@ -99,7 +199,8 @@ namespace libtorrent
 #endif
 		// allocate the piece_map to cover all pieces
 		// and make them invalid (as if we don't have a single piece)
-		m_piece_map.resize(total_num_pieces, piece_pos(0, 0));
+		m_piece_map.resize(total_num_pieces, piece_pos(0));
+		m_peer_count.assign(total_num_pieces, 0);
 		m_reverse_cursor = int(m_piece_map.size());
 		m_cursor = 0;
 
@@ -115,7 +216,6 @@ namespace libtorrent
 		for (std::vector<piece_pos>::iterator i = m_piece_map.begin()
 			, end(m_piece_map.end()); i != end; ++i)
 		{
-			i->peer_count = 0;
 			i->download_state = piece_pos::piece_open;
 			i->index = 0;
 #ifdef TORRENT_DEBUG_REFCOUNTS
@@ -175,7 +275,7 @@ namespace libtorrent
 		TORRENT_ASSERT(index >= 0 && index < int(m_piece_map.size()));
 		piece_pos const& pp = m_piece_map[index];
 		piece_stats_t ret = {
-			pp.peer_count + m_seeds,
+			m_peer_count[index] + m_seeds,
 			pp.priority(this),
 			pp.have(),
 			pp.downloading()
@@ -446,12 +546,9 @@ namespace libtorrent
 	void piece_picker::check_invariant(torrent const* t) const
 	{
 #ifndef TORRENT_DEBUG_REFCOUNTS
-#if TORRENT_OPTIMIZE_MEMORY_USAGE
 		TORRENT_ASSERT(sizeof(piece_pos) == 4);
-#else
-		TORRENT_ASSERT(sizeof(piece_pos) == 8);
-#endif
 #endif
+		TORRENT_ASSERT(m_peer_count.size() == m_piece_map.size());
 		TORRENT_ASSERT(m_num_have >= 0);
 		TORRENT_ASSERT(m_num_have_filtered >= 0);
 		TORRENT_ASSERT(m_num_filtered >= 0);
@@ -627,7 +724,7 @@ namespace libtorrent
 			}
 
 #ifdef TORRENT_DEBUG_REFCOUNTS
-			TORRENT_ASSERT(p.have_peers.size() == p.peer_count + m_seeds);
+			TORRENT_ASSERT(p.have_peers.size() == m_peer_count[index] + m_seeds);
 #endif
 			if (p.index == piece_pos::we_have_index)
 				++num_have;
@@ -642,7 +739,7 @@ namespace libtorrent
 					if (peer->second->has_piece(index)) actual_peer_count++;
 				}
 
-				TORRENT_ASSERT((int)i->peer_count == actual_peer_count);
+				TORRENT_ASSERT((int)m_peer_count[index] == actual_peer_count);
 /*
 				int num_downloaders = 0;
 				for (std::vector<peer_connection*>::const_iterator peer = t->begin();
@@ -782,12 +879,11 @@ namespace libtorrent
 		// and also the number of pieces that have more than that.
 		int integer_part = 0;
 		int fraction_part = 0;
-		for (std::vector<piece_pos>::const_iterator i = m_piece_map.begin()
-			, end(m_piece_map.end()); i != end; ++i)
+		for (int index = 0; index < num_pieces; ++index)
 		{
-			int peer_count = int(i->peer_count);
+			int peer_count = m_peer_count[index];
 			// take ourself into account
-			if (i->have()) ++peer_count;
+			if (m_piece_map[index].have()) ++peer_count;
 			if (min_availability > peer_count)
 			{
 				min_availability = peer_count;
@@ -844,7 +940,7 @@ namespace libtorrent
 #ifdef TORRENT_PICKER_LOG
 		std::cerr << "[" << this << "] " << "add " << index << " (" << priority << ")" << std::endl;
 		std::cerr << "[" << this << "] " << "  p: state: " << p.download_state
-			<< " peer_count: " << p.peer_count
+			<< " peer_count: " << m_peer_count[index]
 			<< " prio: " << p.piece_priority
 			<< " index: " << p.index << std::endl;
 		print_pieces();
@@ -1134,12 +1230,26 @@ namespace libtorrent
 #endif
 
 		++m_seeds;
-		if (m_seeds == 1)
+		if (m_seeds == 1 && !m_dirty)
 		{
 			// when m_seeds is increased from 0 to 1
 			// we may have to add pieces that previously
-			// didn't have any peers
-			m_dirty = true;
+			// didn't have any peers. If there are only a few of them, add them
+			// one at a time rather than rebuilding the piece list
+			int const num_unavailable = int(std::count(m_peer_count.begin()
+				, m_peer_count.end(), 0));
+			if (num_unavailable > max_incremental_updates())
+			{
+				m_dirty = true;
+			}
+			else if (num_unavailable > 0)
+			{
+				for (int i = 0; i < int(m_peer_count.size()); ++i)
+				{
+					if (m_peer_count[i] != 0) continue;
+					if (m_piece_map[i].priority(this) >= 0) add(i);
+				}
+			}
 		}
 #ifdef TORRENT_DEBUG_REFCOUNTS
 		for (std::vector<piece_pos>::iterator i = m_piece_map.begin()
@@ -1159,13 +1269,44 @@ namespace libtorrent
 
 		if (m_seeds > 0)
 		{
-			--m_seeds;
-			if (m_seeds == 0)
+			if (m_seeds == 1 && !m_dirty)
 			{
 				// when m_seeds is decreased from 1 to 0
 				// we may have to remove pieces that previously
-				// didn't have any peers
-				m_dirty = true;
+				// didn't have any peers. If there are only a few of them,
+				// remove them one at a time (see inc_refcount_all()). Their
+				// priority has to be looked up while the seed still counts.
+				// Removing a piece only moves pieces behind it in m_pieces, so
+				// removing them back to front leaves the positions of the
+				// remaining ones intact
+				// (position in m_pieces, priority)
+				std::vector<std::pair<int, int> > unavailable;
+				for (int i = 0; i < int(m_peer_count.size()); ++i)
+				{
+					if (m_peer_count[i] != 0) continue;
+					int const prio = m_piece_map[i].priority(this);
+					if (prio < 0) continue;
+					unavailable.push_back(std::make_pair(int(m_piece_map[i].index), prio));
+				}
+				--m_seeds;
+				if (int(unavailable.size()) > max_incremental_updates())
+				{
+					m_dirty = true;
+				}
+				else
+				{
+					std::sort(unavailable.begin(), unavailable.end()
+						, std::greater<std::pair<int, int> >());
+					for (std::vector<std::pair<int, int> >::iterator i = unavailable.begin()
+						, end(unavailable.end()); i != end; ++i)
+					{
+						remove(i->second, i->first);
+					}
+				}
+			}
+			else
+			{
+				--m_seeds;
 			}
 #ifdef TORRENT_DEBUG_REFCOUNTS
 			for (std::vector<piece_pos>::iterator i = m_piece_map.begin()
@@ -1179,16 +1320,20 @@ namespace libtorrent
 		}
 		TORRENT_ASSERT(m_seeds == 0);
 
+#ifdef TORRENT_DEBUG_REFCOUNTS
 		for (std::vector<piece_pos>::iterator i = m_piece_map.begin()
 			, end(m_piece_map.end()); i != end; ++i)
 		{
-#ifdef TORRENT_DEBUG_REFCOUNTS
 			TORRENT_ASSERT(i->have_peers.count(peer) == 1);
 			i->have_peers.erase(peer);
+		}
 #endif
 
-			TORRENT_ASSERT(i->peer_count > 0);
-			--i->peer_count;
+		for (std::vector<boost::uint16_t>::iterator i = m_peer_count.begin()
+			, end(m_peer_count.end()); i != end; ++i)
+		{
+			TORRENT_ASSERT(*i > 0);
+			--*i;
 		}
 
 		m_dirty = true;
@@ -1211,7 +1356,7 @@ namespace libtorrent
 #endif
 
 		int prev_priority = p.priority(this);
-		++p.peer_count;
+		++m_peer_count[index];
 		if (m_dirty) return;
 		int new_priority = p.priority(this);
 		if (prev_priority == new_priority) return;
@@ -1234,10 +1379,10 @@ namespace libtorrent
 		TORRENT_ASSERT(m_seeds > 0);
 		--m_seeds;
 
-		for (std::vector<piece_pos>::iterator i = m_piece_map.begin()
-			, end(m_piece_map.end()); i != end; ++i)
+		for (std::vector<boost::uint16_t>::iterator i = m_peer_count.begin()
+			, end(m_peer_count.end()); i != end; ++i)
 		{
-			++i->peer_count;
+			++*i;
 		}
 
 		m_dirty = true;
@@ -1255,7 +1400,7 @@ namespace libtorrent
 
 		piece_pos& p = m_piece_map[index];
 
-		if (p.peer_count == 0)
+		if (m_peer_count[index] == 0)
 		{
 			TORRENT_ASSERT(m_seeds > 0);
 			// this is the case where we have one or more
@@ -1272,8 +1417,8 @@ namespace libtorrent
 		p.have_peers.erase(peer);
 #endif
 
-		TORRENT_ASSERT(p.peer_count > 0);
-		--p.peer_count;
+		TORRENT_ASSERT(m_peer_count[index] > 0);
+		--m_peer_count[index];
 		if (m_dirty) return;
 		if (prev_priority >= 0) update(prev_priority, p.index);
 	}
@@ -1297,77 +1442,51 @@ namespace libtorrent
 			return;
 		}
 
-		const int size = (std::min)(50, int(bitmask.size()/2));
+		TORRENT_ASSERT(bitmask.size() <= int(m_peer_count.size()));
 
-		// this is an optimization where if just a few
-		// pieces end up changing, instead of making
-		// the piece list dirty, just update those pieces
-		// instead
-		int* incremented = TORRENT_ALLOCA(int, size);
-		int num_inc = 0;
-
-		if (!m_dirty)
+#ifdef TORRENT_DEBUG_REFCOUNTS
+		int index = 0;
+		for (bitfield::const_iterator i = bitmask.begin()
+			, end(bitmask.end()); i != end; ++i, ++index)
 		{
-			// first count how many pieces we're updating. If it's few (less than half)
-			// we'll just update them one at a time. Othewise we'll just update the counters
-			// and mark the picker as dirty, so we'll rebuild it next time we need it.
-			// this only matters if we're not already dirty, in which case the fasted
-			// thing to do is to just update the counters and be done
-			int index = 0;
-			for (bitfield::const_iterator i = bitmask.begin()
-				, end(bitmask.end()); i != end; ++i, ++index)
-			{
-				if (!*i) continue;
-				if (num_inc < size) incremented[num_inc] = index;
-				++num_inc;
-				if (num_inc >= size) break;
-			}
+			if (!*i) continue;
+			TORRENT_ASSERT(m_piece_map[index].have_peers.count(peer) == 0);
+			m_piece_map[index].have_peers.insert(peer);
+		}
+#endif
 
-			if (num_inc < size)
+		// if the piece list is up to date and this peer doesn't have too many
+		// pieces, move the pieces it has to their new buckets one at a time.
+		// Otherwise just update the counters and rebuild the piece list the
+		// next time we need it. If we're already dirty, the fastest thing to
+		// do is to just update the counters
+		if (!m_dirty && bitmask.count() <= max_incremental_updates())
+		{
+			boost::uint32_t const* words
+				= reinterpret_cast<boost::uint32_t const*>(bitmask.bytes());
+			int const num_words = bitmask.num_words();
+			for (int w = 0; w < num_words; ++w)
 			{
-				// not that many pieces were updated
-				// just update those individually instead of
-				// rebuilding the whole piece list
-				for (int i = 0; i < num_inc; ++i)
+				boost::uint32_t const word = ntohl(words[w]);
+				if (word == 0) continue;
+				for (int k = 0; k < 32; ++k)
 				{
-					int piece = incremented[i];
+					if ((word & (0x80000000 >> k)) == 0) continue;
+					int const piece = w * 32 + k;
 					piece_pos& p = m_piece_map[piece];
 					int prev_priority = p.priority(this);
-					++p.peer_count;
-#ifdef TORRENT_DEBUG_REFCOUNTS
-					TORRENT_ASSERT(p.have_peers.count(peer) == 0);
-					p.have_peers.insert(peer);
-#endif
+					++m_peer_count[piece];
 					int new_priority = p.priority(this);
 					if (prev_priority == new_priority) continue;
 					else if (prev_priority >= 0) update(prev_priority, p.index);
 					else add(piece);
 				}
-				return;
-			}
-		}
-
-		int index = 0;
-		bool updated = false;
-		for (bitfield::const_iterator i = bitmask.begin()
-			, end(bitmask.end()); i != end; ++i, ++index)
-		{
-			if (*i)
-			{
-#ifdef TORRENT_DEBUG_REFCOUNTS
-				TORRENT_ASSERT(m_piece_map[index].have_peers.count(peer) == 0);
-				m_piece_map[index].have_peers.insert(peer);
-#endif
-
-				++m_piece_map[index].peer_count;
-				updated = true;
 			}
+			return;
 		}
 
-		// if we're already dirty, no point in doing anything more
-		if (m_dirty) return;
-
-		if (updated) m_dirty = true;
+		add_to_counters(m_peer_count, bitmask, 1);
+		m_dirty = true;
 	}
 
 	void piece_picker::dec_refcount(bitfield const& bitmask, const void* peer)
@@ -1390,98 +1509,115 @@ namespace libtorrent
 			return;
 		}
 
-		const int size = (std::min)(50, int(bitmask.size()/2));
+		TORRENT_ASSERT(bitmask.size() <= int(m_peer_count.size()));
 
-		// this is an optimization where if just a few
-		// pieces end up changing, instead of making
-		// the piece list dirty, just update those pieces
-		// instead
-		int* decremented = TORRENT_ALLOCA(int, size);
-		int num_dec = 0;
+		if (m_seeds > 0 && any_counter_zero(&m_peer_count[0], bitmask))
+		{
+			// this is the case where we have one or more
+			// seeds, and one of them saying: I don't have some
+			// pieces anymore. we need to break up one of the seed
+			// counters into actual peer counters on the pieces.
+			// Once that's done, every piece has a count of at least 1
+			break_one_seed();
+		}
 
-		if (!m_dirty)
+#ifdef TORRENT_DEBUG_REFCOUNTS
+		int index = 0;
+		for (bitfield::const_iterator i = bitmask.begin()
+			, end(bitmask.end()); i != end; ++i, ++index)
 		{
-			// first count how many pieces we're updating. If it's few (less than half)
-			// we'll just update them one at a time. Othewise we'll just update the counters
-			// and mark the picker as dirty, so we'll rebuild it next time we need it.
-			// this only matters if we're not already dirty, in which case the fasted
-			// thing to do is to just update the counters and be done
-			int index = 0;
-			for (bitfield::const_iterator i = bitmask.begin()
-				, end(bitmask.end()); i != end; ++i, ++index)
-			{
-				if (!*i) continue;
-				if (num_dec < size) decremented[num_dec] = index;
-				++num_dec;
-				if (num_dec >= size) break;
-			}
+			if (!*i) continue;
+			TORRENT_ASSERT(m_piece_map[index].have_peers.count(peer) == 1);
+			m_piece_map[index].have_peers.erase(peer);
+		}
+#endif
+
+		TORRENT_ASSERT(!any_counter_zero(&m_peer_count[0], bitmask));
 
-			if (num_dec < size)
+		// see inc_refcount()
+		if (!m_dirty && bitmask.count() <= max_incremental_updates())
+		{
+			boost::uint32_t const* words
+				= reinterpret_cast<boost::uint32_t const*>(bitmask.bytes());
+			int const num_words = bitmask.num_words();
+			for (int w = 0; w < num_words; ++w)
 			{
-				// not that many pieces were updated
-				// just update those individually instead of
-				// rebuilding the whole piece list
-				for (int i = 0; i < num_dec; ++i)
+				boost::uint32_t const word = ntohl(words[w]);
+				if (word == 0) continue;
+				for (int k = 0; k < 32; ++k)
 				{
-					int piece = decremented[i];
+					if ((word & (0x80000000 >> k)) == 0) continue;
+					int const piece = w * 32 + k;
 					piece_pos& p = m_piece_map[piece];
 					int prev_priority = p.priority(this);
-
-					if (p.peer_count == 0)
-					{
-						TORRENT_ASSERT(m_seeds > 0);
-						// this is the case where we have one or more
-						// seeds, and one of them saying: I don't have this
-						// piece anymore. we need to break up one of the seed
-						// counters into actual peer counters on the pieces
-						break_one_seed();
-					}
-
-#ifdef TORRENT_DEBUG_REFCOUNTS
-					TORRENT_ASSERT(p.have_peers.count(peer) == 1);
-					p.have_peers.erase(peer);
-#endif
-					TORRENT_ASSERT(p.peer_count > 0);
-					--p.peer_count;
-					if (!m_dirty && prev_priority >= 0) update(prev_priority, p.index);
+					--m_peer_count[piece];
+					if (prev_priority >= 0) update(prev_priority, p.index);
 				}
-				return;
 			}
+			return;
 		}
 
-		int index = 0;
-		bool updated = false;
-		for (bitfield::const_iterator i = bitmask.begin()
-			, end(bitmask.end()); i != end; ++i, ++index)
+		add_to_counters(m_peer_count, bitmask, -1);
+		m_dirty = true;
+	}
+
+	void piece_picker::inc_refcount(std::vector<bitfield const*> const& bitmasks
+		, std::vector<const void*> const& peers)
+	{
+#ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
+		TORRENT_PIECE_PICKER_INVARIANT_CHECK;
+#endif
+		TORRENT_ASSERT(bitmasks.size() == peers.size());
+
+#ifdef TORRENT_PICKER_LOG
+		std::cerr << "[" << this << "] " << "inc_refcount(" << bitmasks.size()
+			<< " bitfields)" << std::endl;
+#endif
+
+		// seeds and peers with only a few pieces are added one at a time, since
+		// that doesn't require rebuilding the piece list. All other bitfields
+		// are summed up and added to the counters in a single pass
+		std::vector<bitfield const*> batch;
+		batch.reserve(bitmasks.size());
+		for (int i = 0; i < int(bitmasks.size()); ++i)
 		{
-			if (*i)
+			bitfield const& bitmask = *bitmasks[i];
+			if (bitmask.none_set()) continue;
+			if ((bitmask.all_set() && bitmask.size() == int(m_piece_map.size()))
+				|| (!m_dirty && bitmask.count() <= max_incremental_updates()))
 			{
-				piece_pos& p = m_piece_map[index];
-				if (p.peer_count == 0)
-				{
-					TORRENT_ASSERT(m_seeds > 0);
-					// this is the case where we have one or more
-					// seeds, and one of them saying: I don't have this
-					// piece anymore. we need to break up one of the seed
-					// counters into actual peer counters on the pieces
-					break_one_seed();
-				}
+				inc_refcount(bitmask, peers[i]);
+				continue;
+			}
 
 #ifdef TORRENT_DEBUG_REFCOUNTS
-				TORRENT_ASSERT(p.have_peers.count(peer) == 1);
-				p.have_peers.erase(peer);
-#endif
-
-				TORRENT_ASSERT(p.peer_count > 0);
-				--p.peer_count;
-				updated = true;
+			int index = 0;
+			for (bitfield::const_iterator j = bitmask.begin()
+				, end(bitmask.end()); j != end; ++j, ++index)
+			{
+				if (!*j) continue;
+				TORRENT_ASSERT(m_piece_map[index].have_peers.count(peers[i]) == 0);
+				m_piece_map[index].have_peers.insert(peers[i]);
 			}
+#endif
+			batch.push_back(&bitmask);
 		}
 
-		// if we're already dirty, no point in doing anything more
-		if (m_dirty) return;
+		if (batch.empty()) return;
 
-		if (updated) m_dirty = true;
+		add_to_counters(&m_peer_count[0], int(m_peer_count.size())
+			, &batch[0], int(batch.size()), 1);
+		m_dirty = true;
+	}
+
+	int piece_picker::max_incremental_updates() const
+	{
+		// moving a single piece to its new bucket costs a few random memory
+		// accesses per bucket it passes, rebuilding the piece list costs about
+		// a tenth of that per piece, but is done for every piece. Rebuilding
+		// also makes the next pick_pieces() call stall, so lean towards
+		// updating in place
+		return int(m_piece_map.size()) / 4;
 	}
 
 	void piece_picker::update_pieces() const
@@ -1904,8 +2040,8 @@ namespace libtorrent
 	bool piece_picker::partial_compare_rarest_first(downloading_piece const* lhs
 		, downloading_piece const* rhs) const
 	{
-		int lhs_availability = m_piece_map[lhs->index].peer_count;
-		int rhs_availability = m_piece_map[rhs->index].peer_count;
+		int lhs_availability = m_peer_count[lhs->index];
+		int rhs_availability = m_peer_count[rhs->index];
 		if (lhs_availability != rhs_availability)
 			return lhs_availability < rhs_availability;
 
@@ -3224,15 +3360,15 @@ get_out:
 	
 		avail.resize(m_piece_map.size());
 		std::vector<int>::iterator j = avail.begin();
-		for (std::vector<piece_pos>::const_iterator i = m_piece_map.begin()
-			, end(m_piece_map.end()); i != end; ++i, ++j)
-			*j = i->peer_count + m_seeds;
+		for (std::vector<boost::uint16_t>::const_iterator i = m_peer_count.begin()
+			, end(m_peer_count.end()); i != end; ++i, ++j)
+			*j = *i + m_seeds;
 	}
 
 	int piece_picker::get_availability(int piece) const
 	{
 		TORRENT_ASSERT(piece >= 0 && piece < int(m_piece_map.size()));
-		return m_piece_map[piece].peer_count + m_seeds;
+		return m_peer_count[piece] + m_seeds;
 	}
 
 	bool piece_picker::mark_as_writing(piece_block block, void* peer)
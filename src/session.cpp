@@ -819,6 +819,13 @@ namespace libtorrent
 #endif
 	}
 
+	void session::set_dht_storage(dht::dht_storage_constructor_type sc)
+	{
+#ifndef TORRENT_DISABLE_DHT
+		TORRENT_ASYNC_CALL1(set_dht_storage, sc);
+#endif
+	}
+
 #ifndef TORRENT_NO_DEPRECATE
 	void session::start_dht(entry const& startup_state)
 	{
@@ -1153,6 +1160,11 @@ namespace libtorrent
 		m_impl->pop_alerts(alerts);
 	}
 
+	void session::pop_alerts(std::vector<alert*>* alerts)
+	{
+		m_impl->pop_alerts(alerts);
+	}
+
 	alert const* session::wait_for_alert(time_duration max_wait)
 	{
 		return m_impl->wait_for_alert(max_wait);
@@ -187,7 +187,7 @@ namespace libtorrent {
 
 socket_job::~socket_job() {}
 
-void network_thread_pool::process_job(socket_job const& j, bool post)
+void network_thread_pool::issue_job(socket_job const& j)
 {
 	if (j.type == socket_job::write_job)
 	{
@@ -213,6 +213,39 @@ void network_thread_pool::process_job(socket_job const& j, bool post)
 	}
 }
 
+void network_thread_pool::process_job(socket_job const& j, bool post)
+{
+	issue_job(j);
+}
+
+network_shard::network_shard(io_service& main_ios)
+	: m_work(io_service::work(m_ios))
+	, m_main_work(io_service::work(main_ios))
+{
+	m_thread.reset(new thread(boost::bind(&network_shard::thread_fun, this)));
+}
+
+network_shard::~network_shard()
+{
+	stop();
+	m_thread->join();
+}
+
+void network_shard::stop()
+{
+	m_work = boost::none;
+}
+
+void network_shard::thread_fun()
+{
+	error_code ec;
+	m_ios.run(ec);
+
+	// all handlers for our sockets have been posted to the main network
+	// thread, it's OK for it to exit now
+	m_main_work = boost::none;
+}
+
 // TODO: 2 find a better place for this function
 proxy_settings::proxy_settings(aux::session_settings const& sett)
 {
@@ -350,6 +383,8 @@ namespace aux {
 		, m_alerts(m_settings.get_int(settings_pack::alert_queue_size), alert::all_categories)
 		, m_disk_thread(m_io_service, this, m_stats_counters
 			, (uncork_interface*)this)
+		, m_num_net_shards(0)
+		, m_next_incoming_shard(0)
 		, m_download_rate(peer_connection::download_channel)
 #ifdef TORRENT_VERBOSE_BANDWIDTH_LIMIT
 		, m_upload_rate(peer_connection::upload_channel, true)
@@ -393,11 +428,11 @@ namespace aux {
 		, m_dht_interval_update_torrents(0)
 #endif
 		, m_external_udp_port(0)
-		, m_udp_socket(m_io_service)
+		, m_udp_socket(m_io_service, m_stats_counters)
 		, m_utp_socket_manager(m_settings, m_udp_socket, m_stats_counters, NULL
 			, boost::bind(&session_impl::incoming_connection, this, _1))
 #ifdef TORRENT_USE_OPENSSL
-		, m_ssl_udp_socket(m_io_service)
+		, m_ssl_udp_socket(m_io_service, m_stats_counters)
 		, m_ssl_utp_socket_manager(m_settings, m_ssl_udp_socket, m_stats_counters
 			, &m_ssl_ctx
 			, boost::bind(&session_impl::on_incoming_utp_ssl, this, _1))
@@ -576,6 +611,8 @@ namespace aux {
 		update_unchoke_limit();
 		update_disk_threads();
 		update_network_threads();
+		update_network_shards();
+		update_udp_offload();
 		update_upnp();
 		update_natpmp();
 		update_lsd();
@@ -702,6 +739,9 @@ namespace aux {
 			dht_sett["max_fail_count"] = m_dht_settings.max_fail_count;
 			dht_sett["max_torrents"] = m_dht_settings.max_torrents;
 			dht_sett["max_dht_items"] = m_dht_settings.max_dht_items;
+			dht_sett["max_peer_store_size"] = m_dht_settings.max_peer_store_size;
+			dht_sett["request_threads"] = m_dht_settings.request_threads;
+			dht_sett["put_verify_batch"] = m_dht_settings.put_verify_batch;
 			dht_sett["max_torrent_search_reply"] = m_dht_settings.max_torrent_search_reply;
 			dht_sett["restrict_routing_ips"] = m_dht_settings.restrict_routing_ips;
 			dht_sett["extended_routing_table"] = m_dht_settings.extended_routing_table;
@@ -763,6 +803,12 @@ namespace aux {
 			if (val) m_dht_settings.max_torrents = val.int_value();
 			val = settings.dict_find_int("max_dht_items");
 			if (val) m_dht_settings.max_dht_items = val.int_value();
+			val = settings.dict_find_int("max_peer_store_size");
+			if (val) m_dht_settings.max_peer_store_size = val.int_value();
+			val = settings.dict_find_int("request_threads");
+			if (val) m_dht_settings.request_threads = val.int_value();
+			val = settings.dict_find_int("put_verify_batch");
+			if (val) m_dht_settings.put_verify_batch = val.int_value();
 			val = settings.dict_find_int("max_torrent_search_reply");
 			if (val) m_dht_settings.max_torrent_search_reply = val.int_value();
 			val = settings.dict_find_int("restrict_routing_ips");
@@ -1068,6 +1114,12 @@ namespace aux {
 
 		m_undead_peers.clear();
 
+		// all peer sockets are closed, the network shards exit as soon as
+		// the handlers of their sockets have been posted to us
+		for (std::vector<boost::shared_ptr<network_shard> >::iterator i
+			= m_net_shards.begin(), end(m_net_shards.end()); i != end; ++i)
+			(*i)->stop();
+
 		// it's OK to detach the threads here. The disk_io_thread
 		// has an internal counter and won't release the network
 		// thread until they're all dead (via m_work).
@@ -2167,7 +2219,10 @@ retry:
 	void session_impl::async_accept(boost::shared_ptr<socket_acceptor> const& listener, bool ssl)
 	{
 		TORRENT_ASSERT(!m_abort);
-		shared_ptr<socket_type> c(new socket_type(m_io_service));
+		// SSL connections stay on the main network thread, plain TCP
+		// connections may be assigned to a network shard
+		io_service& ios = ssl ? m_io_service : incoming_socket_io_service();
+		shared_ptr<socket_type> c(new socket_type(ios));
 		stream_socket* str = 0;
 
 #ifdef TORRENT_USE_OPENSSL
@@ -2183,7 +2238,7 @@ retry:
 		else
 #endif
 		{
-			c->instantiate<stream_socket>(m_io_service);
+			c->instantiate<stream_socket>(ios);
 			str = c->get<stream_socket>();
 		}
 
@@ -5400,7 +5455,8 @@ retry:
 		stop_dht();
 		m_dht = boost::make_shared<dht::dht_tracker>(boost::ref(*this)
 			, boost::ref(m_udp_socket), boost::cref(m_dht_settings)
-			, boost::ref(m_stats_counters), &startup_state);
+			, boost::ref(m_stats_counters), &startup_state
+			, m_dht_storage_constructor);
 
 		for (std::list<udp::endpoint>::iterator i = m_dht_router_nodes.begin()
 			, end(m_dht_router_nodes.end()); i != end; ++i)
@@ -5426,6 +5482,11 @@ retry:
 		m_dht_settings = settings;
 	}
 
+	void session_impl::set_dht_storage(dht::dht_storage_constructor_type sc)
+	{
+		m_dht_storage_constructor = sc;
+	}
+
 #ifndef TORRENT_NO_DEPRECATE
 	entry session_impl::dht_state() const
 	{
@@ -5854,6 +5915,10 @@ retry:
 #endif
 
 		m_disk_thread.set_num_threads(m_settings.get_int(settings_pack::aio_threads));
+
+		if (m_settings.get_int(settings_pack::hashing_threads) < 0)
+			m_settings.set_int(settings_pack::hashing_threads, 0);
+		m_disk_thread.set_num_hashing_threads(m_settings.get_int(settings_pack::hashing_threads));
 	}
 
 	void session_impl::update_network_threads()
@@ -5877,8 +5942,53 @@ retry:
 		}
 	}
 
+	void session_impl::update_network_shards()
+	{
+		int const num_shards = (std::max)(0
+			, m_settings.get_int(settings_pack::network_shards));
+
+		// shards are only started, never stopped, while the session is
+		// running. Connections keep using the shard their socket was
+		// created on. Shards beyond the setting are no longer assigned
+		// new connections
+		while (int(m_net_shards.size()) < num_shards && !m_abort)
+		{
+			m_net_shards.push_back(boost::make_shared<network_shard>(
+				boost::ref(m_io_service)));
+		}
+		m_num_net_shards = (std::min)(num_shards, int(m_net_shards.size()));
+	}
+
+	io_service& session_impl::peer_socket_io_service(sha1_hash const& ih)
+	{
+		if (m_num_net_shards == 0) return m_io_service;
+
+		// all connections of a torrent are handled by the same shard
+		return m_net_shards[ih[0] % m_num_net_shards]->get_io_service();
+	}
+
+	io_service& session_impl::incoming_socket_io_service()
+	{
+		if (m_num_net_shards == 0) return m_io_service;
+
+		// we don't know which torrent an incoming connection is for until
+		// it has sent its handshake, at which point its socket can't be
+		// moved. Spread them evenly instead
+		m_next_incoming_shard = (m_next_incoming_shard + 1) % m_num_net_shards;
+		return m_net_shards[m_next_incoming_shard]->get_io_service();
+	}
+
 	void session_impl::post_socket_job(socket_job& j)
 	{
+		io_service& ios = j.peer->get_socket()->get_io_service();
+		if (&ios != &m_io_service)
+		{
+			// this peer's socket belongs to a network shard. Operations on
+			// it are issued by the shard's thread
+			ios.post(boost::bind(&network_thread_pool::issue_job, j));
+			return;
+		}
+
 		uintptr_t idx = 0;
 		if (m_net_thread_pool.size() > 1)
 		{
@@ -6012,6 +6122,16 @@ retry:
 		url_random((char*)&m_peer_id[0], (char*)&m_peer_id[0] + 20);
 	}
 
+	void session_impl::update_udp_offload()
+	{
+		bool const gso = m_settings.get_bool(settings_pack::enable_udp_gso);
+		bool const gro = m_settings.get_bool(settings_pack::enable_udp_gro);
+		m_udp_socket.set_segmentation_offload(gso, gro);
+#ifdef TORRENT_USE_OPENSSL
+		m_ssl_udp_socket.set_segmentation_offload(gso, gro);
+#endif
+	}
+
 	void session_impl::update_force_proxy()
 	{
 		m_udp_socket.set_force_proxy(m_settings.get_bool(settings_pack::force_proxy));
@@ -6224,6 +6344,18 @@ retry:
 			, this, num_resume));
 	}
 
+	// this function is called on the user's thread
+	// not the network thread
+	void session_impl::pop_alerts(std::vector<alert*>* alerts)
+	{
+		int num_resume = 0;
+		m_alerts.get_all(*alerts, num_resume);
+		// we can only issue more resume data jobs from
+		// the network thread
+		m_io_service.post(boost::bind(&session_impl::async_resume_dispatched
+			, this, num_resume));
+	}
+
 	alert const* session_impl::wait_for_alert(time_duration max_wait)
 	{
 		return m_alerts.wait_for_alert(max_wait);
@@ -311,6 +311,15 @@ namespace libtorrent
 		METRIC(picker, interesting_piece_picks)
 		METRIC(picker, hash_fail_piece_picks)
 
+		// the number of time critical pieces (see set_piece_deadline()) that
+		// completed before and after their deadline, and the number of
+		// times the blocks still outstanding for a time critical piece were
+		// not expected to arrive in time, and were requested from one
+		// more peer
+		METRIC(picker, piece_deadlines_met)
+		METRIC(picker, piece_deadlines_missed)
+		METRIC(picker, piece_deadlines_at_risk)
+
 		METRIC(disk, write_cache_blocks)
 		METRIC(disk, read_cache_blocks)
 
@@ -329,6 +338,13 @@ namespace libtorrent
 		METRIC(disk, num_running_threads)
 		METRIC(disk, blocked_disk_jobs)
 
+		// the number of hash jobs waiting for one of the hashing threads,
+		// the number of jobs they're currently hashing and the number of
+		// hashing threads running. See settings_pack::hashing_threads
+		METRIC(disk, queued_hash_jobs)
+		METRIC(disk, num_running_hash_jobs)
+		METRIC(disk, num_hashing_threads)
+
 		// the number of bytes we have sent to the disk I/O
 		// thread for writing. Every time we hear back from
 		// the disk I/O thread with a completed write job, this
@@ -343,6 +359,14 @@ namespace libtorrent
 		METRIC(disk, arc_write_size)
 		METRIC(disk, arc_volatile_size)
 
+		// the size of the huge page disk cache arena in blocks, the number of
+		// 2 MiB pages that have blocks in use, and the number of free blocks
+		// on those pages. A high fragmentation count means the cache is
+		// spread thinly over the arena. See settings_pack::use_hugepage_cache
+		METRIC(disk, disk_arena_blocks)
+		METRIC(disk, disk_arena_pages_in_use)
+		METRIC(disk, disk_arena_fragmented_blocks)
+
 		// the number of blocks written and read from disk in total. A block is
 		// 16 kiB.
 		METRIC(disk, num_blocks_written)
@@ -353,6 +377,19 @@ namespace libtorrent
 		
 		// the number of blocks read from the disk cache
 		METRIC(disk, num_blocks_cache_hits)
+
+		// read cache lookups of blocks requested by peers, broken down by the
+		// cache_eviction_policy in effect
+		METRIC(disk, arc_cache_hits)
+		METRIC(disk, arc_cache_misses)
+		METRIC(disk, tinylfu_cache_hits)
+		METRIC(disk, tinylfu_cache_misses)
+
+		// the number of blocks read ahead of a request that were later
+		// requested, and that were evicted from the cache without ever
+		// being requested
+		METRIC(disk, read_ahead_useful_blocks)
+		METRIC(disk, read_ahead_wasted_blocks)
 		
 		// the number of disk I/O operation for reads and writes. One disk
 		// operation may transfer more then one block.
@@ -410,6 +447,10 @@ namespace libtorrent
 		// the number of mutable data items tracked by our DHT node
 		METRIC(dht, dht_mutable_data)
 
+		// the number of bytes of memory used to store the torrents and peers
+		// tracked by our DHT node
+		METRIC(dht, dht_peer_store_bytes)
+
 		// the number of RPC observers currently allocated
 		METRIC(dht, dht_allocated_observers)
 
@@ -417,6 +458,11 @@ namespace libtorrent
 		METRIC(dht, dht_messages_in)
 		METRIC(dht, dht_messages_out)
 
+		// the number of incoming queries that were dropped because the
+		// request threads were too far behind, or the DHT was out of upload
+		// quota
+		METRIC(dht, dht_messages_in_dropped)
+
 		// the number of outgoing messages that failed to be
 		// sent
 		METRIC(dht, dht_messages_out_dropped)
@@ -446,6 +492,11 @@ namespace libtorrent
 		METRIC(dht, dht_invalid_put)
 		METRIC(dht, dht_invalid_get)
 
+		// the number of torrents our DHT node stopped tracking to stay within
+		// the ``max_torrents`` and ``max_peer_store_size`` limits. The least
+		// recently announced torrents are evicted first
+		METRIC(dht, dht_torrents_evicted)
+
 		// uTP counters. Each counter represents the number of time each event
 		// has occurred.
 		METRIC(utp, utp_packet_loss)
@@ -461,6 +512,20 @@ namespace libtorrent
 		METRIC(utp, utp_invalid_pkts_in)
 		METRIC(utp, utp_redundant_pkts_in)
 
+		// the number of recvmmsg() and sendmmsg() calls on the UDP socket
+		// shared by uTP and the DHT, and the number of packets they
+		// received and sent. The ratios are the average batch sizes
+		METRIC(net, udp_recv_batches)
+		METRIC(net, udp_recv_batched_packets)
+		METRIC(net, udp_send_batches)
+		METRIC(net, udp_send_batched_packets)
+
+		// the number of packets sent and received as part of a train of
+		// packets coalesced into a single buffer by generic segmentation
+		// offload (``UDP_SEGMENT``) and generic receive offload (``UDP_GRO``)
+		METRIC(net, udp_gso_packets)
+		METRIC(net, udp_gro_packets)
+
 		// the number of uTP sockets in each respective state
 		METRIC(utp, num_utp_idle)
 		METRIC(utp, num_utp_syn_sent)
@@ -468,6 +533,13 @@ namespace libtorrent
 		METRIC(utp, num_utp_fin_sent)
 		METRIC(utp, num_utp_close_wait)
 
+		// the number of uTP packet buffers allocated from the packet pool's
+		// free lists (hits) and from the heap (misses), and the number of
+		// bytes currently held in the free lists
+		METRIC(utp, utp_packet_pool_hits)
+		METRIC(utp, utp_packet_pool_misses)
+		METRIC(utp, utp_packet_pool_bytes)
+
 		// the buffer sizes accepted by
 		// socket send and receive calls respectively.
 		// The larger the buffers are, the more efficient,
@@ -210,6 +210,14 @@ namespace libtorrent
 		SET_NOPREV(proxy_hostnames, true, 0),
 		SET_NOPREV(proxy_peer_connections, true, 0),
 		SET_NOPREV(auto_sequential, true, &session_impl::update_auto_sequential),
+		SET_NOPREV(use_io_uring, false, 0),
+		SET_NOPREV(use_mmap_reads, false, 0),
+		SET_NOPREV(use_sendfile, false, 0),
+		SET_NOPREV(adaptive_read_ahead, false, 0),
+		SET_NOPREV(adaptive_request_queue, false, 0),
+		SET_NOPREV(use_hugepage_cache, false, 0),
+		SET_NOPREV(enable_udp_gso, false, &session_impl::update_udp_offload),
+		SET_NOPREV(enable_udp_gro, false, &session_impl::update_udp_offload),
 	};
 
 	int_setting_entry_t int_settings[settings_pack::num_int_settings] =
@@ -319,7 +327,7 @@ namespace libtorrent
 		SET(torrent_connect_boost, 10, 0),
 		SET(alert_queue_size, 1000, &session_impl::update_alert_queue_size),
 		SET(max_metadata_size, 3 * 1024 * 10240, 0),
-		SET(hashing_threads, 1, 0),
+		SET(hashing_threads, 1, &session_impl::update_disk_threads),
 		SET(checking_mem_usage, 256, 0),
 		SET(predictive_piece_announce, 0, 0),
 		SET(aio_threads, 4, &session_impl::update_disk_threads),
@@ -343,7 +351,10 @@ namespace libtorrent
 		SET(inactive_up_rate, 2048, 0),
 		SET_NOPREV(proxy_type, settings_pack::none, &session_impl::update_proxy),
 		SET_NOPREV(proxy_port, 0, &session_impl::update_proxy),
-		SET_NOPREV(i2p_port, 0, &session_impl::update_i2p_bridge)
+		SET_NOPREV(i2p_port, 0, &session_impl::update_i2p_bridge),
+		SET_NOPREV(cache_eviction_policy, settings_pack::arc_cache_policy, 0),
+		SET_NOPREV(time_critical_window, 0, 0),
+		SET_NOPREV(network_shards, 0, &session_impl::update_network_shards)
 	};
 
 #undef SET
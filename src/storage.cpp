@@ -1283,6 +1283,143 @@ namespace libtorrent
 		return size;
 	}
 
+	// this is the same piece-to-file mapping as readwritev(), except the
+	// file operations are not performed. Instead the open files and offsets
+	// are handed back to the caller. Anything that needs special treatment
+	// (pad files and files that go in the part file) is left to
+	// readwritev().
+	bool default_storage::map_io(int slot, int offset, int size, int mode
+		, std::vector<file_io_slice>& slices, storage_error& ec)
+	{
+		TORRENT_ASSERT(slot >= 0);
+		TORRENT_ASSERT(slot < m_files.num_pieces());
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(size > 0);
+		TORRENT_ASSERT(files().is_loaded());
+
+		slices.clear();
+
+		// a storage deriving from default_storage may customize readv() and
+		// writev(), in which case they must not be bypassed
+		if (!supports_mapped_io()) return false;
+
+		boost::uint64_t torrent_offset = slot * boost::uint64_t(m_files.piece_length()) + offset;
+		int file_index = files().file_index_at_offset(torrent_offset);
+		boost::int64_t file_offset = torrent_offset - files().file_offset(file_index);
+
+		bool const write = (mode & file::rw_mask) != file::read_only;
+		int buf_pos = 0;
+		int bytes_left = size;
+		int file_bytes_left;
+		for (;bytes_left > 0; ++file_index, bytes_left -= file_bytes_left
+			, buf_pos += file_bytes_left, file_offset = 0)
+		{
+			TORRENT_ASSERT(file_index < files().num_files());
+
+			file_bytes_left = bytes_left;
+			if (file_offset + file_bytes_left > files().file_size(file_index))
+				file_bytes_left = (std::max)(static_cast<int>(files().file_size(file_index) - file_offset), 0);
+
+			if (file_bytes_left == 0) continue;
+
+			if ((file_index < int(m_file_priority.size())
+				&& m_file_priority[file_index] == 0)
+				|| files().pad_file_at(file_index))
+			{
+				slices.clear();
+				return false;
+			}
+
+			// invalidate our stat cache for this file, since
+			// we're writing to it
+			if (write) m_stat_cache.set_dirty(file_index);
+
+			file_handle handle = open_file(file_index, mode, ec);
+			if (ec)
+			{
+				slices.clear();
+				return false;
+			}
+
+			if (m_allocate_files && write)
+			{
+				if (m_file_created.size() != files().num_files())
+					m_file_created.resize(files().num_files(), false);
+
+				if (m_file_created[file_index] == false)
+				{
+					error_code e;
+					handle->set_size(files().file_size(file_index), e);
+					m_file_created.set_bit(file_index);
+					if (e)
+					{
+						ec.ec = e;
+						ec.file = file_index;
+						ec.operation = storage_error::fallocate;
+						slices.clear();
+						return false;
+					}
+				}
+			}
+
+			file_io_slice s;
+			s.handle = handle;
+			s.file_offset =
+#ifndef TORRENT_NO_DEPRECATE
+				files().file_base(file_index) +
+#endif
+				file_offset;
+			s.buffer_offset = buf_pos;
+			s.size = file_bytes_left;
+			s.file_index = file_index;
+			slices.push_back(s);
+		}
+		return true;
+	}
+
+	char const* default_storage::map_read(int slot, int offset, int size
+		, int flags, boost::intrusive_ptr<file_mapping>& mapping
+		, storage_error& ec)
+	{
+		TORRENT_ASSERT(slot >= 0);
+		TORRENT_ASSERT(slot < m_files.num_pieces());
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(size > 0);
+		TORRENT_ASSERT(files().is_loaded());
+
+		if (!file_mapping::supported()) return NULL;
+
+		// a storage deriving from default_storage may customize readv(), in
+		// which case it must not be bypassed
+		if (!supports_mapped_io()) return NULL;
+
+		boost::uint64_t torrent_offset = slot * boost::uint64_t(m_files.piece_length()) + offset;
+		int file_index = files().file_index_at_offset(torrent_offset);
+		boost::int64_t file_offset = torrent_offset - files().file_offset(file_index);
+
+		// the range has to be contained in a single file
+		if (file_offset + size > files().file_size(file_index)) return NULL;
+
+		// files with priority 0 may be backed by the part file
+		if ((file_index < int(m_file_priority.size())
+			&& m_file_priority[file_index] == 0)
+			|| files().pad_file_at(file_index))
+			return NULL;
+
+		file_handle handle = open_file(file_index, file::read_only | flags, ec);
+		if (ec) return NULL;
+
+#ifndef TORRENT_NO_DEPRECATE
+		file_offset += files().file_base(file_index);
+#endif
+
+		// if the file can't be mapped, just fall back to reading it
+		error_code e;
+		mapping = m_pool.map_file(this, file_index, handle, file_offset + size, e);
+		if (!mapping) return NULL;
+		return mapping->data() + file_offset;
+	}
+
 	file_handle default_storage::open_file(int file, int mode
 		, storage_error& ec) const
 	{
@@ -1416,6 +1553,7 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(p->in_storage == false);
 		TORRENT_ASSERT(p->storage.get() == this);
+		mutex::scoped_lock l(m_cached_pieces_mutex);
 		TORRENT_ASSERT(m_cached_pieces.count(p) == 0);
 		m_cached_pieces.insert(p);
 #if TORRENT_USE_ASSERTS
@@ -1425,12 +1563,14 @@ namespace libtorrent
 
 	bool storage_piece_set::has_piece(cached_piece_entry* p) const
 	{
+		mutex::scoped_lock l(m_cached_pieces_mutex);
 		return m_cached_pieces.count(p) > 0;
 	}
 
 	void storage_piece_set::remove_piece(cached_piece_entry* p)
 	{
 		TORRENT_ASSERT(p->in_storage == true);
+		mutex::scoped_lock l(m_cached_pieces_mutex);
 		TORRENT_ASSERT(m_cached_pieces.count(p) == 1);
 		m_cached_pieces.erase(p);
 #if TORRENT_USE_ASSERTS
@@ -1438,8 +1578,68 @@ namespace libtorrent
 #endif
 	}
 
+	int storage_piece_set::num_pieces() const
+	{
+		mutex::scoped_lock l(m_cached_pieces_mutex);
+		return int(m_cached_pieces.size());
+	}
+
+	void storage_piece_set::cached_pieces(std::vector<int>& pieces) const
+	{
+		mutex::scoped_lock l(m_cached_pieces_mutex);
+		pieces.reserve(pieces.size() + m_cached_pieces.size());
+		// the piece index of an entry never changes, and entries are removed
+		// from this set before they're destructed, so it's safe to read it
+		// without holding the mutex of its cache shard
+		for (boost::unordered_set<cached_piece_entry*>::const_iterator i
+			= m_cached_pieces.begin(), end(m_cached_pieces.end()); i != end; ++i)
+			pieces.push_back((*i)->piece);
+	}
+
 	// -- piece_manager -----------------------------------------------------
 
+	int read_stream_tracker::read_ahead(void* requester, boost::int64_t offset
+		, int block_size, int initial_blocks, int max_blocks, bool& sequential)
+	{
+		TORRENT_ASSERT(initial_blocks > 0);
+		TORRENT_ASSERT(max_blocks >= initial_blocks);
+
+		mutex::scoped_lock l(m_streams_mutex);
+
+		std::vector<read_stream>::iterator i = m_streams.begin();
+		for (; i != m_streams.end(); ++i)
+			if (i->requester == requester) break;
+
+		read_stream s;
+		if (i == m_streams.end())
+		{
+			if (int(m_streams.size()) >= max_streams)
+				m_streams.erase(m_streams.begin());
+			s.requester = requester;
+			s.blocks = initial_blocks;
+			sequential = false;
+		}
+		else
+		{
+			s = *i;
+			m_streams.erase(i);
+
+			// the read-ahead of the last miss may have been cut short by the
+			// end of the piece, so anything up to where it would have ended
+			// counts as picking up where it left off
+			sequential = offset > s.last_offset && offset <= s.end_offset;
+			if (sequential) s.blocks = (std::min)(s.blocks * 2, max_blocks);
+			else s.blocks = (std::max)(s.blocks / 2, 1);
+			s.blocks = (std::min)(s.blocks, max_blocks);
+		}
+
+		boost::int64_t const aligned_offset = offset - offset % block_size;
+		s.last_offset = offset;
+		s.end_offset = aligned_offset + boost::int64_t(s.blocks) * block_size;
+		m_streams.push_back(s);
+		return s.blocks;
+	}
+
 	piece_manager::piece_manager(
 		storage_interface* storage_impl
 		, boost::shared_ptr<void> const& torrent
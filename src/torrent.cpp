@@ -1249,11 +1249,22 @@ namespace libtorrent
 
 		update_gauge();
 
+		if (m_connections.empty()) return;
+
+		// add the bitfields of all peers we're already connected to in one
+		// batch, rather than one peer at a time
+		std::vector<bitfield const*> bitfields;
+		std::vector<const void*> peers;
+		bitfields.reserve(m_connections.size());
+		peers.reserve(m_connections.size());
 		for (peer_iterator i = m_connections.begin()
 			, end(m_connections.end()); i != end; ++i)
 		{
-			peer_has((*i)->get_bitfield(), *i);
+			bitfields.push_back(&(*i)->get_bitfield());
+			peers.push_back(*i);
 		}
+		m_picker->inc_refcount(bitfields, peers);
+		refresh_suggest_pieces();
 	}
 
 	void torrent::add_piece(int piece, char const* data, int flags)
@@ -5108,6 +5119,9 @@ namespace libtorrent
 					read_piece(i->piece);
 				}
 
+				m_stats_counters.inc_stats_counter(aux::time_now() > i->deadline
+					? counters::piece_deadlines_missed : counters::piece_deadlines_met);
+
 				// if first_requested is min_time(), it wasn't requested as a critical piece
 				// and we shouldn't adjust any average download times
 				if (i->first_requested != min_time())
@@ -7320,12 +7334,13 @@ namespace libtorrent
 		TORRENT_ASSERT(!m_apply_ip_filter
 			|| (m_ses.get_ip_filter().access(peerinfo->address()) & ip_filter::blocked) == 0);
 
-		boost::shared_ptr<socket_type> s(new socket_type(m_ses.get_io_service()));
+		boost::shared_ptr<socket_type> s;
 
 #if TORRENT_USE_I2P
 		bool i2p = peerinfo->is_i2p_addr;
 		if (i2p)
 		{
+			s.reset(new socket_type(m_ses.get_io_service()));
 			if (m_ses.i2p_proxy().hostname.empty())
 			{
 				// we have an i2p torrent, but we're not connected to an i2p
@@ -7368,8 +7383,17 @@ namespace libtorrent
 			}
 #endif
 
-			bool ret = instantiate_connection(m_ses.get_io_service()
-				, m_ses.proxy(), *s, userdata, sm, true);
+			// plain TCP connections may be handled by a network shard. uTP,
+			// SSL and proxied connections always stay on the network thread
+			proxy_settings const ps = m_ses.proxy();
+			bool const plain_tcp = sm == 0 && userdata == 0
+				&& (ps.type == settings_pack::none || !ps.proxy_peer_connections);
+			io_service& ios = plain_tcp
+				? m_ses.peer_socket_io_service(info_hash())
+				: m_ses.get_io_service();
+			s.reset(new socket_type(ios));
+
+			bool ret = instantiate_connection(ios, ps, *s, userdata, sm, true);
 			(void)ret;
 			TORRENT_ASSERT(ret);
 
@@ -7772,7 +7796,8 @@ namespace libtorrent
 
 #ifdef TORRENT_DEBUG
 		error_code ec;
-		TORRENT_ASSERT(p->remote() == p->get_socket()->remote_endpoint(ec) || ec);
+		TORRENT_ASSERT(p->socket_on_shard()
+			|| p->remote() == p->get_socket()->remote_endpoint(ec) || ec);
 #endif
 
 		TORRENT_ASSERT(p->peer_info_struct() != NULL);
@@ -10196,6 +10221,43 @@ namespace libtorrent
 	}
 #endif // TORRENT_DEBUG_STREAMING
 
+	namespace
+	{
+		// orders peers by how soon we expect to receive a block if we send a
+		// new request to them
+		bool earlier_arrival(peer_connection const* lhs, peer_connection const* rhs)
+		{
+			return lhs->expected_arrival_time(16*1024)
+				< rhs->expected_arrival_time(16*1024);
+		}
+
+		// returns true if any block of this piece that we're waiting for is not
+		// expected to arrive before the piece's deadline, based on the queue
+		// of the peer it was requested from. Blocks that have already been
+		// requested from more than one peer are not considered
+		bool deadline_at_risk(piece_picker const* picker
+			, piece_picker::downloading_piece const& pi
+			, time_critical_piece const& p
+			, int blocks_in_piece
+			, time_point now)
+		{
+			piece_picker::block_info const* info = picker->blocks_for_piece(pi);
+			for (int k = 0; k < blocks_in_piece; ++k)
+			{
+				if (info[k].state != piece_picker::block_info::state_requested)
+					continue;
+				if (info[k].num_peers > 1) continue;
+
+				torrent_peer* tp = static_cast<torrent_peer*>(info[k].peer);
+				if (tp == 0 || tp->connection == 0) continue;
+				peer_connection const* c = static_cast<peer_connection const*>(tp->connection);
+				if (now + c->expected_arrival_time(piece_block(p.piece, k)) > p.deadline)
+					return true;
+			}
+			return false;
+		}
+	}
+
 	struct busy_block_t
 	{
 		int peers;
@@ -10444,9 +10506,8 @@ namespace libtorrent
 				continue;
 			}
 
-			// resort p, since it will have a higher download_queue_time now
-			while (p != peers.end()-1 && (*p)->download_queue_time()
-				> (*(p+1))->download_queue_time())
+			// resort p, since it will have a later expected arrival time now
+			while (p != peers.end()-1 && earlier_arrival(*(p+1), *p))
 			{
 				std::iter_swap(p, p+1);
 				++p;
@@ -10474,11 +10535,10 @@ namespace libtorrent
 			, std::back_inserter(peers), !boost::bind(&peer_connection::can_request_time_critical, _1));
 
 		// sort by the time we believe it will take this peer to send us all
-		// blocks we've requested from it. The shorter time, the better candidate
-		// it is to request a time critical block from.
-		std::sort(peers.begin(), peers.end()
-			, boost::bind(&peer_connection::download_queue_time, _1, 16*1024)
-			< boost::bind(&peer_connection::download_queue_time, _2, 16*1024));
+		// blocks we've requested from it, plus the round-trip of one more
+		// request. The shorter time, the better candidate it is to request a
+		// time critical block from.
+		std::sort(peers.begin(), peers.end(), &earlier_arrival);
 
 		// remove the bottom 10% of peers from the candidate set.
 		// this is just to remove outliers that might stall downloads
@@ -10501,6 +10561,15 @@ namespace libtorrent
 
 		time_point now = clock_type::now();
 
+		// time critical pieces are requested if their deadline falls within
+		// this window. Unless it's set explicitly, it's derived from the time
+		// it takes to download a piece. The +1000 is to compensate for the
+		// fact that we only call this function once per second, so if we need
+		// to request it 500 ms from now, we should request it right away
+		int const window = settings().get_int(settings_pack::time_critical_window);
+		time_duration const horizon = window > 0 ? milliseconds(window)
+			: milliseconds(m_average_piece_time + m_piece_time_deviation * 4 + 1000);
+
 		// now, iterate over all time critical pieces, in order of importance, and
 		// request them from the peers, in order of responsiveness. i.e. request
 		// the most time critical pieces from the fastest peers.
@@ -10519,11 +10588,7 @@ namespace libtorrent
 				break;
 			}
 
-			// the +1000 is to compensate for the fact that we only call this
-			// function once per second, so if we need to request it 500 ms from
-			// now, we should request it right away
-			if (i != m_time_critical_pieces.begin() && i->deadline > now
-				+ milliseconds(m_average_piece_time + m_piece_time_deviation * 4 + 1000))
+			if (i != m_time_critical_pieces.begin() && i->deadline > now + horizon)
 			{
 				// don't request pieces whose deadline is too far in the future
 				// this is one of the termination conditions. We don't want to
@@ -10562,6 +10627,15 @@ namespace libtorrent
 					timed_out = total_milliseconds(now - i->last_requested)
 						/ (std::max)(int(m_average_piece_time + m_piece_time_deviation / 2), 1);
 
+				// if a block we're still waiting for is not expected to arrive
+				// before the deadline, allow requesting it from one more peer
+				if (timed_out == 0 && pi.requested > 0
+					&& deadline_at_risk(m_picker.get(), pi, *i, blocks_in_piece, now))
+				{
+					timed_out = 1;
+					m_stats_counters.inc_stats_counter(counters::piece_deadlines_at_risk);
+				}
+
 #if TORRENT_DEBUG_STREAMING > 0
 				i->timed_out = timed_out;
 #endif
@@ -10609,9 +10683,7 @@ namespace libtorrent
 
 				// TODO: instead of resorting the whole list, insert the peers
 				// directly into the right place
-				std::sort(peers.begin(), peers.end()
-					, boost::bind(&peer_connection::download_queue_time, _1, 16*1024)
-					< boost::bind(&peer_connection::download_queue_time, _2, 16*1024));
+				std::sort(peers.begin(), peers.end(), &earlier_arrival);
 			}
 
 			// if this peer's download time exceeds 2 seconds, we're done.
@@ -40,6 +40,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/broadcast_socket.hpp" // for is_any
 #include "libtorrent/settings_pack.hpp"
 #include "libtorrent/aux_/time.hpp" // for aux::time_now()
+#include "libtorrent/performance_counters.hpp"
 
 #include <stdlib.h>
 #include <boost/bind.hpp>
@@ -55,10 +56,27 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/debug.hpp"
 #endif
 
+#if TORRENT_USE_MMSG
+#include <sys/socket.h> // for recvmmsg, sendmmsg
+#include <netinet/in.h> // for IPPROTO_UDP
+#include <netinet/udp.h>
+#include <errno.h>
+#include <string.h> // for memset
+
+// older system headers don't define the segmentation offload options
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
 using namespace libtorrent;
 
-udp_socket::udp_socket(asio::io_service& ios)
+udp_socket::udp_socket(asio::io_service& ios, counters& cnt)
 	: m_observers_locked(false)
+	, m_counters(cnt)
 	, m_ipv4_sock(ios)
 	, m_timer(ios)
 	, m_buf_size(0)
@@ -79,6 +97,13 @@ udp_socket::udp_socket(asio::io_service& ios)
 	, m_force_proxy(false)
 	, m_abort(false)
 	, m_outstanding_ops(0)
+#if TORRENT_USE_MMSG
+	, m_flush_posted(false)
+	, m_want_gso(false)
+	, m_gso(false)
+	, m_want_gro(false)
+	, m_gro(false)
+#endif
 #if TORRENT_USE_IPV6
 	, m_v6_write_subscribed(false)
 #endif
@@ -207,34 +232,58 @@ void udp_socket::send(udp::endpoint const& ep, char const* p, int len
 
 	if (m_force_proxy) return;
 
+#if TORRENT_USE_MMSG
+	if (flags & batch)
+	{
+		queue_packet(ep, p, len, ec);
+		return;
+	}
+
+	// don't let this packet overtake the ones already queued. If the socket
+	// is still blocked, it has to wait at the end of the queue
+	if (!m_send_queue.empty())
+	{
+		flush_send_queue();
+		if (!m_send_queue.empty())
+		{
+			queue_packet(ep, p, len, ec);
+			return;
+		}
+	}
+#endif
+
+	udp::socket* s = &m_ipv4_sock;
 #if TORRENT_USE_IPV6
 	if (ep.address().is_v6() && m_ipv6_sock.is_open())
-		m_ipv6_sock.send_to(asio::buffer(p, len), ep, 0, ec);
-	else
+		s = &m_ipv6_sock;
 #endif
-		m_ipv4_sock.send_to(asio::buffer(p, len), ep, 0, ec);
+	s->send_to(asio::buffer(p, len), ep, 0, ec);
 
 	if (ec == error::would_block || ec == error::try_again)
-	{
+		wait_writable(s);
+}
+
+// get a call to on_writable() once the socket can be sent to again
+void udp_socket::wait_writable(udp::socket* s)
+{
 #if TORRENT_USE_IPV6
-		if (ep.address().is_v6() && m_ipv6_sock.is_open())
+	if (s == &m_ipv6_sock)
+	{
+		if (!m_v6_write_subscribed)
 		{
-			if (!m_v6_write_subscribed)
-			{
-				m_ipv6_sock.async_send(asio::null_buffers()
-					, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv6_sock));
-				m_v6_write_subscribed = true;
-			}
+			m_ipv6_sock.async_send(asio::null_buffers()
+				, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv6_sock));
+			m_v6_write_subscribed = true;
 		}
-		else
+	}
+	else
 #endif
+	{
+		if (!m_v4_write_subscribed)
 		{
-			if (!m_v4_write_subscribed)
-			{
-				m_ipv4_sock.async_send(asio::null_buffers()
-					, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv4_sock));
-				m_v4_write_subscribed = true;
-			}
+			m_ipv4_sock.async_send(asio::null_buffers()
+				, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv4_sock));
+			m_v4_write_subscribed = true;
 		}
 	}
 }
@@ -248,9 +297,318 @@ void udp_socket::on_writable(error_code const& ec, udp::socket* s)
 #endif
 		m_v4_write_subscribed = false;
 
+#if TORRENT_USE_MMSG
+	// the packets that were queued when the socket blocked go first
+	if (!m_send_queue.empty() && !m_abort) flush_send_queue();
+#endif
+
 	call_writable_handler();
 }
 
+#if TORRENT_USE_MMSG
+void udp_socket::queue_packet(udp::endpoint const& ep, char const* p, int len
+	, error_code& ec)
+{
+	if (int(m_send_queue.size()) >= max_queued)
+	{
+		flush_send_queue();
+
+		// if the socket didn't take all of them, it's blocked. Report it
+		// the same way an immediate send would
+		if (!m_send_queue.empty())
+		{
+			ec = error::would_block;
+			return;
+		}
+	}
+
+	batched_packet bp;
+	bp.ep = ep;
+	bp.offset = int(m_send_queue_buf.size());
+	bp.len = len;
+	m_send_queue_buf.insert(m_send_queue_buf.end(), p, p + len);
+	m_send_queue.push_back(bp);
+
+	if (!m_flush_posted)
+	{
+		m_flush_posted = true;
+		get_io_service().post(boost::bind(&udp_socket::on_flush, this));
+	}
+}
+
+void udp_socket::on_flush()
+{
+	m_flush_posted = false;
+	if (m_abort)
+	{
+		m_send_queue.clear();
+		m_send_queue_buf.clear();
+		return;
+	}
+	flush_send_queue();
+}
+
+void udp_socket::flush_send_queue()
+{
+	mmsghdr msgs[max_batch];
+	iovec iov[max_batch];
+	// the UDP_SEGMENT control message of each message
+	char cmsgs[max_batch][CMSG_SPACE(sizeof(boost::uint16_t))];
+	// the number of queued packets each message carries
+	int msg_packets[max_batch];
+
+	int const num_queued = int(m_send_queue.size());
+	int sent = 0;
+	while (sent < num_queued)
+	{
+		// sendmmsg() sends on a single socket. Find the run of packets going
+		// out through the same one
+		udp::socket* s = &m_ipv4_sock;
+#if TORRENT_USE_IPV6
+		if (m_send_queue[sent].ep.address().is_v6() && m_ipv6_sock.is_open())
+			s = &m_ipv6_sock;
+#endif
+		int n = 0;
+		for (int i = sent; i < num_queued && n < max_batch; ++n)
+		{
+			batched_packet& bp = m_send_queue[i];
+#if TORRENT_USE_IPV6
+			if ((s == &m_ipv6_sock) != (bp.ep.address().is_v6() && m_ipv6_sock.is_open()))
+				break;
+#endif
+			// with segmentation offload, a run of equally sized packets to
+			// the same endpoint is sent as one buffer, and split back into
+			// packets by the kernel or the NIC. Only the last one may be
+			// smaller. The packets are already contiguous in
+			// m_send_queue_buf
+			int segments = 1;
+			int len = bp.len;
+			if (m_gso)
+			{
+				while (i + segments < num_queued)
+				{
+					batched_packet const& next = m_send_queue[i + segments];
+					if (next.ep != bp.ep || next.len > bp.len
+						|| len + next.len > max_gso_bytes)
+						break;
+					TORRENT_ASSERT(next.offset == bp.offset + len);
+					len += next.len;
+					++segments;
+					if (next.len < bp.len) break;
+				}
+			}
+
+			iov[n].iov_base = &m_send_queue_buf[bp.offset];
+			iov[n].iov_len = len;
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = bp.ep.data();
+			msgs[n].msg_hdr.msg_namelen = bp.ep.size();
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			if (segments > 1)
+			{
+				msgs[n].msg_hdr.msg_control = cmsgs[n];
+				msgs[n].msg_hdr.msg_controllen = sizeof(cmsgs[n]);
+				cmsghdr* cm = CMSG_FIRSTHDR(&msgs[n].msg_hdr);
+				cm->cmsg_level = IPPROTO_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof(boost::uint16_t));
+				boost::uint16_t const segment_size = bp.len;
+				memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+			}
+			msg_packets[n] = segments;
+			i += segments;
+		}
+
+		int ret = sendmmsg(s->native_handle(), msgs, n, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				wait_writable(s);
+				break;
+			}
+			if (msg_packets[0] > 1 && (errno == EIO || errno == EINVAL
+				|| errno == ENOPROTOOPT || errno == EOPNOTSUPP))
+			{
+				// the kernel or the network interface doesn't support
+				// segmentation offload (EIO means there's no checksum
+				// offload). Send the packets one at a time from now on
+				m_gso = false;
+				continue;
+			}
+			// the first message failed. Drop it, the same way a failed
+			// send() drops it
+			sent += msg_packets[0];
+			continue;
+		}
+
+		int packets = 0;
+		for (int i = 0; i < ret; ++i)
+		{
+			packets += msg_packets[i];
+			if (msg_packets[i] > 1)
+				m_counters.inc_stats_counter(counters::udp_gso_packets, msg_packets[i]);
+		}
+		m_counters.inc_stats_counter(counters::udp_send_batches);
+		m_counters.inc_stats_counter(counters::udp_send_batched_packets, packets);
+		sent += packets;
+	}
+
+	if (sent == num_queued)
+	{
+		m_send_queue.clear();
+		m_send_queue_buf.clear();
+		return;
+	}
+
+	// the socket blocked. Keep the remaining packets at the front of the
+	// queue until it's writable again
+	int const offset = m_send_queue[sent].offset;
+	m_send_queue.erase(m_send_queue.begin(), m_send_queue.begin() + sent);
+	m_send_queue_buf.erase(m_send_queue_buf.begin()
+		, m_send_queue_buf.begin() + offset);
+	for (std::vector<batched_packet>::iterator i = m_send_queue.begin()
+		, end(m_send_queue.end()); i != end; ++i)
+		i->offset -= offset;
+}
+
+void udp_socket::read_batches(udp::socket* s)
+{
+	mmsghdr msgs[max_batch];
+	iovec iov[max_batch];
+	udp::endpoint eps[max_batch];
+	// the UDP_GRO control message, telling the segment size of coalesced
+	// packets
+	char cmsgs[max_batch][CMSG_SPACE(sizeof(int))];
+
+	for (;;)
+	{
+		// each packet gets a slot of the same size as the single receive
+		// buffer would be. With receive offload, the slots have to fit a
+		// whole train of coalesced packets
+		int slot_size = m_buf_size;
+		if (slot_size == 0) return;
+		if (m_gro) slot_size = (std::max)(slot_size, int(gro_slot_size));
+		int const num_slots = (std::max)(1, (std::min)(int(max_batch)
+			, int(max_recv_batch_bytes) / slot_size));
+		if (int(m_recv_batch_buf.size()) < num_slots * slot_size)
+			m_recv_batch_buf.resize(num_slots * slot_size);
+
+		for (int i = 0; i < num_slots; ++i)
+		{
+			iov[i].iov_base = &m_recv_batch_buf[i * slot_size];
+			iov[i].iov_len = slot_size;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = eps[i].data();
+			msgs[i].msg_hdr.msg_namelen = eps[i].capacity();
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			if (m_gro)
+			{
+				msgs[i].msg_hdr.msg_control = cmsgs[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(cmsgs[i]);
+			}
+		}
+
+		int const ret = recvmmsg(s->native_handle(), msgs, num_slots
+			, MSG_DONTWAIT, NULL);
+		if (ret < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			error_code ec(errno, asio::error::get_system_category());
+			on_read_impl(s, udp::endpoint(), ec, 0, 0);
+			continue;
+		}
+
+		m_counters.inc_stats_counter(counters::udp_recv_batches);
+		m_counters.inc_stats_counter(counters::udp_recv_batched_packets, ret);
+
+		for (int i = 0; i < ret; ++i)
+		{
+			eps[i].resize(msgs[i].msg_hdr.msg_namelen);
+			char const* buf = &m_recv_batch_buf[i * slot_size];
+			int const len = msgs[i].msg_len;
+
+			int segment_size = 0;
+			if (msgs[i].msg_hdr.msg_controllen > 0)
+			{
+				for (cmsghdr* cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm != NULL
+					; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm))
+				{
+					if (cm->cmsg_level != IPPROTO_UDP || cm->cmsg_type != UDP_GRO)
+						continue;
+					memcpy(&segment_size, CMSG_DATA(cm), sizeof(segment_size));
+				}
+			}
+
+			if (segment_size <= 0 || segment_size >= len)
+			{
+				on_read_impl(s, eps[i], error_code(), buf, len);
+				continue;
+			}
+
+			// this is a train of packets coalesced by the kernel. Split it
+			// back into the packets it was made of. Only the last one may be
+			// smaller than the segment size
+			m_counters.inc_stats_counter(counters::udp_gro_packets
+				, (len + segment_size - 1) / segment_size);
+			for (int offset = 0; offset < len; offset += segment_size)
+			{
+				on_read_impl(s, eps[i], error_code(), buf + offset
+					, (std::min)(segment_size, len - offset));
+			}
+		}
+
+		// if we didn't fill all the slots, the socket is drained, there's no
+		// need to make another call just to be told so
+		if (ret < num_slots) break;
+	}
+}
+
+void udp_socket::update_gso()
+{
+	// kernels before 4.18 don't know about UDP_SEGMENT, and would silently
+	// ignore the control message and send the whole buffer as one packet.
+	// Setting the socket's default segment size to 0 (i.e. no segmentation)
+	// only succeeds if it's supported
+	int const val = 0;
+	bool supported = m_ipv4_sock.is_open()
+#if TORRENT_USE_IPV6
+		|| m_ipv6_sock.is_open()
+#endif
+		;
+	if (m_ipv4_sock.is_open() && setsockopt(m_ipv4_sock.native_handle()
+		, IPPROTO_UDP, UDP_SEGMENT, &val, sizeof(val)) != 0)
+		supported = false;
+#if TORRENT_USE_IPV6
+	if (m_ipv6_sock.is_open() && setsockopt(m_ipv6_sock.native_handle()
+		, IPPROTO_UDP, UDP_SEGMENT, &val, sizeof(val)) != 0)
+		supported = false;
+#endif
+	m_gso = m_want_gso && supported;
+}
+
+void udp_socket::update_gro()
+{
+	int const val = m_want_gro ? 1 : 0;
+	bool enabled = false;
+	if (m_ipv4_sock.is_open() && setsockopt(m_ipv4_sock.native_handle()
+		, IPPROTO_UDP, UDP_GRO, &val, sizeof(val)) == 0)
+		enabled = m_want_gro;
+#if TORRENT_USE_IPV6
+	if (m_ipv6_sock.is_open() && setsockopt(m_ipv6_sock.native_handle()
+		, IPPROTO_UDP, UDP_GRO, &val, sizeof(val)) == 0)
+		enabled = m_want_gro;
+#endif
+	// if the kernel doesn't support it, don't waste large receive buffers
+	// on packets that will never be coalesced
+	m_gro = enabled;
+}
+#endif // TORRENT_USE_MMSG
+
 // called whenever the socket is readable
 void udp_socket::on_read(error_code const& ec, udp::socket* s)
 {
@@ -279,6 +637,9 @@ void udp_socket::on_read(error_code const& ec, udp::socket* s)
 
 	CHECK_MAGIC;
 
+#if TORRENT_USE_MMSG
+	read_batches(s);
+#else
 	for (;;)
 	{
 		error_code ec;
@@ -300,8 +661,9 @@ void udp_socket::on_read(error_code const& ec, udp::socket* s)
 #endif
 
 		if (ec == asio::error::would_block || ec == asio::error::try_again) break;
-		on_read_impl(s, ep, ec, bytes_transferred);
+		on_read_impl(s, ep, ec, m_buf, bytes_transferred);
 	}
+#endif
 	call_drained_handler();
 	setup_read(s);
 }
@@ -418,7 +780,7 @@ void udp_socket::unsubscribe(udp_socket_observer* o)
 }
 
 void udp_socket::on_read_impl(udp::socket* s, udp::endpoint const& ep
-	, error_code const& e, std::size_t bytes_transferred)
+	, error_code const& e, char const* buf, std::size_t bytes_transferred)
 {
 	TORRENT_ASSERT(m_magic == 0x1337);
 	TORRENT_ASSERT(is_single_thread());
@@ -462,11 +824,11 @@ void udp_socket::on_read_impl(udp::socket* s, udp::endpoint const& ep
 		{
 			// if the source IP doesn't match the proxy's, ignore the packet
 			if (ep == m_udp_proxy_addr)
-				unwrap(e, m_buf, bytes_transferred);
+				unwrap(e, buf, bytes_transferred);
 		}
 		else if (!m_force_proxy) // block incoming packets that aren't coming via the proxy
 		{
-			call_handler(e, ep, m_buf, bytes_transferred);
+			call_handler(e, ep, buf, bytes_transferred);
 		}
 
 	} TORRENT_CATCH (std::exception&) {}
@@ -703,6 +1065,20 @@ void udp_socket::set_buf_size(int s)
 #endif
 }
 
+void udp_socket::set_segmentation_offload(bool gso, bool gro)
+{
+	TORRENT_ASSERT(is_single_thread());
+#if TORRENT_USE_MMSG
+	m_want_gso = gso;
+	m_want_gro = gro;
+	update_gso();
+	update_gro();
+#else
+	(void)gso;
+	(void)gro;
+#endif
+}
+
 void udp_socket::bind(udp::endpoint const& ep, error_code& ec)
 {
 	CHECK_MAGIC;
@@ -751,6 +1127,10 @@ void udp_socket::bind(udp::endpoint const& ep, error_code& ec)
 		setup_read(&m_ipv6_sock);
 	}
 #endif
+#if TORRENT_USE_MMSG
+	update_gso();
+	update_gro();
+#endif
 #if TORRENT_USE_ASSERTS
 	m_started = true;
 #endif
@@ -1330,8 +1710,9 @@ void udp_socket::drain_queue()
 	}
 }
 
-rate_limited_udp_socket::rate_limited_udp_socket(io_service& ios)
-	: udp_socket(ios)
+rate_limited_udp_socket::rate_limited_udp_socket(io_service& ios
+	, counters& cnt)
+	: udp_socket(ios, cnt)
 	, m_rate_limit(8000)
 	, m_quota(8000)
 	, m_last_tick(aux::time_now())
@@ -59,6 +59,7 @@ namespace libtorrent
 		, m_last_if_update(min_time())
 		, m_sock_buf_size(0)
 		, m_counters(cnt)
+		, m_packet_pool(cnt)
 		, m_ssl_context(ssl_context)
 	{}
 
@@ -182,7 +183,10 @@ namespace libtorrent
 		if (flags & utp_socket_manager::dont_fragment)
 			m_sock.set_option(libtorrent::dont_fragment(true), tmp);
 #endif
-		m_sock.send(ep, p, len, ec);
+		// MTU probes are sent right away, since the don't fragment option
+		// is set on the socket just for them
+		m_sock.send(ep, p, len, ec
+			, (flags & dont_fragment) ? 0 : udp_socket::batch);
 #ifdef TORRENT_HAS_DONT_FRAGMENT
 		if (flags & utp_socket_manager::dont_fragment)
 			m_sock.set_option(libtorrent::dont_fragment(false), tmp);
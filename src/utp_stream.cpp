@@ -316,6 +316,12 @@ struct utp_socket_impl
 	void defer_ack();
 	void remove_sack_header(packet* p);
 
+	// allocates a packet with room for ``size`` bytes of header and payload
+	// from the socket manager's packet pool. ``allocated`` is set to
+	// ``size``, and must not be changed before the packet is released
+	packet* acquire_packet(int size);
+	void release_packet(packet* p);
+
 	enum packet_flags_t { pkt_ack = 1, pkt_fin = 2 };
 	bool send_pkt(int flags = 0);
 	bool resend_packet(packet* p, bool fast_resend = false);
@@ -1080,7 +1086,7 @@ size_t utp_stream::read_some(bool clear_buffers)
 		// Consumed entire packet
 		if (p->header_size == p->size)
 		{
-			free(p);
+			m_impl->release_packet(p);
 			++pop_packets;
 			*i = 0;
 			++i;
@@ -1175,27 +1181,40 @@ utp_socket_impl::~utp_socket_impl()
 		+ m_inbuf.capacity()) & ACK_MASK);
 		i != end; i = (i + 1) & ACK_MASK)
 	{
-		void* p = m_inbuf.remove(i);
-		free(p);
+		packet* p = (packet*)m_inbuf.remove(i);
+		release_packet(p);
 	}
 	for (boost::uint16_t i = m_outbuf.cursor(), end((m_outbuf.cursor()
 		+ m_outbuf.capacity()) & ACK_MASK);
 		i != end; i = (i + 1) & ACK_MASK)
 	{
-		void* p = m_outbuf.remove(i);
-		free(p);
+		packet* p = (packet*)m_outbuf.remove(i);
+		release_packet(p);
 	}
 
 	for (std::vector<packet*>::iterator i = m_receive_buffer.begin()
 		, end = m_receive_buffer.end(); i != end; ++i)
 	{
-		free(*i);
+		release_packet(*i);
 	}
 
-	free(m_nagle_packet);
+	release_packet(m_nagle_packet);
 	m_nagle_packet = NULL;
 }
 
+packet* utp_socket_impl::acquire_packet(int size)
+{
+	packet* p = (packet*)m_sm->allocate_packet(sizeof(packet) + size);
+	p->allocated = size;
+	return p;
+}
+
+void utp_socket_impl::release_packet(packet* p)
+{
+	if (p == NULL) return;
+	m_sm->release_packet(p, sizeof(packet) + p->allocated);
+}
+
 bool utp_socket_impl::should_delete() const
 {
 	INVARIANT_CHECK;
@@ -1322,7 +1341,7 @@ void utp_socket_impl::send_syn()
 	m_ack_nr = 0;
 	m_fast_resend_seq_nr = m_seq_nr;
 
-	packet* p = (packet*)malloc(sizeof(packet) + sizeof(utp_header));
+	packet* p = acquire_packet(sizeof(utp_header));
 	p->size = sizeof(utp_header);
 	p->header_size = sizeof(utp_header);
 	p->num_transmissions = 0;
@@ -1371,7 +1390,7 @@ void utp_socket_impl::send_syn()
 	}
 	else if (ec)
 	{
-		free(p);
+		release_packet(p);
 		m_error = ec;
 		set_state(UTP_STATE_ERROR_WAIT);
 		test_socket_state();
@@ -1673,25 +1692,26 @@ void utp_socket_impl::remove_sack_header(packet* p)
 
 struct holder
 {
-	holder(char* buf = NULL): m_buf(buf) {}
-	~holder() { free(m_buf); }
+	holder(utp_socket_impl* s): m_sock(s), m_buf(NULL) {}
+	~holder() { m_sock->release_packet(m_buf); }
 
-	void reset(char* buf)
+	void reset(packet* buf)
 	{
-		free(m_buf);
+		m_sock->release_packet(m_buf);
 		m_buf = buf;
 	}
 
-	char* release()
+	packet* release()
 	{
-		char* ret = m_buf;
+		packet* ret = m_buf;
 		m_buf = NULL;
 		return ret;
 	}
 
 private:
 
-	char* m_buf;
+	utp_socket_impl* m_sock;
+	packet* m_buf;
 };
 
 // sends a packet, pulls data from the write buffer (if there's any)
@@ -1815,7 +1835,7 @@ bool utp_socket_impl::send_pkt(int flags)
 
 	// used to free the packet buffer in case we exit the
 	// function early
-	holder buf_holder;
+	holder buf_holder(this);
 
 	// payload size being zero means we're just sending
 	// an force. We should not pick up the nagle packet
@@ -1825,9 +1845,8 @@ bool utp_socket_impl::send_pkt(int flags)
 		// need to keep the packet around (in the outbuf)
 		if (payload_size) 
 		{
-			p = (packet*)malloc(sizeof(packet) + m_mtu);
-			p->allocated = m_mtu;
-			buf_holder.reset((char*)p);
+			p = acquire_packet(m_mtu);
+			buf_holder.reset(p);
 
 			m_sm->inc_stats_counter(counters::utp_payload_pkts_out);
 		}
@@ -2085,7 +2104,7 @@ bool utp_socket_impl::send_pkt(int flags)
 		{
 			TORRENT_ASSERT(((utp_header*)old->buf)->seq_nr == m_seq_nr);
 			if (!old->need_resend) m_bytes_in_flight -= old->size - old->header_size;
-			free(old);
+			release_packet(old);
 		}
 		TORRENT_ASSERT(h->seq_nr == m_seq_nr);
 		m_seq_nr = (m_seq_nr + 1) & ACK_MASK;
@@ -2361,7 +2380,7 @@ void utp_socket_impl::ack_packet(packet* p, time_point const& receive_time
 
 	m_rtt.add_sample(rtt / 1000);
 	if (rtt < min_rtt) min_rtt = rtt;
-	free(p);
+	release_packet(p);
 }
 
 void utp_socket_impl::incoming(boost::uint8_t const* buf, int size, packet* p
@@ -2399,7 +2418,7 @@ void utp_socket_impl::incoming(boost::uint8_t const* buf, int size, packet* p
 		if (size == 0)
 		{
 			TORRENT_ASSERT(p == 0 || p->header_size == p->size);
-			free(p);
+			release_packet(p);
 			return;
 		}
 	}
@@ -2409,7 +2428,7 @@ void utp_socket_impl::incoming(boost::uint8_t const* buf, int size, packet* p
 	if (!p)
 	{
 		TORRENT_ASSERT(buf);
-		p = (packet*)malloc(sizeof(packet) + size);
+		p = acquire_packet(size);
 		p->size = size;
 		p->header_size = 0;
 		memcpy(p->buf, buf, size);
@@ -2543,7 +2562,7 @@ bool utp_socket_impl::consume_incoming_data(
 		}
 
 		// we don't need to save the packet header, just the payload
-		packet* p = (packet*)malloc(sizeof(packet) + payload_size);
+		packet* p = acquire_packet(payload_size);
 		p->size = payload_size;
 		p->header_size = 0;
 		p->num_transmissions = 0;
@@ -0,0 +1,232 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/alert_manager.hpp"
+#include "libtorrent/alert_types.hpp"
+#include "libtorrent/alert_arena.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+using namespace libtorrent;
+
+// an alert that doesn't use TORRENT_DEFINE_ALERT, and so can't be copied
+// into the arena
+struct user_alert : alert
+{
+	user_alert(int v) : value(v) {}
+	virtual int type() const { return user_alert_id + 1; }
+	virtual char const* what() const { return "user_alert"; }
+	virtual std::string message() const { return "user alert"; }
+	virtual int category() const { return alert::status_notification; }
+	virtual std::auto_ptr<alert> clone() const
+	{ return std::auto_ptr<alert>(new user_alert(*this)); }
+
+	int value;
+};
+
+int msg_value(alert const* a)
+{
+	portmap_log_alert const* pa = alert_cast<portmap_log_alert>(a);
+	TEST_CHECK(pa != NULL);
+	if (pa == NULL) return -1;
+	return boost::lexical_cast<int>(pa->msg);
+}
+
+void post(alert_manager& mgr, int first, int num)
+{
+	for (int i = first; i < first + num; ++i)
+		mgr.post_alert(portmap_log_alert(0, boost::lexical_cast<std::string>(i)));
+}
+
+void test_arena()
+{
+	alert_arena q;
+	TEST_CHECK(q.empty());
+
+	for (int i = 0; i < 1000; ++i)
+		q.push_back(portmap_log_alert(0, boost::lexical_cast<std::string>(i)));
+	q.push_back(std::auto_ptr<alert>(new user_alert(1)));
+	q.push_back(user_alert(2));
+
+	TEST_EQUAL(q.size(), 1002);
+	for (int i = 0; i < 1000; ++i)
+		TEST_EQUAL(msg_value(q[i]), i);
+	TEST_EQUAL(static_cast<user_alert*>(q[1000])->value, 1);
+	TEST_EQUAL(static_cast<user_alert*>(q[1001])->value, 2);
+
+	// the memory is kept when the arena is cleared, and reused
+	int const capacity = q.capacity();
+	TEST_CHECK(capacity > 0);
+	q.clear();
+	TEST_CHECK(q.empty());
+	for (int i = 0; i < 1000; ++i)
+		q.push_back(portmap_log_alert(0, boost::lexical_cast<std::string>(i)));
+	TEST_EQUAL(q.capacity(), capacity);
+	TEST_EQUAL(msg_value(q[999]), 999);
+}
+
+void test_pop_alerts()
+{
+	alert_manager mgr(1000, alert::all_categories);
+	std::vector<alert*> alerts;
+	int num_resume = 0;
+
+	post(mgr, 0, 100);
+	TEST_CHECK(mgr.pending());
+	mgr.get_all(alerts, num_resume);
+	TEST_EQUAL(num_resume, 0);
+	TEST_EQUAL(alerts.size(), 100);
+	for (int i = 0; i < int(alerts.size()); ++i)
+		TEST_EQUAL(msg_value(alerts[i]), i);
+	TEST_CHECK(!mgr.pending());
+
+	// the alerts from the previous call are still valid while new ones are
+	// posted
+	post(mgr, 100, 50);
+	TEST_EQUAL(msg_value(alerts[99]), 99);
+
+	mgr.get_all(alerts, num_resume);
+	TEST_EQUAL(alerts.size(), 50);
+	for (int i = 0; i < int(alerts.size()); ++i)
+		TEST_EQUAL(msg_value(alerts[i]), 100 + i);
+
+	mgr.get_all(alerts, num_resume);
+	TEST_CHECK(alerts.empty());
+}
+
+void test_queue_limit()
+{
+	alert_manager mgr(10, alert::all_categories);
+	post(mgr, 0, 20);
+
+	std::vector<alert*> alerts;
+	int num_resume = 0;
+	mgr.get_all(alerts, num_resume);
+	TEST_EQUAL(alerts.size(), 10);
+	TEST_EQUAL(msg_value(alerts.back()), 9);
+
+	// the alerts handed out don't count against the limit
+	post(mgr, 0, 10);
+	TEST_EQUAL(mgr.should_post<portmap_log_alert>(), false);
+	mgr.get_all(alerts, num_resume);
+	TEST_EQUAL(alerts.size(), 10);
+	TEST_EQUAL(mgr.should_post<portmap_log_alert>(), true);
+}
+
+void test_mixed_pop()
+{
+	alert_manager mgr(1000, alert::all_categories);
+	int num_resume = 0;
+
+	post(mgr, 0, 10);
+	mgr.post_alert_ptr(new user_alert(10));
+
+	alert const* a = mgr.wait_for_alert(seconds(0));
+	TEST_CHECK(a != NULL);
+	if (a) TEST_EQUAL(msg_value(a), 0);
+
+	// the single alert API returns copies owned by the caller
+	std::auto_ptr<alert> a1 = mgr.get(num_resume);
+	TEST_EQUAL(msg_value(a1.get()), 0);
+	a1 = mgr.get(num_resume);
+	TEST_EQUAL(msg_value(a1.get()), 1);
+
+	std::vector<alert*> alerts;
+	mgr.get_all(alerts, num_resume);
+	TEST_EQUAL(alerts.size(), 9);
+	TEST_EQUAL(msg_value(alerts.front()), 2);
+	TEST_EQUAL(static_cast<user_alert*>(alerts.back())->value, 10);
+
+	post(mgr, 20, 5);
+	std::deque<alert*> owned;
+	mgr.get_all(&owned, num_resume);
+	TEST_EQUAL(owned.size(), 5);
+	TEST_EQUAL(msg_value(owned.front()), 20);
+	for (std::deque<alert*>::iterator i = owned.begin()
+		, end(owned.end()); i != end; ++i)
+		delete *i;
+
+	TEST_CHECK(!mgr.pending());
+	TEST_CHECK(mgr.wait_for_alert(seconds(0)) == NULL);
+	TEST_CHECK(mgr.get(num_resume).get() == NULL);
+}
+
+// alerts that are heap allocated when they're posted are handed over to the
+// caller of get() and get_all() with a deque, not copied
+void test_handover()
+{
+	alert_manager mgr(1000, alert::all_categories);
+	int num_resume = 0;
+
+	user_alert* a1 = new user_alert(1);
+	user_alert* a2 = new user_alert(2);
+	mgr.post_alert_ptr(a1);
+	post(mgr, 0, 1);
+	mgr.post_alert_ptr(a2);
+
+	std::auto_ptr<alert> p = mgr.get(num_resume);
+	TEST_CHECK(p.get() == a1);
+
+	std::deque<alert*> owned;
+	mgr.get_all(&owned, num_resume);
+	TEST_EQUAL(owned.size(), 2);
+	TEST_EQUAL(msg_value(owned[0]), 0);
+	TEST_CHECK(owned[1] == a2);
+	for (std::deque<alert*>::iterator i = owned.begin()
+		, end(owned.end()); i != end; ++i)
+		delete *i;
+
+	// the same in the arena
+	alert_arena q;
+	q.push_back(std::auto_ptr<alert>(new user_alert(3)));
+	q.push_back(portmap_log_alert(0, "4"));
+	alert* heap = q[0];
+	std::auto_ptr<alert> r = q.release(0);
+	TEST_CHECK(r.get() == heap);
+	r = q.release(1);
+	TEST_CHECK(r.get() != q[1]);
+	TEST_EQUAL(msg_value(r.get()), 4);
+	q.clear();
+	TEST_CHECK(q.empty());
+}
+
+int test_main()
+{
+	test_arena();
+	test_pop_alerts();
+	test_queue_limit();
+	test_mixed_pop();
+	test_handover();
+	return 0;
+}
+
@@ -43,6 +43,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <algorithm>
 
 using namespace libtorrent;
 
@@ -466,6 +467,253 @@ void test_unaligned_read()
 	bc.clear(jobs);
 }
 
+void test_shards()
+{
+	TEST_SETUP;
+
+	// adjacent pieces of the same storage map to the same shard
+	int const shard = block_cache::shard_index(pm.get(), 0);
+	for (int i = 1; i < block_cache::shard_stripe; ++i)
+		TEST_EQUAL(block_cache::shard_index(pm.get(), i), shard);
+	TEST_CHECK(block_cache::shard_index(pm.get(), block_cache::shard_stripe) != shard);
+
+	INSERT(0, 0);
+	INSERT(3, 0);
+
+	TEST_EQUAL(block_cache::shard_index(pe), shard);
+	int total = 0;
+	for (int i = 0; i < block_cache::num_shards; ++i)
+		total += bc.num_pieces(i);
+	TEST_EQUAL(total, 2);
+	TEST_EQUAL(bc.num_pieces(shard), 2);
+
+	std::vector<int> pieces;
+	pm->cached_pieces(pieces);
+	std::sort(pieces.begin(), pieces.end());
+	TEST_EQUAL(pieces.size(), 2);
+	TEST_EQUAL(pieces[0], 0);
+	TEST_EQUAL(pieces[1], 3);
+
+	tailqueue jobs;
+	bc.clear(jobs);
+	TEST_EQUAL(bc.num_pieces(shard), 0);
+}
+
+void test_frequency_sketch()
+{
+	frequency_sketch fs;
+	fs.resize(100);
+	TEST_EQUAL(fs.width(), 128);
+
+	for (int i = 0; i < 5; ++i) fs.increment(1);
+	fs.increment(2);
+	TEST_EQUAL(fs.estimate(1), 5);
+	TEST_EQUAL(fs.estimate(2), 1);
+	TEST_EQUAL(fs.estimate(3), 0);
+
+	// counters saturate
+	for (int i = 0; i < 20; ++i) fs.increment(1);
+	TEST_EQUAL(fs.estimate(1), frequency_sketch::max_count);
+
+	// once enough keys have been added, all counters are halved
+	for (int i = 0; i < 10 * fs.width(); ++i) fs.increment(1000 + i);
+	TEST_CHECK(fs.estimate(1) < frequency_sketch::max_count);
+	TEST_CHECK(fs.estimate(1) >= frequency_sketch::max_count / 2);
+}
+
+// make sure a piece that's requested by many peers survives a scan of pieces
+// that are requested once, with the TinyLFU policy
+void test_tinylfu_scan()
+{
+	TEST_SETUP;
+
+	sett.set_int(settings_pack::cache_eviction_policy, settings_pack::tinylfu_cache_policy);
+	bc.set_settings(sett);
+	TEST_EQUAL(bc.eviction_policy(), settings_pack::tinylfu_cache_policy);
+
+	// three different peers read the piece
+	INSERT(0, 0);
+	READ_BLOCK(0, 0, 2);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+	READ_BLOCK(0, 0, 3);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+	READ_BLOCK(0, 0, 4);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+
+	// pieces are not promoted on hits
+	counters c;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::arc_mru_size], 1);
+	TEST_EQUAL(c[counters::arc_mfu_size], 0);
+
+	// the scan
+	for (int i = 1; i < 4; ++i)
+	{
+		INSERT(i, 0);
+	}
+
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::read_cache_blocks], 4);
+	TEST_EQUAL(c[counters::arc_mru_size], 4);
+
+	int const shard = block_cache::shard_index(pm.get(), 0);
+	TEST_EQUAL(bc.try_evict_blocks(shard, 3), 0);
+
+	// piece 0 was admitted to the main cache, the scanned pieces lost and
+	// were evicted. There are no ghost lists
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::read_cache_blocks], 1);
+	TEST_EQUAL(c[counters::arc_mru_size], 0);
+	TEST_EQUAL(c[counters::arc_mfu_size], 1);
+	TEST_EQUAL(c[counters::arc_mru_ghost_size], 0);
+	TEST_EQUAL(c[counters::arc_mfu_ghost_size], 0);
+
+	READ_BLOCK(0, 0, 5);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+	READ_BLOCK(1, 0, 5);
+	TEST_EQUAL(ret, -1);
+
+	tailqueue jobs;
+	bc.clear(jobs);
+}
+
+// blocks read ahead of a request are accounted for as useful once they're
+// requested, and as wasted if they're evicted before that
+void test_read_ahead_accounting()
+{
+	TEST_SETUP;
+
+	file::iovec_t ra_iov[2];
+	rj.action = disk_io_job::read;
+	rj.d.io.offset = 0;
+	rj.d.io.buffer_size = 0x4000;
+	rj.requester = (void*)1;
+
+	// read block 0 of piece 0, and block 1 along with it
+	rj.piece = 0;
+	pe = bc.allocate_piece(&rj, cached_piece_entry::read_lru1);
+	ret = bc.allocate_iovec(ra_iov, 2);
+	TEST_EQUAL(ret, 0);
+	bc.insert_blocks(pe, 0, ra_iov, 2, &rj, block_cache::blocks_read_ahead);
+
+	counters c;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::read_ahead_useful_blocks], 0);
+	TEST_EQUAL(c[counters::read_ahead_wasted_blocks], 0);
+
+	// the block that was requested isn't read-ahead
+	READ_BLOCK(0, 0, 1);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::read_ahead_useful_blocks], 0);
+
+	// the read-ahead block is only counted the first time it's requested
+	READ_BLOCK(0, 1, 2);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+	READ_BLOCK(0, 1, 3);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::read_ahead_useful_blocks], 1);
+	TEST_EQUAL(c[counters::read_ahead_wasted_blocks], 0);
+
+	// read block 0 of piece 1 along with block 1, which is never requested
+	rj.piece = 1;
+	rj.d.io.offset = 0;
+	rj.d.io.buffer_size = 0x4000;
+	pe = bc.allocate_piece(&rj, cached_piece_entry::read_lru1);
+	ret = bc.allocate_iovec(ra_iov, 2);
+	TEST_EQUAL(ret, 0);
+	bc.insert_blocks(pe, 0, ra_iov, 2, &rj, block_cache::blocks_read_ahead);
+
+	tailqueue jobs;
+	bc.evict_piece(pe, jobs);
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::read_ahead_useful_blocks], 1);
+	TEST_EQUAL(c[counters::read_ahead_wasted_blocks], 1);
+
+	bc.clear(jobs);
+}
+
+void test_hugepage_arena()
+{
+#if TORRENT_HAVE_MMAP
+	io_service ios;
+	print_alert ad;
+	block_cache bc(0x4000, ios, boost::bind(&nop), &ad);
+	aux::session_settings sett;
+	// two huge pages worth of blocks
+	sett.set_int(settings_pack::cache_size, 256);
+	sett.set_bool(settings_pack::use_hugepage_cache, true);
+	bc.set_settings(sett);
+
+	counters c;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::disk_arena_blocks], 256);
+	TEST_EQUAL(c[counters::disk_arena_pages_in_use], 0);
+	TEST_EQUAL(c[counters::disk_arena_fragmented_blocks], 0);
+
+	// blocks are handed out from the start of the arena
+	char* b0 = bc.allocate_buffer("test");
+	char* b1 = bc.allocate_buffer("test");
+	char* b2 = bc.allocate_buffer("test");
+	TEST_CHECK(b0 != NULL);
+	TEST_EQUAL(b1, b0 + 0x4000);
+	TEST_EQUAL(b2, b1 + 0x4000);
+	TEST_EQUAL(boost::uint64_t(b0) % disk_buffer_pool::arena_page_size, 0);
+
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::disk_arena_pages_in_use], 1);
+	TEST_EQUAL(c[counters::disk_arena_fragmented_blocks], 128 - 3);
+
+	// a freed block is the next one to be handed out
+	bc.free_buffer(b1);
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::disk_arena_fragmented_blocks], 128 - 2);
+	char* b3 = bc.allocate_buffer("test");
+	TEST_EQUAL(b3, b1);
+
+	// after churn, the lowest free block is still handed out first,
+	// regardless of the order blocks were freed in
+	char* more[200];
+	for (int i = 0; i < 200; ++i) more[i] = bc.allocate_buffer("test");
+	TEST_EQUAL(more[199], b0 + 202 * 0x4000);
+	int const freed[] = { 150, 10, 199, 50 };
+	for (int i = 0; i < 4; ++i) bc.free_buffer(more[freed[i]]);
+	int const expected[] = { 10, 50, 150, 199 };
+	for (int i = 0; i < 4; ++i)
+	{
+		char* b = bc.allocate_buffer("test");
+		TEST_EQUAL(b, more[expected[i]]);
+	}
+	for (int i = 0; i < 200; ++i) bc.free_buffer(more[i]);
+
+	bc.free_buffer(b0);
+	bc.free_buffer(b2);
+	bc.free_buffer(b3);
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::disk_arena_pages_in_use], 0);
+	TEST_EQUAL(c[counters::disk_arena_fragmented_blocks], 0);
+
+	// resizing the cache re-creates the arena
+	sett.set_int(settings_pack::cache_size, 512);
+	bc.set_settings(sett);
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::disk_arena_blocks], 512);
+
+	sett.set_bool(settings_pack::use_hugepage_cache, false);
+	bc.set_settings(sett);
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::disk_arena_blocks], 0);
+#endif
+}
+
 int test_main()
 {
 	test_write();
@@ -476,6 +724,11 @@ int test_main()
 	test_arc_unghost();
 	test_iovec();
 	test_unaligned_read();
+	test_shards();
+	test_frequency_sketch();
+	test_tinylfu_scan();
+	test_read_ahead_accounting();
+	test_hugepage_arena();
 
 	// TODO: test try_evict_blocks
 	// TODO: test evicting volatile pieces, to see them be removed
@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/buffer.hpp"
 #include "libtorrent/chained_buffer.hpp"
 #include "libtorrent/socket.hpp"
+#include "libtorrent/file.hpp"
 
 #include "test.hpp"
 
@@ -319,10 +320,91 @@ void test_chained_buffer()
 	TEST_CHECK(buffer_list.empty());
 }
 
+void test_chained_buffer_file()
+{
+	char data[] = "foobar";
+	error_code ec;
+	libtorrent::file_handle f(new file("test_chained_buffer_file", file::read_write, ec));
+	TEST_CHECK(!ec);
+	{
+		chained_buffer b;
+		boost::int64_t offset = 0;
+		int size = 0;
+
+		TEST_CHECK(b.front_file(offset, size) == NULL);
+
+		char* b1 = allocate_buffer(512);
+		std::memcpy(b1, data, 6);
+		b.append_buffer(b1, 512, 6, &free_buffer, (void*)0x1337);
+		peer_request r;
+		r.piece = 3;
+		r.start = 0x4000;
+		r.length = 1000;
+		b.append_file(f, 100, r);
+
+		TEST_EQUAL(b.size(), 1006);
+		TEST_EQUAL(b.capacity(), 512 + 1000);
+
+		// nothing can be appended to a file range
+		TEST_EQUAL(b.space_in_last_buffer(), 0);
+		TEST_EQUAL(b.allocate_appendix(1), 0);
+
+		// iovecs stop at the file range
+		std::vector<libtorrent::asio::const_buffer> const& vec = b.build_iovec(1006);
+		TEST_EQUAL(vec.size(), 1);
+		TEST_EQUAL(libtorrent::asio::buffer_size(vec[0]), 6);
+		TEST_CHECK(b.front_file(offset, size) == NULL);
+
+		b.pop_front(6);
+		TEST_CHECK(buffer_list.empty());
+		TEST_CHECK(b.build_iovec(1000).empty());
+		TEST_CHECK(b.front_file(offset, size) == f.get());
+		TEST_EQUAL(offset, 100);
+		TEST_EQUAL(size, 1000);
+
+		// popping part of a file range moves its offset forward
+		b.pop_front(300);
+		TEST_CHECK(b.front_file(offset, size) == f.get());
+		TEST_EQUAL(offset, 400);
+		TEST_EQUAL(size, 700);
+		TEST_EQUAL(b.size(), 700);
+		TEST_CHECK(b.front_file_request() == r);
+
+		// a file range replaced by a buffer holding its block picks up
+		// where the file range left off
+		char* b3 = allocate_buffer(1000);
+		for (int i = 0; i < 1000; ++i) b3[i] = char(i);
+		b.replace_front_file(b3, &free_buffer, (void*)0x1337);
+		TEST_CHECK(b.front_file(offset, size) == NULL);
+		TEST_EQUAL(b.size(), 700);
+		TEST_EQUAL(b.capacity(), 1000);
+		std::vector<libtorrent::asio::const_buffer> const& vec2 = b.build_iovec(700);
+		TEST_EQUAL(vec2.size(), 1);
+		TEST_EQUAL(libtorrent::asio::buffer_size(vec2[0]), 700);
+		TEST_CHECK(libtorrent::asio::buffer_cast<char const*>(vec2[0]) == b3 + 300);
+
+		char* b2 = allocate_buffer(512);
+		std::memcpy(b2, data, 6);
+		b.append_buffer(b2, 512, 6, &free_buffer, (void*)0x1337);
+
+		b.pop_front(700);
+		TEST_CHECK(b.front_file(offset, size) == NULL);
+		TEST_CHECK(compare_chained_buffer(b, "foobar", 6));
+
+		r.length = 10;
+		b.append_file(f, 0, r);
+		TEST_EQUAL(b.size(), 16);
+	}
+	TEST_CHECK(buffer_list.empty());
+	f.reset();
+	remove("test_chained_buffer_file", ec);
+}
+
 int test_main()
 {
 	test_buffer();
 	test_chained_buffer();
+	test_chained_buffer_file();
 	return 0;
 }
 
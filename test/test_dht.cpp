@@ -45,6 +45,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/kademlia/node_id.hpp"
 #include "libtorrent/kademlia/routing_table.hpp"
+#include "libtorrent/kademlia/flat_routing_table.hpp"
 #include "libtorrent/kademlia/item.hpp"
 #include "libtorrent/ed25519.hpp"
 #include <numeric>
@@ -186,6 +187,9 @@ void send_dht_request(node_impl& node, char const* msg, udp::endpoint const& ep
 
 	dht::msg m(decoded, ep);
 	node.incoming(m);
+	// mutable puts are held back until the socket is drained, to verify
+	// their signatures in a batch
+	node.verify_pending_puts();
 
 	// by now the node should have invoked the send function and put the
 	// response in g_sent_packets
@@ -1047,6 +1051,119 @@ int test_main()
 
 	}
 
+	// test batch verification of mutable item signatures
+	{
+		const int num_items = 20;
+		char keys[num_items][item_pk_len];
+		char sigs[num_items][item_sig_len];
+		char values[num_items][20];
+		signed_item_ref refs[num_items];
+		bool valid[num_items];
+
+		for (int i = 0; i < num_items; ++i)
+		{
+			unsigned char seed[32];
+			char private_key[item_sk_len];
+			std::generate(seed, seed + 32, &std::rand);
+			ed25519_create_keypair((unsigned char*)keys[i]
+				, (unsigned char*)private_key, seed);
+
+			int len = snprintf(values[i], sizeof(values[i]), "5:val%02d", i);
+			refs[i].v = std::make_pair(values[i], len);
+			refs[i].salt = std::make_pair((i & 1) ? "salt" : (char const*)NULL
+				, (i & 1) ? 4 : 0);
+			refs[i].seq = i;
+			refs[i].pk = keys[i];
+			refs[i].sig = sigs[i];
+			sign_mutable_item(refs[i].v, refs[i].salt, refs[i].seq, keys[i]
+				, private_key, sigs[i]);
+		}
+
+		TEST_CHECK(verify_mutable_items(refs, num_items, valid));
+		TEST_EQUAL(std::count(valid, valid + num_items, true), num_items);
+
+		// break some of them, the batch must fail and tell which ones
+		sigs[3][5] ^= 0x10;
+		refs[8].seq = 100;
+		sigs[13][63] ^= 0x80;
+		TEST_CHECK(!verify_mutable_items(refs, num_items, valid));
+		for (int i = 0; i < num_items; ++i)
+		{
+			TEST_EQUAL(valid[i], i != 3 && i != 8 && i != 13);
+			TEST_EQUAL(valid[i], verify_mutable_item(refs[i].v, refs[i].salt
+				, refs[i].seq, refs[i].pk, refs[i].sig));
+		}
+	}
+
+	// a signature by a public key with a small order component. The
+	// cofactorless ed25519_verify() rejects it for about half the messages,
+	// but the single and the batch verification of mutable items must agree
+	// on it, whether the batch holds only good signatures or not.
+	{
+		unsigned char seed[32];
+		char pk[item_pk_len];
+		char private_key[item_sk_len];
+		std::generate(seed, seed + 32, &std::rand);
+		ed25519_create_keypair((unsigned char*)pk
+			, (unsigned char*)private_key, seed);
+
+		// A + (0, -1) = (-x, -y). -y is p - y, and the sign of x flips
+		char torsion_pk[item_pk_len];
+		int borrow = 0;
+		for (int i = 0; i < item_pk_len; ++i)
+		{
+			int const p = i == 0 ? 0xed : i == item_pk_len - 1 ? 0x7f : 0xff;
+			int const y = (unsigned char)pk[i] & (i == item_pk_len - 1 ? 0x7f : 0xff);
+			int const d = p - y - borrow;
+			borrow = d < 0;
+			torsion_pk[i] = char(d & 0xff);
+		}
+		torsion_pk[item_pk_len - 1] |= ~pk[item_pk_len - 1] & 0x80;
+
+		std::pair<char const*, int> value("5:hello", 7);
+		std::pair<char const*, int> no_salt(static_cast<char const*>(NULL), 0);
+		char sig[item_sig_len];
+		boost::uint64_t seq = 0;
+		bool diverges = false;
+		for (; seq < 100 && !diverges; ++seq)
+		{
+			sign_mutable_item(value, no_salt, seq, torsion_pk, private_key, sig);
+			char str[100];
+			int len = snprintf(str, sizeof(str), "3:seqi%de1:v5:hello", int(seq));
+			diverges = ed25519_verify((unsigned char const*)sig
+				, (unsigned char const*)str, len
+				, (unsigned char const*)torsion_pk) == 0;
+		}
+		--seq;
+		TEST_CHECK(diverges);
+
+		TEST_CHECK(verify_mutable_item(value, no_salt, seq, torsion_pk, sig));
+
+		char good_sig[item_sig_len];
+		sign_mutable_item(value, no_salt, seq, pk, private_key, good_sig);
+
+		signed_item_ref refs[2];
+		bool valid[2];
+		refs[0].v = value;
+		refs[0].salt = no_salt;
+		refs[0].seq = seq;
+		refs[0].pk = torsion_pk;
+		refs[0].sig = sig;
+		refs[1] = refs[0];
+		refs[1].pk = pk;
+		refs[1].sig = good_sig;
+		TEST_CHECK(verify_mutable_items(refs, 2, valid));
+		TEST_CHECK(valid[0]);
+		TEST_CHECK(valid[1]);
+
+		// with a bad signature in it, the batch is verified one by one
+		good_sig[5] ^= 0x10;
+		TEST_CHECK(!verify_mutable_items(refs, 2, valid));
+		TEST_CHECK(valid[0]);
+		TEST_CHECK(!valid[1]);
+		TEST_CHECK(!verify_mutable_item(value, no_salt, seq, pk, good_sig));
+	}
+
 // test routing table
 
 	{
@@ -1394,6 +1511,46 @@ int test_main()
 			}
 		}
 
+		// the snapshot is what the request threads search. It's a flat copy
+		// of the table, it must find the closest nodes just like the table
+		TEST_CHECK(!table.snapshot());
+		table.update_snapshot();
+		dht::routing_table::snapshot_t snap = table.snapshot();
+		TEST_CHECK(snap);
+		if (snap)
+		{
+			TEST_EQUAL(snap->size(), int(nodes.size()));
+			TEST_EQUAL(snap->num_buckets(), table.num_active_buckets());
+
+			snap->find_node(tmp, temp, 0, nodes.size() * 2);
+			TEST_EQUAL(temp.size(), nodes.size());
+
+			for (int r = 0; r < reps; ++r)
+			{
+				std::generate(tmp.begin(), tmp.end(), random_byte);
+				snap->find_node(tmp, temp, 0, bucket_size * 2);
+				TEST_EQUAL(int(temp.size()), bucket_size * 2);
+
+				std::sort(nodes.begin(), nodes.end(), boost::bind(&compare_ref
+						, boost::bind(&node_entry::id, _1)
+						, boost::bind(&node_entry::id, _2), tmp));
+
+				// the nodes are returned closest first
+				for (int i = 0; i < int(temp.size()); ++i)
+					TEST_CHECK(temp[i].id == nodes[i].id);
+
+				int expected = std::accumulate(nodes.begin(), nodes.begin() + (bucket_size * 2)
+					, 0, boost::bind(&sum_distance_exp, _1, _2, tmp));
+				int sum_hits = std::accumulate(temp.begin(), temp.end()
+					, 0, boost::bind(&sum_distance_exp, _1, _2, tmp));
+				TEST_EQUAL(expected, sum_hits);
+			}
+
+			// updating the table doesn't change a published snapshot
+			table.node_seen(tmp, udp::endpoint(rand_v4(), rand()), 10);
+			TEST_CHECK(table.snapshot() == snap);
+		}
+
 		using namespace libtorrent::dht;
 
 		char const* ips[] = {
@@ -0,0 +1,167 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/kademlia/routing_table.hpp"
+#include "libtorrent/kademlia/flat_routing_table.hpp"
+#include "libtorrent/session_settings.hpp"
+#include "libtorrent/random.hpp"
+#include "libtorrent/time.hpp"
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace libtorrent;
+using namespace libtorrent::dht;
+
+// measures looking up the nodes closest to a target, which is done for every
+// incoming get_peers, find_node, get and announce. Both on the routing table
+// itself and on the flat snapshot of it that the request threads search.
+
+namespace
+{
+	node_id random_id()
+	{
+		node_id ret;
+		for (int i = 0; i < 5; ++i)
+		{
+			boost::uint32_t const r = libtorrent::random();
+			memcpy(&ret[i * 4], &r, 4);
+		}
+		return ret;
+	}
+
+	// a node ID sharing the first ``bits`` bits with ``id``, and not the next
+	// one. This fills the buckets as evenly as a busy node's
+	node_id id_at_depth(node_id const& id, int bits)
+	{
+		node_id ret = random_id();
+		for (int i = 0; i < bits; ++i)
+		{
+			int const mask = 0x80 >> (i & 7);
+			ret[i / 8] = (ret[i / 8] & ~mask) | (id[i / 8] & mask);
+		}
+		ret[bits / 8] ^= (ret[bits / 8] ^ ~id[bits / 8]) & (0x80 >> (bits & 7));
+		return ret;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int bucket_size = 8;
+	if (argc > 1) bucket_size = atoi(argv[1]);
+	if (bucket_size <= 0)
+	{
+		fputs("usage: dht_benchmark [bucket-size]\n", stderr);
+		return 1;
+	}
+
+	const int depth = 30;
+	const int num_lookups = 200000;
+
+	dht_settings sett;
+	sett.restrict_routing_ips = false;
+	sett.extended_routing_table = true;
+
+	node_id const our_id = random_id();
+	routing_table table(our_id, bucket_size, sett);
+
+	for (int i = 0; i < depth * bucket_size * 4; ++i)
+	{
+		node_id const id = id_at_depth(our_id, libtorrent::random() % depth);
+		udp::endpoint const ep(address_v4(libtorrent::random()), 6881);
+		table.node_seen(id, ep, 10 + libtorrent::random() % 200);
+	}
+
+	time_point start = clock_type::now();
+	const int num_snapshots = 100;
+	for (int i = 0; i < num_snapshots; ++i)
+		table.update_snapshot();
+	boost::int64_t const snapshot_time = total_microseconds(clock_type::now() - start);
+	routing_table::snapshot_t snap = table.snapshot();
+
+	std::vector<node_id> targets(num_lookups);
+	for (int i = 0; i < num_lookups; ++i)
+		targets[i] = random_id();
+
+	std::vector<node_entry> l;
+	int checksum = 0;
+
+	start = clock_type::now();
+	for (int i = 0; i < num_lookups; ++i)
+	{
+		table.find_node(targets[i], l, 0);
+		checksum += int(l.size());
+	}
+	boost::int64_t const table_time = total_microseconds(clock_type::now() - start);
+
+	start = clock_type::now();
+	for (int i = 0; i < num_lookups; ++i)
+	{
+		snap->find_node(targets[i], l, 0);
+		checksum += int(l.size());
+	}
+	boost::int64_t const flat_time = total_microseconds(clock_type::now() - start);
+
+	// lookups asking for more nodes than a bucket holds, like the ones
+	// our own traversals start with
+	start = clock_type::now();
+	for (int i = 0; i < num_lookups; ++i)
+	{
+		table.find_node(targets[i], l, 0, bucket_size * 4);
+		checksum += int(l.size());
+	}
+	boost::int64_t const table_wide_time = total_microseconds(clock_type::now() - start);
+
+	start = clock_type::now();
+	for (int i = 0; i < num_lookups; ++i)
+	{
+		snap->find_node(targets[i], l, 0, bucket_size * 4);
+		checksum += int(l.size());
+	}
+	boost::int64_t const flat_wide_time = total_microseconds(clock_type::now() - start);
+
+	fprintf(stderr, "nodes: %d buckets: %d bucket size: %d (checksum: %d)\n"
+		, snap->size(), snap->num_buckets(), bucket_size, checksum);
+	fprintf(stderr, "update_snapshot                    done in %8d ns per call\n"
+		, int(snapshot_time * 1000 / num_snapshots));
+	fprintf(stderr, "routing_table::find_node           done in %8d ns per call\n"
+		, int(table_time * 1000 / num_lookups));
+	fprintf(stderr, "flat_routing_table::find_node      done in %8d ns per call\n"
+		, int(flat_time * 1000 / num_lookups));
+	fprintf(stderr, "routing_table::find_node (4k)      done in %8d ns per call\n"
+		, int(table_wide_time * 1000 / num_lookups));
+	fprintf(stderr, "flat_routing_table::find_node (4k) done in %8d ns per call\n"
+		, int(flat_wide_time * 1000 / num_lookups));
+
+	return 0;
+}
+
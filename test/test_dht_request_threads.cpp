@@ -0,0 +1,256 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "setup_transfer.hpp"
+#include "libtorrent/session.hpp"
+#include "libtorrent/session_settings.hpp"
+#include "libtorrent/alert_types.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/socket_io.hpp"
+#include "libtorrent/io_service.hpp"
+#include <string>
+#include <vector>
+
+using namespace libtorrent;
+namespace lt = libtorrent;
+
+// these tests talk to a session's DHT node over loopback, with the incoming
+// queries answered by request threads
+
+namespace
+{
+	char const client_id[] = "abcdefghij0123456789";
+
+	std::string bstr(std::string const& s)
+	{
+		char len[20];
+		snprintf(len, sizeof(len), "%d:", int(s.size()));
+		return len + s;
+	}
+
+	// a query with the arguments ``args`` (the contents of the bencoded
+	// "a" dictionary, not including our node ID)
+	std::string query(std::string const& q, std::string const& tid
+		, std::string const& args, std::string const& extra = std::string())
+	{
+		return "d1:ad2:id20:" + std::string(client_id) + args + "e"
+			+ extra + "1:q" + bstr(q) + "1:t" + bstr(tid) + "1:y1:qe";
+	}
+
+	// waits up to 5 seconds for a message. Returns false if none arrived
+	bool receive(udp::socket& sock, std::vector<char>& buf, bdecode_node& msg)
+	{
+		buf.resize(1500);
+		time_point const end = clock_type::now() + seconds(5);
+		while (clock_type::now() < end)
+		{
+			error_code ec;
+			udp::endpoint from;
+			size_t const len = sock.receive_from(asio::buffer(&buf[0], buf.size())
+				, from, 0, ec);
+			if (ec == asio::error::would_block || ec == asio::error::try_again)
+			{
+				test_sleep(10);
+				continue;
+			}
+			if (ec) return false;
+			int pos;
+			bdecode(&buf[0], &buf[0] + len, msg, ec, &pos);
+			return !ec;
+		}
+		return false;
+	}
+
+	// sends ``q`` and returns the reply's "r" dictionary. Replies to earlier
+	// queries still in flight are skipped
+	bdecode_node request(udp::socket& sock, udp::endpoint const& node
+		, std::string const& q, std::string const& tid, std::vector<char>& buf)
+	{
+		error_code ec;
+		sock.send_to(asio::buffer(q), node, 0, ec);
+		TEST_CHECK(!ec);
+
+		bdecode_node msg;
+		while (receive(sock, buf, msg))
+		{
+			if (msg.type() != bdecode_node::dict_t) continue;
+			if (msg.dict_find_string_value("t") != tid) continue;
+			TEST_EQUAL(msg.dict_find_string_value("y"), "r");
+			return msg.dict_find_dict("r");
+		}
+		TEST_ERROR("no reply to: " + q);
+		return bdecode_node();
+	}
+
+	struct dht_session
+	{
+		dht_session(int request_threads)
+		{
+			settings_pack pack;
+			pack.set_bool(settings_pack::enable_lsd, false);
+			pack.set_bool(settings_pack::enable_natpmp, false);
+			pack.set_bool(settings_pack::enable_upnp, false);
+			pack.set_bool(settings_pack::enable_dht, false);
+			pack.set_int(settings_pack::alert_mask, alert::dht_notification
+				| alert::error_notification);
+			pack.set_str(settings_pack::listen_interfaces, "127.0.0.1:48300");
+			pack.set_int(settings_pack::max_retry_port_bind, 1000);
+			// the DHT drops queries when it runs out of upload quota
+			pack.set_int(settings_pack::dht_upload_rate_limit, 50000000);
+			ses.reset(new lt::session(pack));
+
+			dht_settings sett;
+			sett.request_threads = request_threads;
+			// all the queries come from the same address
+			sett.block_ratelimit = 1000000;
+			ses->set_dht_settings(sett);
+
+			pack.clear();
+			pack.set_bool(settings_pack::enable_dht, true);
+			ses->apply_settings(pack);
+
+			error_code ec;
+			node = udp::endpoint(address_v4::from_string("127.0.0.1", ec)
+				, ses->listen_port());
+		}
+
+		~dht_session() { ses->abort(); }
+
+		boost::shared_ptr<lt::session> ses;
+		udp::endpoint node;
+	};
+}
+
+void test_queries(int request_threads)
+{
+	fprintf(stderr, "\n ==== TEST QUERIES (request threads: %d) ====\n\n"
+		, request_threads);
+
+	dht_session s(request_threads);
+
+	io_service ios;
+	udp::socket sock(ios);
+	error_code ec;
+	sock.open(udp::v4(), ec);
+	sock.bind(udp::endpoint(address_v4::from_string("127.0.0.1", ec), 0), ec);
+	sock.non_blocking(true, ec);
+	TEST_CHECK(!ec);
+
+	std::vector<char> buf;
+	std::string const ih = "01234567890123456789";
+
+	// a plain query, answered by a request thread
+	bdecode_node r = request(sock, s.node, query("ping", "aa", ""), "aa", buf);
+	TEST_EQUAL(r.dict_find_string_value("id").size(), 20);
+
+	// get_peers posts an alert. That's deferred on the request thread, and
+	// posted when the reply is sent
+	r = request(sock, s.node, query("get_peers", "bb", "9:info_hash20:" + ih)
+		, "bb", buf);
+	std::string const token = r.dict_find_string_value("token");
+	TEST_CHECK(!token.empty());
+	TEST_CHECK(!r.dict_find_list("values"));
+	std::auto_ptr<alert> a = wait_for_alert(*s.ses, dht_get_peers_alert::alert_type
+		, "ses");
+	TEST_CHECK(a.get());
+	if (a.get())
+		TEST_CHECK(static_cast<dht_get_peers_alert*>(a.get())->info_hash
+			== sha1_hash(ih));
+
+	// the announce is stored, and its alert posted
+	r = request(sock, s.node, query("announce_peer", "cc"
+		, "9:info_hash20:" + ih + "4:porti1234e5:token" + bstr(token)), "cc", buf);
+	TEST_EQUAL(r.dict_find_string_value("id").size(), 20);
+	a = wait_for_alert(*s.ses, dht_announce_alert::alert_type, "ses");
+	TEST_CHECK(a.get());
+	if (a.get())
+	{
+		dht_announce_alert* da = static_cast<dht_announce_alert*>(a.get());
+		TEST_EQUAL(da->port, 1234);
+		TEST_CHECK(da->info_hash == sha1_hash(ih));
+	}
+
+	r = request(sock, s.node, query("get_peers", "dd", "9:info_hash20:" + ih)
+		, "dd", buf);
+	bdecode_node values = r.dict_find_list("values");
+	TEST_CHECK(values);
+	if (values)
+	{
+		TEST_EQUAL(values.list_size(), 1);
+		std::string const v = values.list_string_value_at(0);
+		TEST_EQUAL(v.size(), 6);
+		char const* ptr = v.c_str();
+		if (v.size() == 6)
+			TEST_EQUAL(detail::read_v4_endpoint<tcp::endpoint>(ptr).port(), 1234);
+	}
+
+	// a query with an "ip" key is handed back to the network thread
+	char const ip_buf[] = { 127, 0, 0, 1, 4, char(210) };
+	std::string const ip(ip_buf, sizeof(ip_buf));
+	r = request(sock, s.node, query("ping", "ee", "", "2:ip" + bstr(ip))
+		, "ee", buf);
+	TEST_EQUAL(r.dict_find_string_value("id").size(), 20);
+
+	// a burst of queries. Replies may be lost, and queries dropped when the
+	// request threads fall behind, but never more than were sent
+	int const burst = 3000;
+	for (int i = 0; i < burst; ++i)
+	{
+		char tid[10];
+		snprintf(tid, sizeof(tid), "%d", i);
+		sock.send_to(asio::buffer(query("ping", tid, "")), s.node, 0, ec);
+	}
+	int replies = 0;
+	bdecode_node msg;
+	while (replies < burst && receive(sock, buf, msg)) ++replies;
+
+	std::map<std::string, boost::uint64_t> cnt = get_counters(*s.ses);
+	boost::uint64_t const dropped = cnt["dht.dht_messages_in_dropped"];
+	fprintf(stderr, "burst: %d replies: %d dropped: %d\n", burst, replies
+		, int(dropped));
+	TEST_CHECK(replies + int(dropped) <= burst);
+	if (request_threads == 0) TEST_EQUAL(dropped, 0);
+
+	// the queue drains, queries are answered again
+	r = request(sock, s.node, query("ping", "ff", ""), "ff", buf);
+	TEST_EQUAL(r.dict_find_string_value("id").size(), 20);
+}
+
+int test_main()
+{
+	test_queries(0);
+	test_queries(1);
+	test_queries(4);
+	return 0;
+}
+
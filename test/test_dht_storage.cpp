@@ -0,0 +1,460 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_DISABLE_DHT
+
+#include "test.hpp"
+#include "libtorrent/kademlia/peer_store.hpp"
+#include "libtorrent/kademlia/dht_storage.hpp"
+#include "libtorrent/kademlia/item.hpp"
+#include "libtorrent/session_settings.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/entry.hpp"
+#include "libtorrent/socket_io.hpp"
+#include "libtorrent/aux_/time.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/hasher.hpp"
+
+#include <boost/scoped_ptr.hpp>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+using namespace libtorrent;
+using namespace libtorrent::dht;
+
+namespace
+{
+	sha1_hash info_hash(int i)
+	{
+		sha1_hash ret(0);
+		ret[0] = i & 0xff;
+		ret[1] = (i >> 8) & 0xff;
+		ret[19] = 1;
+		return ret;
+	}
+
+	tcp::endpoint peer(int i, int port = 6881)
+	{
+		return tcp::endpoint(address_v4(0x0a000000 + i), port);
+	}
+
+	int num_values(entry const& e)
+	{
+		entry const* v = e.find_key("values");
+		return v ? int(v->list().size()) : 0;
+	}
+
+	address addr(int i)
+	{
+		return address_v4(0x0b000000 + i);
+	}
+
+	// a bencoded string
+	std::string value(std::string const& v)
+	{
+		char buf[10];
+		snprintf(buf, sizeof(buf), "%d:", int(v.size()));
+		return buf + v;
+	}
+
+	char const sig[item_sig_len] = { 1, 2, 3 };
+	char const pk[item_pk_len] = { 4, 5, 6 };
+
+	void put_immutable(dht_storage_interface& s, int i, std::string const& v)
+	{
+		std::string const buf = value(v);
+		s.put_immutable_item(info_hash(i), buf.c_str(), int(buf.size()), addr(i));
+	}
+
+	void put_mutable(dht_storage_interface& s, int i, std::string const& v
+		, boost::int64_t seq, std::string const& salt = std::string())
+	{
+		std::string const buf = value(v);
+		s.put_mutable_item(info_hash(i), buf.c_str(), int(buf.size()), sig
+			, seq, pk, salt.c_str(), int(salt.size()), addr(i));
+	}
+
+	std::string immutable_value(dht_storage_interface const& s, int i)
+	{
+		entry e;
+		if (!s.get_immutable_item(info_hash(i), e)) return "";
+		return e["v"].string();
+	}
+
+	void test_storage(dht_storage_interface& s)
+	{
+		put_immutable(s, 1, "foo");
+		put_immutable(s, 2, "bar");
+		TEST_EQUAL(immutable_value(s, 1), "foo");
+		TEST_EQUAL(immutable_value(s, 2), "bar");
+		TEST_EQUAL(immutable_value(s, 3), "");
+
+		put_mutable(s, 10, "first", 1, "salt");
+		boost::int64_t seq = 0;
+		TEST_CHECK(s.get_mutable_item_seq(info_hash(10), seq));
+		TEST_EQUAL(seq, 1);
+		TEST_CHECK(!s.get_mutable_item_seq(info_hash(1), seq));
+
+		// a higher sequence number replaces the value
+		put_mutable(s, 10, "second", 2, "salt");
+		entry e;
+		TEST_CHECK(s.get_mutable_item(info_hash(10), 0, true, e));
+		TEST_EQUAL(e["seq"].integer(), 2);
+		TEST_EQUAL(e["v"].string(), "second");
+		TEST_EQUAL(e["sig"].string(), std::string(sig, sizeof(sig)));
+		TEST_EQUAL(e["k"].string(), std::string(pk, sizeof(pk)));
+
+		// the value is only included if the requester's is older
+		entry e2;
+		TEST_CHECK(s.get_mutable_item(info_hash(10), 2, false, e2));
+		TEST_EQUAL(e2["seq"].integer(), 2);
+		TEST_CHECK(e2.find_key("v") == NULL);
+
+		s.announce_peer(info_hash(20), peer(1), "name", 4, false);
+		s.announce_peer(info_hash(20), peer(2), NULL, 0, true);
+		TEST_EQUAL(s.num_torrents(), 1);
+		TEST_EQUAL(s.num_peers(), 2);
+		entry r;
+		TEST_CHECK(s.get_peers(info_hash(20), false, false, r));
+		TEST_EQUAL(num_values(r), 2);
+		TEST_EQUAL(r["n"].string(), "name");
+	}
+}
+
+int test_main()
+{
+	time_point const now = aux::time_now();
+
+	// announce and get_peers
+	{
+		dht_settings sett;
+		counters cnt;
+		peer_store s(sett, cnt);
+
+		s.announce(info_hash(1), peer(1), false, "test", 4, now);
+		s.announce(info_hash(1), peer(2), true, NULL, 0, now);
+		// announcing again refreshes the peer
+		s.announce(info_hash(1), peer(1), false, "other", 5, now);
+		s.announce(info_hash(2), peer(1), false, NULL, 0, now);
+
+		TEST_EQUAL(s.num_torrents(), 2);
+		TEST_EQUAL(s.num_peers(), 3);
+		TEST_EQUAL(cnt[counters::dht_torrents], 2);
+		TEST_EQUAL(cnt[counters::dht_peers], 3);
+		TEST_EQUAL(cnt[counters::dht_peer_store_bytes], s.memory_used());
+
+		entry r;
+		TEST_CHECK(s.get_peers(info_hash(1), false, false, r));
+		TEST_EQUAL(r["n"].string(), "test");
+		TEST_EQUAL(num_values(r), 2);
+
+		// the values are compact endpoints
+		std::string const& ep = r["values"].list().front().string();
+		TEST_EQUAL(ep.size(), 6);
+		char const* ptr = ep.c_str();
+		tcp::endpoint const e = detail::read_v4_endpoint<tcp::endpoint>(ptr);
+		TEST_CHECK(e == peer(1) || e == peer(2));
+
+		entry noseed;
+		TEST_CHECK(s.get_peers(info_hash(1), true, false, noseed));
+		TEST_EQUAL(num_values(noseed), 1);
+
+		entry scrape;
+		TEST_CHECK(s.get_peers(info_hash(1), false, true, scrape));
+		TEST_EQUAL(scrape["BFsd"].string().size(), 256);
+		TEST_EQUAL(scrape["BFpe"].string().size(), 256);
+
+		entry missing;
+		TEST_CHECK(!s.get_peers(info_hash(3), false, false, missing));
+		TEST_EQUAL(missing.type(), entry::undefined_t);
+	}
+
+	// peers time out, and torrents without peers are removed
+	{
+		dht_settings sett;
+		counters cnt;
+		peer_store s(sett, cnt);
+
+		s.announce(info_hash(1), peer(1), false, NULL, 0, now);
+		s.announce(info_hash(1), peer(2), false, NULL, 0, now + minutes(30));
+		s.announce(info_hash(2), peer(1), false, NULL, 0, now);
+
+		s.tick(now + minutes(40));
+		TEST_EQUAL(s.num_peers(), 3);
+
+		s.tick(now + minutes(50));
+		TEST_EQUAL(s.num_torrents(), 1);
+		TEST_EQUAL(s.num_peers(), 1);
+
+		s.tick(now + minutes(80));
+		TEST_EQUAL(s.num_torrents(), 0);
+		TEST_EQUAL(s.num_peers(), 0);
+		TEST_EQUAL(cnt[counters::dht_torrents], 0);
+		TEST_EQUAL(cnt[counters::dht_peers], 0);
+	}
+
+	// the least recently announced torrent is evicted when there are too
+	// many torrents
+	{
+		dht_settings sett;
+		sett.max_torrents = 3;
+		counters cnt;
+		peer_store s(sett, cnt);
+
+		s.announce(info_hash(1), peer(1), false, NULL, 0, now);
+		s.announce(info_hash(2), peer(1), false, NULL, 0, now + seconds(1));
+		s.announce(info_hash(3), peer(1), false, NULL, 0, now + seconds(2));
+		// refresh the first one, making 2 the oldest
+		s.announce(info_hash(1), peer(2), false, NULL, 0, now + seconds(3));
+		s.announce(info_hash(4), peer(1), false, NULL, 0, now + seconds(4));
+
+		TEST_EQUAL(s.num_torrents(), 3);
+		TEST_EQUAL(cnt[counters::dht_torrents_evicted], 1);
+		entry r;
+		TEST_CHECK(!s.get_peers(info_hash(2), false, false, r));
+		TEST_CHECK(s.get_peers(info_hash(1), false, false, r));
+		TEST_CHECK(s.get_peers(info_hash(4), false, false, r));
+	}
+
+	// the memory limit
+	{
+		dht_settings sett;
+		sett.max_torrents = 100000;
+		sett.max_peer_store_size = 64 * 1024;
+		counters cnt;
+		peer_store s(sett, cnt);
+
+		for (int i = 0; i < 5000; ++i)
+			s.announce(info_hash(i), peer(i), false, NULL, 0, now + seconds(i));
+
+		TEST_CHECK(s.memory_used() <= sett.max_peer_store_size);
+		TEST_CHECK(s.num_torrents() < 5000);
+		TEST_CHECK(cnt[counters::dht_torrents_evicted] > 0);
+		TEST_EQUAL(cnt[counters::dht_peer_store_bytes], s.memory_used());
+
+		// the most recent ones are kept
+		entry r;
+		TEST_CHECK(s.get_peers(info_hash(4999), false, false, r));
+		TEST_CHECK(!s.get_peers(info_hash(0), false, false, r));
+	}
+
+	// many peers for one torrent, and many torrents
+	{
+		dht_settings sett;
+		sett.max_torrents = 100000;
+		sett.max_peers_reply = 50;
+		counters cnt;
+		peer_store s(sett, cnt);
+
+		for (int i = 0; i < 1000; ++i)
+			s.announce(info_hash(1), peer(i * 7 % 1000), false, NULL, 0, now);
+		TEST_EQUAL(s.num_peers(), 1000);
+
+		entry r;
+		TEST_CHECK(s.get_peers(info_hash(1), false, false, r));
+		TEST_EQUAL(num_values(r), 50);
+
+		for (int i = 2; i < 3000; ++i)
+			s.announce(info_hash(i), peer(i), false, NULL, 0, now);
+		TEST_EQUAL(s.num_torrents(), 2999);
+		for (int i = 1; i < 3000; ++i)
+			TEST_CHECK(s.get_peers(info_hash(i), false, false, r));
+
+		// remove every other torrent, which exercises deletion from the
+		// middle of probe sequences
+		s.announce(info_hash(1), peer(1), false, NULL, 0, now + minutes(30));
+		for (int i = 2; i < 3000; i += 2)
+			s.announce(info_hash(i), peer(i), false, NULL, 0, now + minutes(30));
+		s.tick(now + minutes(50));
+		TEST_EQUAL(s.num_torrents(), 1500);
+		for (int i = 2; i < 3000; ++i)
+		{
+			entry e;
+			TEST_EQUAL(s.get_peers(info_hash(i), false, false, e), (i % 2) == 0);
+		}
+	}
+
+	// the torrents we're asked to store are close to our node ID, and share
+	// a long prefix with it. They must not end up in the same part of the
+	// hash table
+	{
+		dht_settings sett;
+		sett.max_torrents = 100000;
+		counters cnt;
+		peer_store s(sett, cnt);
+
+		int const num_torrents = 2000;
+		std::vector<sha1_hash> hashes;
+		for (int i = 0; i < num_torrents; ++i)
+		{
+			char buf[20];
+			snprintf(buf, sizeof(buf), "%d", i);
+			sha1_hash const suffix = hasher(buf, int(strlen(buf))).final();
+			sha1_hash h(0);
+			memset(&h[0], 0xab, 16);
+			memcpy(&h[16], &suffix[0], 4);
+			hashes.push_back(h);
+			s.announce(h, peer(i), false, NULL, 0, now);
+		}
+		TEST_EQUAL(s.num_torrents(), num_torrents);
+
+		int total = 0;
+		int longest = 0;
+		for (int i = 0; i < num_torrents; ++i)
+		{
+			int const len = s.probe_length(hashes[i]);
+			TEST_CHECK(len >= 0);
+			total += len;
+			longest = (std::max)(longest, len);
+		}
+		fprintf(stderr, "probe length, average: %.2f longest: %d\n"
+			, double(total) / num_torrents, longest);
+		// with a load factor of at most 3/4, linear probing averages well
+		// below 2 slots past the home slot
+		TEST_CHECK(total < num_torrents * 2);
+		TEST_CHECK(longest < 100);
+		TEST_EQUAL(s.probe_length(info_hash(1)), -1);
+	}
+
+	// the default storage
+	{
+		dht_settings sett;
+		sett.max_dht_items = 10;
+		counters cnt;
+		boost::scoped_ptr<dht_storage_interface> s(
+			dht_default_storage_constructor(sha1_hash(0), sett, cnt));
+		test_storage(*s);
+
+		for (int i = 100; i < 120; ++i) put_immutable(*s, i, "x");
+		TEST_EQUAL(cnt[counters::dht_immutable_data], 10);
+	}
+
+	// the on-disk storage survives a restart
+	{
+		error_code ec;
+		remove_all("tmp_dht_storage", ec);
+
+		dht_settings sett;
+		counters cnt;
+		{
+			boost::scoped_ptr<dht_storage_interface> s(dht_disk_storage_constructor(
+				"tmp_dht_storage", sha1_hash(0), sett, cnt));
+			test_storage(*s);
+		}
+		TEST_EQUAL(cnt[counters::dht_immutable_data], 0);
+		TEST_EQUAL(cnt[counters::dht_mutable_data], 0);
+
+		{
+			boost::scoped_ptr<dht_storage_interface> s(dht_disk_storage_constructor(
+				"tmp_dht_storage", sha1_hash(0), sett, cnt));
+			TEST_EQUAL(cnt[counters::dht_immutable_data], 2);
+			TEST_EQUAL(cnt[counters::dht_mutable_data], 1);
+			TEST_EQUAL(immutable_value(*s, 1), "foo");
+			TEST_EQUAL(immutable_value(*s, 2), "bar");
+
+			entry e;
+			TEST_CHECK(s->get_mutable_item(info_hash(10), 0, true, e));
+			TEST_EQUAL(e["seq"].integer(), 2);
+			TEST_EQUAL(e["v"].string(), "second");
+			TEST_EQUAL(e["sig"].string(), std::string(sig, sizeof(sig)));
+
+			TEST_EQUAL(s->num_peers(), 2);
+			entry r;
+			TEST_CHECK(s->get_peers(info_hash(20), true, false, r));
+			TEST_EQUAL(num_values(r), 1);
+			TEST_EQUAL(r["n"].string(), "name");
+		}
+
+		// garbage at the end of the log is ignored
+		FILE* f = fopen(combine_path("tmp_dht_storage", "dht_storage.log").c_str(), "r+b");
+		TEST_CHECK(f != NULL);
+		if (f)
+		{
+			fseek(f, 0, SEEK_END);
+			long const size = ftell(f);
+			// find the end of the records. The rest is zeros
+			std::vector<char> buf(size);
+			fseek(f, 0, SEEK_SET);
+			TEST_EQUAL(fread(&buf[0], 1, size, f), size_t(size));
+			long end = size;
+			while (end > 0 && buf[end - 1] == 0) --end;
+			end = (end + 7) & ~7;
+			// overwrite the last record's checksum
+			fseek(f, end - 8, SEEK_SET);
+			fputc(0x55, f);
+			fclose(f);
+		}
+
+		{
+			boost::scoped_ptr<dht_storage_interface> s(dht_disk_storage_constructor(
+				"tmp_dht_storage", sha1_hash(0), sett, cnt));
+			// the last record was the seed's announce
+			TEST_EQUAL(s->num_peers(), 1);
+			TEST_EQUAL(immutable_value(*s, 1), "foo");
+
+			// grow the log enough to be compacted
+			for (int i = 0; i < 20000; ++i)
+				s->announce_peer(info_hash(20), peer(1), NULL, 0, false);
+			put_mutable(*s, 10, "third", 3);
+			s->tick();
+			TEST_CHECK(file_size(combine_path("tmp_dht_storage", "dht_storage.log"))
+				< 1024 * 1024 * 2);
+			put_immutable(*s, 3, "baz");
+		}
+
+		{
+			boost::scoped_ptr<dht_storage_interface> s(dht_disk_storage_constructor(
+				"tmp_dht_storage", sha1_hash(0), sett, cnt));
+			TEST_EQUAL(immutable_value(*s, 1), "foo");
+			TEST_EQUAL(immutable_value(*s, 3), "baz");
+			entry e;
+			TEST_CHECK(s->get_mutable_item(info_hash(10), 0, true, e));
+			TEST_EQUAL(e["v"].string(), "third");
+			TEST_EQUAL(s->num_peers(), 1);
+		}
+		remove_all("tmp_dht_storage", ec);
+	}
+
+	return 0;
+}
+
+#else
+
+int test_main()
+{
+	return 0;
+}
+
+#endif
+
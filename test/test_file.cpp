@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libtorrent/file.hpp"
+#include "libtorrent/io_uring_queue.hpp"
 #include "test.hpp"
 #include "setup_transfer.hpp" // for test_sleep
 #include <string.h> // for strcmp
@@ -103,10 +104,106 @@ void test_stat()
 	TEST_CHECK(diff >= 2 && diff <= 4);
 }
 
+void test_io_uring_queue()
+{
+	io_uring_queue ring(8);
+	if (!ring.is_open())
+	{
+		fprintf(stderr, "io_uring not supported, skipping test\n");
+		return;
+	}
+	TEST_CHECK(ring.capacity() >= 8);
+
+	error_code ec;
+	file f;
+	TEST_CHECK(f.open("__test_uring__", file::read_write, ec));
+	TEST_CHECK(!ec);
+
+	char wbuf[2][100];
+	memset(wbuf[0], 'a', sizeof(wbuf[0]));
+	memset(wbuf[1], 'b', sizeof(wbuf[1]));
+	file::iovec_t wb[2] = { { wbuf[0], 100 }, { wbuf[1], 100 } };
+	int tag = 0;
+	TEST_CHECK(ring.async_writev(f.native_handle(), wb, 2, 50, &tag));
+	TEST_EQUAL(ring.num_pending(), 1);
+	TEST_EQUAL(ring.num_unsubmitted(), 1);
+	TEST_EQUAL(ring.submit(true, ec), 1);
+	TEST_CHECK(!ec);
+	TEST_EQUAL(ring.num_unsubmitted(), 0);
+
+	io_uring_queue::completion c[4];
+	int num = ring.reap(c, 4);
+	TEST_EQUAL(num, 1);
+	TEST_CHECK(c[0].userdata == &tag);
+	TEST_EQUAL(c[0].result, 200);
+	TEST_EQUAL(ring.num_pending(), 0);
+
+	// read back the two halves in separate operations, as well as past
+	// the end of the file
+	char rbuf[3][100];
+	file::iovec_t rb[3] = { { rbuf[0], 100 }, { rbuf[1], 100 }, { rbuf[2], 100 } };
+	int tags[3];
+	TEST_CHECK(ring.async_readv(f.native_handle(), &rb[0], 1, 50, &tags[0]));
+	TEST_CHECK(ring.async_readv(f.native_handle(), &rb[1], 1, 150, &tags[1]));
+	TEST_CHECK(ring.async_readv(f.native_handle(), &rb[2], 1, 200, &tags[2]));
+	TEST_EQUAL(ring.submit(false, ec), 3);
+	TEST_CHECK(!ec);
+
+	// wait() returns once there are completions to reap
+	int results[3] = { -1, -1, -1 };
+	while (ring.num_pending() > 0)
+	{
+		ring.wait();
+		num = ring.reap(c, 4);
+		for (int i = 0; i < num; ++i)
+			results[static_cast<int*>(c[i].userdata) - tags] = c[i].result;
+	}
+	TEST_EQUAL(results[0], 100);
+	TEST_EQUAL(results[1], 100);
+	TEST_EQUAL(results[2], 50);
+	TEST_CHECK(memcmp(rbuf[0], wbuf[0], 100) == 0);
+	TEST_CHECK(memcmp(rbuf[1], wbuf[1], 100) == 0);
+
+	// operations that haven't been submitted can be taken back
+	TEST_CHECK(ring.async_readv(f.native_handle(), &rb[0], 1, 50, &tags[0]));
+	TEST_CHECK(ring.async_readv(f.native_handle(), &rb[1], 1, 150, &tags[1]));
+	std::vector<void*> taken;
+	ring.take_unsubmitted(taken);
+	TEST_EQUAL(int(taken.size()), 2);
+	TEST_CHECK(taken[0] == &tags[0]);
+	TEST_CHECK(taken[1] == &tags[1]);
+	TEST_EQUAL(ring.num_pending(), 0);
+	TEST_EQUAL(ring.num_unsubmitted(), 0);
+
+	// and the queue still works after that
+	TEST_CHECK(ring.async_readv(f.native_handle(), &rb[2], 1, 50, &tags[2]));
+	TEST_EQUAL(ring.submit(false, ec), 1);
+	while (ring.num_pending() > 0)
+	{
+		ring.wait();
+		num = ring.reap(c, 4);
+		for (int i = 0; i < num; ++i)
+		{
+			TEST_CHECK(c[i].userdata == &tags[2]);
+			TEST_EQUAL(c[i].result, 100);
+		}
+	}
+
+	// wake() makes wait() return without any completions
+	ring.wake();
+	ring.wait();
+	TEST_EQUAL(ring.reap(c, 4), 0);
+
+	f.close();
+	remove("__test_uring__", ec);
+	TEST_CHECK(!ec);
+}
+
 int test_main()
 {
 	test_create_directory();
 	test_stat();
+	test_io_uring_queue();
 
 	error_code ec;
 
@@ -31,6 +31,9 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libtorrent/hasher.hpp"
+#include "libtorrent/multi_hasher.hpp"
+#include "libtorrent/random.hpp"
+#include <vector>
 #include <boost/lexical_cast.hpp>
 #include "libtorrent/hex.hpp" // from_hex
 
@@ -59,6 +62,58 @@ char const* result_array[4] =
 	"DEA356A2CDDD90C7A7ECEDC5EBB563934F460452"
 };
 
+void test_multi_hasher()
+{
+	fprintf(stderr, "multi_hasher parallel: %s\n"
+		, multi_hasher::is_parallel() ? "yes" : "no");
+
+	// the test vectors, one per lane
+	multi_hasher mh;
+	for (int test = 0; test < 4; ++test)
+	{
+		for (int i = 0; i < repeat_count[test]; ++i)
+			mh.update(test, test_array[test], std::strlen(test_array[test]));
+	}
+	for (int test = 0; test < 4; ++test)
+	{
+		sha1_hash result;
+		from_hex(result_array[test], 40, (char*)&result[0]);
+		TEST_CHECK(result == mh.final(test));
+	}
+
+	// hash buffers of different sizes in parallel, the way pieces are
+	// hashed block by block, and compare against the regular hasher
+	int const block_size = 0x4000;
+	int const sizes[4] = { 3 * block_size, 2 * block_size + 1000, block_size, 0 };
+	std::vector<char> buf[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		buf[i].resize(sizes[i]);
+		for (int k = 0; k < sizes[i]; ++k) buf[i][k] = char(libtorrent::random());
+	}
+
+	for (int offset = 0; offset < 3 * block_size; offset += block_size)
+	{
+		char const* lanes[multi_hasher::max_lanes] = { NULL };
+		for (int i = 0; i < 4; ++i)
+		{
+			int const len = (std::min)(block_size, sizes[i] - offset);
+			if (len == block_size) lanes[i] = &buf[i][offset];
+			else if (len > 0) mh.update(i, &buf[i][offset], len);
+		}
+		mh.update_lanes(lanes, block_size);
+	}
+
+	for (int i = 0; i < 4; ++i)
+	{
+		hasher h;
+		if (sizes[i] > 0) h.update(&buf[i][0], sizes[i]);
+		TEST_CHECK(h.final() == mh.final(i));
+	}
+
+	// final() resets the lane
+	TEST_CHECK(mh.final(0) == hasher().final());
+}
 
 int test_main()
 {
@@ -75,6 +130,8 @@ int test_main()
 		TEST_CHECK(result == h.final());
 	}
 
+	test_multi_hasher();
+
 	return 0;
 }
 
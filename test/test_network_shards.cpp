@@ -0,0 +1,163 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "setup_transfer.hpp"
+#include "libtorrent/session.hpp"
+#include "libtorrent/torrent_handle.hpp"
+#include "libtorrent/alert_types.hpp"
+#include <boost/tuple/tuple.hpp>
+
+using namespace libtorrent;
+namespace lt = libtorrent;
+
+settings_pack shard_settings(int shards)
+{
+	settings_pack pack;
+	pack.set_bool(settings_pack::enable_lsd, false);
+	pack.set_bool(settings_pack::enable_natpmp, false);
+	pack.set_bool(settings_pack::enable_upnp, false);
+	pack.set_bool(settings_pack::enable_dht, false);
+	pack.set_int(settings_pack::alert_mask, alert::all_categories
+		& ~(alert::progress_notification | alert::stats_notification));
+	pack.set_str(settings_pack::listen_interfaces, "0.0.0.0:48200");
+	pack.set_int(settings_pack::max_retry_port_bind, 1000);
+	pack.set_int(settings_pack::network_shards, shards);
+	// keep the transfer going long enough for the peers to be disconnected
+	// with reads and writes outstanding on the shard threads
+	pack.set_int(settings_pack::upload_rate_limit, 200000);
+	// plain TCP only, uTP sockets never move to a shard
+	pack.set_bool(settings_pack::enable_outgoing_utp, false);
+	pack.set_bool(settings_pack::enable_incoming_utp, false);
+	return pack;
+}
+
+void test_disconnect_in_flight(int shards)
+{
+	fprintf(stderr, "\n ==== TEST DISCONNECT IN FLIGHT (shards: %d) ====\n\n", shards);
+
+	error_code ec;
+	remove_all("tmp1_network_shards", ec);
+	remove_all("tmp2_network_shards", ec);
+
+	session_proxy p1;
+	session_proxy p2;
+
+	settings_pack pack = shard_settings(shards);
+	lt::session ses1(pack);
+	lt::session ses2(pack);
+
+	torrent_handle tor1;
+	torrent_handle tor2;
+	boost::tie(tor1, tor2, boost::tuples::ignore) = setup_transfer(&ses1, &ses2
+		, NULL, true, false, true, "_network_shards", 16 * 1024);
+
+	// pausing the downloader disconnects the peer, typically with a read
+	// outstanding on one side and a write on the other. The connection is
+	// established again on every resume
+	for (int i = 0; i < 10; ++i)
+	{
+		test_sleep(300);
+		print_alerts(ses1, "ses1");
+		print_alerts(ses2, "ses2");
+		if (tor2.status().is_seeding) break;
+		tor2.pause();
+		test_sleep(100);
+		tor2.resume();
+		tor2.connect_peer(tcp::endpoint(address::from_string("127.0.0.1", ec)
+			, ses1.listen_port()));
+	}
+
+	for (int i = 0; i < 60; ++i)
+	{
+		print_alerts(ses1, "ses1");
+		print_alerts(ses2, "ses2");
+		if (tor2.status().is_seeding) break;
+		test_sleep(500);
+	}
+	TEST_CHECK(tor2.status().is_seeding);
+
+	p1 = ses1.abort();
+	p2 = ses2.abort();
+
+	remove_all("tmp1_network_shards", ec);
+	remove_all("tmp2_network_shards", ec);
+}
+
+void test_abort_in_flight(int shards)
+{
+	fprintf(stderr, "\n ==== TEST ABORT IN FLIGHT (shards: %d) ====\n\n", shards);
+
+	error_code ec;
+	remove_all("tmp1_network_shards", ec);
+	remove_all("tmp2_network_shards", ec);
+
+	session_proxy p1;
+	session_proxy p2;
+
+	settings_pack pack = shard_settings(shards);
+	lt::session ses1(pack);
+	lt::session ses2(pack);
+
+	torrent_handle tor1;
+	torrent_handle tor2;
+	boost::tie(tor1, tor2, boost::tuples::ignore) = setup_transfer(&ses1, &ses2
+		, NULL, true, false, true, "_network_shards", 16 * 1024);
+
+	// wait for the transfer to start, then tear both sessions down while
+	// the shards still have I/O in flight on the peer sockets
+	for (int i = 0; i < 20; ++i)
+	{
+		print_alerts(ses1, "ses1");
+		print_alerts(ses2, "ses2");
+		if (tor2.status().total_payload_download > 0) break;
+		test_sleep(100);
+	}
+	TEST_CHECK(tor2.status().total_payload_download > 0);
+	TEST_CHECK(!tor2.status().is_seeding);
+
+	p1 = ses1.abort();
+	p2 = ses2.abort();
+
+	remove_all("tmp1_network_shards", ec);
+	remove_all("tmp2_network_shards", ec);
+}
+
+int test_main()
+{
+	test_disconnect_in_flight(1);
+	test_disconnect_in_flight(2);
+	test_abort_in_flight(2);
+
+	return 0;
+}
+
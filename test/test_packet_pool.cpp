@@ -0,0 +1,111 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/packet_pool.hpp"
+#include "libtorrent/performance_counters.hpp"
+
+using namespace libtorrent;
+
+int test_main()
+{
+	// size classes
+	{
+		TEST_EQUAL(packet_pool::size_class(1), 0);
+		TEST_EQUAL(packet_pool::size_class(packet_pool::class_size(0)), 0);
+		TEST_EQUAL(packet_pool::size_class(packet_pool::class_size(0) + 1), 1);
+		TEST_CHECK(packet_pool::class_size(1) >= 1500);
+		TEST_EQUAL(packet_pool::size_class(packet_pool::class_size(
+			packet_pool::num_size_classes - 1) + 1), -1);
+	}
+
+	// buffers are reused within a size class
+	{
+		counters cnt;
+		packet_pool pool(cnt);
+
+		void* p1 = pool.allocate(1400);
+		TEST_CHECK(p1 != NULL);
+		TEST_EQUAL(cnt[counters::utp_packet_pool_misses], 1);
+		pool.release(p1, 1400);
+		TEST_EQUAL(pool.cached_bytes(), packet_pool::class_size(1));
+		TEST_EQUAL(cnt[counters::utp_packet_pool_bytes], pool.cached_bytes());
+
+		// a different size in the same class gets the same buffer back
+		void* p2 = pool.allocate(1000);
+		TEST_CHECK(p2 == p1);
+		TEST_EQUAL(cnt[counters::utp_packet_pool_hits], 1);
+		TEST_EQUAL(pool.cached_bytes(), 0);
+		TEST_EQUAL(cnt[counters::utp_packet_pool_bytes], 0);
+
+		// but not a different class
+		void* p3 = pool.allocate(100);
+		TEST_CHECK(p3 != p2);
+		TEST_EQUAL(cnt[counters::utp_packet_pool_misses], 2);
+
+		pool.release(p2, 1000);
+		pool.release(p3, 100);
+		TEST_EQUAL(pool.cached_bytes(), packet_pool::class_size(0)
+			+ packet_pool::class_size(1));
+
+		// releasing NULL is a no-op
+		pool.release(NULL, 100);
+	}
+
+	// buffers too large to be pooled go straight to the heap
+	{
+		counters cnt;
+		packet_pool pool(cnt);
+		void* p = pool.allocate(65000);
+		TEST_CHECK(p != NULL);
+		pool.release(p, 65000);
+		TEST_EQUAL(pool.cached_bytes(), 0);
+	}
+
+	// the free lists are bounded
+	{
+		counters cnt;
+		packet_pool pool(cnt);
+		int const size = packet_pool::class_size(2);
+		int const num = packet_pool::max_cached_bytes / size + 10;
+		std::vector<void*> bufs;
+		for (int i = 0; i < num; ++i)
+			bufs.push_back(pool.allocate(size));
+		for (int i = 0; i < num; ++i)
+			pool.release(bufs[i], size);
+		TEST_CHECK(pool.cached_bytes() <= packet_pool::max_cached_bytes);
+		TEST_CHECK(pool.cached_bytes() > packet_pool::max_cached_bytes - size);
+	}
+
+	return 0;
+}
+
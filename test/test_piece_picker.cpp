@@ -1478,6 +1478,93 @@ int test_main()
 	print_availability(p);
 	TEST_CHECK(verify_availability(p, "1110111111111111"));
 
+// ========================================================
+
+	// test that availability changes on a clean piece list move the pieces
+	// into their new buckets, without rebuilding the list
+	print_title("test incremental availability update");
+	p = setup_picker("2222222222222222", "                ", "", "");
+	pick_pieces(p, "****************", 1, blocks_per_piece, 0);
+
+	p->dec_refcount(string2vec("   *            "), &tmp1);
+	TEST_CHECK(verify_availability(p, "2221222222222222"));
+	picked = pick_pieces(p, "****************", 1, 0, 0);
+	TEST_CHECK(int(picked.size()) > 0);
+	TEST_EQUAL(picked.front().piece_index, 3);
+
+	p->inc_refcount(string2vec("   *  *         "), &tmp1);
+	p->dec_refcount(string2vec("            *   "), &tmp1);
+	TEST_CHECK(verify_availability(p, "2222223222221222"));
+	picked = pick_pieces(p, "****************", 1, 0, 0);
+	TEST_CHECK(int(picked.size()) > 0);
+	TEST_EQUAL(picked.front().piece_index, 12);
+
+	// a piece nobody has becomes available when the first seed joins
+	p = setup_picker("2222202222222222", "                ", "", "");
+	pick_pieces(p, "****************", 1, blocks_per_piece, 0);
+	p->inc_refcount_all(&tmp8);
+	picked = pick_pieces(p, "****************", 1, 0, 0);
+	TEST_CHECK(int(picked.size()) > 0);
+	TEST_EQUAL(picked.front().piece_index, 5);
+
+	// and leaves the piece list again with the seed
+	p->dec_refcount_all(&tmp8);
+	TEST_CHECK(verify_availability(p, "2222202222222222"));
+	picked = pick_pieces(p, "****************", 1, 0, 0);
+	TEST_CHECK(int(picked.size()) > 0);
+	TEST_CHECK(picked.front().piece_index != 5);
+
+	// a seed that loses a piece is broken up into a count on every piece
+	p->inc_refcount_all(&tmp8);
+	p->dec_refcount(string2vec("  *             "), &tmp8);
+	TEST_CHECK(verify_availability(p, "3323313333333333"));
+	picked = pick_pieces(p, "****************", 1, 0, 0);
+	TEST_CHECK(int(picked.size()) > 0);
+	TEST_EQUAL(picked.front().piece_index, 5);
+
+	// a peer with every piece leaving, when there are no seeds
+	p = setup_picker("2222212222222222", "                ", "", "");
+	pick_pieces(p, "****************", 1, blocks_per_piece, 0);
+	p->dec_refcount_all(&tmp0);
+	TEST_CHECK(verify_availability(p, "1111101111111111"));
+	picked = pick_pieces(p, "****************", 1, 0, 0);
+	TEST_CHECK(int(picked.size()) > 0);
+	TEST_CHECK(picked.front().piece_index != 5);
+
+// ========================================================
+
+	// test adding the bitfields of many peers in one batch
+	print_title("test batched inc_refcount");
+	p = setup_picker("11111111111111111111", "                    ", "", "");
+	{
+		bitfield const b1 = string2vec("*****  *****     ***");
+		bitfield const b2 = string2vec("  ********      ** *");
+		bitfield const b3 = string2vec("                    ");
+		bitfield const b4 = string2vec("********************");
+		bitfield const b5 = string2vec("*                   ");
+		std::vector<bitfield const*> bitfields;
+		std::vector<const void*> peers;
+		bitfields.push_back(&b1); peers.push_back(&tmp1);
+		bitfields.push_back(&b2); peers.push_back(&tmp2);
+		bitfields.push_back(&b3); peers.push_back(&tmp3);
+		bitfields.push_back(&b4); peers.push_back(&tmp4);
+		bitfields.push_back(&b5); peers.push_back(&tmp5);
+		p->inc_refcount(bitfields, peers);
+		print_availability(p);
+		TEST_CHECK(verify_availability(p, "43444334443322223434"));
+
+		picked = pick_pieces(p, "********************", 1, 0, 0);
+		TEST_CHECK(int(picked.size()) > 0);
+		TEST_CHECK(picked.front().piece_index >= 12
+			&& picked.front().piece_index <= 15);
+
+		p->dec_refcount(b1, &tmp1);
+		p->dec_refcount(b2, &tmp2);
+		p->dec_refcount(b4, &tmp4);
+		p->dec_refcount(b5, &tmp5);
+		TEST_CHECK(verify_availability(p, "11111111111111111111"));
+	}
+
 // ========================================================
 
 	// test reversed peers
@@ -0,0 +1,168 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/piece_picker.hpp"
+#include "libtorrent/bitfield.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/random.hpp"
+#include "libtorrent/time.hpp"
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace libtorrent;
+
+// measures the piece picker operations whose cost is proportional to the
+// number of pieces in the torrent. Peers joining (bitfield), picking pieces
+// from a peer with few pieces and peers leaving again.
+
+int main(int argc, char* argv[])
+{
+	int num_pieces = 1000000;
+	if (argc > 1) num_pieces = atoi(argv[1]);
+	if (num_pieces <= 0)
+	{
+		fputs("usage: piece_picker_benchmark [num-pieces]\n", stderr);
+		return 1;
+	}
+
+	const int blocks_per_piece = 16;
+	const int num_peers = 50;
+	const int rounds = 5;
+
+	// half of the peers have about half the pieces, the other half have about
+	// one in 64 pieces. The sparse peers are the ones we pick from
+	std::vector<bitfield> peers(num_peers);
+	for (int i = 0; i < num_peers; ++i)
+	{
+		peers[i].resize(num_pieces, false);
+		boost::uint32_t const mask = (i & 1) ? 63 : 1;
+		for (int p = 0; p < num_pieces; ++p)
+			if ((libtorrent::random() & mask) == 0) peers[i].set_bit(p);
+	}
+
+	piece_picker picker;
+	picker.init(blocks_per_piece, blocks_per_piece, num_pieces);
+
+	counters pc;
+	std::vector<piece_block> picked;
+	std::vector<int> const suggested;
+
+	boost::int64_t inc_time = 0;
+	boost::int64_t dec_time = 0;
+	boost::int64_t rebuild_time = 0;
+	boost::int64_t pick_time = 0;
+	boost::int64_t reconnect_time = 0;
+	boost::int64_t batch_time = 0;
+	int num_picks = 0;
+
+	for (int r = 0; r < rounds; ++r)
+	{
+		time_point start = clock_type::now();
+		for (int i = 0; i < num_peers; ++i)
+			picker.inc_refcount(peers[i], &peers[i]);
+		inc_time += total_microseconds(clock_type::now() - start);
+
+		// the first pick after the availability changed rebuilds the piece
+		// list, the following ones only scan it
+		for (int i = 1; i < num_peers; i += 2)
+		{
+			picked.clear();
+			start = clock_type::now();
+			picker.pick_pieces(peers[i], picked, blocks_per_piece, 0, NULL
+				, piece_picker::rarest_first, suggested, num_peers, pc);
+			boost::int64_t const t = total_microseconds(clock_type::now() - start);
+			if (i == 1)
+			{
+				rebuild_time += t;
+				continue;
+			}
+			pick_time += t;
+			++num_picks;
+		}
+
+		// a peer with few pieces reconnecting to a swarm whose piece list is
+		// up to date, followed by a pick
+		for (int i = 1; i < num_peers; i += 2)
+		{
+			picked.clear();
+			start = clock_type::now();
+			picker.dec_refcount(peers[i], &peers[i]);
+			picker.inc_refcount(peers[i], &peers[i]);
+			picker.pick_pieces(peers[i], picked, blocks_per_piece, 0, NULL
+				, piece_picker::rarest_first, suggested, num_peers, pc);
+			reconnect_time += total_microseconds(clock_type::now() - start);
+		}
+
+		start = clock_type::now();
+		for (int i = 0; i < num_peers; ++i)
+			picker.dec_refcount(peers[i], &peers[i]);
+		dec_time += total_microseconds(clock_type::now() - start);
+
+		// all peers connecting at once, added in a single batch
+		std::vector<bitfield const*> bitfields;
+		std::vector<const void*> peer_ptrs;
+		for (int i = 0; i < num_peers; ++i)
+		{
+			bitfields.push_back(&peers[i]);
+			peer_ptrs.push_back(&peers[i]);
+		}
+		start = clock_type::now();
+		picker.inc_refcount(bitfields, peer_ptrs);
+		batch_time += total_microseconds(clock_type::now() - start);
+		for (int i = 0; i < num_peers; ++i)
+			picker.dec_refcount(peers[i], &peers[i]);
+
+		// make the next round start from a dirty piece list again
+		picked.clear();
+		picker.pick_pieces(peers[1], picked, blocks_per_piece, 0, NULL
+			, piece_picker::rarest_first, suggested, num_peers, pc);
+	}
+
+	fprintf(stderr, "pieces: %d peers: %d rounds: %d\n"
+		, num_pieces, num_peers, rounds);
+	fprintf(stderr, "inc_refcount(bitfield) done in %8d us per call\n"
+		, int(inc_time / (rounds * num_peers)));
+	fprintf(stderr, "dec_refcount(bitfield) done in %8d us per call\n"
+		, int(dec_time / (rounds * num_peers)));
+	fprintf(stderr, "inc_refcount(batch)    done in %8d us per bitfield\n"
+		, int(batch_time / (rounds * num_peers)));
+	fprintf(stderr, "pick_pieces (rebuild)  done in %8d us per call\n"
+		, int(rebuild_time / rounds));
+	fprintf(stderr, "pick_pieces            done in %8d us per call\n"
+		, int(pick_time / num_picks));
+	fprintf(stderr, "peer reconnect + pick  done in %8d us per call\n"
+		, int(reconnect_time / (rounds * num_peers / 2)));
+
+	return 0;
+}
+
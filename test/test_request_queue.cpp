@@ -0,0 +1,111 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/peer_connection.hpp"
+
+using namespace libtorrent;
+
+int const block_size = 16 * 1024;
+
+void test_bdp()
+{
+	// without a round-trip estimate, the queue sized by request_queue_time
+	// is kept
+	TEST_EQUAL(adaptive_queue_size(5, 1000000, block_size, 0, 0), 5);
+
+	// 1 MB/s with a 200 ms round-trip is 200 kB in flight. Twice that is
+	// 24 blocks
+	TEST_EQUAL(adaptive_queue_size(5, 1000000, block_size, 200, 0), 24);
+
+	// a queue that's already deeper than the bandwidth-delay product stays
+	TEST_EQUAL(adaptive_queue_size(100, 1000000, block_size, 200, 0), 100);
+
+	// the product grows with latency
+	TEST_EQUAL(adaptive_queue_size(5, 1000000, block_size, 2000, 0), 244);
+
+	// rates high enough to overflow 32 bits in the product
+	TEST_EQUAL(adaptive_queue_size(5, 100000000, block_size, 1000, 0), 12207);
+
+	// while in slow start, the slow start queue is the lower bound
+	TEST_EQUAL(adaptive_queue_size(5, 1000000, block_size, 200, 40), 40);
+	TEST_EQUAL(adaptive_queue_size(5, 1000000, block_size, 200, 10), 24);
+	TEST_EQUAL(adaptive_queue_size(5, 0, block_size, 0, 3), 5);
+}
+
+void test_slow_start()
+{
+	// the rate is still growing
+	TEST_CHECK(!slow_start_done(16, 500, 200000, 100000));
+	TEST_CHECK(!slow_start_done(16, 500, 113000, 100000));
+
+	// the rate grew by less than 1/8, or dropped
+	TEST_CHECK(slow_start_done(16, 500, 112500, 100000));
+	TEST_CHECK(slow_start_done(16, 500, 100000, 100000));
+	TEST_CHECK(slow_start_done(16, 500, 50000, 100000));
+
+	// nothing received yet, we can't tell
+	TEST_CHECK(!slow_start_done(16, 500, 0, 0));
+	TEST_CHECK(!slow_start_done(16, 500, 0, 100000));
+
+	// the queue can't grow any further
+	TEST_CHECK(slow_start_done(500, 500, 200000, 100000));
+	TEST_CHECK(slow_start_done(600, 500, 0, 0));
+}
+
+void test_base_rtt()
+{
+	// the first sample is taken as is
+	TEST_EQUAL(update_base_rtt(0, 150), 150);
+
+	// a sample can't be 0, that would mean "not measured"
+	TEST_EQUAL(update_base_rtt(0, 0), 1);
+
+	// lower samples replace the estimate
+	TEST_EQUAL(update_base_rtt(150, 100), 100);
+
+	// higher samples are followed slowly
+	TEST_EQUAL(update_base_rtt(100, 180), 110);
+
+	int rtt = 100;
+	for (int i = 0; i < 100; ++i) rtt = update_base_rtt(rtt, 300);
+	TEST_CHECK(rtt > 290 && rtt <= 300);
+}
+
+int test_main()
+{
+	test_bdp();
+	test_slow_start();
+	test_base_rtt();
+	return 0;
+}
+
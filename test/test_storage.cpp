@@ -356,6 +356,127 @@ void test_remove(std::string const& test_path, bool unbuffered)
 	TEST_CHECK(!exists(combine_path(test_path, "temp_storage")));	
 }
 
+void test_map_io(std::string const& test_path)
+{
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+
+	file_storage fs;
+	std::vector<char> buf;
+	file_pool fp;
+	aux::session_settings set;
+	boost::shared_ptr<default_storage> s = setup_torrent(fs, fp, buf, test_path, set);
+
+	std::vector<file_io_slice> slices;
+	storage_error se;
+
+	// files with priority 0 are stored in the part file, and can't be
+	// mapped
+	std::vector<boost::uint8_t> prio(fs.num_files(), 1);
+	prio[4] = 0;
+	s->set_file_priority(prio, se);
+	TEST_CHECK(!se);
+	TEST_CHECK(!s->map_io(4, 0, 4, file::read_only, slices, se));
+	TEST_CHECK(!se);
+	TEST_CHECK(slices.empty());
+	prio[4] = 1;
+	s->set_file_priority(prio, se);
+
+	// piece 1 is entirely in the first file
+	TEST_CHECK(s->map_io(1, 1, 3, file::read_write, slices, se));
+	TEST_CHECK(!se);
+	TEST_EQUAL(slices.size(), 1);
+	TEST_EQUAL(slices[0].file_index, 0);
+	TEST_EQUAL(slices[0].file_offset, 5);
+	TEST_EQUAL(slices[0].buffer_offset, 0);
+	TEST_EQUAL(slices[0].size, 3);
+	TEST_CHECK(slices[0].handle);
+
+	// a range spanning the first and the second file
+	TEST_CHECK(s->map_io(1, 2, 6, file::read_write, slices, se));
+	TEST_CHECK(!se);
+	TEST_EQUAL(slices.size(), 2);
+	TEST_EQUAL(slices[0].file_index, 0);
+	TEST_EQUAL(slices[0].file_offset, 6);
+	TEST_EQUAL(slices[0].buffer_offset, 0);
+	TEST_EQUAL(slices[0].size, 2);
+	TEST_EQUAL(slices[1].file_index, 1);
+	TEST_EQUAL(slices[1].file_offset, 0);
+	TEST_EQUAL(slices[1].buffer_offset, 2);
+	TEST_EQUAL(slices[1].size, 4);
+
+	// the empty files in between the second and the last file are skipped
+	TEST_CHECK(s->map_io(3, 2, 4, file::read_write, slices, se));
+	TEST_CHECK(!se);
+	TEST_EQUAL(slices.size(), 2);
+	TEST_EQUAL(slices[0].file_index, 1);
+	TEST_EQUAL(slices[1].file_index, 4);
+	TEST_EQUAL(slices[1].file_offset, 0);
+	TEST_EQUAL(slices[1].buffer_offset, 2);
+
+	slices.clear();
+	s->release_files(se);
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+}
+
+void test_map_read(std::string const& test_path)
+{
+	if (!file_mapping::supported())
+	{
+		fprintf(stderr, "memory mapped files not supported, skipping test\n");
+		return;
+	}
+
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+
+	file_storage fs;
+	std::vector<char> buf;
+	file_pool fp;
+	aux::session_settings set;
+	boost::shared_ptr<default_storage> s = setup_torrent(fs, fp, buf, test_path, set);
+
+	// fill in the first file (piece 0 and 1)
+	char data[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	file::iovec_t b = { data, 8 };
+	storage_error se;
+	TEST_EQUAL(s->writev(&b, 1, 0, 0, 0, se), 8);
+	TEST_CHECK(!se);
+
+	boost::intrusive_ptr<file_mapping> m;
+	char const* p = s->map_read(1, 1, 3, 0, m, se);
+	TEST_CHECK(!se);
+	TEST_CHECK(p != NULL);
+	TEST_CHECK(m);
+	if (p == NULL) return;
+	TEST_CHECK(memcmp(p, data + 5, 3) == 0);
+
+	// the file pool keeps the mapping around
+	boost::intrusive_ptr<file_mapping> m2;
+	char const* p2 = s->map_read(0, 0, 4, 0, m2, se);
+	TEST_CHECK(!se);
+	TEST_CHECK(m2 == m);
+	TEST_CHECK(p2 == p - 5);
+
+	// a range spanning the first and the second file can't be mapped
+	boost::intrusive_ptr<file_mapping> m3;
+	TEST_CHECK(s->map_read(1, 2, 6, 0, m3, se) == NULL);
+	TEST_CHECK(!se);
+	TEST_CHECK(!m3);
+
+	// nor can a range that hasn't been written to disk yet (the last file)
+	TEST_CHECK(s->map_read(5, 0, 4, 0, m3, se) == NULL);
+	TEST_CHECK(!m3);
+
+	// closing the file doesn't invalidate the mapping
+	s->release_files(se);
+	m2.reset();
+	TEST_CHECK(memcmp(p, data + 5, 3) == 0);
+
+	m.reset();
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+}
+
 void test_rename(std::string const& test_path)
 {
 	error_code ec;
@@ -470,6 +591,105 @@ void test_check_files(std::string const& test_path
 	io.set_num_threads(0);
 }
 
+// records the write operations issued to the storage
+struct write_recording_storage : default_storage
+{
+	write_recording_storage(storage_params const& p) : default_storage(p) {}
+
+	virtual int writev(file::iovec_t const* bufs, int num_bufs
+		, int piece, int offset, int flags, storage_error& ec)
+	{
+		writes.push_back(peer_request());
+		writes.back().piece = piece;
+		writes.back().start = offset;
+		writes.back().length = bufs_size(bufs, num_bufs);
+		return default_storage::writev(bufs, num_bufs, piece, offset, flags, ec);
+	}
+
+	std::vector<peer_request> writes;
+};
+
+void on_write_flushed(disk_io_job const* j, int* flushed)
+{
+	TEST_EQUAL(j->ret, 0x4000);
+	++*flushed;
+}
+
+void test_sorted_flush(std::string const& test_path)
+{
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+
+	file_storage fs;
+	fs.add_file("temp_storage/test1.tmp", 0x10000);
+	fs.add_file("temp_storage/test2.tmp", 0x10000);
+	fs.set_piece_length(0x8000);
+	fs.set_num_pieces(4);
+
+	aux::session_settings set;
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	counters cnt;
+	disk_io_thread io(ios, NULL, cnt, NULL);
+	settings_pack pack;
+	pack.set_bool(settings_pack::use_write_cache, true);
+	pack.set_int(settings_pack::cache_size, 256);
+	io.set_settings(&pack);
+	io.set_num_threads(1);
+
+	storage_params p;
+	p.files = &fs;
+	p.path = test_path;
+	p.pool = &fp;
+	p.mode = storage_mode_sparse;
+	write_recording_storage* st = new write_recording_storage(p);
+	st->m_settings = &set;
+	boost::shared_ptr<void> dummy;
+	boost::shared_ptr<piece_manager> pm = boost::make_shared<piece_manager>(st, dummy, &fs);
+
+	// none of the pieces is complete, so nothing is flushed until the files
+	// are released. The blocks are added out of order, and the last block of
+	// piece 1 is contiguous with the first block of piece 2, across the file
+	// boundary
+	int const blocks[][2] = { {3, 1}, {0, 0}, {2, 0}, {1, 1} };
+	int flushed = 0;
+	for (int i = 0; i < int(sizeof(blocks) / sizeof(blocks[0])); ++i)
+	{
+		disk_buffer_holder buf(io, io.allocate_disk_buffer("test"));
+		std::memset(buf.get(), i, 0x4000);
+		peer_request r;
+		r.piece = blocks[i][0];
+		r.start = blocks[i][1] * 0x4000;
+		r.length = 0x4000;
+		io.async_write(pm.get(), r, buf, boost::bind(&on_write_flushed, _1, &flushed));
+	}
+
+	bool done = false;
+	io.async_release_files(pm.get(), boost::bind(&signal_bool, &done, "release_files"));
+	io.submit_jobs();
+	run_until(ios, done);
+	io.set_num_threads(0);
+
+	TEST_EQUAL(flushed, 4);
+
+	// the writes are issued in order, with adjacent blocks merged
+	TEST_EQUAL(st->writes.size(), 3);
+	if (st->writes.size() == 3)
+	{
+		TEST_EQUAL(st->writes[0].piece, 0);
+		TEST_EQUAL(st->writes[0].start, 0);
+		TEST_EQUAL(st->writes[0].length, 0x4000);
+		TEST_EQUAL(st->writes[1].piece, 1);
+		TEST_EQUAL(st->writes[1].start, 0x4000);
+		TEST_EQUAL(st->writes[1].length, 0x8000);
+		TEST_EQUAL(st->writes[2].piece, 3);
+		TEST_EQUAL(st->writes[2].start, 0x4000);
+		TEST_EQUAL(st->writes[2].length, 0x4000);
+	}
+
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+}
+
 #ifdef TORRENT_NO_DEPRECATE
 #define storage_mode_compact storage_mode_sparse
 #endif
@@ -942,12 +1162,60 @@ void test_iovec_advance_bufs()
 	free_iov(iov1, 10);
 }
 
+void test_read_stream_tracker()
+{
+	read_stream_tracker t;
+	bool sequential = true;
+	int const bs = 0x4000;
+	void* peer1 = (void*)1;
+	void* peer2 = (void*)2;
+
+	// a requester not seen before starts out with the initial read-ahead
+	TEST_EQUAL(t.read_ahead(peer1, 0, bs, 4, 16, sequential), 4);
+	TEST_CHECK(!sequential);
+
+	// picking up where the read-ahead ended doubles it, up to the limit
+	TEST_EQUAL(t.read_ahead(peer1, 4 * bs, bs, 4, 16, sequential), 8);
+	TEST_CHECK(sequential);
+	// the read-ahead may have been cut short by the end of the piece
+	TEST_EQUAL(t.read_ahead(peer1, 8 * bs, bs, 4, 16, sequential), 16);
+	TEST_CHECK(sequential);
+	TEST_EQUAL(t.read_ahead(peer1, 24 * bs, bs, 4, 16, sequential), 16);
+	TEST_CHECK(sequential);
+
+	// requesters are tracked independently
+	TEST_EQUAL(t.read_ahead(peer2, 24 * bs, bs, 4, 16, sequential), 4);
+	TEST_CHECK(!sequential);
+
+	// jumping backwards or past the read-ahead halves it, down to one block
+	TEST_EQUAL(t.read_ahead(peer1, 0, bs, 4, 16, sequential), 8);
+	TEST_CHECK(!sequential);
+	TEST_EQUAL(t.read_ahead(peer1, 1000 * bs, bs, 4, 16, sequential), 4);
+	TEST_CHECK(!sequential);
+	TEST_EQUAL(t.read_ahead(peer1, 10 * bs, bs, 4, 16, sequential), 2);
+	TEST_EQUAL(t.read_ahead(peer1, 500 * bs + 100, bs, 4, 16, sequential), 1);
+	TEST_EQUAL(t.read_ahead(peer1, 20 * bs, bs, 4, 16, sequential), 1);
+	TEST_CHECK(!sequential);
+
+	// an unaligned request continuing the stream is sequential too
+	TEST_EQUAL(t.read_ahead(peer1, 21 * bs, bs, 4, 16, sequential), 2);
+	TEST_CHECK(sequential);
+
+	// lowering the limit applies to existing requesters
+	TEST_EQUAL(t.read_ahead(peer1, 23 * bs, bs, 1, 1, sequential), 1);
+	TEST_CHECK(sequential);
+}
+
 int test_main()
 {
+	test_read_stream_tracker();
 	test_iovec_copy_bufs();
 	test_iovec_clear_bufs();
 	test_iovec_advance_bufs();
 	test_iovec_bufs_size();
+	test_map_io(current_working_directory());
+	test_map_read(current_working_directory());
+	test_sorted_flush(current_working_directory());
 
 	return 0;
 
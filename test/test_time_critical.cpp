@@ -31,9 +31,136 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "swarm_suite.hpp"
+#include "test.hpp"
+#include "setup_transfer.hpp"
+#include "libtorrent/session.hpp"
+#include "libtorrent/peer_connection.hpp"
+#include "libtorrent/torrent_handle.hpp"
+#include "libtorrent/alert_types.hpp"
+#include <boost/tuple/tuple.hpp>
+
+using namespace libtorrent;
+namespace lt = libtorrent;
+
+int arrival_ms(int piece, int block, std::vector<pending_block> const& dq
+	, std::vector<pending_block> const& rq, int outstanding)
+{
+	// 16 kiB blocks, received at 16 kiB/s with a 200 ms request round-trip
+	return int(total_milliseconds(block_arrival_time(piece_block(piece, block)
+		, dq, rq, outstanding, 16 * 1024, 16 * 1024, 200)));
+}
+
+void test_arrival_time()
+{
+	// the time it takes to receive the queued bytes is in milliseconds
+	TEST_EQUAL(total_milliseconds(transfer_time(16 * 1024, 16 * 1024)), 1000);
+	TEST_EQUAL(total_milliseconds(transfer_time(8 * 1024, 16 * 1024)), 500);
+	TEST_EQUAL(total_milliseconds(transfer_time(0, 50)), 0);
+	TEST_EQUAL(total_milliseconds(transfer_time(boost::int64_t(1) << 32, 1 << 20)), 4096000);
+
+	std::vector<pending_block> dq;
+	dq.push_back(pending_block(piece_block(0, 0)));
+	dq.push_back(pending_block(piece_block(0, 1)));
+	dq.push_back(pending_block(piece_block(0, 2)));
+	std::vector<pending_block> rq;
+	rq.push_back(pending_block(piece_block(1, 0)));
+	rq.push_back(pending_block(piece_block(1, 1)));
+
+	// blocks that have been requested only wait for the ones ahead of them
+	TEST_EQUAL(arrival_ms(0, 0, dq, rq, 3 * 16 * 1024), 1000);
+	TEST_EQUAL(arrival_ms(0, 2, dq, rq, 3 * 16 * 1024), 3000);
+
+	// half of the first block has been received already
+	TEST_EQUAL(arrival_ms(0, 2, dq, rq, 5 * 8 * 1024), 2500);
+
+	// blocks that haven't been requested yet wait for all outstanding bytes,
+	// the ones ahead of them in the request queue and a request round-trip
+	TEST_EQUAL(arrival_ms(1, 0, dq, rq, 3 * 16 * 1024), 4200);
+	TEST_EQUAL(arrival_ms(1, 1, dq, rq, 3 * 16 * 1024), 5200);
+
+	// a block that isn't queued at all would be requested last
+	TEST_EQUAL(arrival_ms(2, 0, dq, rq, 3 * 16 * 1024), 6200);
+	TEST_EQUAL(arrival_ms(2, 0, std::vector<pending_block>()
+		, std::vector<pending_block>(), 0), 1200);
+}
+
+void test_deadline_counters(int window)
+{
+	fprintf(stderr, "\n ==== TEST DEADLINE COUNTERS (window: %d) ====\n\n", window);
+
+	error_code ec;
+	remove_all("tmp1_time_critical", ec);
+	remove_all("tmp2_time_critical", ec);
+
+	session_proxy p1;
+	session_proxy p2;
+
+	settings_pack pack;
+	pack.set_bool(settings_pack::enable_lsd, false);
+	pack.set_bool(settings_pack::enable_natpmp, false);
+	pack.set_bool(settings_pack::enable_upnp, false);
+	pack.set_bool(settings_pack::enable_dht, false);
+	pack.set_int(settings_pack::alert_mask, alert::all_categories
+		& ~(alert::progress_notification | alert::stats_notification));
+	pack.set_str(settings_pack::listen_interfaces, "0.0.0.0:48100");
+	pack.set_int(settings_pack::max_retry_port_bind, 1000);
+	pack.set_int(settings_pack::time_critical_window, window);
+	// slow the transfer down, to give the time critical logic a few rounds
+	pack.set_int(settings_pack::upload_rate_limit, 100000);
+
+	lt::session ses1(pack);
+	lt::session ses2(pack);
+
+	torrent_handle tor1;
+	torrent_handle tor2;
+	boost::tie(tor1, tor2, boost::tuples::ignore) = setup_transfer(&ses1, &ses2
+		, NULL, true, false, false, "_time_critical", 16 * 1024);
+
+	// the peers aren't connected yet, so none of these pieces can have been
+	// downloaded already
+	tor2.set_piece_deadline(1, 0);
+	tor2.set_piece_deadline(4, 1000);
+	tor2.set_piece_deadline(7, 60000);
+
+	tor2.connect_peer(tcp::endpoint(address::from_string("127.0.0.1", ec)
+		, ses1.listen_port()));
+
+	for (int i = 0; i < 60; ++i)
+	{
+		print_alerts(ses1, "ses1");
+		print_alerts(ses2, "ses2");
+		if (tor2.status().is_seeding) break;
+		test_sleep(500);
+	}
+	TEST_CHECK(tor2.status().is_seeding);
+
+	// every piece with a deadline either made it or didn't
+	std::map<std::string, boost::uint64_t> cnt = get_counters(ses2);
+	TEST_EQUAL(cnt["picker.piece_deadlines_met"]
+		+ cnt["picker.piece_deadlines_missed"], 3);
+
+	// the downloader's deadlines don't affect the seed
+	cnt = get_counters(ses1);
+	TEST_EQUAL(cnt["picker.piece_deadlines_met"], 0);
+	TEST_EQUAL(cnt["picker.piece_deadlines_missed"], 0);
+	TEST_EQUAL(cnt["picker.piece_deadlines_at_risk"], 0);
+
+	p1 = ses1.abort();
+	p2 = ses2.abort();
+
+	remove_all("tmp1_time_critical", ec);
+	remove_all("tmp2_time_critical", ec);
+}
 
 int test_main()
 {
+	test_arrival_time();
+
+	// the window derived from the average piece download time, and a fixed
+	// window that's shorter than the last deadline
+	test_deadline_counters(0);
+	test_deadline_counters(2000);
+
 	// with time critical pieces
 	test_swarm(time_critical);
 
@@ -81,6 +81,9 @@ struct test_storage : default_storage
 	virtual void set_file_priority(std::vector<boost::uint8_t> const& p
 		, storage_error& ec) {}
 
+	// writev() is customized, it must not be bypassed
+	virtual bool supports_mapped_io() const { return false; }
+
 	void set_limit(int lim)
 	{
 		mutex::scoped_lock l(m_mutex);
@@ -355,6 +358,26 @@ int test_main()
 	p.set_bool(settings_pack::contiguous_recv_buffer, false);
 	test_transfer(0, p);
 
+	// test serving blocks out of memory mapped files. The seed's pieces
+	// would otherwise still be in the read cache from checking them
+	p = settings_pack();
+	p.set_bool(settings_pack::use_mmap_reads, true);
+	p.set_bool(settings_pack::use_read_cache, false);
+	test_transfer(0, p);
+
+	// test uncached reads and writes issued via io_uring. If it isn't
+	// supported, this falls back to regular reads and writes
+	p = settings_pack();
+	p.set_bool(settings_pack::use_io_uring, true);
+	p.set_int(settings_pack::cache_size, 0);
+	test_transfer(0, p);
+
+	// test sending blocks straight from the files with sendfile()
+	p = settings_pack();
+	p.set_bool(settings_pack::use_sendfile, true);
+	p.set_bool(settings_pack::use_read_cache, false);
+	test_transfer(0, p);
+
 	// test with all kinds of proxies
 	p = settings_pack();
 	for (int i = 0; i < 6; ++i)
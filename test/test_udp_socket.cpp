@@ -0,0 +1,214 @@
+/*
+
+Copyright (c) 2015, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/udp_socket.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/io_service.hpp"
+#include "libtorrent/time.hpp"
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+using namespace libtorrent;
+
+struct packet_log : udp_socket_observer
+{
+	virtual bool incoming_packet(error_code const& ec
+		, udp::endpoint const&, char const* buf, int size)
+	{
+		if (ec) return false;
+		packets.push_back(std::string(buf, size));
+		return true;
+	}
+
+	std::vector<std::string> packets;
+};
+
+// the payload of packet number i. The sizes vary, so that no two adjacent
+// packets could be sent as one segmented buffer
+std::string payload(int i)
+{
+	char buf[50];
+	snprintf(buf, sizeof(buf), "packet %d", i);
+	return std::string(buf) + std::string(i % 7, '*');
+}
+
+// runs the io_service until 'num' packets have been received, or a few
+// seconds have passed
+void wait_for_packets(io_service& ios, packet_log const& log, int num)
+{
+	time_point const start = clock_type::now();
+	while (int(log.packets.size()) < num
+		&& clock_type::now() - start < seconds(5))
+	{
+		ios.poll();
+		ios.reset();
+	}
+}
+
+void test_batch()
+{
+	io_service ios;
+	counters cnt;
+	udp_socket sock(ios, cnt);
+	packet_log log;
+	sock.subscribe(&log);
+
+	error_code ec;
+	sock.bind(udp::endpoint(address_v4::from_string("127.0.0.1"), 0), ec);
+	TEST_CHECK(!ec);
+	if (ec) fprintf(stderr, "bind failed: %s\n", ec.message().c_str());
+	udp::endpoint const ep(address_v4::from_string("127.0.0.1")
+		, sock.local_endpoint(ec).port());
+
+	// more than fit in a single sendmmsg() or recvmmsg() call, and more
+	// than the send queue holds
+	int const num_packets = 100;
+	for (int i = 0; i < num_packets; ++i)
+	{
+		std::string const p = payload(i);
+		sock.send(ep, p.c_str(), int(p.size()), ec, udp_socket::batch);
+		TEST_CHECK(!ec);
+	}
+
+	// a packet sent without the batch flag may not overtake the queued ones
+	std::string const last = payload(num_packets);
+	sock.send(ep, last.c_str(), int(last.size()), ec);
+	TEST_CHECK(!ec);
+
+	wait_for_packets(ios, log, num_packets + 1);
+
+	TEST_EQUAL(int(log.packets.size()), num_packets + 1);
+	for (int i = 0; i < int(log.packets.size()); ++i)
+	{
+		TEST_EQUAL(log.packets[i], payload(i));
+	}
+
+#if TORRENT_USE_MMSG
+	// the unbatched packet isn't counted
+	TEST_EQUAL(cnt[counters::udp_send_batched_packets], num_packets);
+	TEST_CHECK(cnt[counters::udp_send_batches] >= num_packets / 32);
+	TEST_CHECK(cnt[counters::udp_send_batches] < num_packets);
+	TEST_EQUAL(cnt[counters::udp_recv_batched_packets], num_packets + 1);
+	TEST_CHECK(cnt[counters::udp_recv_batches] < num_packets);
+	TEST_EQUAL(cnt[counters::udp_gso_packets], 0);
+	TEST_EQUAL(cnt[counters::udp_gro_packets], 0);
+#endif
+
+	sock.unsubscribe(&log);
+	sock.close();
+	ios.run();
+}
+
+// a packet of 'size' bytes, unique to 'i'
+std::string sized_payload(int i, int size)
+{
+	char buf[20];
+	snprintf(buf, sizeof(buf), "%d:", i);
+	std::string ret(buf);
+	ret.resize(size, char('a' + i % 26));
+	return ret;
+}
+
+void test_offload(bool gro)
+{
+	fprintf(stderr, "\n ==== TEST OFFLOAD (gro: %d) ====\n\n", gro);
+
+	io_service ios;
+	counters cnt;
+	udp_socket sock(ios, cnt);
+	packet_log log;
+	sock.subscribe(&log);
+
+	// if the kernel doesn't support segmentation or receive offload, this
+	// falls back to plain batches. The packets have to come out the same
+	// either way
+	sock.set_segmentation_offload(true, gro);
+
+	error_code ec;
+	sock.bind(udp::endpoint(address_v4::from_string("127.0.0.1"), 0), ec);
+	TEST_CHECK(!ec);
+	if (ec) fprintf(stderr, "bind failed: %s\n", ec.message().c_str());
+	udp::endpoint const ep(address_v4::from_string("127.0.0.1")
+		, sock.local_endpoint(ec).port());
+
+	// runs of equally sized packets, each ended by a smaller one, which
+	// is the last packet that fits in the same segmented buffer. Followed
+	// by a larger packet, which starts a new one
+	std::vector<std::string> sent;
+	int const sizes[] = { 100, 100, 100, 100, 60, 1200, 1200, 1200, 1
+		, 500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 700, 300, 300 };
+	for (int i = 0; i < int(sizeof(sizes) / sizeof(sizes[0])); ++i)
+		sent.push_back(sized_payload(i, sizes[i]));
+
+	for (int i = 0; i < int(sent.size()); ++i)
+	{
+		sock.send(ep, sent[i].c_str(), int(sent[i].size()), ec
+			, udp_socket::batch);
+		TEST_CHECK(!ec);
+	}
+
+	wait_for_packets(ios, log, int(sent.size()));
+
+	TEST_EQUAL(log.packets.size(), sent.size());
+	for (int i = 0; i < int((std::min)(log.packets.size(), sent.size())); ++i)
+	{
+		TEST_EQUAL(log.packets[i], sent[i]);
+	}
+
+#if TORRENT_USE_MMSG
+	fprintf(stderr, "segmented packets sent: %d coalesced packets received: %d\n"
+		, int(cnt[counters::udp_gso_packets])
+		, int(cnt[counters::udp_gro_packets]));
+	TEST_EQUAL(cnt[counters::udp_send_batched_packets], int(sent.size()));
+	// only trains of packets sent as one buffer can be coalesced. There
+	// are 4 of those, with 21 packets in total
+	TEST_CHECK(cnt[counters::udp_gso_packets] == 0
+		|| cnt[counters::udp_gso_packets] == 21);
+	TEST_CHECK(cnt[counters::udp_gro_packets] <= cnt[counters::udp_gso_packets]);
+	if (!gro) TEST_EQUAL(cnt[counters::udp_gro_packets], 0);
+#endif
+
+	sock.unsubscribe(&log);
+	sock.close();
+	ios.run();
+}
+
+int test_main()
+{
+	test_batch();
+	test_offload(false);
+	test_offload(true);
+	return 0;
+}
+